@@ -0,0 +1,512 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "runtime.h"
+#include "datatype99.h"
+
+/*
+ * x86-64 assembly backend.
+ *
+ * Translates intermediate code to GNU assembler source for the System V
+ * ABI, defining the pseudo_main that the runtime library in runtime.c calls.
+ *
+ * Every variable and temporary, and one scratch value, has a PseudoValue
+ * slot in the stack frame, and constants are PseudoValues in a read only
+ * section, so every operand is a memory operand with the tag at offset 0 and
+ * the payload at offset 8. Typed instructions work on payloads inline, with
+ * numbers in SSE2 registers, and branches become native jumps. Untyped
+ * instructions, displaying, concatenating and every error go through the
+ * runtime library.
+ */
+
+typedef struct {
+  FILE* out;
+  IrProgram* ir;
+  int frame_size;
+  int next_local;  // Number of the next .Lok label
+  bool* assigned;  // Variables assigned on every path to the current instruction
+
+  ExprResult* consts;  // Constant pool, in .LC label order
+  int const_count;
+} Asm;
+
+static void emit(Asm* a, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  fputc('\t', a->out);
+  vfprintf(a->out, fmt, ap);
+  fputc('\n', a->out);
+  va_end(ap);
+}
+
+static int add_const(Asm* a, ExprResult value) {
+  for (int i = 0; i < a->const_count; i++) {
+    if (ir_results_equal(a->consts[i], value)) return i;
+  }
+
+  a->consts = realloc(a->consts, (a->const_count + 1) * sizeof(ExprResult));
+  ensure_non_null(a->consts, "out of space");
+  a->consts[a->const_count] = value;
+  return a->const_count++;
+}
+
+static int slot_offset(int slot) {
+  return -16 * (slot + 1);
+}
+
+static int scratch_slot(Asm* a) {
+  return a->ir->var_count + a->ir->temp_count;
+}
+
+// Memory operand of the tag (offset 0) or payload (offset 8) of `operand`.
+// The text lives until the fourth call after this one.
+static const char* mem(Asm* a, IrOperand operand, int offset) {
+  static char buffers[4][48];
+  static int next = 0;
+  char* buffer = buffers[next++ % 4];
+
+  match (operand) {
+    of(IrVar, var) sprintf(buffer, "%d(%%rbp)", slot_offset(*var) + offset);
+    of(IrTemp, temp) sprintf(buffer, "%d(%%rbp)", slot_offset(a->ir->var_count + *temp) + offset);
+    of(IrConst, value) sprintf(buffer, ".LC%d+%d(%%rip)", add_const(a, *value), offset);
+    of(IrNone) unreachable("mem");
+  }
+  return buffer;
+}
+
+static const char* scratch_mem(Asm* a, int offset) {
+  static char buffer[32];
+  sprintf(buffer, "%d(%%rbp)", slot_offset(scratch_slot(a)) + offset);
+  return buffer;
+}
+
+static int new_local(Asm* a) {
+  return a->next_local++;
+}
+
+// Static type of an operand, IR_TYPE_ANY when it is not known
+static IrType static_type(Asm* a, IrOperand operand) {
+  match (operand) {
+    of(IrConst, value) return ir_result_type(*value);
+    of(IrTemp, temp) if (a->ir->temp_types) return a->ir->temp_types[*temp];
+    otherwise {}
+  }
+  return IR_TYPE_ANY;
+}
+
+static int64_t runtime_op(IrOpcode op) {
+  switch (ir_untyped_op(op)) {
+    case IR_ADD: return PSEUDO_ADD;
+    case IR_SUB: return PSEUDO_SUB;
+    case IR_MUL: return PSEUDO_MUL;
+    case IR_DIV: return PSEUDO_DIV;
+    case IR_EQ: return PSEUDO_EQ;
+    case IR_GT: return PSEUDO_GT;
+    case IR_GTE: return PSEUDO_GTE;
+    case IR_LT: return PSEUDO_LT;
+    case IR_LTE: return PSEUDO_LTE;
+    case IR_AND: return PSEUDO_AND;
+    case IR_OR: return PSEUDO_OR;
+    case IR_NEG: return PSEUDO_NEG;
+    case IR_NOT: return PSEUDO_NOT;
+    case IR_IF: return PSEUDO_IF;
+    case IR_TRUNC: return PSEUDO_TRUNC;
+    case IR_FOR_TRIP: return PSEUDO_FOR_TRIP;
+    default:
+      unreachable("runtime_op");
+      return 0;
+  }
+}
+
+static int64_t runtime_tag(IrType type) {
+  switch (type) {
+    case IR_TYPE_BOOLEAN: return PSEUDO_BOOLEAN;
+    case IR_TYPE_NUMBER: return PSEUDO_NUMBER;
+    case IR_TYPE_STRING: return PSEUDO_STRING;
+    default:
+      unreachable("runtime_tag");
+      return 0;
+  }
+}
+
+// Reading a variable nothing was assigned to is an error
+static void emit_defined_check(Asm* a, IrOperand operand) {
+  ifLet(operand, IrVar, var) {
+    if (a->assigned[*var]) return;
+    int ok = new_local(a);
+    emit(a, "cmpq $%d, %s", PSEUDO_UNDEFINED, mem(a, operand, 0));
+    emit(a, "jne .Lok%d", ok);
+    emit(a, "leaq .LN%d(%%rip), %%rdi", *var);
+    emit(a, "call pseudo_undefined");
+    fprintf(a->out, ".Lok%d:\n", ok);
+  }
+}
+
+static void store_tag(Asm* a, IrOperand dest, PseudoTag tag) {
+  emit(a, "movq $%d, %s", tag, mem(a, dest, 0));
+}
+
+static void store_number(Asm* a, IrOperand dest) {
+  emit(a, "movsd %%xmm0, %s", mem(a, dest, 8));
+  store_tag(a, dest, PSEUDO_NUMBER);
+}
+
+static void store_boolean(Asm* a, IrOperand dest) {
+  emit(a, "movzbl %%al, %%eax");
+  emit(a, "movq %%rax, %s", mem(a, dest, 8));
+  store_tag(a, dest, PSEUDO_BOOLEAN);
+}
+
+// Condition code of a typed number comparison after emit_float_compare.
+// Unordered operands are never above, so comparisons with NaN are false.
+static const char* float_condition(IrOpcode relop) {
+  switch (relop) {
+    case IR_FGT: case IR_FLT: return "a";
+    case IR_FGTE: case IR_FLTE: return "ae";
+    default:
+      unreachable("float_condition");
+      return "";
+  }
+}
+
+static const char* negate_condition(const char* cc) {
+  if (strcmp(cc, "a") == 0) return "be";
+  if (strcmp(cc, "ae") == 0) return "b";
+  if (strcmp(cc, "ne") == 0) return "e";
+  return "ne";
+}
+
+// Compares the numbers x and y, the other way around for x < y and x <= y
+// so that every comparison is an above or above or equal
+static void emit_float_compare(Asm* a, IrOpcode relop, IrOperand x, IrOperand y) {
+  bool swap = relop == IR_FLT || relop == IR_FLTE;
+  emit(a, "movsd %s, %%xmm0", mem(a, swap ? y : x, 8));
+  emit(a, "ucomisd %s, %%xmm0", mem(a, swap ? x : y, 8));
+}
+
+// Leaves the boolean result of typed comparison `relop` in al
+static void emit_typed_compare(Asm* a, IrOpcode relop, IrOperand x, IrOperand y) {
+  switch (relop) {
+    case IR_FEQ:
+      emit_float_compare(a, relop, x, y);
+      emit(a, "sete %%al");
+      emit(a, "setnp %%cl");
+      emit(a, "andb %%cl, %%al");
+      break;
+    case IR_FGT: case IR_FGTE: case IR_FLT: case IR_FLTE:
+      emit_float_compare(a, relop, x, y);
+      emit(a, "set%s %%al", float_condition(relop));
+      break;
+    case IR_BEQ:
+      emit(a, "movq %s, %%rax", mem(a, x, 8));
+      emit(a, "cmpq %s, %%rax", mem(a, y, 8));
+      emit(a, "sete %%al");
+      break;
+    case IR_STREQ:
+      emit(a, "movq %s, %%rdi", mem(a, x, 8));
+      emit(a, "movq %s, %%rsi", mem(a, y, 8));
+      emit(a, "call pseudo_streq");
+      break;
+    default:
+      unreachable("emit_typed_compare");
+  }
+}
+
+static void emit_branch(Asm* a, IrInstr* instr) {
+  bool negated = instr->op == IR_IF_NOT || instr->op == IR_IF_NOT_CMP;
+  IrOperand x = instr->args[0];
+  IrOperand y = instr->args[1];
+
+  if (instr->op == IR_IF || instr->op == IR_IF_NOT) {
+    if (static_type(a, x) != IR_TYPE_BOOLEAN) {
+      int ok = new_local(a);
+      emit(a, "cmpq $%d, %s", PSEUDO_BOOLEAN, mem(a, x, 0));
+      emit(a, "je .Lok%d", ok);
+      emit(a, "leaq %s, %%rdi", mem(a, x, 0));
+      emit(a, "call pseudo_condition");
+      fprintf(a->out, ".Lok%d:\n", ok);
+    }
+    emit(a, "cmpq $0, %s", mem(a, x, 8));
+    emit(a, "j%s .L%d", negated ? "e" : "ne", instr->label);
+    return;
+  }
+
+  switch (instr->relop) {
+    case IR_FGT: case IR_FGTE: case IR_FLT: case IR_FLTE: {
+      const char* cc = float_condition(instr->relop);
+      emit_float_compare(a, instr->relop, x, y);
+      emit(a, "j%s .L%d", negated ? negate_condition(cc) : cc, instr->label);
+      return;
+    }
+    case IR_FEQ: {
+      emit_float_compare(a, instr->relop, x, y);
+      if (negated) {
+        emit(a, "jp .L%d", instr->label);
+        emit(a, "jne .L%d", instr->label);
+      } else {
+        int skip = new_local(a);
+        emit(a, "jp .Lok%d", skip);
+        emit(a, "je .L%d", instr->label);
+        fprintf(a->out, ".Lok%d:\n", skip);
+      }
+      return;
+    }
+    case IR_BEQ: case IR_STREQ:
+      emit_typed_compare(a, instr->relop, x, y);
+      emit(a, "testb %%al, %%al");
+      break;
+    default:
+      // Untyped comparisons always give a boolean, or fail
+      emit(a, "leaq %s, %%rdi", scratch_mem(a, 0));
+      emit(a, "movl $%ld, %%esi", (long)runtime_op(instr->relop));
+      emit(a, "leaq %s, %%rdx", mem(a, x, 0));
+      emit(a, "leaq %s, %%rcx", mem(a, y, 0));
+      emit(a, "call pseudo_binary");
+      emit(a, "cmpq $0, %s", scratch_mem(a, 8));
+      break;
+  }
+  emit(a, "j%s .L%d", negated ? "e" : "ne", instr->label);
+}
+
+static void emit_check(Asm* a, IrInstr* instr) {
+  PseudoTag tag = runtime_tag(ir_operand_type(instr->op));
+  bool binary = ir_is_binary(instr->relop);
+  IrOperand x = instr->args[0];
+  IrOperand y = binary ? instr->args[1] : x;
+
+  // Operands whose type is known need no checking
+  bool check_x = static_type(a, x) != ir_operand_type(instr->op);
+  bool check_y = binary && static_type(a, y) != ir_operand_type(instr->op);
+  if (!check_x && !check_y) return;
+
+  int ok = new_local(a);
+  int fail = new_local(a);
+
+  if (check_x) {
+    emit(a, "cmpq $%d, %s", tag, mem(a, x, 0));
+    emit(a, check_y ? "jne .Lok%d" : "je .Lok%d", check_y ? fail : ok);
+  }
+  if (check_y) {
+    emit(a, "cmpq $%d, %s", tag, mem(a, y, 0));
+    emit(a, "je .Lok%d", ok);
+  }
+  fprintf(a->out, ".Lok%d:\n", fail);
+  emit(a, "movl $%ld, %%edi", (long)runtime_op(instr->relop));
+  emit(a, "leaq %s, %%rsi", mem(a, x, 0));
+  emit(a, "leaq %s, %%rdx", mem(a, y, 0));
+  emit(a, "call pseudo_check_failed");
+  fprintf(a->out, ".Lok%d:\n", ok);
+}
+
+static void emit_instr(Asm* a, IrInstr* instr) {
+  IrOperand dest = instr->dest;
+  IrOperand x = instr->args[0];
+  IrOperand y = instr->args[1];
+
+  if (instr->op != IR_LABEL) {
+    fprintf(a->out, "\t# ");
+    fprint_ir_instr(a->out, a->ir, instr);
+    fprintf(a->out, "\n");
+  }
+  emit_defined_check(a, x);
+  emit_defined_check(a, y);
+
+  switch (instr->op) {
+    case IR_COPY:
+      emit(a, "movups %s, %%xmm0", mem(a, x, 0));
+      emit(a, "movups %%xmm0, %s", mem(a, dest, 0));
+      break;
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+    case IR_EQ: case IR_GT: case IR_GTE: case IR_LT: case IR_LTE:
+    case IR_AND: case IR_OR:
+      emit(a, "leaq %s, %%rdi", mem(a, dest, 0));
+      emit(a, "movl $%ld, %%esi", (long)runtime_op(instr->op));
+      emit(a, "leaq %s, %%rdx", mem(a, x, 0));
+      emit(a, "leaq %s, %%rcx", mem(a, y, 0));
+      emit(a, "call pseudo_binary");
+      break;
+    case IR_NEG: case IR_NOT:
+      emit(a, "leaq %s, %%rdi", mem(a, dest, 0));
+      emit(a, "movl $%ld, %%esi", (long)runtime_op(instr->op));
+      emit(a, "leaq %s, %%rdx", mem(a, x, 0));
+      emit(a, "call pseudo_unary");
+      break;
+    case IR_FOR_TRIP:
+      emit(a, "leaq %s, %%rdi", mem(a, x, 0));
+      emit(a, "leaq %s, %%rsi", mem(a, y, 0));
+      emit(a, "call pseudo_for_trip");
+      store_number(a, dest);
+      break;
+    case IR_TRUNC:
+      emit(a, "leaq %s, %%rdi", mem(a, x, 0));
+      emit(a, "call pseudo_for_start");
+      store_number(a, dest);
+      break;
+    case IR_IS_NUMBER:
+      emit(a, "cmpq $%d, %s", PSEUDO_NUMBER, mem(a, x, 0));
+      emit(a, "sete %%al");
+      store_boolean(a, dest);
+      break;
+    case IR_DISPLAY:
+      emit(a, "leaq %s, %%rdi", mem(a, x, 0));
+      emit(a, "call pseudo_display");
+      break;
+    case IR_LABEL:
+      fprintf(a->out, ".L%d:\n", instr->label);
+      break;
+    case IR_GOTO:
+      emit(a, "jmp .L%d", instr->label);
+      break;
+    case IR_IF: case IR_IF_NOT: case IR_IF_CMP: case IR_IF_NOT_CMP:
+      emit_branch(a, instr);
+      break;
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: {
+      const char* name = instr->op == IR_FADD ? "addsd" : instr->op == IR_FSUB ? "subsd"
+        : instr->op == IR_FMUL ? "mulsd" : "divsd";
+      emit(a, "movsd %s, %%xmm0", mem(a, x, 8));
+      emit(a, "%s %s, %%xmm0", name, mem(a, y, 8));
+      store_number(a, dest);
+      break;
+    }
+    case IR_FNEG:
+      emit(a, "movq %s, %%rax", mem(a, x, 8));
+      emit(a, "btcq $63, %%rax");
+      emit(a, "movq %%rax, %s", mem(a, dest, 8));
+      store_tag(a, dest, PSEUDO_NUMBER);
+      break;
+    case IR_FEQ: case IR_FGT: case IR_FGTE: case IR_FLT: case IR_FLTE:
+    case IR_BEQ: case IR_STREQ:
+      emit_typed_compare(a, instr->op, x, y);
+      store_boolean(a, dest);
+      break;
+    case IR_BAND: case IR_BOR:
+      emit(a, "movq %s, %%rax", mem(a, x, 8));
+      emit(a, "%s %s, %%rax", instr->op == IR_BAND ? "andq" : "orq", mem(a, y, 8));
+      emit(a, "movq %%rax, %s", mem(a, dest, 8));
+      store_tag(a, dest, PSEUDO_BOOLEAN);
+      break;
+    case IR_BNOT:
+      emit(a, "movq %s, %%rax", mem(a, x, 8));
+      emit(a, "xorq $1, %%rax");
+      emit(a, "movq %%rax, %s", mem(a, dest, 8));
+      store_tag(a, dest, PSEUDO_BOOLEAN);
+      break;
+    case IR_CONCAT:
+      emit(a, "movq %s, %%rdi", mem(a, x, 8));
+      emit(a, "movq %s, %%rsi", mem(a, y, 8));
+      emit(a, "call pseudo_concat");
+      emit(a, "movq %%rax, %s", mem(a, dest, 8));
+      store_tag(a, dest, PSEUDO_STRING);
+      break;
+    case IR_CHECK_NUMBER: case IR_CHECK_BOOLEAN: case IR_CHECK_STRING:
+      emit_check(a, instr);
+      break;
+    default:
+      unreachable("emit_instr");
+  }
+}
+
+static void emit_string(Asm* a, const char* str) {
+  fprintf(a->out, "\t.string \"");
+  for (const unsigned char* c = (const unsigned char*)str; *c; c++) {
+    if (*c == '"' || *c == '\\') fprintf(a->out, "\\%c", *c);
+    else if (*c < ' ' || *c >= 0x7f) fprintf(a->out, "\\%03o", *c);
+    else fputc(*c, a->out);
+  }
+  fprintf(a->out, "\"\n");
+}
+
+static void emit_data(Asm* a) {
+  // Constants holding string pointers need relocating in position
+  // independent executables, so they are not in .rodata
+  fprintf(a->out, "\t.section .data.rel.ro.local,\"aw\"\n");
+  fprintf(a->out, "\t.p2align 4\n");
+  for (int i = 0; i < a->const_count; i++) {
+    fprintf(a->out, ".LC%d:\n", i);
+    match (a->consts[i]) {
+      of(BooleanResult, boolean) {
+        emit(a, ".quad %d", PSEUDO_BOOLEAN);
+        emit(a, ".quad %d", *boolean ? 1 : 0);
+      }
+      of(NumberResult, number) {
+        uint64_t bits;
+        memcpy(&bits, number, sizeof(bits));
+        emit(a, ".quad %d", PSEUDO_NUMBER);
+        emit(a, ".quad 0x%016llx  # %g", (unsigned long long)bits, *number);
+      }
+      of(StringResult, _) {
+        emit(a, ".quad %d", PSEUDO_STRING);
+        emit(a, ".quad .LS%d", i);
+      }
+    }
+  }
+
+  fprintf(a->out, "\t.section .rodata\n");
+  for (int i = 0; i < a->const_count; i++) {
+    ifLet(a->consts[i], StringResult, str) {
+      fprintf(a->out, ".LS%d:\n", i);
+      emit_string(a, *str);
+    }
+  }
+  for (int v = 0; v < a->ir->var_count; v++) {
+    fprintf(a->out, ".LN%d:\n", v);
+    emit_string(a, a->ir->vars[v]);
+  }
+  fprintf(a->out, "\t.section .note.GNU-stack,\"\",@progbits\n");
+}
+
+// Writes `ir` to `out` as x86-64 assembly defining pseudo_main
+void emit_asm(IrProgram* ir, FILE* out) {
+  Asm a = { .out = out, .ir = ir };
+  a.frame_size = 16 * (ir->var_count + ir->temp_count + 1);
+
+  fprintf(out, "\t.text\n");
+  fprintf(out, "\t.globl pseudo_main\n");
+  fprintf(out, "\t.type pseudo_main, @function\n");
+  fprintf(out, "pseudo_main:\n");
+  emit(&a, "pushq %%rbp");
+  emit(&a, "movq %%rsp, %%rbp");
+  emit(&a, "subq $%d, %%rsp", a.frame_size);
+
+  // Every slot starts out undefined
+  emit(&a, "movq %%rsp, %%rdi");
+  emit(&a, "xorl %%eax, %%eax");
+  emit(&a, "movl $%d, %%ecx", a.frame_size / 8);
+  emit(&a, "rep stosq");
+
+  Cfg* cfg = build_cfg(ir);
+  bool* assigned = assigned_on_entry(ir, cfg);
+  for (int b = 0; b < cfg->block_count; b++) {
+    a.assigned = &assigned[b * (size_t)ir->var_count];
+    for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+      emit_instr(&a, &ir->instrs[i]);
+      ifLet(ir->instrs[i].dest, IrVar, var) a.assigned[*var] = true;
+    }
+  }
+  free(assigned);
+  free_cfg(cfg);
+
+  emit(&a, "leave");
+  emit(&a, "ret");
+  fprintf(out, "\t.size pseudo_main, .-pseudo_main\n");
+  emit_data(&a);
+  free(a.consts);
+}
+
+void write_asm(IrProgram* ir, const char* path) {
+  FILE* out = fopen(path, "w");
+  if (!out) {
+    perror("could not open output file");
+    exit(1);
+  }
+
+  emit_asm(ir, out);
+  if (ferror(out) | fclose(out)) {
+    perror("could not write output file");
+    exit(1);
+  }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdio.h>
+#include "ir.h"
+
+void emit_asm(IrProgram* ir, FILE* out);
+void write_asm(IrProgram* ir, const char* path);
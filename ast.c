@@ -1,4 +1,6 @@
+#include <math.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,15 +8,26 @@
 #include "datatype99.h"
 #include "parser.tab.h"
 #include "argparse.h"
+#include "closure.h"
+#include "ir.h"
+#include "irbin.h"
+#include "asm.h"
+#include "obj.h"
+#include "llvm.h"
+#include "cgen.h"
+#include "jit.h"
+#include "tier.h"
+#include "cfg.h"
+#include "opt.h"
+#include "ssa.h"
+#include "switch.h"
+#include "tape.h"
 
 extern SymbolTable* symtab;
 extern FILE* yyin;
 extern StatementList* parse_result;
 extern int yylex();
 
-int IR_TEMP_IDX = 0;
-int IR_LABEL_IDX = 0;
-
 // Prints 2 * level number of spaces
 void print_indent(int level) {
   for (int i=1; i<=level; i++) printf("  "); 
@@ -30,12 +43,32 @@ void iprintf(int indent, const char *s, ...) {
 }
 
 char* concat_str(char* left, char* right) {
-  int size = strlen(left) + strlen(right) + 1;
+  return concat_strs(left, &right, 1);
+}
+
+// Concatenates `head`, unless it is NULL, and `count` more strings. The
+// lengths are summed once, so the result is allocated once at its exact size
+// and every piece is copied once.
+char* concat_strs(char* head, char** pieces, int count) {
+  size_t size = (head ? strlen(head) : 0) + 1;
+  for (int i = 0; i < count; i++) size += strlen(pieces[i]);
+
   char* new = malloc(size);
-  snprintf(new, size, "%s%s", left, right);
+  ensure_non_null(new, "out of space");
+  char* end = head ? stpcpy(new, head) : new;
+  *end = '\0';
+  for (int i = 0; i < count; i++) end = stpcpy(end, pieces[i]);
   return new;
 }
 
+void print_result(ExprResult result) {
+  match(result) {
+    of(BooleanResult, boolean) printf("%s\n", *boolean ? "true" : "false");
+    of(NumberResult, number) printf("%g\n", *number);
+    of(StringResult, string) printf("%s\n", *string);
+  }
+}
+
 void runtime_error(const char *s, ...) {
   va_list ap;
   va_start(ap, s);
@@ -138,36 +171,32 @@ void print_aexpr(ArithExpr* ast, int ind) {
   ind--;
 }
 
-int assign_temp_ir(const char* fmt, ...) {
-  va_list ap;
-  va_start(ap, fmt);
-
-  printf("t%d = ", IR_TEMP_IDX);
-  vprintf(fmt, ap);
-  printf("\n");
-  return IR_TEMP_IDX++;
+// Emits `tN = a op b` into the IR and returns N
+int assign_temp_ir(IrProgram* ir, IrOpcode op, IrOperand a, IrOperand b) {
+  int temp = ir_new_temp(ir);
+  ir_emit(ir, ir_instr(op, IrTemp(temp), a, b));
+  return temp;
 }
 
-
-int ir_aexpr(ArithExpr* ast) {
+int ir_aexpr(IrProgram* ir, ArithExpr* ast) {
   match(*ast) {
     of(BinaryAExpr, left, op, right) {
-      int l = ir_aexpr(*left);
-      int r = ir_aexpr(*right);
+      IrOperand l = IrTemp(ir_aexpr(ir, *left));
+      IrOperand r = IrTemp(ir_aexpr(ir, *right));
       switch (*op) {
-        case BinaryOp_Add: return assign_temp_ir("t%d + t%d", l, r);
-        case BinaryOp_Sub: return assign_temp_ir("t%d - t%d", l, r);
-        case BinaryOp_Mul: return assign_temp_ir("t%d * t%d", l, r);
-        case BinaryOp_Div: return assign_temp_ir("t%d / t%d", l, r);
+        case BinaryOp_Add: return assign_temp_ir(ir, IR_ADD, l, r);
+        case BinaryOp_Sub: return assign_temp_ir(ir, IR_SUB, l, r);
+        case BinaryOp_Mul: return assign_temp_ir(ir, IR_MUL, l, r);
+        case BinaryOp_Div: return assign_temp_ir(ir, IR_DIV, l, r);
       }
     }
     of(UnaryAExpr, op, right) {
       switch (*op) {
-        case UnaryOp_Minus: return assign_temp_ir("- t%d", ir_aexpr(*right));
+        case UnaryOp_Minus: return assign_temp_ir(ir, IR_NEG, IrTemp(ir_aexpr(ir, *right)), IrNone());
       }
     }
     of(Number, num) {
-      return assign_temp_ir("%g", *num);
+      return assign_temp_ir(ir, IR_COPY, IrConst(NumberResult(*num)), IrNone());
     }; 
   }
   unreachable("ir_aexpr");
@@ -263,36 +292,90 @@ void print_bexpr(BoolExpr* ast, int ind) {
   }
 }
 
-int ir_bexpr(BoolExpr* ast) {
+int ir_bexpr(IrProgram* ir, BoolExpr* ast) {
   match (*ast) {
     of(RelationalArithExpr, left, relop, right) {
-      int l = ir_aexpr(*left);
-      int r = ir_aexpr(*right);
+      IrOperand l = IrTemp(ir_aexpr(ir, *left));
+      IrOperand r = IrTemp(ir_aexpr(ir, *right));
       switch (*relop) {
-        case RelationalEqual: return assign_temp_ir("t%d == t%d", l, r);
-        case Greater:         return assign_temp_ir("t%d > t%d", l, r);
-        case GreaterOrEqual:  return assign_temp_ir("t%d >= t%d", l, r);
-        case Less:            return assign_temp_ir("t%d < t%d", l, r);
-        case LessOrEqual:     return assign_temp_ir("t%d <= t%d", l, r);
+        case RelationalEqual: return assign_temp_ir(ir, IR_EQ, l, r);
+        case Greater:         return assign_temp_ir(ir, IR_GT, l, r);
+        case GreaterOrEqual:  return assign_temp_ir(ir, IR_GTE, l, r);
+        case Less:            return assign_temp_ir(ir, IR_LT, l, r);
+        case LessOrEqual:     return assign_temp_ir(ir, IR_LTE, l, r);
       }
     }
     of(LogicalBoolExpr, left, logicalop, right) {
-      int l = ir_bexpr(*left);
-      int r = ir_bexpr(*right);
+      IrOperand l = IrTemp(ir_bexpr(ir, *left));
+      IrOperand r = IrTemp(ir_bexpr(ir, *right));
       switch (*logicalop) {
-        case And: return assign_temp_ir("t%d && t%d", l, r);
-        case Or: return assign_temp_ir("t%d || t%d", l, r);
-        case LogicalEqual: return assign_temp_ir("t%d == t%d", l, r);
+        case And: return assign_temp_ir(ir, IR_AND, l, r);
+        case Or: return assign_temp_ir(ir, IR_OR, l, r);
+        case LogicalEqual: return assign_temp_ir(ir, IR_EQ, l, r);
       }
     }
-    of(NegatedBoolExpr, bexpr) return assign_temp_ir("! t%d", ir_bexpr(*bexpr));
-    of(Boolean, boolean) return assign_temp_ir("%s", *boolean ? "true" : "false");
+    of(NegatedBoolExpr, bexpr) return assign_temp_ir(ir, IR_NOT, IrTemp(ir_bexpr(ir, *bexpr)), IrNone());
+    of(Boolean, boolean) return assign_temp_ir(ir, IR_COPY, IrConst(BooleanResult(*boolean)), IrNone());
   }
 
   unreachable("ir_bexpr");
   return -1;
 }
 
+// Emits a jump to `label` taken when `cond` is `when`, falling through
+// otherwise
+static void ir_branch_temp(IrProgram* ir, IrOperand cond, bool when, int label) {
+  IrInstr branch = ir_if_instr(cond, label);
+  if (!when) branch.op = IR_IF_NOT;
+  ir_emit(ir, branch);
+}
+
+// Emits a jump to `label` taken when `ast` evaluates to `when`, falling
+// through otherwise. Like eval_bexpr, the right operand of && and || is only
+// evaluated when the left one does not decide the result.
+void ir_branch_bexpr(IrProgram* ir, BoolExpr* ast, bool when, int label) {
+  match (*ast) {
+    of(RelationalArithExpr, left, relop, right) {
+      IrOperand l = IrTemp(ir_aexpr(ir, *left));
+      IrOperand r = IrTemp(ir_aexpr(ir, *right));
+      IrOpcode op = IR_EQ;
+      switch (*relop) {
+        case RelationalEqual: op = IR_EQ; break;
+        case Greater:         op = IR_GT; break;
+        case GreaterOrEqual:  op = IR_GTE; break;
+        case Less:            op = IR_LT; break;
+        case LessOrEqual:     op = IR_LTE; break;
+      }
+
+      IrInstr branch = ir_if_cmp_instr(op, l, r, label);
+      if (!when) branch.op = IR_IF_NOT_CMP;
+      ir_emit(ir, branch);
+    }
+    of(LogicalBoolExpr, left, logicalop, right) {
+      if (*logicalop == LogicalEqual) {
+        ir_branch_temp(ir, IrTemp(ir_bexpr(ir, ast)), when, label);
+      } else {
+        // The left operand decides the result when it is false for &&, and
+        // true for ||
+        bool decides = *logicalop == Or;
+        if (when == decides) {
+          ir_branch_bexpr(ir, *left, decides, label);
+          ir_branch_bexpr(ir, *right, when, label);
+        } else {
+          int skip_label = ir_new_label(ir);
+          ir_branch_bexpr(ir, *left, decides, skip_label);
+          ir_branch_bexpr(ir, *right, when, label);
+          ir_emit(ir, ir_label_instr(IR_LABEL, skip_label));
+        }
+      }
+    }
+    of(NegatedBoolExpr, bexpr) ir_branch_bexpr(ir, *bexpr, !when, label);
+    of(Boolean, boolean) {
+      if (*boolean == when) ir_emit(ir, ir_label_instr(IR_GOTO, label));
+    }
+  }
+}
+
 void free_bexpr(BoolExpr* ast) {
   match (*ast) {
     of(RelationalArithExpr, left, _, right) {
@@ -312,13 +395,39 @@ void free_bexpr(BoolExpr* ast) {
 
 /* --------------------------- StringExpression --------------------------- */
 
+// Joins the strings of `left + right` into one concatenation node, so a
+// chain of + is evaluated with a single allocation instead of one per +
+StrExpr* alloc_concat_sexpr(StrExpr* left, StrExpr* right) {
+  StrExpr* sides[2] = { left, right };
+  int count = 0;
+  for (int k = 0; k < 2; k++) {
+    match (*sides[k]) {
+      of(StringConcat, _, side_count) count += *side_count;
+      of(String, _) count++;
+    }
+  }
+
+  char** pieces = malloc(count * sizeof(char*));
+  ensure_non_null(pieces, "out of space");
+  int len = 0;
+  for (int k = 0; k < 2; k++) {
+    match (*sides[k]) {
+      of(StringConcat, side_pieces, side_count) {
+        memcpy(pieces + len, *side_pieces, *side_count * sizeof(char*));
+        len += *side_count;
+        free(*side_pieces);
+      }
+      of(String, str) pieces[len++] = *str;
+    }
+    free(sides[k]);
+  }
+
+  return alloc_sexpr(StringConcat(pieces, count));
+}
+
 char* eval_sexpr(StrExpr* ast) {
   match (*ast) {
-    of(StringConcat, first, second) {
-      char* left = eval_sexpr(*first);
-      char* right = eval_sexpr(*second);
-      return concat_str(left, right);
-    }
+    of(StringConcat, pieces, count) return concat_strs(NULL, *pieces, *count);
     of(String, str) return *str;
   }
 
@@ -328,23 +437,22 @@ char* eval_sexpr(StrExpr* ast) {
 
 void print_sexpr(StrExpr* ast, int ind) {
   match (*ast) {
-    of(StringConcat, first, second) {
+    of(StringConcat, pieces, count) {
       iprintf(ind, "StringConcat\n");
-      print_sexpr(*first, ind + 1);
-      print_sexpr(*second, ind + 1);
+      for (int i = 0; i < *count; i++) iprintf(ind + 1, "String(\"%s\")\n", (*pieces)[i]);
     }
     of(String, str) iprintf(ind, "String(\"%s\")\n", *str);
   }
 }
 
-int ir_sexpr(StrExpr* ast) {
+int ir_sexpr(IrProgram* ir, StrExpr* ast) {
   match (*ast) {
-    of(StringConcat, first, second) {
-      int left = ir_sexpr(*first);
-      int right = ir_sexpr(*second);
-      return assign_temp_ir("t%d + t%d", left, right);
+    of(StringConcat, pieces, count) {
+      // Every piece is a constant, so the concatenation is one too
+      char* joined = concat_strs(NULL, *pieces, *count);
+      return assign_temp_ir(ir, IR_COPY, IrConst(StringResult(joined)), IrNone());
     }
-    of(String, str) return assign_temp_ir("\"%s\"", *str);
+    of(String, str) return assign_temp_ir(ir, IR_COPY, IrConst(StringResult(strdup(*str))), IrNone());
   }
 
   unreachable("ir_sexpr");
@@ -353,9 +461,9 @@ int ir_sexpr(StrExpr* ast) {
 
 void free_sexpr(StrExpr* ast) {
   match (*ast) {
-    of(StringConcat, first, second) {
-      free_sexpr(*first);
-      free_sexpr(*second);
+    of(StringConcat, pieces, count) {
+      for (int i = 0; i < *count; i++) free((*pieces)[i]);
+      free(*pieces);
     }
     of(String, str) free(*str);
   }
@@ -365,8 +473,8 @@ void free_sexpr(StrExpr* ast) {
 
 ExprResult eval_literal_expr(LiteralExpr* expr) {
   match (*expr) {
-    of(BooleanExpr, bexpr) return BooleanResult(eval_bexpr(*bexpr));
-    of(ArithmeticExpr, aexpr) return NumberResult(eval_aexpr(*aexpr));
+    of(BooleanExpr, bexpr, tape) return BooleanResult(*tape ? run_bexpr_tape(*tape) : eval_bexpr(*bexpr));
+    of(ArithmeticExpr, aexpr, tape) return NumberResult(*tape ? run_aexpr_tape(*tape) : eval_aexpr(*aexpr));
     of(StringExpr, sexpr) return StringResult(eval_sexpr(*sexpr));
   }
 
@@ -391,11 +499,11 @@ void print_literal_expr(LiteralExpr* ast, int ind) {
   }
 }
 
-int ir_literal_expr(LiteralExpr* expr) {
+int ir_literal_expr(IrProgram* ir, LiteralExpr* expr) {
   match (*expr) {
-    of(BooleanExpr, bexpr) return ir_bexpr(*bexpr);
-    of(ArithmeticExpr, aexpr) return ir_aexpr(*aexpr);
-    of(StringExpr, sexpr) return ir_sexpr(*sexpr);
+    of(BooleanExpr, bexpr) return ir_bexpr(ir, *bexpr);
+    of(ArithmeticExpr, aexpr) return ir_aexpr(ir, *aexpr);
+    of(StringExpr, sexpr) return ir_sexpr(ir, *sexpr);
   }
 
   unreachable("ir_literal_expr");
@@ -404,8 +512,14 @@ int ir_literal_expr(LiteralExpr* expr) {
 
 void free_literal_expr(LiteralExpr* ast) {
   match (*ast) {
-    of(BooleanExpr, bexpr) free_bexpr(*bexpr);
-    of(ArithmeticExpr, aexpr) free_aexpr(*aexpr);
+    of(BooleanExpr, bexpr, tape) {
+      free_bexpr(*bexpr);
+      free_expr_tape(*tape);
+    }
+    of(ArithmeticExpr, aexpr, tape) {
+      free_aexpr(*aexpr);
+      free_expr_tape(*tape);
+    }
     of(StringExpr, sexpr) free_sexpr(*sexpr);
   }
 
@@ -414,10 +528,7 @@ void free_literal_expr(LiteralExpr* ast) {
 
 /* ------------------------ IdentifierExpression ------------------------ */
 
-ExprResult eval_binary_ident_expr(char* ident, IdentBinaryOp op, LiteralExpr* expr) {
-  ExprResult lhs = symbol_get(symtab, ident);
-  ExprResult rhs = eval_literal_expr(expr);
-
+ExprResult eval_binary_values(ExprResult lhs, IdentBinaryOp op, ExprResult rhs) {
   match (lhs) {
     of(BooleanResult, bool1) {
       match (rhs) {
@@ -442,7 +553,7 @@ ExprResult eval_binary_ident_expr(char* ident, IdentBinaryOp op, LiteralExpr* ex
         of(StringResult, str2) {
           switch (op) {
             case IdentBOp_Plus: return StringResult(concat_str(*str1, *str2));
-            case IdentBOp_EqEq: return BooleanResult(strcmp(*str1, *str2));
+            case IdentBOp_EqEq: return BooleanResult(strcmp(*str1, *str2) == 0);
             default: runtime_error("unsupported string operation");
           }
         }
@@ -480,10 +591,26 @@ ExprResult eval_binary_ident_expr(char* ident, IdentBinaryOp op, LiteralExpr* ex
       }
     }
   }
-  unreachable("eval_binary_ident_expr");
+  unreachable("eval_binary_values");
   return BooleanResult(false);
 }
 
+ExprResult eval_binary_ident_expr(char* ident, IdentBinaryOp op, LiteralExpr* expr) {
+  ExprResult lhs = symbol_get(symtab, ident);
+
+  // `s + "a" + "b"` is concatenated in one go
+  if (op == IdentBOp_Plus && MATCHES(lhs, StringResult)) {
+    ifLet(*expr, StringExpr, sexpr) {
+      ifLet(**sexpr, StringConcat, pieces, count) {
+        return StringResult(concat_strs(lhs.data.StringResult._0, *pieces, *count));
+      }
+    }
+  }
+
+  ExprResult rhs = eval_literal_expr(expr);
+  return eval_binary_values(lhs, op, rhs);
+}
+
 ExprResult eval_ident_expr(IdentExpr* expr) {
   match (*expr) {
     of(IdentBinaryExpr, ident, op, expr) return eval_binary_ident_expr(*ident, *op, *expr);
@@ -499,7 +626,7 @@ ExprResult eval_ident_expr(IdentExpr* expr) {
         }
         case IdentUOp_Exclamation:
           match (value) {
-            of(BooleanResult, boolean) return BooleanResult(!boolean);
+            of(BooleanResult, boolean) return BooleanResult(!*boolean);
             otherwise runtime_error("unsupported variable type for boolean negation");
           }
           break;
@@ -512,31 +639,33 @@ ExprResult eval_ident_expr(IdentExpr* expr) {
   return BooleanResult(false);
 }
 
-int ir_ident_expr(IdentExpr* expr) {
+int ir_ident_expr(IrProgram* ir, IdentExpr* expr) {
   match (*expr) {
     of(IdentBinaryExpr, ident, op, expr) {
-      int r = ir_literal_expr(*expr);
+      IrOperand l = IrVar(ir_intern_var(ir, *ident));
+      IrOperand r = IrTemp(ir_literal_expr(ir, *expr));
       switch (*op) {
-        case IdentBOp_Plus:  return assign_temp_ir("%s + t%d", *ident, r);
-        case IdentBOp_Minus: return assign_temp_ir("%s - t%d", *ident, r);
-        case IdentBOp_Star:  return assign_temp_ir("%s * t%d", *ident, r);
-        case IdentBOp_Slash: return assign_temp_ir("%s / t%d", *ident, r);
-        case IdentBOp_Gt:    return assign_temp_ir("%s > t%d", *ident, r);
-        case IdentBOp_Gte:   return assign_temp_ir("%s >= t%d", *ident, r);
-        case IdentBOp_Lt:    return assign_temp_ir("%s < t%d", *ident, r);
-        case IdentBOp_Lte:   return assign_temp_ir("%s <= t%d", *ident, r);
-        case IdentBOp_EqEq:  return assign_temp_ir("%s == t%d", *ident, r);
-        case IdentBOp_And:   return assign_temp_ir("%s && t%d", *ident, r);
-        case IdentBOp_Or:    return assign_temp_ir("%s || t%d", *ident, r);
+        case IdentBOp_Plus:  return assign_temp_ir(ir, IR_ADD, l, r);
+        case IdentBOp_Minus: return assign_temp_ir(ir, IR_SUB, l, r);
+        case IdentBOp_Star:  return assign_temp_ir(ir, IR_MUL, l, r);
+        case IdentBOp_Slash: return assign_temp_ir(ir, IR_DIV, l, r);
+        case IdentBOp_Gt:    return assign_temp_ir(ir, IR_GT, l, r);
+        case IdentBOp_Gte:   return assign_temp_ir(ir, IR_GTE, l, r);
+        case IdentBOp_Lt:    return assign_temp_ir(ir, IR_LT, l, r);
+        case IdentBOp_Lte:   return assign_temp_ir(ir, IR_LTE, l, r);
+        case IdentBOp_EqEq:  return assign_temp_ir(ir, IR_EQ, l, r);
+        case IdentBOp_And:   return assign_temp_ir(ir, IR_AND, l, r);
+        case IdentBOp_Or:    return assign_temp_ir(ir, IR_OR, l, r);
       }
     }
     of(IdentUnaryExpr, op, ident) {
+      IrOperand var = IrVar(ir_intern_var(ir, *ident));
       switch (*op) {
-        case IdentUOp_Minus: return assign_temp_ir("- %s", *ident);
-        case IdentUOp_Exclamation: return assign_temp_ir("! %s", *ident);
+        case IdentUOp_Minus: return assign_temp_ir(ir, IR_NEG, var, IrNone());
+        case IdentUOp_Exclamation: return assign_temp_ir(ir, IR_NOT, var, IrNone());
       }
     }
-    of(Identifier, ident) return assign_temp_ir("%s", *ident);
+    of(Identifier, ident) return assign_temp_ir(ir, IR_COPY, IrVar(ir_intern_var(ir, *ident)), IrNone());
   }
 
   unreachable("ir_ident_expr");
@@ -617,16 +746,57 @@ void print_expr(Expr* ast, int ind) {
   }
 }
 
-int ir_expr(Expr* expr) {
+int ir_expr(IrProgram* ir, Expr* expr) {
   match (*expr) {
-    of(LiteralExpression, lexpr) return ir_literal_expr(*lexpr);
-    of(IdentExpression, iexpr) return ir_ident_expr(*iexpr);
+    of(LiteralExpression, lexpr) return ir_literal_expr(ir, *lexpr);
+    of(IdentExpression, iexpr) return ir_ident_expr(ir, *iexpr);
   }
 
   unreachable("ir_expr");
   return -1;
 }
 
+// Emits a jump to `label` taken when the condition `expr` evaluates to
+// `when`, falling through otherwise. Logical operators are lowered to jumps
+// that skip their right operand when the left one decides the result.
+void ir_branch(IrProgram* ir, Expr* expr, bool when, int label) {
+  ifLet(*expr, LiteralExpression, lexpr) {
+    ifLet(**lexpr, BooleanExpr, bexpr) {
+      ir_branch_bexpr(ir, *bexpr, when, label);
+      return;
+    }
+  }
+
+  ifLet(*expr, IdentExpression, iexpr) {
+    ifLet(**iexpr, IdentBinaryExpr, ident, op, rhs) {
+      bool logical = *op == IdentBOp_And || *op == IdentBOp_Or;
+      if (logical && MATCHES(**rhs, BooleanExpr)) {
+        // The variable is combined with the identity of the operator first:
+        // that leaves a boolean as is, and fails like the whole expression
+        // on any other value
+        bool decides = *op == IdentBOp_Or;
+        IrOpcode opcode = decides ? IR_OR : IR_AND;
+        IrOperand var = IrVar(ir_intern_var(ir, *ident));
+        IrOperand left = IrTemp(assign_temp_ir(ir, opcode, var, IrConst(BooleanResult(!decides))));
+        BoolExpr* right = (*rhs)->data.BooleanExpr._0;
+
+        if (when == decides) {
+          ir_branch_temp(ir, left, decides, label);
+          ir_branch_bexpr(ir, right, when, label);
+        } else {
+          int skip_label = ir_new_label(ir);
+          ir_branch_temp(ir, left, decides, skip_label);
+          ir_branch_bexpr(ir, right, when, label);
+          ir_emit(ir, ir_label_instr(IR_LABEL, skip_label));
+        }
+        return;
+      }
+    }
+  }
+
+  ir_branch_temp(ir, IrTemp(ir_expr(ir, expr)), when, label);
+}
+
 void free_expr(Expr* ast) {
   match (*ast) {
     of(LiteralExpression, lexpr) free_literal_expr(*lexpr);
@@ -636,6 +806,80 @@ void free_expr(Expr* ast) {
 
 /* ----------------------------- Statement ----------------------------- */
 
+// The loop variable of a for loop starts at the start value truncated toward
+// zero, like the conversion to a C integer, clamped to the int64 range.
+int64_t for_loop_start(double from) {
+  if (isnan(from)) return 0;
+  if (from <= (double)INT64_MIN) return INT64_MIN;
+  if (from >= (double)INT64_MAX) return INT64_MAX;
+  return (int64_t)from;
+}
+
+// Number of iterations of `for i = from to to`, counting like
+// `for (int64_t i = from; i <= to; i++)`. The count is computed once, before
+// the first iteration.
+int64_t for_loop_trip_count(ExprResult from, ExprResult to) {
+  if (!MATCHES(from, NumberResult)) {
+    runtime_error("start variable should be a number in for loop");
+  }
+  if (!MATCHES(to, NumberResult)) {
+    runtime_error("for loop end should be a number");
+  }
+
+  int64_t start = for_loop_start(from.data.NumberResult._0);
+  double end = floor(to.data.NumberResult._0);
+  if (isnan(end) || end < (double)start) return 0;
+
+  double count = end - (double)start + 1;
+  return count >= (double)INT64_MAX ? INT64_MAX : (int64_t)count;
+}
+
+static bool ident_expr_mentions(IdentExpr* expr, char* name) {
+  match (*expr) {
+    of(IdentBinaryExpr, ident, _, _) return strcmp(*ident, name) == 0;
+    of(IdentUnaryExpr, _, ident) return strcmp(*ident, name) == 0;
+    of(Identifier, ident) return strcmp(*ident, name) == 0;
+  }
+  return false;
+}
+
+static bool expr_mentions(Expr* expr, char* name) {
+  ifLet(*expr, IdentExpression, ident) return ident_expr_mentions(*ident, name);
+  return false;
+}
+
+// Whether any statement in `stmts` reads or assigns the variable `name`
+bool stmt_list_mentions(StatementList* stmts, char* name) {
+  for (StatementList* curr = stmts; curr; curr = curr->next) {
+    match (*curr->value) {
+      of(DisplayStmt, expr) if (expr_mentions(*expr, name)) return true;
+      of(ExprStmt, expr) if (expr_mentions(*expr, name)) return true;
+      of(AssignStmt, ident, value) {
+        if (strcmp(*ident, name) == 0 || expr_mentions(*value, name)) return true;
+      }
+      of(IfStmt, condition, true_stmts, else_if, else_stmts) {
+        if (expr_mentions(*condition, name)) return true;
+        if (stmt_list_mentions(*true_stmts, name)) return true;
+        for (ElseIfStatement* e = *else_if; e; e = e->next) {
+          if (expr_mentions(e->condition, name)) return true;
+          if (stmt_list_mentions(e->true_stmts, name)) return true;
+        }
+        if (stmt_list_mentions(*else_stmts, name)) return true;
+      }
+      of(WhileStmt, condition, true_stmts) {
+        if (expr_mentions(*condition, name)) return true;
+        if (stmt_list_mentions(*true_stmts, name)) return true;
+      }
+      of(ForStmt, ident, from, to, body) {
+        if (strcmp(*ident, name) == 0) return true;
+        if (expr_mentions(*from, name) || expr_mentions(*to, name)) return true;
+        if (stmt_list_mentions(*body, name)) return true;
+      }
+    }
+  }
+  return false;
+}
+
 bool eval_to_condition(Expr* expr) {
   ExprResult evaled = eval_expr(expr);
   match (evaled) {
@@ -647,22 +891,60 @@ bool eval_to_condition(Expr* expr) {
   return false;
 }
 
-void eval_stmt(Stmt* stmt) {
-  match (*stmt) {
-    of(DisplayStmt, expr) {
-      ExprResult result = eval_expr(*expr);
-      match(result) {
-        of(BooleanResult, boolean) printf("%s\n", *boolean ? "true" : "false");
-        of(NumberResult, number) printf("%g\n", *number);
-        of(StringResult, string) printf("%s\n", *string);
+// `loop` is the JIT state of the loop, or NULL
+static void eval_for(Stmt* stmt, JitLoop* loop, char* ident, Expr* from, Expr* to, StatementList* stmts, bool mentioned) {
+  ExprResult from_expr = eval_expr(from);
+  ExprResult to_expr = eval_expr(to);
+  int64_t trip = for_loop_trip_count(from_expr, to_expr);
+  if (trip == 0) return;
+
+  // The loop counts in an integer, and the loop variable is looked up once.
+  // When the body never mentions the variable it only needs the value of the
+  // last iteration, and nothing can observe it being stored early.
+  int64_t i = for_loop_start(from_expr.data.NumberResult._0);
+  int64_t last = i + (trip - 1);
+  add_symbol(&symtab, ident, NumberResult(i));
+  Symbol* sym = symbol_lookup(symtab, ident);
+
+  if (!mentioned) {
+    sym->value = NumberResult(last);
+    for (int64_t n = 0; n < trip; n++) {
+      eval_stmt_list(stmts);
+      if (n + 1 == trip) break;
+      if (loop && jit_for_back_edge(loop, i + n + 1, last)) return;
+      if (atomic_load_explicit(&tier_ready, memory_order_acquire)) {
+        tier_resume_for(stmt, i + n + 1, last);
+        return;
       }
     }
+    return;
+  }
+
+  for (;; i++) {
+    sym->value = NumberResult(i);
+    eval_stmt_list(stmts);
+    if (i == last) return;
+    if (loop && jit_for_back_edge(loop, i + 1, last)) return;
+    if (atomic_load_explicit(&tier_ready, memory_order_acquire)) {
+      tier_resume_for(stmt, i + 1, last);
+      return;
+    }
+  }
+}
+
+void eval_stmt(Stmt* stmt) {
+  match (*stmt) {
+    of(DisplayStmt, expr) print_result(eval_expr(*expr));
     of(ExprStmt, expr) eval_expr(*expr); 
     of(AssignStmt, ident, value) {
       add_symbol(&symtab, *ident, eval_expr(*value));
     }
     of(IfStmt, condition, true_stmts, else_if, else_stmts) {
-      if (eval_to_condition(*condition)) {
+      if (*else_if && (*else_if)->switch_table) {
+        SwitchTable* table = (*else_if)->switch_table;
+        int arm = switch_table_lookup(table, symbol_get(symtab, table->ident));
+        eval_stmt_list(arm >= 0 ? table->arms[arm] : *else_stmts);
+      } else if (eval_to_condition(*condition)) {
         eval_stmt_list(*true_stmts);
       } else {
         bool else_if_did_exec = eval_else_if(*else_if);
@@ -672,30 +954,17 @@ void eval_stmt(Stmt* stmt) {
       }
     }
     of(WhileStmt, condition, true_stmts) {
+      JitLoop* loop = jit_loop(stmt);
       while (eval_to_condition(*condition)) {
         eval_stmt_list(*true_stmts);
-      }
-    }
-    of(ForStmt, ident, from, to, stmts) {
-      ExprResult from_expr = eval_expr(*from);
-      ExprResult to_expr = eval_expr(*to);
-
-      if (!MATCHES(from_expr, NumberResult)) {
-        runtime_error("start variable should be a number in for loop");
-      }
-      if (!MATCHES(to_expr, NumberResult)) {
-        runtime_error("for loop end should be a number");
-      }
-
-      ifLet(from_expr, NumberResult, from_num) {
-        ifLet(to_expr, NumberResult, to_num) {
-          for (int i = *from_num; i <= *to_num; i++) {
-            add_symbol(&symtab, *ident, NumberResult(i));
-            eval_stmt_list(*stmts);
-          }
+        if (loop && jit_while_back_edge(loop)) break;
+        if (atomic_load_explicit(&tier_ready, memory_order_acquire)) {
+          tier_resume_while(stmt);
+          break;
         }
       }
     }
+    of(ForStmt, ident, from, to, stmts, mentioned) eval_for(stmt, jit_loop(stmt), *ident, *from, *to, *stmts, *mentioned);
   }
 }
 
@@ -757,48 +1026,434 @@ void print_stmt(Stmt *ast, int ind) {
   }
 }
 
-void ir_stmt(Stmt* stmt) {
-  match (*stmt) {
-    of(DisplayStmt, expr) printf("display t%d\n", ir_expr(*expr));
-    of(ExprStmt, expr) ir_expr(*expr); 
-    of(AssignStmt, ident, value) printf("%s = t%d\n", *ident, ir_expr(*value));
-    of(IfStmt, condition, true_stmts, else_if, else_stmts) {
-      // Consider an if conditional like so:
-      // ```
-      // if cond then
-      //   true_stmts
-      // else
-      //   else_stmts
-      // endif
-      // rest_of_program
-      // ```
-      // 
-      // Then the corresponding 3 address code will be:
-      //
-      // ```
-      // if cond == true goto LTRUE
-      // else_stmts
-      // goto LDONE
-      // LTRUE:
-      // true_stmts
-      // LDONE:
-      // rest_of_program
-      // ```
+// Loops with at most this many iterations are unrolled completely
+#define FULL_UNROLL_MAX_TRIP 16
+
+// Finds the value of `temp` when the instructions emitted from `mark` on
+// compute it from constants only, without any runtime error.
+static bool ir_fold_emitted(IrProgram* ir, int mark, int temp, ExprResult* out) {
+  ExprResult* values = calloc(ir->temp_count + 1, sizeof(ExprResult));
+  bool* known = calloc(ir->temp_count + 1, sizeof(bool));
+  ensure_non_null(values, "out of space");
+  ensure_non_null(known, "out of space");
+
+  for (int i = mark; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    if (!MATCHES(instr->dest, IrTemp)) continue;
+
+    ExprResult args[2] = { BooleanResult(false), BooleanResult(false) };
+    bool constant = true;
+    for (int k = 0; k < 2; k++) {
+      match (instr->args[k]) {
+        of(IrConst, value) args[k] = *value;
+        of(IrTemp, t) {
+          if (known[*t]) args[k] = values[*t];
+          else constant = false;
+        }
+        of(IrNone) {}
+        otherwise constant = false;
+      }
+    }
 
-      // TODO: Handle else if
-      int true_label = IR_LABEL_IDX++;
-      printf("if t%d == true goto L%d\n", ir_expr(*condition), true_label);
+    int dest = instr->dest.data.IrTemp._0;
+    if (constant && !known[dest]) known[dest] = ir_fold(instr->op, args[0], args[1], &values[dest]);
+  }
 
-      if (*else_stmts) {
-        ir_stmt_list(*else_stmts);
+  bool found = known[temp];
+  if (found) *out = ir_copy_result(values[temp]);
+  for (int t = 0; t < ir->temp_count; t++) {
+    if (known[t]) ir_free_result(values[t]);
+  }
+  free(values);
+  free(known);
+  return found;
+}
+
+// Instructions a loop body lowered to, cut out of the program so that they
+// can be measured before deciding how to lay out the loop, then emitted once
+// or copied. Temporaries and labels from temp_base and label_base on were
+// created by lowering the body, and are renamed in every copy but the first.
+typedef struct {
+  IrInstr* instrs;
+  int len;
+  int temp_base, temp_end;
+  int label_base, label_end;
+  bool emitted;
+} IrBody;
+
+static IrBody ir_lower_body(IrProgram* ir, StatementList* stmts) {
+  IrBody body = { .temp_base = ir->temp_count, .label_base = ir->label_count };
+  int mark = ir->len;
+  ir_stmt_list(ir, stmts);
+
+  body.len = ir->len - mark;
+  body.instrs = malloc((body.len + 1) * sizeof(IrInstr));
+  ensure_non_null(body.instrs, "out of space");
+  memcpy(body.instrs, &ir->instrs[mark], body.len * sizeof(IrInstr));
+  ir->len = mark;
+  body.temp_end = ir->temp_count;
+  body.label_end = ir->label_count;
+  return body;
+}
+
+static bool ir_has_label(IrOpcode op) {
+  return op == IR_LABEL || ir_is_branch(op);
+}
+
+// Emits the body, moving its instructions the first time and copying them
+// with fresh temporaries, labels and constants after that
+static void ir_emit_body(IrProgram* ir, IrBody* body) {
+  if (!body->emitted) {
+    for (int i = 0; i < body->len; i++) ir_emit(ir, body->instrs[i]);
+    body->emitted = true;
+    return;
+  }
+
+  int temps = body->temp_end - body->temp_base;
+  int labels = body->label_end - body->label_base;
+  int* temp_map = malloc((temps + 1) * sizeof(int));
+  int* label_map = malloc((labels + 1) * sizeof(int));
+  ensure_non_null(temp_map, "out of space");
+  ensure_non_null(label_map, "out of space");
+  for (int t = 0; t < temps; t++) temp_map[t] = ir_new_temp(ir);
+  for (int l = 0; l < labels; l++) label_map[l] = ir_new_label(ir);
+
+  for (int i = 0; i < body->len; i++) {
+    IrInstr instr = body->instrs[i];
+    IrOperand* operands[] = { &instr.dest, &instr.args[0], &instr.args[1] };
+    for (int k = 0; k < 3; k++) {
+      match (*operands[k]) {
+        of(IrTemp, temp) {
+          if (*temp >= body->temp_base) *temp = temp_map[*temp - body->temp_base];
+        }
+        of(IrConst, value) *value = ir_copy_result(*value);
+        otherwise {}
       }
+    }
+    if (ir_has_label(instr.op) && instr.label >= body->label_base) {
+      instr.label = label_map[instr.label - body->label_base];
+    }
+    ir_emit(ir, instr);
+  }
+
+  free(label_map);
+  free(temp_map);
+}
+
+// Frees the instructions of a body that was never emitted, and the copy of
+// the ones of a body that was
+static void ir_free_body(IrBody* body) {
+  if (!body->emitted) {
+    for (int i = 0; i < body->len; i++) {
+      IrInstr* instr = &body->instrs[i];
+      IrOperand* operands[] = { &instr->dest, &instr->args[0], &instr->args[1] };
+      for (int k = 0; k < 3; k++) {
+        ifLet(*operands[k], IrConst, value) ir_free_result(*value);
+      }
+    }
+  }
+  free(body->instrs);
+}
+
+// One iteration of a counted loop. The loop variable is only assigned when
+// the body mentions it.
+static void ir_for_iteration(IrProgram* ir, IrOperand var, IrOperand counter, bool mentioned, IrBody* body) {
+  if (mentioned) ir_emit(ir, ir_instr(IR_COPY, var, counter, IrNone()));
+  ir_emit_body(ir, body);
+  if (mentioned) ir_emit(ir, ir_instr(IR_ADD, counter, counter, IrConst(NumberResult(1))));
+}
+
+// Unrolls a for loop with a constant trip count when enabled and the
+// unrolled code fits in the budget. Small loops are unrolled completely.
+// Larger ones run `factor` copies of the body per iteration of the main
+// loop, then a remainder loop runs the iterations left over. Returns
+// false when the loop should be lowered as is, leaving the body lowered in
+// `body` if it had to be measured.
+static bool ir_unroll_for(IrProgram* ir, char* ident, int mark, IrOperand start, IrOperand end, StatementList* stmts, bool mentioned, IrBody* body) {
+  if (ir->unroll_factor < 2) return false;
+
+  ExprResult from_value, to_value;
+  bool from_known = ir_fold_emitted(ir, mark, start.data.IrTemp._0, &from_value);
+  bool to_known = ir_fold_emitted(ir, mark, end.data.IrTemp._0, &to_value);
+  bool numbers = from_known && to_known
+    && MATCHES(from_value, NumberResult) && MATCHES(to_value, NumberResult);
+  int64_t trip = numbers ? for_loop_trip_count(from_value, to_value) : 0;
+  if (from_known) ir_free_result(from_value);
+  if (to_known) ir_free_result(to_value);
+  if (!numbers || trip < 2) return false;
+
+  // Every loop inside is lowered once, here, however many times it is copied
+  *body = ir_lower_body(ir, stmts);
+  int size = body->len + 2;
+  int64_t first = for_loop_start(from_value.data.NumberResult._0);
+  IrOperand var = IrVar(ir_intern_var(ir, ident));
+
+  if (trip <= FULL_UNROLL_MAX_TRIP && trip * size <= ir->unroll_budget) {
+    if (!mentioned) ir_emit(ir, ir_instr(IR_COPY, var, IrConst(NumberResult(first + trip - 1)), IrNone()));
+    for (int64_t n = 0; n < trip; n++) {
+      if (mentioned) ir_emit(ir, ir_instr(IR_COPY, var, IrConst(NumberResult(first + n)), IrNone()));
+      ir_emit_body(ir, body);
+    }
+    return true;
+  }
+
+  int factor = ir->unroll_factor;
+  if (factor * size > ir->unroll_budget) factor = ir->unroll_budget / size;
+  if (factor > trip) factor = trip;
+  if (factor < 2) return false;
+
+  // ```
+  // t0 = int first
+  // t1 = t0 + trip
+  // t2 = t1 - (factor - 1)
+  // LMAIN:
+  // if t0 < t2 goto LBODY
+  // goto LREST
+  // LBODY:
+  // i = t0, stmts, t0 = t0 + 1   (factor times)
+  // goto LMAIN
+  // LREST:
+  // if t0 < t1 goto LREST_BODY   (when trip % factor != 0)
+  // goto LDONE
+  // LREST_BODY:
+  // i = t0, stmts, t0 = t0 + 1
+  // goto LREST
+  // LDONE:
+  // ```
+  IrOperand counter = IrTemp(assign_temp_ir(ir, IR_COPY, IrConst(NumberResult(first)), IrNone()));
+  IrOperand limit = IrTemp(assign_temp_ir(ir, IR_ADD, counter, IrConst(NumberResult(trip))));
+  IrOperand main_limit = IrTemp(assign_temp_ir(ir, IR_SUB, limit, IrConst(NumberResult(factor - 1))));
+  if (!mentioned) ir_emit(ir, ir_instr(IR_SUB, var, limit, IrConst(NumberResult(1))));
+
+  int main_label = ir_new_label(ir);
+  int body_label = ir_new_label(ir);
+  int rest_label = ir_new_label(ir);
+  int rest_body_label = ir_new_label(ir);
+  int done_label = ir_new_label(ir);
+
+  ir_emit(ir, ir_label_instr(IR_LABEL, main_label));
+  ir_emit(ir, ir_if_cmp_instr(IR_LT, counter, main_limit, body_label));
+  ir_emit(ir, ir_label_instr(IR_GOTO, rest_label));
+  ir_emit(ir, ir_label_instr(IR_LABEL, body_label));
+  for (int n = 0; n < factor; n++) ir_for_iteration(ir, var, counter, mentioned, body);
+  if (!mentioned) ir_emit(ir, ir_instr(IR_ADD, counter, counter, IrConst(NumberResult(factor))));
+  ir_emit(ir, ir_label_instr(IR_GOTO, main_label));
+
+  ir_emit(ir, ir_label_instr(IR_LABEL, rest_label));
+  if (trip % factor != 0) {
+    ir_emit(ir, ir_if_cmp_instr(IR_LT, counter, limit, rest_body_label));
+    ir_emit(ir, ir_label_instr(IR_GOTO, done_label));
+    ir_emit(ir, ir_label_instr(IR_LABEL, rest_body_label));
+    ir_for_iteration(ir, var, counter, mentioned, body);
+    if (!mentioned) ir_emit(ir, ir_instr(IR_ADD, counter, counter, IrConst(NumberResult(1))));
+    ir_emit(ir, ir_label_instr(IR_GOTO, rest_label));
+  }
+  ir_emit(ir, ir_label_instr(IR_LABEL, done_label));
+  return true;
+}
+
+static void ir_for_stmt(IrProgram* ir, char* ident, Expr* from, Expr* to, StatementList* stmts, bool mentioned) {
+  // Consider a for statement like so:
+  // ```
+  // for i = 1 to 10 do
+  //   stmts
+  // endfor
+  // rest_of_program
+  // ```
+  // 
+  // It is lowered to a counted loop. The number of iterations is computed
+  // once, and the loop counts in a temporary holding an integer:
+  //
+  // ```
+  // t0 = 1
+  // t1 = 10
+  // t2 = trip t0, t1
+  // t3 = int t0
+  // t4 = t3 + t2
+  // LBEGIN:
+  // if t3 < t4 goto LTRUE
+  // goto LDONE
+  // LTRUE:
+  // i = t3
+  // stmts
+  // t3 = t3 + 1
+  // goto LBEGIN
+  // LDONE:
+  // rest_of_program
+  // ```
+  //
+  // When the body never mentions `i`, it is assigned the value of the
+  // last iteration before the loop, and the loop just counts down t2.
+  //
+  // Loops over constant bounds may be unrolled instead, see ir_unroll_for.
+  int mark = ir->len;
+  IrOperand var = IrVar(ir_intern_var(ir, ident));
+  IrOperand start = IrTemp(ir_expr(ir, from));
+  IrOperand end = IrTemp(ir_expr(ir, to));
+  IrBody body = { 0 };
+  if (ir_unroll_for(ir, ident, mark, start, end, stmts, mentioned, &body)) {
+    ir_free_body(&body);
+    return;
+  }
+
+  IrOperand trip = IrTemp(assign_temp_ir(ir, IR_FOR_TRIP, start, end));
+  IrOperand zero = IrConst(NumberResult(0));
+  IrOperand one = IrConst(NumberResult(1));
+
+  int begin_label = ir_new_label(ir);
+  int true_label = ir_new_label(ir);
+  int done_label = ir_new_label(ir);
+
+  IrOperand counter = IrTemp(assign_temp_ir(ir, IR_TRUNC, start, IrNone()));
+  IrOperand limit = IrTemp(assign_temp_ir(ir, IR_ADD, counter, trip));
+  if (!mentioned) {
+    ir_emit(ir, ir_if_cmp_instr(IR_LTE, trip, zero, done_label));
+    ir_emit(ir, ir_instr(IR_SUB, var, limit, one));
+  }
+
+  ir_emit(ir, ir_label_instr(IR_LABEL, begin_label));
+  if (mentioned) {
+    ir_emit(ir, ir_if_cmp_instr(IR_LT, counter, limit, true_label));
+  } else {
+    ir_emit(ir, ir_if_cmp_instr(IR_GT, trip, zero, true_label));
+  }
+  ir_emit(ir, ir_label_instr(IR_GOTO, done_label));
+
+  ir_emit(ir, ir_label_instr(IR_LABEL, true_label));
+  if (mentioned) ir_emit(ir, ir_instr(IR_COPY, var, counter, IrNone()));
+  if (body.instrs) {
+    ir_emit_body(ir, &body);
+    ir_free_body(&body);
+  } else {
+    ir_stmt_list(ir, stmts);
+  }
+  if (mentioned) {
+    ir_emit(ir, ir_instr(IR_ADD, counter, counter, one));
+  } else {
+    ir_emit(ir, ir_instr(IR_SUB, trip, trip, one));
+  }
+  ir_emit(ir, ir_label_instr(IR_GOTO, begin_label));
+
+  ir_emit(ir, ir_label_instr(IR_LABEL, done_label));
+}
 
-      int done_label = IR_LABEL_IDX++;
-      printf("goto L%d\n", done_label);
+// Emits a binary search for temporary `value` among the numeric constants
+// of cases [lo, hi), jumping to the label of the arm of the case it equals,
+// or to `else_label` if it equals none
+static void ir_switch_search(IrProgram* ir, IrOperand value, SwitchCase* cases, int lo, int hi, int* arm_labels, int else_label) {
+  if (hi - lo <= 3) {
+    for (int i = lo; i < hi; i++) {
+      IrOperand key = IrConst(NumberResult(cases[i].key.data.NumberResult._0));
+      ir_emit(ir, ir_if_cmp_instr(IR_EQ, value, key, arm_labels[cases[i].arm]));
+    }
+    ir_emit(ir, ir_label_instr(IR_GOTO, else_label));
+    return;
+  }
+
+  int mid = lo + (hi - lo) / 2;
+  int lower_label = ir_new_label(ir);
+  IrOperand key = IrConst(NumberResult(cases[mid].key.data.NumberResult._0));
+  ir_emit(ir, ir_if_cmp_instr(IR_LT, value, key, lower_label));
+  ir_switch_search(ir, value, cases, mid, hi, arm_labels, else_label);
+  ir_emit(ir, ir_label_instr(IR_LABEL, lower_label));
+  ir_switch_search(ir, value, cases, lo, mid, arm_labels, else_label);
+}
+
+static void ir_if_stmt(IrProgram* ir, Expr* condition, StatementList* true_stmts, ElseIfStatement* else_if, StatementList* else_stmts) {
+  // Consider an if conditional like so:
+  // ```
+  // if cond0 then
+  //   stmts0
+  // else if cond1 then
+  //   stmts1
+  // else
+  //   else_stmts
+  // endif
+  // rest_of_program
+  // ```
+  // 
+  // Then the corresponding 3 address code will be:
+  //
+  // ```
+  // if cond0 == true goto L0
+  // if cond1 == true goto L1
+  // else_stmts
+  // goto LDONE
+  // L0:
+  // stmts0
+  // goto LDONE
+  // L1:
+  // stmts1
+  // LDONE:
+  // rest_of_program
+  // ```
+  //
+  // When the conditions compare a variable against numbers, the tests are
+  // replaced by a binary search over the numbers. The variable is read once,
+  // and values that are not numbers go straight to the else statements.
+  SwitchTable* table = else_if ? else_if->switch_table : NULL;
+  if (table && !switch_table_numeric(table)) table = NULL;
+
+  int arm_count = 1;
+  for (ElseIfStatement* e = else_if; e; e = e->next) arm_count++;
+  int* arm_labels = malloc(arm_count * sizeof(int));
+  StatementList** arms = malloc(arm_count * sizeof(StatementList*));
+  ensure_non_null(arm_labels, "out of space");
+  ensure_non_null(arms, "out of space");
+
+  ElseIfStatement* e = else_if;
+  for (int arm = 0; arm < arm_count; arm++) {
+    arm_labels[arm] = -1;
+    arms[arm] = arm == 0 ? true_stmts : e->true_stmts;
+    if (!table) {
+      arm_labels[arm] = ir_new_label(ir);
+      ir_branch(ir, arm == 0 ? condition : e->condition, true, arm_labels[arm]);
+    }
+    if (arm > 0) e = e->next;
+  }
+
+  if (table) {
+    // Arms whose constant is tested earlier in the chain, or is NaN, never run
+    for (int i = 0; i < table->count; i++) arm_labels[table->cases[i].arm] = ir_new_label(ir);
+
+    IrOperand value = IrTemp(assign_temp_ir(ir, IR_COPY, IrVar(ir_intern_var(ir, table->ident)), IrNone()));
+    IrOperand number = IrTemp(assign_temp_ir(ir, IR_IS_NUMBER, value, IrNone()));
+    int else_label = ir_new_label(ir);
+    IrInstr not_number = ir_if_instr(number, else_label);
+    not_number.op = IR_IF_NOT;
+    ir_emit(ir, not_number);
+    ir_switch_search(ir, value, table->cases, 0, table->count, arm_labels, else_label);
+    ir_emit(ir, ir_label_instr(IR_LABEL, else_label));
+  }
+
+  if (else_stmts) ir_stmt_list(ir, else_stmts);
 
-      printf("L%d:\n", true_label);
-      ir_stmt_list(*true_stmts);
-      printf("L%d:\n", done_label);
+  int done_label = ir_new_label(ir);
+  for (int arm = 0; arm < arm_count; arm++) {
+    if (arm_labels[arm] < 0) continue;
+    ir_emit(ir, ir_label_instr(IR_GOTO, done_label));
+    ir_emit(ir, ir_label_instr(IR_LABEL, arm_labels[arm]));
+    ir_stmt_list(ir, arms[arm]);
+  }
+  ir_emit(ir, ir_label_instr(IR_LABEL, done_label));
+
+  free(arm_labels);
+  free(arms);
+}
+
+void ir_stmt(IrProgram* ir, Stmt* stmt) {
+  match (*stmt) {
+    of(DisplayStmt, expr) {
+      IrOperand value = IrTemp(ir_expr(ir, *expr));
+      ir_emit(ir, ir_instr(IR_DISPLAY, IrNone(), value, IrNone()));
+    }
+    of(ExprStmt, expr) ir_expr(ir, *expr); 
+    of(AssignStmt, ident, value) {
+      IrOperand temp = IrTemp(ir_expr(ir, *value));
+      ir_emit(ir, ir_instr(IR_COPY, IrVar(ir_intern_var(ir, *ident)), temp, IrNone()));
+    }
+    of(IfStmt, condition, true_stmts, else_if, else_stmts) {
+      ir_if_stmt(ir, *condition, *true_stmts, *else_if, *else_stmts);
     }
     of(WhileStmt, condition, true_stmts) {
       // Consider a while statement like so:
@@ -821,62 +1476,22 @@ void ir_stmt(Stmt* stmt) {
       // LDONE:
       // rest_of_program
       // ```
-      int begin_label = IR_LABEL_IDX++;
-      printf("L%d:\n", begin_label);
-
-      int true_label = IR_LABEL_IDX++;
-      printf("if t%d == true goto L%d\n", ir_expr(*condition), true_label);
-
-      int done_label = IR_LABEL_IDX++;
-      printf("goto L%d\n", done_label);
-
-      printf("L%d:\n", true_label);
-      ir_stmt_list(*true_stmts);
-      printf("goto L%d\n", begin_label);
-
-      printf("L%d:\n", done_label);
-    }
-    of(ForStmt, ident, from, to, stmts) {
-      // Consider a for statement like so:
-      // ```
-      // for i = 1 to 10 do
-      //   stmts
-      // endfor
-      // rest_of_program
-      // ```
-      // 
-      // Then the corresponding 3 address code will be:
-      //
-      // ```
-      // i = 1
-      // t0 = 10
-      // LBEGIN:
-      // if i <= t0 goto LTRUE
-      // goto LDONE
-      // LTRUE:
-      // stmts
-      // i = i + 1
-      // goto LBEGIN
-      // LDONE:
-      // rest_of_program
-      // ```
-      printf("%s = t%d\n", *ident, ir_expr(*from));
-      int begin_label = IR_LABEL_IDX++;
-      printf("L%d:\n", begin_label);
+      int begin_label = ir_new_label(ir);
+      ir_emit(ir, ir_label_instr(IR_LABEL, begin_label));
 
-      int true_label = IR_LABEL_IDX++;
-      printf("if %s <= t%d goto L%d\n", *ident, ir_expr(*to), true_label);
+      int true_label = ir_new_label(ir);
+      ir_branch(ir, *condition, true, true_label);
 
-      int done_label = IR_LABEL_IDX++;
-      printf("goto L%d\n", done_label);
+      int done_label = ir_new_label(ir);
+      ir_emit(ir, ir_label_instr(IR_GOTO, done_label));
 
-      printf("L%d:\n", true_label);
-      ir_stmt_list(*stmts);
-      printf("%s = %s + 1\n", *ident, *ident);
-      printf("goto L%d\n", begin_label);
+      ir_emit(ir, ir_label_instr(IR_LABEL, true_label));
+      ir_stmt_list(ir, *true_stmts);
+      ir_emit(ir, ir_label_instr(IR_GOTO, begin_label));
 
-      printf("L%d:\n", done_label);
+      ir_emit(ir, ir_label_instr(IR_LABEL, done_label));
     }
+    of(ForStmt, ident, from, to, stmts, mentioned) ir_for_stmt(ir, *ident, *from, *to, *stmts, *mentioned);
   }
 }
 
@@ -915,6 +1530,7 @@ ElseIfStatement* alloc_else_if(Condition* cond, TrueStatements* stmts) {
   alloc->condition = cond;
   alloc->true_stmts = stmts;
   alloc->next = NULL;
+  alloc->switch_table = NULL;
 
   return alloc;
 }
@@ -945,6 +1561,7 @@ bool eval_else_if(ElseIfStatement* stmt) {
 
 void free_else_if(ElseIfStatement* stmt) {
   while (stmt) {
+    free_switch_table(stmt->switch_table);
     free_expr(stmt->condition);
     free_stmt_list(stmt->true_stmts);
     stmt = stmt->next;
@@ -999,13 +1616,19 @@ void eval_stmt_list(StatementList* start) {
   while (curr) {
     eval_stmt(curr->value);
     curr = curr->next;
+
+    // With tiered execution, the rest runs as closures once they are ready
+    if (curr && atomic_load_explicit(&tier_ready, memory_order_acquire)) {
+      tier_run(curr->value);
+      return;
+    }
   }
 }
 
-void ir_stmt_list(StatementList* start) {
+void ir_stmt_list(IrProgram* ir, StatementList* start) {
   StatementList* curr = start;
   while (curr) {
-    ir_stmt(curr->value);
+    ir_stmt(ir, curr->value);
     curr = curr->next;
   }
 }
@@ -1061,30 +1684,37 @@ void add_symbol(SymbolTable** head, char* name, ExprResult value) {
   }
 }
 
-ExprResult symbol_get(SymbolTable* head, char* name) {
+Symbol* symbol_lookup(SymbolTable* head, char* name) {
   Symbol* curr = head;
 
   while (curr) {
     if (strcmp(curr->name, name) == 0) {
-      return curr->value;
+      return curr;
     }
     curr = curr->next;
   }
 
+  return NULL;
+}
+
+void undefined_variable_error(char* name) {
   fprintf(stderr, "Runtime error: undefined variable '%s'\n", name);
   exit(1);
 }
 
+ExprResult symbol_get(SymbolTable* head, char* name) {
+  Symbol* sym = symbol_lookup(head, name);
+  if (!sym) undefined_variable_error(name);
+
+  return sym->value;
+}
+
 void print_symtab(SymbolTable* head) {
   Symbol* curr = head;
 
   while (curr) {
     printf("%s = ", curr->name);
-    match(curr->value) {
-      of(BooleanResult, boolean) printf("%s\n", *boolean ? "true" : "false");
-      of(NumberResult, number) printf("%g\n", *number);
-      of(StringResult, string) printf("%s\n", *string);
-    }
+    print_result(curr->value);
     curr = curr->next;
   }
 }
@@ -1156,6 +1786,76 @@ void yyerror(const char *s, ...) {
   fprintf(stderr, "\n");
 }
 
+typedef enum {
+  Engine_TreeWalker,
+  Engine_Closures,
+  Engine_Tiered,
+  Engine_IR,
+} Engine;
+
+// Report what the optimizations, the JIT and tiered execution do on stderr
+int opt_verbose = false;
+
+// Interprets intermediate code and frees it. String values in the symbol
+// table point into the IR's constants, so the symbol table is printed before
+// the IR is freed.
+static void run_ir_program(IrProgram* ir, bool show_symtab) {
+  exec_ir(ir);
+  if (show_symtab) print_symtab(symtab);
+  free_ir_program(ir);
+}
+
+// Executes a parsed program with the tree walking evaluator, the closure
+// compilation engine, both tiered, or by interpreting its intermediate code.
+void run_program(StatementList* program, Engine engine, PassPipeline* pipeline, bool show_symtab) {
+  if (engine != Engine_IR) optimize_ast(program, pipeline);
+
+  switch (engine) {
+    case Engine_TreeWalker:
+      eval_stmt_list(program);
+      if (show_symtab) print_symtab(symtab);
+      free_jit();
+      break;
+    case Engine_Tiered:
+      tier_start(program);
+      eval_stmt_list(program);
+      if (show_symtab) print_symtab(symtab);
+      tier_finish();
+      free_jit();
+      break;
+    case Engine_Closures: {
+      Closure* compiled = compile_stmt_list(program);
+      run_closure(compiled);
+      if (show_symtab) print_symtab(symtab);
+      free_closure(compiled);
+      break;
+    }
+    case Engine_IR:
+      run_ir_program(lower_and_optimize(program, pipeline), show_symtab);
+      break;
+  }
+}
+
+// Reads the input file as source code, or as textual intermediate code when
+// `read_ir` is set, and returns its optimized intermediate code
+static IrProgram* read_program_ir(bool read_ir, PassPipeline* pipeline) {
+  if (read_ir) {
+    IrProgram* ir = parse_ir(yyin);
+    optimize_ir(ir, pipeline);
+    return ir;
+  }
+
+  yyparse();
+  return lower_and_optimize(parse_result, pipeline);
+}
+
+// Records that the option was given, in the int its data points to
+static int option_given(struct argparse* self, const struct argparse_option* option) {
+  (void)self;
+  *(int*)option->data = true;
+  return 0;
+}
+
 int main(int argc, const char **argv) {
   static const char *const usages[] = {
     "psuedoc [options] filename",
@@ -1166,6 +1866,21 @@ int main(int argc, const char **argv) {
   int ir = false;
   int ast = false;
   int show_symtab = false;
+  int closures = false;
+  int tiered = false;
+  int run_ir = false;
+  int cfg = false;
+  int ssa = false;
+  int read_ir = false;
+  const char* emit_ir_bin = NULL;
+  const char* emit_asm = NULL;
+  const char* emit_obj = NULL;
+  const char* emit_llvm = NULL;
+  const char* emit_c = NULL;
+  int cc = false;
+  const char* run_ir_bin = NULL;
+  int no_jit = false;
+  PassPipeline passes = { .unroll_budget = 128 };
 
   struct argparse_option options[] = {
     OPT_HELP(),
@@ -1174,6 +1889,41 @@ int main(int argc, const char **argv) {
     OPT_BOOLEAN('a', "ast", &ast, "print syntax tree", NULL, 0, 0),
     OPT_BOOLEAN('s', "symtab", &show_symtab, "print symbol table", NULL, 0, 0),
     OPT_BOOLEAN('i', "ir", &ir, "print 3 address intermediate code", NULL, 0, 0),
+    OPT_BOOLEAN(0, "cfg", &cfg, "print control flow graph of the intermediate code in graphviz dot format", NULL, 0, 0),
+    OPT_BOOLEAN(0, "print-passes", &passes.print, "print intermediate code before and after every optimization pass", NULL, 0, 0),
+    OPT_BOOLEAN(0, "ssa", &ssa, "print intermediate code in static single assignment form", NULL, 0, 0),
+    OPT_BOOLEAN('v', "verbose", &opt_verbose, "report what the optimizations, the JIT and tiered execution do on stderr", NULL, 0, 0),
+    OPT_GROUP("Execution options"),
+    OPT_BOOLEAN('c', "closures", &closures, "execute using the closure compilation engine", NULL, 0, 0),
+    OPT_BOOLEAN(0, "tiered", &tiered, "start in the tree walking evaluator while compiling to closures in the background, and switch to them once they are ready", NULL, 0, 0),
+    OPT_BOOLEAN('r', "run-ir", &run_ir, "execute the 3 address intermediate code", NULL, 0, 0),
+    OPT_BOOLEAN(0, "no-jit", &no_jit, "only interpret loops in the tree walking evaluator, instead of compiling hot ones to machine code", NULL, 0, 0),
+    OPT_INTEGER(0, "jit-threshold", &jit_threshold, "iterations after which a loop is compiled to machine code (default 1000)", NULL, 0, 0),
+    OPT_BOOLEAN(0, "read-ir", &read_ir, "read the file as textual intermediate code, as printed by -i, instead of source", NULL, 0, 0),
+    OPT_STRING(0, "emit-ir-bin", &emit_ir_bin, "write the optimized intermediate code to the given file in binary form", NULL, 0, 0),
+    OPT_STRING(0, "emit-asm", &emit_asm, "write the optimized intermediate code to the given file as x86-64 assembly, to link with runtime.o", NULL, 0, 0),
+    OPT_STRING(0, "emit-obj", &emit_obj, "write the optimized intermediate code to the given file as an x86-64 ELF object, to link with runtime.o", NULL, 0, 0),
+    OPT_STRING(0, "emit-llvm", &emit_llvm, "write the optimized intermediate code to the given file as LLVM IR, to compile with clang or llc and link with runtime.o", NULL, 0, 0),
+    OPT_STRING(0, "emit-c", &emit_c, "write the syntax tree to the given file as C, to link with runtime.o", NULL, 0, 0),
+    OPT_BOOLEAN(0, "cc", &cc, "compile the file written by --emit-c with the system C compiler at -O2", NULL, 0, 0),
+    OPT_STRING(0, "run-ir-bin", &run_ir_bin, "execute a binary intermediate code file instead of a source file", NULL, 0, 0),
+    OPT_GROUP("Optimization options"),
+    OPT_INTEGER('O', "opt-level", &passes.level, "optimization level: 0 runs no passes, 1 the cheap ones and 2 all of them", NULL, 0, 0),
+    OPT_STRING(0, "passes", &passes.list, "comma separated list of passes to run in order, replacing -O and the pass flags", NULL, 0, 0),
+    OPT_BOOLEAN(0, "time-passes", &passes.time, "report the time and instruction count change of every pass on stderr", NULL, 0, 0),
+    OPT_BOOLEAN(0, "fold", &passes.enabled[PASS_FOLD], "evaluate constant expressions in the syntax tree", NULL, 0, 0),
+    OPT_BOOLEAN(0, "sccp", &passes.enabled[PASS_SCCP], "propagate constants and fold constant branches in the intermediate code", NULL, 0, 0),
+    OPT_BOOLEAN(0, "copy-prop", &passes.enabled[PASS_COPY_PROP], "replace uses of copied values with their source", NULL, 0, 0),
+    OPT_BOOLEAN(0, "gvn", &passes.enabled[PASS_GVN], "reuse the result of computations already done on the same values", NULL, 0, 0),
+    OPT_BOOLEAN(0, "licm", &passes.enabled[PASS_LICM], "move computations that do not change in a loop out of it", NULL, 0, 0),
+    OPT_BOOLEAN(0, "strength-reduce", &passes.enabled[PASS_STRENGTH_REDUCE], "replace multiplications of loop counters by additions", NULL, 0, 0),
+    OPT_BOOLEAN(0, "dce", &passes.enabled[PASS_DCE], "remove instructions computing unused temporaries", NULL, 0, 0),
+    OPT_BOOLEAN(0, "peephole", &passes.enabled[PASS_PEEPHOLE], "simplify branches and rotate loops to end in a single conditional branch", NULL, 0, 0),
+    OPT_BOOLEAN(0, "cfg-cleanup", &passes.enabled[PASS_CFG_CLEANUP], "remove unreachable blocks of intermediate code", NULL, 0, 0),
+    OPT_INTEGER(0, "unroll", &passes.unroll, "unroll for loops with a constant trip count N times, small ones completely, 0 to turn it off (default 4 at -O2)", option_given, (intptr_t)&passes.unroll_given, 0),
+    OPT_INTEGER(0, "unroll-budget", &passes.unroll_budget, "most instructions an unrolled loop may grow to (default 128)", NULL, 0, 0),
+    OPT_INTEGER(0, "registers", &passes.registers, "allocate temporaries to N registers, spilling the rest to frame slots", NULL, 0, 0),
+    OPT_BOOLEAN(0, "typed", &passes.typed, "use typed instructions where the types of operands are known, checking them where they are not", NULL, 0, 0),
     OPT_END(),
   };
 
@@ -1181,6 +1931,26 @@ int main(int argc, const char **argv) {
   argparse_init(&argparse, options, usages, 0);
   // argparse_describe(&argparse, "\nA brief description of what the program does and how it works.", "\nAdditional description of the program after the description of the arguments.");
   argc = argparse_parse(&argparse, argc, argv);
+  jit_enabled = !no_jit;
+
+  if (passes.registers < 0) {
+    fprintf(stderr, "register count must be positive\n");
+    exit(1);
+  }
+
+  if (passes.unroll < 0 || passes.unroll_budget < 0) {
+    fprintf(stderr, "unroll factor and budget must be positive\n");
+    exit(1);
+  }
+
+  pipeline_configure(&passes);
+
+  // Binary intermediate code is run without lexing, parsing or lowering
+  if (run_ir_bin) {
+    run_ir_program(load_ir_bin(run_ir_bin), show_symtab);
+    free_symtab(symtab);
+    return 0;
+  }
 
   if (argc == 0) {
     fprintf(stderr, "filename is required\n");
@@ -1192,6 +1962,16 @@ int main(int argc, const char **argv) {
     }
   }
 
+  Engine engine = Engine_TreeWalker;
+  if (closures) engine = Engine_Closures;
+  if (tiered) engine = Engine_Tiered;
+  if (run_ir || read_ir) engine = Engine_IR;
+
+  if (read_ir && (tokens || ast)) {
+    fprintf(stderr, "tokens and syntax tree need a source file\n");
+    exit(1);
+  }
+
   if (tokens != 0) {
     scan_and_print_tokens();
   }
@@ -1202,26 +1982,94 @@ int main(int argc, const char **argv) {
     free_stmt_list(parse_result);
   }
 
-  if (ir != 0) {
-    yyparse();
-    ir_stmt_list(parse_result);
+  if (ir != 0 || cfg != 0 || ssa != 0) {
+    IrProgram* program = read_program_ir(read_ir, &passes);
+    if (ir != 0) {
+      print_ir(program);
+    }
+    if (cfg != 0) {
+      remove_unreachable_blocks(program);
+      Cfg* graph = build_cfg(program);
+      print_cfg_dot(program, graph);
+      free_cfg(graph);
+    }
+    if (ssa != 0) {
+      SsaForm* form = build_ssa(program);
+      print_ssa(form);
+      free_ssa(form);
+    }
+    free_ir_program(program);
     free_stmt_list(parse_result);
   }
 
-  if (show_symtab != 0) {
-    yyparse();
-    eval_stmt_list(parse_result);
-    print_symtab(symtab);
+  if (emit_ir_bin) {
+    IrProgram* program = read_program_ir(read_ir, &passes);
+    write_ir_bin(program, emit_ir_bin);
+    free_ir_program(program);
+    free_stmt_list(parse_result);
+  }
+
+  if (emit_asm) {
+    IrProgram* program = read_program_ir(read_ir, &passes);
+    write_asm(program, emit_asm);
+    free_ir_program(program);
+    free_stmt_list(parse_result);
+  }
+
+  if (emit_obj) {
+    IrProgram* program = read_program_ir(read_ir, &passes);
+    write_obj(program, emit_obj);
+    free_ir_program(program);
+    free_stmt_list(parse_result);
+  }
+
+  if (emit_llvm) {
+    IrProgram* program = read_program_ir(read_ir, &passes);
+    write_llvm(program, *argv, emit_llvm);
+    free_ir_program(program);
     free_stmt_list(parse_result);
-    free_symtab(symtab);
   }
 
-  if (!(tokens || ast || show_symtab || ir)) {
+  if (cc && !emit_c) {
+    fprintf(stderr, "--cc needs --emit-c\n");
+    exit(1);
+  }
+
+  if (emit_c) {
+    if (read_ir) {
+      fprintf(stderr, "C output needs a source file\n");
+      exit(1);
+    }
     yyparse();
-    eval_stmt_list(parse_result);
+    optimize_ast(parse_result, &passes);
+    write_c(parse_result, *argv, emit_c);
+    if (cc) compile_c(emit_c);
     free_stmt_list(parse_result);
+  }
+
+  if (show_symtab != 0) {
+    if (read_ir) {
+      run_ir_program(read_program_ir(true, &passes), true);
+    } else {
+      yyparse();
+      run_program(parse_result, engine, &passes, true);
+      free_stmt_list(parse_result);
+    }
     free_symtab(symtab);
   }
 
+  if (!(tokens || ast || show_symtab || ir || cfg || ssa || emit_ir_bin || emit_asm || emit_obj || emit_llvm || emit_c)) {
+    if (read_ir) {
+      run_ir_program(read_program_ir(true, &passes), false);
+    } else {
+      yyparse();
+      run_program(parse_result, engine, &passes, false);
+      free_stmt_list(parse_result);
+    }
+    free_symtab(symtab);
+  }
+
+  if (passes.time) print_pass_times(&passes);
+
   return 0;
 }
@@ -1,7 +1,11 @@
+#pragma once
+
 #include "datatype99.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct StatementList StatementList;
+typedef struct IrProgram IrProgram;
 
 extern int yylineno;
 extern void yyerror(const char *, ...);
@@ -70,13 +74,17 @@ datatype(
 datatype(
   StrExpr,
   (String, char*),
-  (StringConcat, StrExpr*, StrExpr*)
+  (StringConcat, char**, int) // The strings of a chain of +, and their count
 );
 
+typedef struct ExprTape ExprTape;
+
+// Arithmetic and boolean expressions keep the postfix tape they were
+// flattened to, see tape.h
 datatype(
   LiteralExpr,
-  (BooleanExpr, BoolExpr *),
-  (ArithmeticExpr, ArithExpr *),
+  (BooleanExpr, BoolExpr *, ExprTape *),
+  (ArithmeticExpr, ArithExpr *, ExprTape *),
   (StringExpr, StrExpr *)
 );
 
@@ -103,12 +111,17 @@ typedef StatementList ElseStatements;
 typedef Expr FromArithExpr;
 typedef Expr ToArithExpr;
 typedef struct ElseIfStatement ElseIfStatement;
+typedef struct SwitchTable SwitchTable;
 
 struct ElseIfStatement {
   Condition* condition;
   TrueStatements* true_stmts;
 
   ElseIfStatement* next;
+
+  // Set on the first else if of a chain whose conditions all compare one
+  // variable against constants, see switch.h
+  SwitchTable* switch_table;
 };
 
 datatype(
@@ -118,7 +131,8 @@ datatype(
   (AssignStmt, char*, Expr*),
   (IfStmt, Condition*, TrueStatements*, ElseIfStatement*, ElseStatements*),
   (WhileStmt, Condition*, TrueStatements*),
-  (ForStmt, char*, FromArithExpr*, ToArithExpr*, StatementList*)
+  // The last field records whether the statements mention the loop variable
+  (ForStmt, char*, FromArithExpr*, ToArithExpr*, StatementList*, bool)
 );
 
 struct StatementList {
@@ -131,7 +145,7 @@ StatementList* alloc_stmt_list();
 void add_stmt_list(StatementList** start, Stmt* stmt);
 void eval_stmt_list(StatementList* stmts);
 void print_stmt_list(StatementList* ast, int indent);
-void ir_stmt_list(StatementList* stmts);
+void ir_stmt_list(IrProgram* ir, StatementList* stmts);
 void free_stmt_list(StatementList* stmts);
 
 datatype(
@@ -144,43 +158,51 @@ datatype(
 ArithExpr* alloc_aexpr(ArithExpr ast);
 double eval_aexpr(ArithExpr* ast);
 void print_aexpr(ArithExpr* ast, int indent);
-int ir_aexpr(ArithExpr* ast);
+int ir_aexpr(IrProgram* ir, ArithExpr* ast);
 void free_aexpr(ArithExpr* ast);
 
 BoolExpr* alloc_bexpr(BoolExpr ast);
 bool eval_bexpr(BoolExpr* ast);
 void print_bexpr(BoolExpr* ast, int indent);
-int ir_bexpr(BoolExpr* ast);
+int ir_bexpr(IrProgram* ir, BoolExpr* ast);
+void ir_branch_bexpr(IrProgram* ir, BoolExpr* ast, bool when, int label);
 void free_bexpr(BoolExpr* ast);
 
 StrExpr* alloc_sexpr(StrExpr ast);
+StrExpr* alloc_concat_sexpr(StrExpr* left, StrExpr* right);
 char* eval_sexpr(StrExpr* ast);
 void print_sexpr(StrExpr* ast, int indent);
-int ir_sexpr(StrExpr* ast);
+int ir_sexpr(IrProgram* ir, StrExpr* ast);
 void free_sexpr(StrExpr* ast);
 
 LiteralExpr* alloc_literal_expr(LiteralExpr ast);
 ExprResult eval_literal_expr(LiteralExpr *);
 void print_literal_expr(LiteralExpr* ast, int indent);
-int ir_literal_expr(LiteralExpr* ast);
+int ir_literal_expr(IrProgram* ir, LiteralExpr* ast);
 void free_literal_expr(LiteralExpr* ast);
 
 IdentExpr* alloc_ident_expr(IdentExpr ast);
 ExprResult eval_ident_expr(IdentExpr *);
+ExprResult eval_binary_values(ExprResult lhs, IdentBinaryOp op, ExprResult rhs);
 void print_ident_expr(IdentExpr* ast, int indent);
-int ir_ident_expr(IdentExpr* ast);
+int ir_ident_expr(IrProgram* ir, IdentExpr* ast);
 void free_ident_expr(IdentExpr* ast);
 
 Expr* alloc_expr(Expr ast);
 ExprResult eval_expr(Expr *);
 void print_expr(Expr* ast, int indent);
-int ir_expr(Expr* ast);
+int ir_expr(IrProgram* ir, Expr* ast);
+void ir_branch(IrProgram* ir, Expr* ast, bool when, int label);
 void free_expr(Expr* ast);
 
+int64_t for_loop_start(double from);
+int64_t for_loop_trip_count(ExprResult from, ExprResult to);
+bool stmt_list_mentions(StatementList* stmts, char* name);
+
 Stmt* alloc_stmt(Stmt ast);
 void eval_stmt(Stmt* ast);
 void print_stmt(Stmt* ast, int indent);
-void ir_stmt(Stmt* ast);
+void ir_stmt(IrProgram* ir, Stmt* ast);
 void free_stmt(Stmt* ast);
 
 ElseIfStatement* alloc_else_if(Condition* cond, TrueStatements* stmts);
@@ -200,6 +222,15 @@ struct Symbol {
 };
 
 void add_symbol(SymbolTable** head, char* name, ExprResult value);
+Symbol* symbol_lookup(SymbolTable* head, char* name);
 ExprResult symbol_get(SymbolTable* head, char* name);
+void undefined_variable_error(char* name);
 void free_symtab(SymbolTable* head);
 void print_symtab(SymbolTable* head);
+
+void print_result(ExprResult result);
+char* concat_str(char* left, char* right);
+char* concat_strs(char* head, char** pieces, int count);
+void runtime_error(const char *s, ...);
+void ensure_non_null(void *ptr, char *msg);
+void unreachable(const char *func_name);
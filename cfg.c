@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+
+/* ----------------------------- Construction ----------------------------- */
+
+static void add_edge(Cfg* cfg, int from, int to) {
+  BasicBlock* src = &cfg->blocks[from];
+  BasicBlock* dst = &cfg->blocks[to];
+
+  for (int i = 0; i < src->succ_count; i++) {
+    if (src->succs[i] == to) return;
+  }
+  src->succs[src->succ_count++] = to;
+
+  if (dst->pred_count == dst->pred_cap) {
+    dst->pred_cap = dst->pred_cap ? dst->pred_cap * 2 : 4;
+    dst->preds = realloc(dst->preds, dst->pred_cap * sizeof(int));
+    ensure_non_null(dst->preds, "out of space");
+  }
+  dst->preds[dst->pred_count++] = from;
+}
+
+// Computes the reverse post-order of the blocks reachable from the entry,
+// with an explicit stack so that long programs do not overflow the C stack.
+static void compute_rpo(Cfg* cfg) {
+  int n = cfg->block_count;
+  cfg->rpo = malloc((n + 1) * sizeof(int));
+  int* stack = malloc((n + 1) * sizeof(int));
+  int* next_succ = calloc(n + 1, sizeof(int));
+  ensure_non_null(cfg->rpo, "out of space");
+  ensure_non_null(stack, "out of space");
+  ensure_non_null(next_succ, "out of space");
+
+  int post_count = 0;
+  int top = 0;
+  if (n > 0) {
+    stack[top++] = 0;
+    cfg->blocks[0].reachable = true;
+  }
+
+  while (top > 0) {
+    BasicBlock* block = &cfg->blocks[stack[top - 1]];
+    if (next_succ[block->id] < block->succ_count) {
+      int succ = block->succs[next_succ[block->id]++];
+      if (!cfg->blocks[succ].reachable) {
+        cfg->blocks[succ].reachable = true;
+        stack[top++] = succ;
+      }
+    } else {
+      // Post-order is filled from the back, giving reverse post-order
+      cfg->rpo[n - 1 - post_count++] = block->id;
+      top--;
+    }
+  }
+
+  memmove(cfg->rpo, cfg->rpo + n - post_count, post_count * sizeof(int));
+  cfg->rpo_count = post_count;
+
+  free(next_succ);
+  free(stack);
+}
+
+Cfg* build_cfg(IrProgram* ir) {
+  Cfg* cfg = calloc(1, sizeof(Cfg));
+  ensure_non_null(cfg, "out of space");
+
+  cfg->label_count = ir->label_count;
+  cfg->label_block = malloc((ir->label_count + 1) * sizeof(int));
+  cfg->instr_block = malloc((ir->len + 1) * sizeof(int));
+  cfg->blocks = calloc(ir->len + 1, sizeof(BasicBlock));
+  ensure_non_null(cfg->label_block, "out of space");
+  ensure_non_null(cfg->instr_block, "out of space");
+  ensure_non_null(cfg->blocks, "out of space");
+
+  for (int i = 0; i < ir->label_count; i++) cfg->label_block[i] = -1;
+
+  // Split the program at leaders: labels and instructions following a branch
+  for (int i = 0; i < ir->len; i++) {
+    IrOpcode op = ir->instrs[i].op;
+    bool leader = i == 0 || op == IR_LABEL || ir_is_branch(ir->instrs[i - 1].op);
+
+    if (leader) {
+      if (cfg->block_count > 0) cfg->blocks[cfg->block_count - 1].end = i;
+      BasicBlock* block = &cfg->blocks[cfg->block_count];
+      block->id = cfg->block_count++;
+      block->start = i;
+    }
+
+    cfg->instr_block[i] = cfg->block_count - 1;
+    if (op == IR_LABEL) cfg->label_block[ir->instrs[i].label] = cfg->block_count - 1;
+  }
+  if (cfg->block_count > 0) cfg->blocks[cfg->block_count - 1].end = ir->len;
+
+  for (int b = 0; b < cfg->block_count; b++) {
+    BasicBlock* block = &cfg->blocks[b];
+    IrInstr* last = &ir->instrs[block->end - 1];
+    bool has_next = b + 1 < cfg->block_count;
+
+    switch (last->op) {
+      case IR_GOTO:
+        add_edge(cfg, b, cfg->label_block[last->label]);
+        break;
+      case IR_IF:
+      case IR_IF_CMP:
+      case IR_IF_NOT:
+      case IR_IF_NOT_CMP:
+        // The fall through edge is always the first successor
+        if (has_next) add_edge(cfg, b, b + 1);
+        add_edge(cfg, b, cfg->label_block[last->label]);
+        break;
+      default:
+        if (has_next) add_edge(cfg, b, b + 1);
+        break;
+    }
+  }
+
+  compute_rpo(cfg);
+  return cfg;
+}
+
+void free_cfg(Cfg* cfg) {
+  for (int i = 0; i < cfg->block_count; i++) free(cfg->blocks[i].preds);
+  free(cfg->blocks);
+  free(cfg->rpo);
+  free(cfg->label_block);
+  free(cfg->instr_block);
+  free(cfg->idom);
+  free(cfg);
+}
+
+/* ----------------------------- Dominators ----------------------------- */
+
+// Iterative dominator computation from Cooper, Harvey and Kennedy's
+// "A Simple, Fast Dominance Algorithm", walking blocks in reverse post-order.
+void compute_dominators(Cfg* cfg) {
+  if (cfg->idom) return;
+
+  int n = cfg->block_count;
+  int* order = malloc((n + 1) * sizeof(int));
+  cfg->idom = malloc((n + 1) * sizeof(int));
+  ensure_non_null(order, "out of space");
+  ensure_non_null(cfg->idom, "out of space");
+
+  for (int b = 0; b < n; b++) {
+    cfg->idom[b] = -1;
+    order[b] = -1;
+  }
+  for (int i = 0; i < cfg->rpo_count; i++) order[cfg->rpo[i]] = i;
+  if (n > 0) cfg->idom[0] = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (int i = 1; i < cfg->rpo_count; i++) {
+      BasicBlock* block = &cfg->blocks[cfg->rpo[i]];
+      int new_idom = -1;
+
+      for (int p = 0; p < block->pred_count; p++) {
+        int pred = block->preds[p];
+        if (cfg->idom[pred] == -1) continue;
+        if (new_idom == -1) {
+          new_idom = pred;
+          continue;
+        }
+
+        int a = pred, b = new_idom;
+        while (a != b) {
+          while (order[a] > order[b]) a = cfg->idom[a];
+          while (order[b] > order[a]) b = cfg->idom[b];
+        }
+        new_idom = a;
+      }
+
+      if (cfg->idom[block->id] != new_idom) {
+        cfg->idom[block->id] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  free(order);
+}
+
+// Whether block `a` dominates block `b`
+bool dominates(Cfg* cfg, int a, int b) {
+  compute_dominators(cfg);
+  if (cfg->idom[b] == -1) return false;
+
+  while (b != a) {
+    if (b == 0) return false;
+    b = cfg->idom[b];
+  }
+  return true;
+}
+
+/* ---------------------------- Assignments ---------------------------- */
+
+// Variables assigned on every path from the entry to the start of each
+// block, as var_count flags per block, by forward data flow over the blocks
+// in reverse post-order:
+//   in(b) = intersection of out(p) over the predecessors p of b
+//   out(b) = in(b) | assigned in b
+bool* assigned_on_entry(IrProgram* ir, Cfg* cfg) {
+  size_t vars = ir->var_count;
+  bool* in = malloc(cfg->block_count * vars + 1);
+  bool* out = malloc(cfg->block_count * vars + 1);
+  ensure_non_null(in, "out of space");
+  ensure_non_null(out, "out of space");
+
+  // Nothing is assigned on entry to the program, or to unreachable blocks
+  for (int b = 0; b < cfg->block_count; b++) {
+    memset(&in[b * vars], b != 0 && cfg->blocks[b].reachable, vars);
+    memset(&out[b * vars], cfg->blocks[b].reachable, vars);
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int r = 0; r < cfg->rpo_count; r++) {
+      int b = cfg->rpo[r];
+      BasicBlock* block = &cfg->blocks[b];
+      bool* block_in = &in[b * vars];
+      bool* block_out = &out[b * vars];
+
+      for (int p = 0; p < block->pred_count; p++) {
+        bool* pred_out = &out[block->preds[p] * vars];
+        for (size_t v = 0; v < vars; v++) block_in[v] &= pred_out[v];
+      }
+
+      for (size_t v = 0; v < vars; v++) {
+        bool assigned = block_in[v];
+        for (int i = block->start; i < block->end && !assigned; i++) {
+          ifLet(ir->instrs[i].dest, IrVar, var) assigned = (size_t)*var == v;
+        }
+        changed |= assigned != block_out[v];
+        block_out[v] = assigned;
+      }
+    }
+  }
+
+  free(out);
+  return in;
+}
+
+/* ----------------------------- Cleanup ----------------------------- */
+
+// Deletes the instructions of blocks that cannot be reached from the entry.
+// Returns the number of instructions removed.
+int remove_unreachable_blocks(IrProgram* ir) {
+  Cfg* cfg = build_cfg(ir);
+  bool* remove = calloc(ir->len + 1, sizeof(bool));
+  ensure_non_null(remove, "out of space");
+
+  for (int b = 0; b < cfg->block_count; b++) {
+    BasicBlock* block = &cfg->blocks[b];
+    if (block->reachable) continue;
+    for (int i = block->start; i < block->end; i++) remove[i] = true;
+  }
+
+  int removed = ir_discard_marked(ir, remove);
+  free(remove);
+  free_cfg(cfg);
+  return removed;
+}
+
+/* ----------------------------- Printing ----------------------------- */
+
+static void print_dot_escaped(const char* str) {
+  for (; *str; str++) {
+    switch (*str) {
+      case '"': printf("\\\""); break;
+      case '\\': printf("\\\\"); break;
+      case '\t': printf("\\t"); break;
+      default: putchar(*str);
+    }
+  }
+}
+
+// Prints the graph in graphviz dot format. Each node lists the instructions
+// of its block, and conditional edges are labelled with the branch outcome.
+void print_cfg_dot(IrProgram* ir, Cfg* cfg) {
+  printf("digraph cfg {\n");
+  printf("  node [shape=box, fontname=monospace];\n");
+  printf("  entry [shape=oval];\n");
+  printf("  exit [shape=oval];\n");
+  if (cfg->block_count > 0) printf("  entry -> B0;\n");
+  else printf("  entry -> exit;\n");
+
+  for (int b = 0; b < cfg->block_count; b++) {
+    BasicBlock* block = &cfg->blocks[b];
+    printf("  B%d [label=\"B%d\\l", b, b);
+    for (int i = block->start; i < block->end; i++) {
+      char* text = NULL;
+      size_t size = 0;
+      FILE* out = open_memstream(&text, &size);
+      fprint_ir_instr(out, ir, &ir->instrs[i]);
+      fclose(out);
+
+      printf("  ");
+      print_dot_escaped(text);
+      printf("\\l");
+      free(text);
+    }
+    printf("\"%s];\n", block->reachable ? "" : ", style=dashed");
+  }
+
+  for (int b = 0; b < cfg->block_count; b++) {
+    BasicBlock* block = &cfg->blocks[b];
+    IrOpcode last = ir->instrs[block->end - 1].op;
+    bool conditional = ir_is_cond_branch(last);
+
+    for (int s = 0; s < block->succ_count; s++) {
+      printf("  B%d -> B%d", b, block->succs[s]);
+      if (conditional && block->succ_count == 2) {
+        bool taken = s == 1;
+        printf(" [label=\"%s\"]", taken != ir_is_negated_branch(last) ? "true" : "false");
+      }
+      printf(";\n");
+    }
+    if (block->succ_count == 0 || (b + 1 == cfg->block_count && conditional)) {
+      printf("  B%d -> exit;\n", b);
+    }
+  }
+
+  printf("}\n");
+}
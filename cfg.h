@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ir.h"
+
+/*
+ * Control flow graph over the IR.
+ *
+ * A basic block is a maximal run of instructions [start, end) of the IR that
+ * is only entered at its first instruction (a label, or the instruction after
+ * a branch) and only left at its last one. Block 0 is the entry block.
+ */
+
+typedef struct {
+  int id;
+  int start;
+  int end;
+
+  int succs[2];
+  int succ_count;
+
+  int* preds;
+  int pred_count;
+  int pred_cap;
+
+  bool reachable;
+} BasicBlock;
+
+typedef struct {
+  BasicBlock* blocks;
+  int block_count;
+
+  // Reachable blocks in reverse post-order, starting with the entry block
+  int* rpo;
+  int rpo_count;
+
+  // Block that each label starts, -1 for labels that are not in the program
+  int* label_block;
+  int label_count;
+
+  // Block that contains each instruction of the IR
+  int* instr_block;
+
+  // Immediate dominator of each block, filled in by compute_dominators. The
+  // entry block is its own immediate dominator, unreachable blocks have -1.
+  int* idom;
+} Cfg;
+
+Cfg* build_cfg(IrProgram* ir);
+void free_cfg(Cfg* cfg);
+
+void compute_dominators(Cfg* cfg);
+bool dominates(Cfg* cfg, int a, int b);
+bool* assigned_on_entry(IrProgram* ir, Cfg* cfg);
+int remove_unreachable_blocks(IrProgram* ir);
+void print_cfg_dot(IrProgram* ir, Cfg* cfg);
@@ -0,0 +1,894 @@
+#include <math.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "ast.h"
+#include "cgen.h"
+#include "ir.h"
+#include "runtime.h"
+#include "datatype99.h"
+
+extern char** environ;
+
+/*
+ * C backend.
+ *
+ * Translates the syntax tree to a C translation unit defining the
+ * pseudo_main of the runtime library in runtime.c. Statements become C
+ * control flow, and every variable becomes a local of pseudo_main. A
+ * variable that is only ever given values of one type is a double, bool or
+ * string local. The others are PseudoValues, the tagged values of the
+ * runtime library, as are the operands of any operation that is not known
+ * to succeed, which the runtime then does or fails the way the interpreter
+ * would.
+ *
+ * Reading a variable before anything is assigned to it is an error. Reads
+ * that can happen before an assignment on some path are checked, through a
+ * flag for typed locals, or the undefined tag of PseudoValues.
+ */
+
+typedef struct {
+  char* text;
+  IrType type;  // IR_TYPE_ANY for PseudoValue expressions
+} CExpr;
+
+typedef struct {
+  FILE* out;
+  int indent;
+  int loop_depth;
+
+  char** vars;
+  int var_count;
+  IrType* types;     // Type of the values of every variable
+  bool* flagged;     // Typed locals with a flag telling whether they are assigned
+  bool* assigned;    // Variables assigned on every path to the current statement
+} CGen;
+
+static char* format(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+
+  char* text = malloc(len + 1);
+  ensure_non_null(text, "out of space");
+  va_start(ap, fmt);
+  vsnprintf(text, len + 1, fmt, ap);
+  va_end(ap);
+  return text;
+}
+
+static void line(CGen* g, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(g->out, "%*s", g->indent * 2, "");
+  vfprintf(g->out, fmt, ap);
+  fputc('\n', g->out);
+  va_end(ap);
+}
+
+/* ----------------------------- Variables ----------------------------- */
+
+static int var_index(CGen* g, char* name) {
+  for (int v = 0; v < g->var_count; v++) {
+    if (strcmp(g->vars[v], name) == 0) return v;
+  }
+
+  g->vars = realloc(g->vars, (g->var_count + 1) * sizeof(char*));
+  ensure_non_null(g->vars, "out of space");
+  g->vars[g->var_count] = name;
+  return g->var_count++;
+}
+
+// Variable read by an expression, or NULL. The grammar only lets an
+// expression mention one variable.
+static char* expr_var(Expr* expr) {
+  ifLet(*expr, IdentExpression, iexpr) {
+    match (**iexpr) {
+      of(IdentBinaryExpr, ident, _, _) return *ident;
+      of(IdentUnaryExpr, _, ident) return *ident;
+      of(Identifier, ident) return *ident;
+    }
+  }
+  return NULL;
+}
+
+static void collect_vars(CGen* g, StatementList* stmts) {
+  for (StatementList* curr = stmts; curr; curr = curr->next) {
+    match (*curr->value) {
+      of(DisplayStmt, expr) if (expr_var(*expr)) var_index(g, expr_var(*expr));
+      of(ExprStmt, expr) if (expr_var(*expr)) var_index(g, expr_var(*expr));
+      of(AssignStmt, ident, value) {
+        if (expr_var(*value)) var_index(g, expr_var(*value));
+        var_index(g, *ident);
+      }
+      of(IfStmt, condition, true_stmts, else_if, else_stmts) {
+        if (expr_var(*condition)) var_index(g, expr_var(*condition));
+        collect_vars(g, *true_stmts);
+        for (ElseIfStatement* e = *else_if; e; e = e->next) {
+          if (expr_var(e->condition)) var_index(g, expr_var(e->condition));
+          collect_vars(g, e->true_stmts);
+        }
+        collect_vars(g, *else_stmts);
+      }
+      of(WhileStmt, condition, true_stmts) {
+        if (expr_var(*condition)) var_index(g, expr_var(*condition));
+        collect_vars(g, *true_stmts);
+      }
+      of(ForStmt, ident, from, to, body) {
+        if (expr_var(*from)) var_index(g, expr_var(*from));
+        if (expr_var(*to)) var_index(g, expr_var(*to));
+        var_index(g, *ident);
+        collect_vars(g, *body);
+      }
+    }
+  }
+}
+
+/* ------------------------------- Types ------------------------------- */
+
+static IrType join(IrType a, IrType b) {
+  if (a == IR_TYPE_NONE) return b;
+  if (b == IR_TYPE_NONE || a == b) return a;
+  return IR_TYPE_ANY;
+}
+
+static IrType literal_type(LiteralExpr* expr) {
+  match (*expr) {
+    of(BooleanExpr, _) return IR_TYPE_BOOLEAN;
+    of(ArithmeticExpr, _) return IR_TYPE_NUMBER;
+    of(StringExpr, _) return IR_TYPE_STRING;
+  }
+  return IR_TYPE_ANY;
+}
+
+// Type of the values an expression evaluates to when it does not fail, or
+// IR_TYPE_NONE when it always fails
+static IrType expr_type(CGen* g, Expr* expr) {
+  ifLet(*expr, LiteralExpression, lexpr) return literal_type(*lexpr);
+
+  IdentExpr* iexpr = expr->data.IdentExpression._0;
+  match (*iexpr) {
+    of(IdentBinaryExpr, _, op, rhs) {
+      switch (*op) {
+        case IdentBOp_Plus: {
+          // Only numbers and strings can be added, to a value of their type
+          IrType type = literal_type(*rhs);
+          return type == IR_TYPE_BOOLEAN ? IR_TYPE_NONE : type;
+        }
+        case IdentBOp_Minus: case IdentBOp_Star: case IdentBOp_Slash:
+          return IR_TYPE_NUMBER;
+        default:
+          return IR_TYPE_BOOLEAN;
+      }
+    }
+    of(IdentUnaryExpr, op, _) return *op == IdentUOp_Minus ? IR_TYPE_NUMBER : IR_TYPE_BOOLEAN;
+    of(Identifier, ident) return g->types[var_index(g, *ident)];
+  }
+  return IR_TYPE_ANY;
+}
+
+static bool infer_types(CGen* g, StatementList* stmts) {
+  bool changed = false;
+  for (StatementList* curr = stmts; curr; curr = curr->next) {
+    match (*curr->value) {
+      of(AssignStmt, ident, value) {
+        int v = var_index(g, *ident);
+        IrType type = join(g->types[v], expr_type(g, *value));
+        changed |= type != g->types[v];
+        g->types[v] = type;
+      }
+      of(IfStmt, _, true_stmts, else_if, else_stmts) {
+        changed |= infer_types(g, *true_stmts);
+        for (ElseIfStatement* e = *else_if; e; e = e->next) changed |= infer_types(g, e->true_stmts);
+        changed |= infer_types(g, *else_stmts);
+      }
+      of(WhileStmt, _, true_stmts) changed |= infer_types(g, *true_stmts);
+      of(ForStmt, ident, _, _, body) {
+        int v = var_index(g, *ident);
+        IrType type = join(g->types[v], IR_TYPE_NUMBER);
+        changed |= type != g->types[v];
+        g->types[v] = type;
+        changed |= infer_types(g, *body);
+      }
+      otherwise {}
+    }
+  }
+  return changed;
+}
+
+// Whether a variable is a typed C local rather than a PseudoValue
+static bool is_typed(CGen* g, int v) {
+  return g->types[v] != IR_TYPE_NONE && g->types[v] != IR_TYPE_ANY;
+}
+
+/* ------------------------- Definite assignment ------------------------- */
+
+// The statements below track the variables assigned on every path to each
+// statement in g->assigned: a branch only assigns what all its arms assign,
+// and a loop body may not run at all.
+
+static bool* save_assigned(CGen* g) {
+  bool* saved = malloc(g->var_count + 1);
+  ensure_non_null(saved, "out of space");
+  memcpy(saved, g->assigned, g->var_count);
+  return saved;
+}
+
+// Intersects the assigned variables of an arm that ended with `g->assigned`
+// into `joined`, and starts the next arm from `entry`
+static void join_arm(CGen* g, bool* joined, bool* entry) {
+  for (int v = 0; v < g->var_count; v++) joined[v] &= g->assigned[v];
+  memcpy(g->assigned, entry, g->var_count);
+}
+
+static void mark_unassigned_read(CGen* g, Expr* expr) {
+  char* name = expr_var(expr);
+  if (!name) return;
+  int v = var_index(g, name);
+  if (!g->assigned[v] && is_typed(g, v)) g->flagged[v] = true;
+}
+
+// Finds the typed locals read where they may not be assigned, which need a
+// flag to check
+static void find_flagged(CGen* g, StatementList* stmts) {
+  for (StatementList* curr = stmts; curr; curr = curr->next) {
+    match (*curr->value) {
+      of(DisplayStmt, expr) mark_unassigned_read(g, *expr);
+      of(ExprStmt, expr) mark_unassigned_read(g, *expr);
+      of(AssignStmt, ident, value) {
+        mark_unassigned_read(g, *value);
+        g->assigned[var_index(g, *ident)] = true;
+      }
+      of(IfStmt, condition, true_stmts, else_if, else_stmts) {
+        bool* entry = save_assigned(g);
+        bool* joined = save_assigned(g);
+        mark_unassigned_read(g, *condition);
+        find_flagged(g, *true_stmts);
+        join_arm(g, joined, entry);
+        for (ElseIfStatement* e = *else_if; e; e = e->next) {
+          mark_unassigned_read(g, e->condition);
+          find_flagged(g, e->true_stmts);
+          join_arm(g, joined, entry);
+        }
+        if (*else_stmts) {
+          find_flagged(g, *else_stmts);
+          for (int v = 0; v < g->var_count; v++) joined[v] &= g->assigned[v];
+          memcpy(g->assigned, joined, g->var_count);
+        }
+        free(joined);
+        free(entry);
+      }
+      of(WhileStmt, condition, true_stmts) {
+        bool* entry = save_assigned(g);
+        mark_unassigned_read(g, *condition);
+        find_flagged(g, *true_stmts);
+        memcpy(g->assigned, entry, g->var_count);
+        free(entry);
+      }
+      of(ForStmt, ident, from, to, body) {
+        bool* entry = save_assigned(g);
+        mark_unassigned_read(g, *from);
+        mark_unassigned_read(g, *to);
+        g->assigned[var_index(g, *ident)] = true;
+        find_flagged(g, *body);
+        memcpy(g->assigned, entry, g->var_count);
+        free(entry);
+      }
+    }
+  }
+}
+
+/* ----------------------------- Expressions ----------------------------- */
+
+static CExpr cexpr(IrType type, char* text) {
+  return (CExpr){ .text = text, .type = type };
+}
+
+static char* number_literal(double number) {
+  if (isnan(number)) return format("NAN");
+  if (isinf(number)) return format(number < 0 ? "-INFINITY" : "INFINITY");
+
+  // The shortest form that reads back as the same number, as a double
+  char buffer[32];
+  for (int precision = 15; precision <= 17; precision++) {
+    snprintf(buffer, sizeof(buffer), "%.*g", precision, number);
+    if (strtod(buffer, NULL) == number) break;
+  }
+  bool is_double = strpbrk(buffer, ".e") != NULL;
+  return format("%s%s", buffer, is_double ? "" : ".0");
+}
+
+static void append_escaped(char** text, const char* str) {
+  char* escaped = malloc(strlen(str) * 4 + 1);
+  ensure_non_null(escaped, "out of space");
+  char* end = escaped;
+  for (const unsigned char* c = (const unsigned char*)str; *c; c++) {
+    switch (*c) {
+      case '"': case '\\': case '?': end += sprintf(end, "\\%c", *c); break;
+      case '\n': end += sprintf(end, "\\n"); break;
+      case '\t': end += sprintf(end, "\\t"); break;
+      default:
+        if (*c < ' ' || *c >= 0x7f) end += sprintf(end, "\\%03o", *c);
+        else *end++ = *c;
+    }
+  }
+  *end = '\0';
+
+  char* joined = format("%s%s\"%s\"", *text, **text ? " " : "", escaped);
+  free(escaped);
+  free(*text);
+  *text = joined;
+}
+
+static char* aexpr_text(ArithExpr* expr) {
+  match (*expr) {
+    of(BinaryAExpr, left, op, right) {
+      char* l = aexpr_text(*left);
+      char* r = aexpr_text(*right);
+      const char* symbols[] = { "+", "-", "*", "/" };
+      char* text = format("(%s %s %s)", l, symbols[*op], r);
+      free(l);
+      free(r);
+      return text;
+    }
+    of(UnaryAExpr, _, right) {
+      char* r = aexpr_text(*right);
+      char* text = format("(-%s)", r);
+      free(r);
+      return text;
+    }
+    of(Number, number) return number_literal(*number);
+  }
+  return NULL;
+}
+
+static char* bexpr_text(BoolExpr* expr) {
+  match (*expr) {
+    of(RelationalArithExpr, left, relop, right) {
+      char* l = aexpr_text(*left);
+      char* r = aexpr_text(*right);
+      const char* symbols[] = { "==", ">", ">=", "<", "<=" };
+      char* text = format("(%s %s %s)", l, symbols[*relop], r);
+      free(l);
+      free(r);
+      return text;
+    }
+    of(LogicalBoolExpr, left, logicalop, right) {
+      char* l = bexpr_text(*left);
+      char* r = bexpr_text(*right);
+      const char* symbols[] = { "&&", "||", "==" };
+      char* text = format("(%s %s %s)", l, symbols[*logicalop], r);
+      free(l);
+      free(r);
+      return text;
+    }
+    of(NegatedBoolExpr, bexpr) {
+      char* b = bexpr_text(*bexpr);
+      char* text = format("(!%s)", b);
+      free(b);
+      return text;
+    }
+    of(Boolean, boolean) return format(*boolean ? "true" : "false");
+  }
+  return NULL;
+}
+
+static CExpr literal_cexpr(LiteralExpr* expr) {
+  match (*expr) {
+    of(BooleanExpr, bexpr) return cexpr(IR_TYPE_BOOLEAN, bexpr_text(*bexpr));
+    of(ArithmeticExpr, aexpr) return cexpr(IR_TYPE_NUMBER, aexpr_text(*aexpr));
+    of(StringExpr, sexpr) {
+      // Concatenated pieces are adjacent C string literals
+      char* text = format("");
+      match (**sexpr) {
+        of(String, str) append_escaped(&text, *str);
+        of(StringConcat, pieces, count) {
+          for (int i = 0; i < *count; i++) append_escaped(&text, (*pieces)[i]);
+        }
+      }
+      return cexpr(IR_TYPE_STRING, text);
+    }
+  }
+  return cexpr(IR_TYPE_ANY, NULL);
+}
+
+static CExpr box(CExpr expr) {
+  const char* constructor = NULL;
+  switch (expr.type) {
+    case IR_TYPE_BOOLEAN: constructor = "boolean_value"; break;
+    case IR_TYPE_NUMBER: constructor = "number_value"; break;
+    case IR_TYPE_STRING: constructor = "string_value"; break;
+    default: return expr;
+  }
+
+  char* text = format("%s(%s)", constructor, expr.text);
+  free(expr.text);
+  return cexpr(IR_TYPE_ANY, text);
+}
+
+// Converts a PseudoValue that can only be of type `type` to a typed value
+static CExpr unbox(CExpr expr, IrType type) {
+  const char* field = NULL;
+  switch (type) {
+    case IR_TYPE_BOOLEAN: field = "boolean"; break;
+    case IR_TYPE_NUMBER: field = "number"; break;
+    case IR_TYPE_STRING: field = "string"; break;
+    default: return expr;
+  }
+  if (expr.type != IR_TYPE_ANY) return expr;
+
+  char* text = format("%s.%s", expr.text, field);
+  free(expr.text);
+  return cexpr(type, text);
+}
+
+static const char* pseudo_op_name(IdentBinaryOp op) {
+  switch (op) {
+    case IdentBOp_Plus: return "PSEUDO_ADD";
+    case IdentBOp_Minus: return "PSEUDO_SUB";
+    case IdentBOp_Star: return "PSEUDO_MUL";
+    case IdentBOp_Slash: return "PSEUDO_DIV";
+    case IdentBOp_Gt: return "PSEUDO_GT";
+    case IdentBOp_Gte: return "PSEUDO_GTE";
+    case IdentBOp_Lt: return "PSEUDO_LT";
+    case IdentBOp_Lte: return "PSEUDO_LTE";
+    case IdentBOp_EqEq: return "PSEUDO_EQ";
+    case IdentBOp_And: return "PSEUDO_AND";
+    case IdentBOp_Or: return "PSEUDO_OR";
+  }
+  return NULL;
+}
+
+static CExpr binary_cexpr(CGen* g, char* ident, IdentBinaryOp op, LiteralExpr* rhs) {
+  int v = var_index(g, ident);
+  CExpr l = cexpr(g->types[v], format("v_%s", ident));
+  CExpr r = literal_cexpr(rhs);
+  char* text = NULL;
+
+  // Operations on operands of the types they need are done in C
+  bool numbers = l.type == IR_TYPE_NUMBER && r.type == IR_TYPE_NUMBER;
+  bool booleans = l.type == IR_TYPE_BOOLEAN && r.type == IR_TYPE_BOOLEAN;
+  bool strings = l.type == IR_TYPE_STRING && r.type == IR_TYPE_STRING;
+  const char* symbols[] = { "+", "-", "*", "/", ">", ">=", "<", "<=", "==", "&&", "||" };
+  switch (op) {
+    case IdentBOp_Plus:
+      if (numbers) text = format("(%s + %s)", l.text, r.text);
+      if (strings) text = format("pseudo_concat(%s, %s)", l.text, r.text);
+      break;
+    case IdentBOp_Minus: case IdentBOp_Star: case IdentBOp_Slash:
+    case IdentBOp_Gt: case IdentBOp_Gte: case IdentBOp_Lt: case IdentBOp_Lte:
+      if (numbers) text = format("(%s %s %s)", l.text, symbols[op], r.text);
+      break;
+    case IdentBOp_EqEq:
+      if (numbers || booleans) text = format("(%s == %s)", l.text, r.text);
+      if (strings) text = format("pseudo_streq(%s, %s)", l.text, r.text);
+      // Values of different types are never equal
+      if (l.type != IR_TYPE_ANY && l.type != r.type) text = format("false");
+      break;
+    case IdentBOp_And: case IdentBOp_Or:
+      if (booleans) text = format("(%s %s %s)", l.text, symbols[op], r.text);
+      break;
+  }
+
+  IrType type = op == IdentBOp_Plus ? r.type
+    : op == IdentBOp_Minus || op == IdentBOp_Star || op == IdentBOp_Slash ? IR_TYPE_NUMBER
+    : IR_TYPE_BOOLEAN;
+  if (text) {
+    free(l.text);
+    free(r.text);
+    return cexpr(type, text);
+  }
+
+  // Anything else is left to the runtime, which fails where it has to
+  l = box(l);
+  r = box(r);
+  text = format("binary(%s, %s, %s)", pseudo_op_name(op), l.text, r.text);
+  free(l.text);
+  free(r.text);
+  return cexpr(IR_TYPE_ANY, text);
+}
+
+static CExpr expr_cexpr(CGen* g, Expr* expr) {
+  ifLet(*expr, LiteralExpression, lexpr) return literal_cexpr(*lexpr);
+
+  IdentExpr* iexpr = expr->data.IdentExpression._0;
+  match (*iexpr) {
+    of(IdentBinaryExpr, ident, op, rhs) return binary_cexpr(g, *ident, *op, *rhs);
+    of(IdentUnaryExpr, op, ident) {
+      IrType type = g->types[var_index(g, *ident)];
+      bool minus = *op == IdentUOp_Minus;
+      if (type == (minus ? IR_TYPE_NUMBER : IR_TYPE_BOOLEAN)) {
+        return cexpr(type, format("(%sv_%s)", minus ? "-" : "!", *ident));
+      }
+
+      CExpr operand = box(cexpr(type, format("v_%s", *ident)));
+      char* text = format("unary(%s, %s)", minus ? "PSEUDO_NEG" : "PSEUDO_NOT", operand.text);
+      free(operand.text);
+      return cexpr(IR_TYPE_ANY, text);
+    }
+    of(Identifier, ident) return cexpr(g->types[var_index(g, *ident)], format("v_%s", *ident));
+  }
+  return cexpr(IR_TYPE_ANY, NULL);
+}
+
+// Expression converted to `type`, when it evaluates to a value of that type
+static CExpr typed_cexpr(CGen* g, Expr* expr, IrType type) {
+  CExpr value = expr_cexpr(g, expr);
+  if (type == IR_TYPE_ANY) return box(value);
+  return unbox(value, type);
+}
+
+/* ----------------------------- Statements ----------------------------- */
+
+// Drops the parentheses around a whole expression, where it is not an operand
+static char* bare(char* text) {
+  size_t len = strlen(text);
+  if (len < 2 || text[0] != '(' || text[len - 1] != ')') return text;
+
+  int depth = 0;
+  for (size_t i = 0; i < len - 1; i++) {
+    if (text[i] == '"') {
+      for (i++; text[i] != '"'; i++) if (text[i] == '\\') i++;
+    } else if (text[i] == '(') {
+      depth++;
+    } else if (text[i] == ')' && --depth == 0) {
+      return text;
+    }
+  }
+
+  memmove(text, text + 1, len - 2);
+  text[len - 2] = '\0';
+  return text;
+}
+
+static void emit_stmt_list(CGen* g, StatementList* stmts);
+
+// Checks that the variable an expression reads has been assigned, unless it
+// has on every path to it
+static void emit_defined_check(CGen* g, Expr* expr) {
+  char* name = expr_var(expr);
+  if (!name) return;
+  int v = var_index(g, name);
+  if (g->assigned[v]) return;
+
+  if (is_typed(g, v)) line(g, "if (!v_%s_set) pseudo_undefined(\"%s\");", name, name);
+  else line(g, "if (v_%s.tag == PSEUDO_UNDEFINED) pseudo_undefined(\"%s\");", name, name);
+}
+
+static char* condition_text(CGen* g, Expr* expr) {
+  CExpr value = expr_cexpr(g, expr);
+  if (value.type == IR_TYPE_BOOLEAN) return bare(value.text);
+
+  // The runtime fails on anything but a boolean
+  value = box(value);
+  char* text = format("condition(%s)", value.text);
+  free(value.text);
+  return text;
+}
+
+static void emit_assign(CGen* g, int v, CExpr value) {
+  char* name = g->vars[v];
+  if (value.type == IR_TYPE_NONE) {
+    line(g, "(void)%s;", value.text);
+  } else {
+    line(g, "v_%s = %s;", name, bare(value.text));
+    if (g->flagged[v]) line(g, "v_%s_set = true;", name);
+  }
+  g->assigned[v] = true;
+  free(value.text);
+}
+
+static void emit_display(CGen* g, Expr* expr) {
+  CExpr value = expr_cexpr(g, expr);
+  value = unbox(value, expr_type(g, expr));
+  bare(value.text);
+  switch (value.type) {
+    case IR_TYPE_BOOLEAN: line(g, "pseudo_display_boolean(%s);", value.text); break;
+    case IR_TYPE_NUMBER: line(g, "pseudo_display_number(%s);", value.text); break;
+    case IR_TYPE_STRING: line(g, "pseudo_display_string(%s);", value.text); break;
+    default: line(g, "display(%s);", value.text); break;
+  }
+  free(value.text);
+}
+
+static void emit_block(CGen* g, StatementList* stmts) {
+  g->indent++;
+  emit_stmt_list(g, stmts);
+  g->indent--;
+}
+
+// Emits the else if arms, the ones after the first that needs its variable
+// checked nested in an else block
+static void emit_else_if(CGen* g, ElseIfStatement* else_if, ElseStatements* else_stmts, bool* joined, bool* entry) {
+  for (ElseIfStatement* e = else_if; e; e = e->next) {
+    char* name = expr_var(e->condition);
+    if (name && !g->assigned[var_index(g, name)]) {
+      line(g, "} else {");
+      g->indent++;
+      emit_defined_check(g, e->condition);
+      char* cond = condition_text(g, e->condition);
+      line(g, "if (%s) {", cond);
+      free(cond);
+      emit_block(g, e->true_stmts);
+      join_arm(g, joined, entry);
+      emit_else_if(g, e->next, else_stmts, joined, entry);
+      line(g, "}");
+      g->indent--;
+      return;
+    }
+
+    char* cond = condition_text(g, e->condition);
+    line(g, "} else if (%s) {", cond);
+    free(cond);
+    emit_block(g, e->true_stmts);
+    join_arm(g, joined, entry);
+  }
+
+  if (else_stmts) {
+    line(g, "} else {");
+    emit_block(g, else_stmts);
+    for (int v = 0; v < g->var_count; v++) joined[v] &= g->assigned[v];
+  }
+}
+
+static void emit_for(CGen* g, char* ident, Expr* from, Expr* to, StatementList* body) {
+  int v = var_index(g, ident);
+  int depth = ++g->loop_depth;
+  CExpr from_value = typed_cexpr(g, from, IR_TYPE_ANY);
+  CExpr to_value = typed_cexpr(g, to, IR_TYPE_ANY);
+
+  // Counts like the interpreter, in integers, from values computed once
+  line(g, "{");
+  g->indent++;
+  emit_defined_check(g, from);
+  emit_defined_check(g, to);
+  line(g, "PseudoValue from%d = %s, to%d = %s;", depth, from_value.text, depth, to_value.text);
+  line(g, "int64_t count%d = for_count(from%d, to%d);", depth, depth, depth);
+  line(g, "int64_t i%d = for_first(from%d);", depth, depth);
+  line(g, "for (int64_t n%d = 0; n%d < count%d; n%d++, i%d++) {", depth, depth, depth, depth, depth);
+  free(from_value.text);
+  free(to_value.text);
+
+  bool* entry = save_assigned(g);
+  g->indent++;
+  emit_assign(g, v, is_typed(g, v)
+    ? cexpr(IR_TYPE_NUMBER, format("(double)i%d", depth))
+    : cexpr(IR_TYPE_ANY, format("number_value((double)i%d)", depth)));
+  emit_stmt_list(g, body);
+  g->indent--;
+  memcpy(g->assigned, entry, g->var_count);
+  free(entry);
+
+  line(g, "}");
+  g->indent--;
+  line(g, "}");
+  g->loop_depth--;
+}
+
+static void emit_stmt(CGen* g, Stmt* stmt) {
+  match (*stmt) {
+    of(DisplayStmt, expr) {
+      emit_defined_check(g, *expr);
+      emit_display(g, *expr);
+    }
+    of(ExprStmt, expr) {
+      emit_defined_check(g, *expr);
+      CExpr value = expr_cexpr(g, *expr);
+      line(g, "(void)%s;", bare(value.text));
+      free(value.text);
+    }
+    of(AssignStmt, ident, value) {
+      int v = var_index(g, *ident);
+      emit_defined_check(g, *value);
+      IrType type = is_typed(g, v) ? g->types[v] : IR_TYPE_ANY;
+      if (expr_type(g, *value) == IR_TYPE_NONE) {
+        emit_assign(g, v, cexpr(IR_TYPE_NONE, expr_cexpr(g, *value).text));
+      } else {
+        emit_assign(g, v, typed_cexpr(g, *value, type));
+      }
+    }
+    of(IfStmt, condition, true_stmts, else_if, else_stmts) {
+      emit_defined_check(g, *condition);
+      bool* entry = save_assigned(g);
+      bool* joined = save_assigned(g);
+
+      char* cond = condition_text(g, *condition);
+      line(g, "if (%s) {", cond);
+      free(cond);
+      emit_block(g, *true_stmts);
+      join_arm(g, joined, entry);
+      emit_else_if(g, *else_if, *else_stmts, joined, entry);
+      line(g, "}");
+
+      // Without an else, no arm may run
+      memcpy(g->assigned, joined, g->var_count);
+      free(joined);
+      free(entry);
+    }
+    of(WhileStmt, condition, true_stmts) {
+      bool* entry = save_assigned(g);
+      char* name = expr_var(*condition);
+      if (name && !g->assigned[var_index(g, name)]) {
+        line(g, "while (true) {");
+        g->indent++;
+        emit_defined_check(g, *condition);
+        char* cond = condition_text(g, *condition);
+        line(g, "if (!%s) break;", cond);
+        free(cond);
+        emit_stmt_list(g, *true_stmts);
+        g->indent--;
+      } else {
+        char* cond = condition_text(g, *condition);
+        line(g, "while (%s) {", cond);
+        free(cond);
+        emit_block(g, *true_stmts);
+      }
+      line(g, "}");
+      memcpy(g->assigned, entry, g->var_count);
+      free(entry);
+    }
+    of(ForStmt, ident, from, to, body) emit_for(g, *ident, *from, *to, *body);
+  }
+}
+
+static void emit_stmt_list(CGen* g, StatementList* stmts) {
+  for (StatementList* curr = stmts; curr; curr = curr->next) emit_stmt(g, curr->value);
+}
+
+/* ------------------------------ Program ------------------------------ */
+
+// Declarations of the runtime library, see runtime.h, and wrappers taking
+// and returning values
+static void emit_prelude(CGen* g) {
+  FILE* out = g->out;
+  fprintf(out, "#include <math.h>\n");
+  fprintf(out, "#include <stdbool.h>\n");
+  fprintf(out, "#include <stdint.h>\n\n");
+
+  fprintf(out, "typedef struct {\n");
+  fprintf(out, "  int64_t tag;\n");
+  fprintf(out, "  union {\n");
+  fprintf(out, "    int64_t boolean;\n");
+  fprintf(out, "    double number;\n");
+  fprintf(out, "    const char* string;\n");
+  fprintf(out, "  };\n");
+  fprintf(out, "} PseudoValue;\n\n");
+
+  fprintf(out, "enum { PSEUDO_UNDEFINED = %d, PSEUDO_BOOLEAN = %d, PSEUDO_NUMBER = %d, PSEUDO_STRING = %d };\n",
+    PSEUDO_UNDEFINED, PSEUDO_BOOLEAN, PSEUDO_NUMBER, PSEUDO_STRING);
+  fprintf(out, "enum {\n");
+  fprintf(out, "  PSEUDO_ADD = %d, PSEUDO_SUB = %d, PSEUDO_MUL = %d, PSEUDO_DIV = %d,\n",
+    PSEUDO_ADD, PSEUDO_SUB, PSEUDO_MUL, PSEUDO_DIV);
+  fprintf(out, "  PSEUDO_EQ = %d, PSEUDO_GT = %d, PSEUDO_GTE = %d, PSEUDO_LT = %d, PSEUDO_LTE = %d,\n",
+    PSEUDO_EQ, PSEUDO_GT, PSEUDO_GTE, PSEUDO_LT, PSEUDO_LTE);
+  fprintf(out, "  PSEUDO_AND = %d, PSEUDO_OR = %d, PSEUDO_NEG = %d, PSEUDO_NOT = %d,\n",
+    PSEUDO_AND, PSEUDO_OR, PSEUDO_NEG, PSEUDO_NOT);
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "void pseudo_display(const PseudoValue* value);\n");
+  fprintf(out, "void pseudo_display_boolean(int64_t boolean);\n");
+  fprintf(out, "void pseudo_display_number(double number);\n");
+  fprintf(out, "void pseudo_display_string(const char* string);\n");
+  fprintf(out, "void pseudo_binary(PseudoValue* dest, int64_t op, const PseudoValue* a, const PseudoValue* b);\n");
+  fprintf(out, "void pseudo_unary(PseudoValue* dest, int64_t op, const PseudoValue* a);\n");
+  fprintf(out, "int64_t pseudo_condition(const PseudoValue* value);\n");
+  fprintf(out, "int64_t pseudo_for_first(const PseudoValue* from);\n");
+  fprintf(out, "int64_t pseudo_for_count(const PseudoValue* from, const PseudoValue* to);\n");
+  fprintf(out, "const char* pseudo_concat(const char* a, const char* b);\n");
+  fprintf(out, "int64_t pseudo_streq(const char* a, const char* b);\n");
+  fprintf(out, "_Noreturn void pseudo_undefined(const char* name);\n\n");
+
+  fprintf(out, "static inline PseudoValue boolean_value(bool b) { return (PseudoValue){ .tag = PSEUDO_BOOLEAN, .boolean = b }; }\n");
+  fprintf(out, "static inline PseudoValue number_value(double n) { return (PseudoValue){ .tag = PSEUDO_NUMBER, .number = n }; }\n");
+  fprintf(out, "static inline PseudoValue string_value(const char* s) { return (PseudoValue){ .tag = PSEUDO_STRING, .string = s }; }\n");
+  fprintf(out, "static inline PseudoValue binary(int64_t op, PseudoValue a, PseudoValue b) { pseudo_binary(&a, op, &a, &b); return a; }\n");
+  fprintf(out, "static inline PseudoValue unary(int64_t op, PseudoValue a) { pseudo_unary(&a, op, &a); return a; }\n");
+  fprintf(out, "static inline bool condition(PseudoValue v) { return pseudo_condition(&v); }\n");
+  fprintf(out, "static inline void display(PseudoValue v) { pseudo_display(&v); }\n");
+  fprintf(out, "static inline int64_t for_first(PseudoValue from) { return pseudo_for_first(&from); }\n");
+  fprintf(out, "static inline int64_t for_count(PseudoValue from, PseudoValue to) { return pseudo_for_count(&from, &to); }\n\n");
+}
+
+static void emit_locals(CGen* g) {
+  for (int v = 0; v < g->var_count; v++) {
+    char* name = g->vars[v];
+    switch (g->types[v]) {
+      case IR_TYPE_BOOLEAN: line(g, "bool v_%s = false;", name); break;
+      case IR_TYPE_NUMBER: line(g, "double v_%s = 0;", name); break;
+      case IR_TYPE_STRING: line(g, "const char* v_%s = \"\";", name); break;
+      default: line(g, "PseudoValue v_%s = { .tag = PSEUDO_UNDEFINED };", name); break;
+    }
+    if (g->flagged[v]) line(g, "bool v_%s_set = false;", name);
+  }
+  if (g->var_count > 0) fputc('\n', g->out);
+}
+
+// Writes `program` to `path` as C source defining pseudo_main. `source` is
+// the name of the file it was read from.
+void write_c(StatementList* program, const char* source, const char* path) {
+  FILE* out = fopen(path, "w");
+  if (!out) {
+    perror("could not open output file");
+    exit(1);
+  }
+
+  CGen g = { .out = out };
+  collect_vars(&g, program);
+  g.types = calloc(g.var_count + 1, sizeof(IrType));
+  g.flagged = calloc(g.var_count + 1, sizeof(bool));
+  g.assigned = calloc(g.var_count + 1, sizeof(bool));
+  ensure_non_null(g.types, "out of space");
+  ensure_non_null(g.flagged, "out of space");
+  ensure_non_null(g.assigned, "out of space");
+
+  while (infer_types(&g, program)) {}
+  find_flagged(&g, program);
+  memset(g.assigned, 0, g.var_count);
+
+  fprintf(out, "// Generated by pseudoc from %s\n\n", source);
+  emit_prelude(&g);
+  fprintf(out, "void pseudo_main(void) {\n");
+  g.indent = 1;
+  emit_locals(&g);
+  emit_stmt_list(&g, program);
+  fprintf(out, "}\n");
+
+  if (ferror(out) | fclose(out)) {
+    perror("could not write output file");
+    exit(1);
+  }
+  free(g.assigned);
+  free(g.flagged);
+  free(g.types);
+  free(g.vars);
+}
+
+// Compiles the C file at `path` with the system C compiler, $CC or cc, at -O2,
+// and links it with runtime.o from the directory pseudoc is in. The
+// executable is `path` without its extension.
+void compile_c(const char* path) {
+  char exe[4096];
+  ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (len < 0) {
+    perror("could not find the runtime library");
+    exit(1);
+  }
+  exe[len] = '\0';
+  char* slash = strrchr(exe, '/');
+  char* runtime = format("%.*s/runtime.o", (int)(slash ? slash - exe : 1), slash ? exe : ".");
+  if (access(runtime, R_OK) != 0) {
+    fprintf(stderr, "runtime library %s not found, build it with make build\n", runtime);
+    exit(1);
+  }
+
+  char* output = format("%s", path);
+  char* dot = strrchr(output, '.');
+  if (dot && !strchr(dot, '/')) *dot = '\0';
+  if (strcmp(output, path) == 0) {
+    fprintf(stderr, "C file name needs an extension to name the executable after\n");
+    exit(1);
+  }
+
+  // Through the shell, as $CC can have flags in it like in make
+  char* argv[] = {
+    "sh", "-c", "exec ${CC:-cc} -O2 -o \"$1\" \"$2\" \"$3\" -lm", "sh", output, (char*)path, runtime, NULL
+  };
+  pid_t pid;
+  int status;
+  if (posix_spawnp(&pid, "sh", NULL, NULL, argv, environ) != 0 || waitpid(pid, &status, 0) < 0) {
+    perror("could not run the C compiler");
+    exit(1);
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "C compiler failed\n");
+    exit(1);
+  }
+
+  free(output);
+  free(runtime);
+}
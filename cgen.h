@@ -0,0 +1,6 @@
+#pragma once
+
+#include "ast.h"
+
+void write_c(StatementList* program, const char* source, const char* path);
+void compile_c(const char* path);
@@ -0,0 +1,514 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "closure.h"
+#include "switch.h"
+#include "datatype99.h"
+
+extern SymbolTable* symtab;
+
+static Closure* alloc_closure() {
+  Closure* alloc = calloc(1, sizeof(Closure));
+  ensure_non_null(alloc, "out of space");
+  return alloc;
+}
+
+static Symbol* resolve_symbol(Closure* c) {
+  if (!c->sym) {
+    c->sym = symbol_lookup(symtab, c->ident);
+    if (!c->sym) undefined_variable_error(c->ident);
+  }
+  return c->sym;
+}
+
+static void assign_symbol(Closure* c, ExprResult value) {
+  if (c->sym) {
+    c->sym->value = value;
+  } else {
+    add_symbol(&symtab, c->ident, value);
+    c->sym = symbol_lookup(symtab, c->ident);
+  }
+}
+
+#define LEFT_NUMBER(c) ((c)->left->fn.number((c)->left))
+#define RIGHT_NUMBER(c) ((c)->right->fn.number((c)->right))
+#define LEFT_BOOL(c) ((c)->left->fn.boolean((c)->left))
+#define RIGHT_BOOL(c) ((c)->right->fn.boolean((c)->right))
+#define LEFT_VALUE(c) ((c)->left->fn.value((c)->left))
+#define RIGHT_VALUE(c) ((c)->right->fn.value((c)->right))
+
+/* ------------------------ ArithmeticExpression ------------------------ */
+
+static double number_const(Closure* c) { return c->number; }
+static double number_add(Closure* c) { return LEFT_NUMBER(c) + RIGHT_NUMBER(c); }
+static double number_sub(Closure* c) { return LEFT_NUMBER(c) - RIGHT_NUMBER(c); }
+static double number_mul(Closure* c) { return LEFT_NUMBER(c) * RIGHT_NUMBER(c); }
+static double number_div(Closure* c) { return LEFT_NUMBER(c) / RIGHT_NUMBER(c); }
+static double number_neg(Closure* c) { return - LEFT_NUMBER(c); }
+
+static Closure* compile_aexpr(ArithExpr* ast) {
+  Closure* c = alloc_closure();
+
+  match(*ast) {
+    of(BinaryAExpr, left, op, right) {
+      c->left = compile_aexpr(*left);
+      c->right = compile_aexpr(*right);
+      switch (*op) {
+        case BinaryOp_Add: c->fn.number = number_add; break;
+        case BinaryOp_Sub: c->fn.number = number_sub; break;
+        case BinaryOp_Mul: c->fn.number = number_mul; break;
+        case BinaryOp_Div: c->fn.number = number_div; break;
+      }
+    }
+    of(UnaryAExpr, op, right) {
+      c->left = compile_aexpr(*right);
+      switch (*op) {
+        case UnaryOp_Minus: c->fn.number = number_neg; break;
+      }
+    }
+    of(Number, num) {
+      c->number = *num;
+      c->fn.number = number_const;
+    }
+  }
+
+  return c;
+}
+
+/* -------------------------- BoolExpression --------------------------- */
+
+static bool bool_const(Closure* c) { return c->boolean; }
+static bool bool_eq(Closure* c) { return LEFT_NUMBER(c) == RIGHT_NUMBER(c); }
+static bool bool_gt(Closure* c) { return LEFT_NUMBER(c) > RIGHT_NUMBER(c); }
+static bool bool_gte(Closure* c) { return LEFT_NUMBER(c) >= RIGHT_NUMBER(c); }
+static bool bool_lt(Closure* c) { return LEFT_NUMBER(c) < RIGHT_NUMBER(c); }
+static bool bool_lte(Closure* c) { return LEFT_NUMBER(c) <= RIGHT_NUMBER(c); }
+static bool bool_and(Closure* c) { return LEFT_BOOL(c) && RIGHT_BOOL(c); }
+static bool bool_or(Closure* c) { return LEFT_BOOL(c) || RIGHT_BOOL(c); }
+static bool bool_logical_eq(Closure* c) { return LEFT_BOOL(c) == RIGHT_BOOL(c); }
+static bool bool_not(Closure* c) { return !LEFT_BOOL(c); }
+
+static Closure* compile_bexpr(BoolExpr* ast) {
+  Closure* c = alloc_closure();
+
+  match (*ast) {
+    of(RelationalArithExpr, left, relop, right) {
+      c->left = compile_aexpr(*left);
+      c->right = compile_aexpr(*right);
+      switch (*relop) {
+        case RelationalEqual: c->fn.boolean = bool_eq; break;
+        case Greater:         c->fn.boolean = bool_gt; break;
+        case GreaterOrEqual:  c->fn.boolean = bool_gte; break;
+        case Less:            c->fn.boolean = bool_lt; break;
+        case LessOrEqual:     c->fn.boolean = bool_lte; break;
+      }
+    }
+    of(LogicalBoolExpr, left, logicalop, right) {
+      c->left = compile_bexpr(*left);
+      c->right = compile_bexpr(*right);
+      switch (*logicalop) {
+        case And: c->fn.boolean = bool_and; break;
+        case Or: c->fn.boolean = bool_or; break;
+        case LogicalEqual: c->fn.boolean = bool_logical_eq; break;
+      }
+    }
+    of(NegatedBoolExpr, bexpr) {
+      c->left = compile_bexpr(*bexpr);
+      c->fn.boolean = bool_not;
+    }
+    of(Boolean, boolean) {
+      c->boolean = *boolean;
+      c->fn.boolean = bool_const;
+    }
+  }
+
+  return c;
+}
+
+/* --------------------------- StringExpression --------------------------- */
+
+static char* string_const(Closure* c) { return c->string; }
+
+static char* string_concat(Closure* c) {
+  return concat_strs(NULL, c->pieces, c->piece_count);
+}
+
+static Closure* compile_sexpr(StrExpr* ast) {
+  Closure* c = alloc_closure();
+
+  match (*ast) {
+    of(StringConcat, pieces, count) {
+      c->pieces = *pieces;
+      c->piece_count = *count;
+      c->fn.string = string_concat;
+    }
+    of(String, str) {
+      c->string = *str;
+      c->fn.string = string_const;
+    }
+  }
+
+  return c;
+}
+
+/* ----------------------------- LiteralExpression ----------------------------- */
+
+static ExprResult value_of_number(Closure* c) { return NumberResult(LEFT_NUMBER(c)); }
+static ExprResult value_of_bool(Closure* c) { return BooleanResult(LEFT_BOOL(c)); }
+static ExprResult value_of_string(Closure* c) { return StringResult(c->left->fn.string(c->left)); }
+
+static Closure* compile_literal_expr(LiteralExpr* expr) {
+  Closure* c = alloc_closure();
+
+  match (*expr) {
+    of(BooleanExpr, bexpr) {
+      c->left = compile_bexpr(*bexpr);
+      c->fn.value = value_of_bool;
+    }
+    of(ArithmeticExpr, aexpr) {
+      c->left = compile_aexpr(*aexpr);
+      c->fn.value = value_of_number;
+    }
+    of(StringExpr, sexpr) {
+      c->left = compile_sexpr(*sexpr);
+      c->fn.value = value_of_string;
+    }
+  }
+
+  return c;
+}
+
+/* ------------------------ IdentifierExpression ------------------------ */
+
+static ExprResult ident_read(Closure* c) { return resolve_symbol(c)->value; }
+
+// Falls back to the generic evaluator whenever the variable does not hold the
+// type a specialized closure was compiled for, so that errors and mixed type
+// comparisons behave exactly like the tree walker.
+static ExprResult ident_binary_generic(Closure* c) {
+  ExprResult lhs = resolve_symbol(c)->value;
+  return eval_binary_values(lhs, c->op, RIGHT_VALUE(c));
+}
+
+#define IDENT_NUMBER_OP(name, result, expr) \
+    static ExprResult name(Closure* c) { \
+      ExprResult lhs = resolve_symbol(c)->value; \
+      double rhs = RIGHT_NUMBER(c); \
+      ifLet(lhs, NumberResult, num) return result(*num expr rhs); \
+      return eval_binary_values(lhs, c->op, NumberResult(rhs)); \
+    }
+
+IDENT_NUMBER_OP(ident_number_add, NumberResult, +)
+IDENT_NUMBER_OP(ident_number_sub, NumberResult, -)
+IDENT_NUMBER_OP(ident_number_mul, NumberResult, *)
+IDENT_NUMBER_OP(ident_number_div, NumberResult, /)
+IDENT_NUMBER_OP(ident_number_gt, BooleanResult, >)
+IDENT_NUMBER_OP(ident_number_gte, BooleanResult, >=)
+IDENT_NUMBER_OP(ident_number_lt, BooleanResult, <)
+IDENT_NUMBER_OP(ident_number_lte, BooleanResult, <=)
+IDENT_NUMBER_OP(ident_number_eq, BooleanResult, ==)
+
+#define IDENT_BOOL_OP(name, expr) \
+    static ExprResult name(Closure* c) { \
+      ExprResult lhs = resolve_symbol(c)->value; \
+      bool rhs = RIGHT_BOOL(c); \
+      ifLet(lhs, BooleanResult, boolean) return BooleanResult(*boolean expr rhs); \
+      return eval_binary_values(lhs, c->op, BooleanResult(rhs)); \
+    }
+
+IDENT_BOOL_OP(ident_bool_and, &&)
+IDENT_BOOL_OP(ident_bool_or, ||)
+IDENT_BOOL_OP(ident_bool_eq, ==)
+
+static ExprResult ident_string_concat(Closure* c) {
+  ExprResult lhs = resolve_symbol(c)->value;
+  ifLet(lhs, StringResult, str) {
+    // `s + "a" + "b"` is concatenated in one go
+    Closure* right = c->right;
+    if (right->fn.string == string_concat) return StringResult(concat_strs(*str, right->pieces, right->piece_count));
+    return StringResult(concat_str(*str, right->fn.string(right)));
+  }
+  char* rhs = c->right->fn.string(c->right);
+  return eval_binary_values(lhs, c->op, StringResult(rhs));
+}
+
+static ExprResult ident_negate(Closure* c) {
+  ExprResult value = resolve_symbol(c)->value;
+  ifLet(value, NumberResult, num) return NumberResult(- *num);
+  runtime_error("unsupported variable type for number negation");
+  return value;
+}
+
+static ExprResult ident_not(Closure* c) {
+  ExprResult value = resolve_symbol(c)->value;
+  ifLet(value, BooleanResult, boolean) return BooleanResult(!*boolean);
+  runtime_error("unsupported variable type for boolean negation");
+  return value;
+}
+
+static ValueFn specialize_ident_binary(IdentBinaryOp op, LiteralExpr* rhs) {
+  match (*rhs) {
+    of(ArithmeticExpr, _) {
+      switch (op) {
+        case IdentBOp_Plus:  return ident_number_add;
+        case IdentBOp_Minus: return ident_number_sub;
+        case IdentBOp_Star:  return ident_number_mul;
+        case IdentBOp_Slash: return ident_number_div;
+        case IdentBOp_Gt:    return ident_number_gt;
+        case IdentBOp_Gte:   return ident_number_gte;
+        case IdentBOp_Lt:    return ident_number_lt;
+        case IdentBOp_Lte:   return ident_number_lte;
+        case IdentBOp_EqEq:  return ident_number_eq;
+        default: return NULL;
+      }
+    }
+    of(BooleanExpr, _) {
+      switch (op) {
+        case IdentBOp_And:  return ident_bool_and;
+        case IdentBOp_Or:   return ident_bool_or;
+        case IdentBOp_EqEq: return ident_bool_eq;
+        default: return NULL;
+      }
+    }
+    of(StringExpr, _) {
+      if (op == IdentBOp_Plus) return ident_string_concat;
+      return NULL;
+    }
+  }
+
+  return NULL;
+}
+
+static Closure* compile_ident_expr(IdentExpr* expr) {
+  Closure* c = alloc_closure();
+
+  match (*expr) {
+    of(IdentBinaryExpr, ident, op, rhs) {
+      c->ident = *ident;
+      c->op = *op;
+      c->fn.value = specialize_ident_binary(*op, *rhs);
+
+      if (c->fn.value) {
+        // Specialized closures consume the unboxed operand directly
+        match (**rhs) {
+          of(ArithmeticExpr, aexpr) c->right = compile_aexpr(*aexpr);
+          of(BooleanExpr, bexpr) c->right = compile_bexpr(*bexpr);
+          of(StringExpr, sexpr) c->right = compile_sexpr(*sexpr);
+        }
+      } else {
+        c->right = compile_literal_expr(*rhs);
+        c->fn.value = ident_binary_generic;
+      }
+    }
+    of(IdentUnaryExpr, op, ident) {
+      c->ident = *ident;
+      switch (*op) {
+        case IdentUOp_Minus: c->fn.value = ident_negate; break;
+        case IdentUOp_Exclamation: c->fn.value = ident_not; break;
+      }
+    }
+    of(Identifier, ident) {
+      c->ident = *ident;
+      c->fn.value = ident_read;
+    }
+  }
+
+  return c;
+}
+
+/* ----------------------------- Expression ----------------------------- */
+
+static Closure* compile_expr(Expr* expr) {
+  match (*expr) {
+    of(LiteralExpression, lexpr) return compile_literal_expr(*lexpr);
+    of(IdentExpression, iexpr) return compile_ident_expr(*iexpr);
+  }
+
+  unreachable("compile_expr");
+  return NULL;
+}
+
+static bool condition_of_value(Closure* c) {
+  ExprResult evaled = LEFT_VALUE(c);
+  ifLet(evaled, BooleanResult, boolean) return *boolean;
+  runtime_error("if condition must evaluate to a boolean");
+  return false;
+}
+
+// Conditions that are boolean literals are compiled straight to a boolean
+// closure, others are checked to be booleans at run time.
+static Closure* compile_condition(Condition* cond) {
+  ifLet(*cond, LiteralExpression, lexpr) {
+    ifLet(**lexpr, BooleanExpr, bexpr) return compile_bexpr(*bexpr);
+  }
+
+  Closure* c = alloc_closure();
+  c->left = compile_expr(cond);
+  c->fn.boolean = condition_of_value;
+  return c;
+}
+
+/* ----------------------------- Statement ----------------------------- */
+
+#define CONDITION(c) ((c)->left->fn.boolean((c)->left))
+
+static void exec_display(Closure* c) { print_result(LEFT_VALUE(c)); }
+static void exec_expr(Closure* c) { LEFT_VALUE(c); }
+static void exec_assign(Closure* c) { assign_symbol(c, LEFT_VALUE(c)); }
+
+static void exec_if(Closure* c) {
+  if (CONDITION(c)) {
+    run_closure(c->body);
+  } else {
+    run_closure(c->orelse);
+  }
+}
+
+static void exec_switch(Closure* c) {
+  int arm = switch_table_lookup(c->table, resolve_symbol(c)->value);
+  run_closure(arm >= 0 ? c->arms[arm] : c->orelse);
+}
+
+static void exec_while(Closure* c) {
+  while (CONDITION(c)) {
+    run_closure(c->body);
+    if (c->jit && jit_while_back_edge(c->jit)) return;
+  }
+}
+
+// Runs the iterations of for loop `c` from the one where the variable is `i`
+// to the last. `c->mentions_var` is set when the body mentions the loop variable,
+// otherwise it already holds `last`.
+void run_for_iterations(Closure* c, int64_t i, int64_t last) {
+  Symbol* sym = resolve_symbol(c);
+  for (;; i++) {
+    if (c->mentions_var) sym->value = NumberResult(i);
+    run_closure(c->body);
+    if (i == last) return;
+    if (c->jit && jit_for_back_edge(c->jit, i + 1, last)) return;
+  }
+}
+
+// When the body never mentions the loop variable, only the value of the
+// last iteration is stored, before the first one.
+static void exec_for(Closure* c) {
+  ExprResult from_expr = LEFT_VALUE(c);
+  ExprResult to_expr = RIGHT_VALUE(c);
+  int64_t trip = for_loop_trip_count(from_expr, to_expr);
+  if (trip == 0) return;
+
+  int64_t i = for_loop_start(from_expr.data.NumberResult._0);
+  int64_t last = i + (trip - 1);
+  assign_symbol(c, NumberResult(i));
+  if (!c->mentions_var) c->sym->value = NumberResult(last);
+  run_for_iterations(c, i, last);
+}
+
+static Closure* compile_else_if(ElseIfStatement* else_if, ElseStatements* else_stmts) {
+  if (!else_if) return compile_stmt_list(else_stmts);
+
+  // An else-if chain is compiled into nested if closures
+  Closure* c = alloc_closure();
+  c->left = compile_condition(else_if->condition);
+  c->body = compile_stmt_list(else_if->true_stmts);
+  c->orelse = compile_else_if(else_if->next, else_stmts);
+  c->fn.exec = exec_if;
+  return c;
+}
+
+static Closure* compile_stmt(Stmt* stmt) {
+  Closure* c = alloc_closure();
+  c->stmt = stmt;
+
+  match (*stmt) {
+    of(DisplayStmt, expr) {
+      c->left = compile_expr(*expr);
+      c->fn.exec = exec_display;
+    }
+    of(ExprStmt, expr) {
+      c->left = compile_expr(*expr);
+      c->fn.exec = exec_expr;
+    }
+    of(AssignStmt, ident, value) {
+      c->ident = *ident;
+      c->left = compile_expr(*value);
+      c->fn.exec = exec_assign;
+    }
+    of(IfStmt, condition, true_stmts, else_if, else_stmts) {
+      if (*else_if && (*else_if)->switch_table) {
+        c->table = (*else_if)->switch_table;
+        c->ident = c->table->ident;
+        c->arms = malloc(c->table->arm_count * sizeof(Closure*));
+        ensure_non_null(c->arms, "out of space");
+        for (int arm = 0; arm < c->table->arm_count; arm++) {
+          c->arms[arm] = compile_stmt_list(c->table->arms[arm]);
+        }
+        c->orelse = compile_stmt_list(*else_stmts);
+        c->fn.exec = exec_switch;
+      } else {
+        c->left = compile_condition(*condition);
+        c->body = compile_stmt_list(*true_stmts);
+        c->orelse = compile_else_if(*else_if, *else_stmts);
+        c->fn.exec = exec_if;
+      }
+    }
+    of(WhileStmt, condition, true_stmts) {
+      c->left = compile_condition(*condition);
+      c->body = compile_stmt_list(*true_stmts);
+      c->fn.exec = exec_while;
+    }
+    of(ForStmt, ident, from, to, stmts, mentioned) {
+      c->ident = *ident;
+      c->left = compile_expr(*from);
+      c->right = compile_expr(*to);
+      c->body = compile_stmt_list(*stmts);
+      c->mentions_var = *mentioned;
+      c->fn.exec = exec_for;
+    }
+  }
+
+  return c;
+}
+
+/* -------------------------- StatementList -------------------------- */
+
+atomic_bool compile_cancelled;
+
+Closure* compile_stmt_list(StatementList* start) {
+  Closure* head = NULL;
+  Closure** tail = &head;
+
+  for (StatementList* curr = start; curr; curr = curr->next) {
+    if (atomic_load_explicit(&compile_cancelled, memory_order_relaxed)) break;
+    *tail = compile_stmt(curr->value);
+    tail = &(*tail)->next;
+  }
+
+  return head;
+}
+
+void run_closure(Closure* c) {
+  while (c) {
+    c->fn.exec(c);
+    c = c->next;
+  }
+}
+
+void free_closure(Closure* c) {
+  while (c) {
+    Closure* next = c->next;
+    if (c->left) free_closure(c->left);
+    if (c->right) free_closure(c->right);
+    if (c->body) free_closure(c->body);
+    if (c->orelse) free_closure(c->orelse);
+    if (c->arms) {
+      for (int arm = 0; arm < c->table->arm_count; arm++) {
+        if (c->arms[arm]) free_closure(c->arms[arm]);
+      }
+      free(c->arms);
+    }
+    free(c);
+    c = next;
+  }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdatomic.h>
+#include "ast.h"
+#include "jit.h"
+
+/*
+ * Closure compilation engine.
+ *
+ * Instead of re-dispatching on every AST node with `match` each time it runs,
+ * the syntax tree is walked once and turned into a tree of closures. Every
+ * closure carries a function pointer specialized for its node kind and
+ * operator (add two numbers, compare less than, assign to a variable, ...)
+ * along with its operands, so executing a node is a single indirect call.
+ */
+
+typedef struct Closure Closure;
+
+typedef double (*NumberFn)(Closure*);
+typedef bool (*BoolFn)(Closure*);
+typedef char* (*StringFn)(Closure*);
+typedef ExprResult (*ValueFn)(Closure*);
+typedef void (*ExecFn)(Closure*);
+
+struct Closure {
+  union {
+    NumberFn number;
+    BoolFn boolean;
+    StringFn string;
+    ValueFn value;
+    ExecFn exec;
+  } fn;
+
+  Closure* left;
+  Closure* right;
+  Closure* body;   // statements of an if/while/for
+  Closure* orelse; // else-if chain or else statements of an if
+  Closure* next;   // next statement in a statement list
+
+  // Immediate operands
+  double number;
+  bool boolean;
+  char* string;
+  IdentBinaryOp op;
+
+  // Strings of a concatenation
+  char** pieces;
+  int piece_count;
+
+  // Variable operand, resolved to its symbol table entry on first use
+  char* ident;
+  Symbol* sym;
+
+  // Whether the body of a for loop mentions its variable, which is otherwise
+  // only set once the loop ends
+  bool mentions_var;
+
+  // Arms of an if statement dispatched through a switch table, the else
+  // statements are in orelse
+  SwitchTable* table;
+  Closure** arms;
+
+  // Statement compiled, and the JIT state of loops the tiered runtime
+  // switched to closures, see tier.h
+  Stmt* stmt;
+  JitLoop* jit;
+};
+
+// Makes compile_stmt_list stop after the statement it is compiling, once the
+// tiered runtime no longer needs the closures it compiles in the background
+extern atomic_bool compile_cancelled;
+
+Closure* compile_stmt_list(StatementList* stmts);
+void run_closure(Closure* stmts);
+void run_for_iterations(Closure* loop, int64_t i, int64_t last);
+void free_closure(Closure* closure);
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "opt.h"
+#include "ssa.h"
+#include "datatype99.h"
+
+/*
+ * Copy and constant propagation.
+ *
+ * An operand that reads the result of `dest = a` is replaced by `a` itself:
+ * constants are always substituted, and a temporary or variable is
+ * substituted as long as it still holds the same SSA value at the use. The
+ * lowering wraps every leaf in a copy to a temporary, so most of those copies
+ * become dead and are removed by eliminate_dead_temps.
+ *
+ * Afterwards a temporary that is defined once and immediately copied into its
+ * only user, as in `t1 = a + 1; a = t1`, is coalesced into `a = a + 1`.
+ */
+
+typedef struct {
+  SsaForm* ssa;
+  SsaScope scope;
+  int changed;
+} CopyProp;
+
+// Follows the chain of copies that value `v` was defined by, and rewrites
+// operand k of instruction i to its source when that is still available.
+static void propagate_operand(CopyProp* c, int i, int k) {
+  SsaForm* ssa = c->ssa;
+  IrProgram* ir = ssa->ir;
+  IrOperand* operand = &ir->instrs[i].args[k];
+  int v = ssa->use_value[2 * i + k];
+  if (v < 0) return;
+
+  int source = v;
+  for (;;) {
+    int def = ssa->value_instr[source];
+    if (def < 0 || ir->instrs[def].op != IR_COPY) break;
+
+    ifLet(ir->instrs[def].args[0], IrConst, constant) {
+      *operand = IrConst(ir_copy_result(*constant));
+      ssa->use_value[2 * i + k] = -1;
+      c->changed++;
+      return;
+    }
+
+    int w = ssa->use_value[2 * def];
+    if (w < 0 || ssa_scope_current(&c->scope, ssa->value_name[w]) != w) break;
+    source = w;
+  }
+
+  if (source != v) {
+    *operand = ssa_name_operand(ir, ssa->value_name[source]);
+    ssa->use_value[2 * i + k] = source;
+    c->changed++;
+  }
+}
+
+static void propagate_block(CopyProp* c, int b) {
+  SsaForm* ssa = c->ssa;
+  IrProgram* ir = ssa->ir;
+  BasicBlock* block = &ssa->cfg->blocks[b];
+  int mark = c->scope.pushed.len;
+
+  for (int p = ssa->block_phis[b]; p < ssa->block_phis[b + 1]; p++) {
+    ssa_scope_push(&c->scope, ssa->phis[p].name, ssa->phis[p].dest);
+  }
+
+  for (int i = block->start; i < block->end; i++) {
+    for (int k = 0; k < 2; k++) propagate_operand(c, i, k);
+
+    int def = ssa->def_value[i];
+    if (def >= 0) ssa_scope_push(&c->scope, ssa_name(ir, ir->instrs[i].dest), def);
+  }
+
+  for (int d = ssa->dom_child_start[b]; d < ssa->dom_child_start[b + 1]; d++) {
+    propagate_block(c, ssa->dom_children[d]);
+  }
+
+  ssa_scope_pop_to(&c->scope, mark);
+}
+
+// Rewrites `tN = ...; x = tN` into `x = ...` when tN has no other definition
+// or use.
+static int coalesce_copies(IrProgram* ir) {
+  int* defs = calloc(ir->temp_count + 1, sizeof(int));
+  int* uses = calloc(ir->temp_count + 1, sizeof(int));
+  bool* remove = calloc(ir->len + 1, sizeof(bool));
+  ensure_non_null(defs, "out of space");
+  ensure_non_null(uses, "out of space");
+  ensure_non_null(remove, "out of space");
+
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    ifLet(instr->dest, IrTemp, temp) defs[*temp]++;
+    for (int k = 0; k < 2; k++) {
+      ifLet(instr->args[k], IrTemp, temp) uses[*temp]++;
+    }
+  }
+
+  int changed = 0;
+  for (int i = 0; i + 1 < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    IrInstr* next = &ir->instrs[i + 1];
+    if (!MATCHES(instr->dest, IrTemp) || next->op != IR_COPY) continue;
+
+    int temp = instr->dest.data.IrTemp._0;
+    ifLet(next->args[0], IrTemp, source) {
+      if (*source != temp || defs[temp] != 1 || uses[temp] != 1) continue;
+      instr->dest = next->dest;
+      remove[i + 1] = true;
+      changed++;
+      i++;
+    }
+  }
+
+  ir_remove_marked(ir, remove);
+  free(defs);
+  free(uses);
+  free(remove);
+  return changed;
+}
+
+int copy_propagate(IrProgram* ir) {
+  SsaForm* ssa = build_ssa(ir);
+  CopyProp c = { .ssa = ssa, .scope = alloc_ssa_scope(ssa->name_count) };
+
+  if (ssa->cfg->block_count > 0) propagate_block(&c, 0);
+
+  free_ssa_scope(&c.scope);
+  free_ssa(ssa);
+
+  return c.changed + coalesce_copies(ir);
+}
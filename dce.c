@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "opt.h"
+#include "ssa.h"
+#include "datatype99.h"
+
+/*
+ * Dead temporary elimination.
+ *
+ * Removes the instructions whose result is a temporary that is never read.
+ * An instruction is only removed when it cannot fail at run time: reading a
+ * variable that may not be assigned yet, or an operation on values whose type
+ * is unknown, is kept so that the program reports the same error. The
+ * remaining temporaries are then renumbered densely.
+ */
+
+// Marks the SSA values that may be the undefined entry value of their name
+static bool* maybe_undefined(SsaForm* ssa) {
+  bool* undef = calloc(ssa->value_count + 1, sizeof(bool));
+  ensure_non_null(undef, "out of space");
+  for (int v = 0; v < ssa->name_count; v++) undef[v] = true;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int p = 0; p < ssa->phi_count; p++) {
+      Phi* phi = &ssa->phis[p];
+      if (undef[phi->dest]) continue;
+
+      int preds = ssa->cfg->blocks[phi->block].pred_count;
+      for (int a = 0; a < preds; a++) {
+        if (undef[phi->args[a]]) {
+          undef[phi->dest] = changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  return undef;
+}
+
+static bool can_fail(SsaForm* ssa, bool* undef, int i) {
+  IrInstr* instr = &ssa->ir->instrs[i];
+  ExprResult args[2] = { BooleanResult(false), BooleanResult(false) };
+  bool all_const = true;
+
+  for (int k = 0; k < 2; k++) {
+    int v = ssa->use_value[2 * i + k];
+    if (v >= 0 && undef[v]) return true;
+
+    match (instr->args[k]) {
+      of(IrConst, constant) args[k] = *constant;
+      of(IrNone) {}
+      otherwise all_const = false;
+    }
+  }
+
+  if (instr->op == IR_COPY || instr->op == IR_IS_NUMBER) return false;
+  if (!all_const) return true;
+
+  ExprResult result;
+  if (!ir_fold(instr->op, args[0], args[1], &result)) return true;
+  ir_free_result(result);
+  return false;
+}
+
+// Renumbers the temporaries in order of first appearance
+static void renumber_temps(IrProgram* ir) {
+  int* number = malloc((ir->temp_count + 1) * sizeof(int));
+  ensure_non_null(number, "out of space");
+  for (int t = 0; t < ir->temp_count; t++) number[t] = -1;
+
+  int count = 0;
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    IrOperand* operands[3] = { &instr->args[0], &instr->args[1], &instr->dest };
+    for (int k = 0; k < 3; k++) {
+      ifLet(*operands[k], IrTemp, temp) {
+        if (number[*temp] < 0) number[*temp] = count++;
+        *temp = number[*temp];
+      }
+    }
+  }
+
+  ir->temp_count = count;
+  free(number);
+}
+
+int eliminate_dead_temps(IrProgram* ir) {
+  SsaForm* ssa = build_ssa(ir);
+  bool* undef = maybe_undefined(ssa);
+  bool* remove = calloc(ir->len + 1, sizeof(bool));
+  int* reads = calloc(ir->temp_count + 1, sizeof(int));
+  ensure_non_null(remove, "out of space");
+  ensure_non_null(reads, "out of space");
+
+  for (int i = 0; i < ir->len; i++) {
+    for (int k = 0; k < 2; k++) {
+      ifLet(ir->instrs[i].args[k], IrTemp, temp) reads[*temp]++;
+    }
+  }
+
+  // Removing an instruction can leave the temporaries it read unused, so
+  // repeat until nothing else is removed.
+  int removed = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = ir->len - 1; i >= 0; i--) {
+      IrInstr* instr = &ir->instrs[i];
+      if (remove[i] || !MATCHES(instr->dest, IrTemp)) continue;
+      if (reads[instr->dest.data.IrTemp._0] > 0 || can_fail(ssa, undef, i)) continue;
+
+      remove[i] = changed = true;
+      removed++;
+      for (int k = 0; k < 2; k++) {
+        match (instr->args[k]) {
+          of(IrTemp, temp) reads[*temp]--;
+          of(IrConst, constant) ir_free_result(*constant);
+          otherwise {}
+        }
+      }
+    }
+  }
+
+  ir_remove_marked(ir, remove);
+  renumber_temps(ir);
+
+  free(undef);
+  free(remove);
+  free(reads);
+  free_ssa(ssa);
+  return removed;
+}
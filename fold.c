@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include "ast.h"
+#include "opt.h"
+#include "tape.h"
+#include "datatype99.h"
+
+/*
+ * Constant folding on the syntax tree.
+ *
+ * Arithmetic, boolean and string literal expressions never mention a
+ * variable, so each one is replaced by the value it evaluates to. Evaluating
+ * them never fails, and they are evaluated with the tree walking evaluator
+ * itself, so every engine sees the same values as before.
+ */
+
+static int fold_literal_expr(LiteralExpr* ast) {
+  match (*ast) {
+    of(ArithmeticExpr, aexpr, tape) {
+      if (MATCHES(**aexpr, Number)) return 0;
+      double value = eval_aexpr(*aexpr);
+      free_aexpr(*aexpr);
+      free_expr_tape(*tape);
+      *aexpr = alloc_aexpr(Number(value));
+      *tape = build_aexpr_tape(*aexpr);
+      return 1;
+    }
+    of(BooleanExpr, bexpr, tape) {
+      if (MATCHES(**bexpr, Boolean)) return 0;
+      bool value = eval_bexpr(*bexpr);
+      free_bexpr(*bexpr);
+      free_expr_tape(*tape);
+      *bexpr = alloc_bexpr(Boolean(value));
+      *tape = build_bexpr_tape(*bexpr);
+      return 1;
+    }
+    of(StringExpr, sexpr) {
+      if (MATCHES(**sexpr, String)) return 0;
+      char* value = eval_sexpr(*sexpr);
+      free_sexpr(*sexpr);
+      free(*sexpr);
+      *sexpr = alloc_sexpr(String(value));
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int fold_expr(Expr* ast) {
+  match (*ast) {
+    of(LiteralExpression, lexpr) return fold_literal_expr(*lexpr);
+    of(IdentExpression, iexpr) {
+      ifLet(**iexpr, IdentBinaryExpr, _, _, lexpr) return fold_literal_expr(*lexpr);
+    }
+  }
+  return 0;
+}
+
+static int fold_stmt_list(StatementList* stmts) {
+  int changed = 0;
+  for (StatementList* curr = stmts; curr; curr = curr->next) {
+    match (*curr->value) {
+      of(DisplayStmt, expr) changed += fold_expr(*expr);
+      of(ExprStmt, expr) changed += fold_expr(*expr);
+      of(AssignStmt, _, value) changed += fold_expr(*value);
+      of(IfStmt, condition, true_stmts, else_if, else_stmts) {
+        changed += fold_expr(*condition) + fold_stmt_list(*true_stmts);
+        for (ElseIfStatement* e = *else_if; e; e = e->next) {
+          changed += fold_expr(e->condition) + fold_stmt_list(e->true_stmts);
+        }
+        changed += fold_stmt_list(*else_stmts);
+      }
+      of(WhileStmt, condition, true_stmts) {
+        changed += fold_expr(*condition) + fold_stmt_list(*true_stmts);
+      }
+      of(ForStmt, _, from, to, body) {
+        changed += fold_expr(*from) + fold_expr(*to) + fold_stmt_list(*body);
+      }
+    }
+  }
+  return changed;
+}
+
+int fold_constants(StatementList* program) {
+  return fold_stmt_list(program);
+}
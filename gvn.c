@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "opt.h"
+#include "ssa.h"
+#include "datatype99.h"
+
+/*
+ * Dominator based global value numbering.
+ *
+ * The blocks are visited in a pre-order walk of the dominator tree with a
+ * scoped hash table of the expressions computed so far. An instruction
+ * computing an expression that is already in the table is replaced by a copy
+ * of the earlier result, as long as the name holding that result has not
+ * been reassigned since. Copies give their destination the value number of
+ * their source, so a second read of a variable that has not been assigned in
+ * between is recognised as the same value, and so is everything computed
+ * from it.
+ *
+ * The earlier computation dominates the redundant one and has the same
+ * operands, so it would have already failed if the redundant one could fail.
+ */
+
+typedef enum {
+  Key_None,
+  Key_Value,
+  Key_Const,
+} KeyKind;
+
+typedef struct {
+  KeyKind kind;
+  int number;
+  ExprResult constant;
+} KeyOperand;
+
+typedef struct {
+  IrOpcode op;
+  KeyOperand args[2];
+  int value;  // SSA value holding the result of the expression
+  int next;   // Next expression in the same bucket
+} ValueExpr;
+
+typedef struct {
+  SsaForm* ssa;
+  SsaScope scope;
+
+  int* number;  // Value number of each SSA value
+
+  ValueExpr* exprs;
+  int expr_count;
+  int* buckets;
+  int bucket_count;
+
+  int eliminated;
+} Gvn;
+
+static bool is_commutative(IrOpcode op) {
+  // IR_ADD also concatenates strings, so it is not commutative
+  return op == IR_MUL || op == IR_EQ || op == IR_AND || op == IR_OR;
+}
+
+static KeyOperand key_operand(Gvn* g, int i, int k) {
+  IrOperand operand = g->ssa->ir->instrs[i].args[k];
+  ifLet(operand, IrConst, constant) return (KeyOperand){ Key_Const, 0, *constant };
+
+  int v = g->ssa->use_value[2 * i + k];
+  if (v < 0) return (KeyOperand){ Key_None, 0, BooleanResult(false) };
+  return (KeyOperand){ Key_Value, g->number[v], BooleanResult(false) };
+}
+
+static unsigned hash_operand(KeyOperand operand) {
+  unsigned hash = operand.kind * 31u;
+  if (operand.kind == Key_Value) return hash + operand.number * 2654435761u;
+  if (operand.kind != Key_Const) return hash;
+
+  match (operand.constant) {
+    of(BooleanResult, boolean) hash += *boolean ? 7u : 3u;
+    of(NumberResult, number) {
+      unsigned bits[sizeof(double) / sizeof(unsigned)];
+      memcpy(bits, number, sizeof(double));
+      for (size_t w = 0; w < sizeof(bits) / sizeof(unsigned); w++) hash = hash * 31u + bits[w];
+    }
+    of(StringResult, string) {
+      for (char* c = *string; *c; c++) hash = hash * 31u + (unsigned char)*c;
+    }
+  }
+  return hash;
+}
+
+static bool operands_equal(KeyOperand a, KeyOperand b) {
+  if (a.kind != b.kind) return false;
+  if (a.kind == Key_Value) return a.number == b.number;
+  if (a.kind == Key_Const) return ir_results_equal(a.constant, b.constant);
+  return true;
+}
+
+static int bucket_of(Gvn* g, ValueExpr* expr) {
+  unsigned hash = expr->op * 16777619u;
+  hash = hash * 31u + hash_operand(expr->args[0]);
+  hash = hash * 31u + hash_operand(expr->args[1]);
+  return hash & (g->bucket_count - 1);
+}
+
+// Finds an expression equal to `key` whose result is still available in the
+// name holding it, or -1
+static int lookup(Gvn* g, ValueExpr* key) {
+  for (int e = g->buckets[bucket_of(g, key)]; e >= 0; e = g->exprs[e].next) {
+    ValueExpr* expr = &g->exprs[e];
+    if (expr->op != key->op) continue;
+    if (!operands_equal(expr->args[0], key->args[0])) continue;
+    if (!operands_equal(expr->args[1], key->args[1])) continue;
+
+    int holder = g->ssa->value_name[expr->value];
+    if (ssa_scope_current(&g->scope, holder) == expr->value) return e;
+  }
+  return -1;
+}
+
+static void insert(Gvn* g, ValueExpr* key) {
+  int bucket = bucket_of(g, key);
+  key->next = g->buckets[bucket];
+  g->exprs[g->expr_count] = *key;
+  g->buckets[bucket] = g->expr_count++;
+}
+
+static void number_instr(Gvn* g, int i) {
+  SsaForm* ssa = g->ssa;
+  IrProgram* ir = ssa->ir;
+  IrInstr* instr = &ir->instrs[i];
+  int def = ssa->def_value[i];
+  if (def < 0) return;
+
+  ValueExpr key = { .op = instr->op, .value = def };
+  for (int k = 0; k < 2; k++) key.args[k] = key_operand(g, i, k);
+
+  // A copy of a temporary or variable is the value it copies
+  if (instr->op == IR_COPY && key.args[0].kind == Key_Value) {
+    g->number[def] = key.args[0].number;
+    return;
+  }
+
+  if (is_commutative(instr->op) && key.args[1].kind < key.args[0].kind) {
+    KeyOperand swap = key.args[0];
+    key.args[0] = key.args[1];
+    key.args[1] = swap;
+  }
+
+  int found = lookup(g, &key);
+  if (found < 0) {
+    insert(g, &key);
+    return;
+  }
+
+  int earlier = g->exprs[found].value;
+  g->number[def] = g->number[earlier];
+  if (instr->op == IR_COPY) return;
+
+  if (opt_verbose) {
+    fprintf(stderr, "gvn: ");
+    fprint_ir_instr(stderr, ir, instr);
+    fprintf(stderr, " is redundant, reusing ");
+    fprint_ir_operand(stderr, ir, ssa_name_operand(ir, ssa->value_name[earlier]));
+    fprintf(stderr, "\n");
+  }
+
+  ir_free_operands(instr);
+  instr->op = IR_COPY;
+  instr->args[0] = ssa_name_operand(ir, ssa->value_name[earlier]);
+  instr->args[1] = IrNone();
+  ssa->use_value[2 * i] = earlier;
+  ssa->use_value[2 * i + 1] = -1;
+  g->eliminated++;
+}
+
+static void number_block(Gvn* g, int b) {
+  SsaForm* ssa = g->ssa;
+  IrProgram* ir = ssa->ir;
+  BasicBlock* block = &ssa->cfg->blocks[b];
+  int scope_mark = g->scope.pushed.len;
+  int expr_mark = g->expr_count;
+
+  for (int p = ssa->block_phis[b]; p < ssa->block_phis[b + 1]; p++) {
+    ssa_scope_push(&g->scope, ssa->phis[p].name, ssa->phis[p].dest);
+  }
+
+  for (int i = block->start; i < block->end; i++) {
+    number_instr(g, i);
+
+    int def = ssa->def_value[i];
+    if (def >= 0) ssa_scope_push(&g->scope, ssa_name(ir, ir->instrs[i].dest), def);
+  }
+
+  for (int d = ssa->dom_child_start[b]; d < ssa->dom_child_start[b + 1]; d++) {
+    number_block(g, ssa->dom_children[d]);
+  }
+
+  // Expressions were pushed at the head of their bucket, so they are popped
+  // in reverse order
+  while (g->expr_count > expr_mark) {
+    ValueExpr* expr = &g->exprs[--g->expr_count];
+    g->buckets[bucket_of(g, expr)] = expr->next;
+  }
+  ssa_scope_pop_to(&g->scope, scope_mark);
+}
+
+int global_value_numbering(IrProgram* ir) {
+  SsaForm* ssa = build_ssa(ir);
+
+  int bucket_count = 16;
+  while (bucket_count < 2 * ir->len) bucket_count *= 2;
+
+  Gvn g = {
+    .ssa = ssa,
+    .scope = alloc_ssa_scope(ssa->name_count),
+    .number = calloc(ssa->value_count + 1, sizeof(int)),
+    .exprs = calloc(ir->len + 1, sizeof(ValueExpr)),
+    .buckets = malloc(bucket_count * sizeof(int)),
+    .bucket_count = bucket_count,
+  };
+  ensure_non_null(g.number, "out of space");
+  ensure_non_null(g.exprs, "out of space");
+  ensure_non_null(g.buckets, "out of space");
+
+  for (int v = 0; v < ssa->value_count; v++) g.number[v] = v;
+  for (int b = 0; b < bucket_count; b++) g.buckets[b] = -1;
+
+  if (ssa->cfg->block_count > 0) number_block(&g, 0);
+
+  free_ssa_scope(&g.scope);
+  free(g.number);
+  free(g.exprs);
+  free(g.buckets);
+  free_ssa(ssa);
+  return g.eliminated;
+}
@@ -0,0 +1,818 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "ast.h"
+#include "ir.h"
+#include "datatype99.h"
+
+extern SymbolTable* symtab;
+
+/* ----------------------------- IntList ----------------------------- */
+
+void int_list_push(IntList* list, int item) {
+  if (list->len == list->cap) {
+    list->cap = list->cap ? list->cap * 2 : 4;
+    list->items = realloc(list->items, list->cap * sizeof(int));
+    ensure_non_null(list->items, "out of space");
+  }
+  list->items[list->len++] = item;
+}
+
+void free_int_list(IntList* list) {
+  free(list->items);
+  list->items = NULL;
+  list->len = list->cap = 0;
+}
+
+/* ----------------------------- Program ----------------------------- */
+
+IrProgram* alloc_ir_program() {
+  IrProgram* alloc = calloc(1, sizeof(IrProgram));
+  ensure_non_null(alloc, "out of space");
+  return alloc;
+}
+
+void free_ir_program(IrProgram* ir) {
+  free(ir->temp_types);
+  if (ir->image) {
+    munmap(ir->image, ir->image_size);
+    free(ir->vars);
+    free(ir->instrs);
+    free(ir);
+    return;
+  }
+
+  for (int i = 0; i < ir->len; i++) {
+    for (int j = 0; j < 2; j++) {
+      ifLet(ir->instrs[i].args[j], IrConst, value) {
+        ifLet(*value, StringResult, str) free(*str);
+      }
+    }
+  }
+  for (int i = 0; i < ir->var_count; i++) free(ir->vars[i]);
+
+  free(ir->vars);
+  free(ir->instrs);
+  free(ir);
+}
+
+IrInstr* ir_emit(IrProgram* ir, IrInstr instr) {
+  if (ir->len == ir->cap) {
+    ir->cap = ir->cap ? ir->cap * 2 : 64;
+    ir->instrs = realloc(ir->instrs, ir->cap * sizeof(IrInstr));
+    ensure_non_null(ir->instrs, "out of space");
+  }
+
+  ir->instrs[ir->len] = instr;
+  return &ir->instrs[ir->len++];
+}
+
+// Inserts an instruction before the one at `index`
+IrInstr* ir_insert(IrProgram* ir, int index, IrInstr instr) {
+  ir_emit(ir, instr);
+  memmove(&ir->instrs[index + 1], &ir->instrs[index], (ir->len - 1 - index) * sizeof(IrInstr));
+  ir->instrs[index] = instr;
+  return &ir->instrs[index];
+}
+
+// Deletes every instruction whose entry in `remove` is set, keeping the rest
+// in order. Returns the number of instructions removed.
+int ir_remove_marked(IrProgram* ir, bool* remove) {
+  int len = 0;
+  for (int i = 0; i < ir->len; i++) {
+    if (!remove[i]) ir->instrs[len++] = ir->instrs[i];
+  }
+
+  int removed = ir->len - len;
+  ir->len = len;
+  return removed;
+}
+
+// Like ir_remove_marked, for instructions that are dropped rather than moved
+// elsewhere, so the constants they hold are freed
+int ir_discard_marked(IrProgram* ir, bool* remove) {
+  for (int i = 0; i < ir->len; i++) {
+    if (remove[i]) ir_free_operands(&ir->instrs[i]);
+  }
+  return ir_remove_marked(ir, remove);
+}
+
+int ir_new_temp(IrProgram* ir) {
+  return ir->temp_count++;
+}
+
+int ir_new_label(IrProgram* ir) {
+  return ir->label_count++;
+}
+
+int ir_intern_var(IrProgram* ir, char* name) {
+  for (int i = 0; i < ir->var_count; i++) {
+    if (strcmp(ir->vars[i], name) == 0) return i;
+  }
+
+  if (ir->var_count == ir->var_cap) {
+    ir->var_cap = ir->var_cap ? ir->var_cap * 2 : 16;
+    ir->vars = realloc(ir->vars, ir->var_cap * sizeof(char*));
+    ensure_non_null(ir->vars, "out of space");
+  }
+
+  ir->vars[ir->var_count] = strdup(name);
+  return ir->var_count++;
+}
+
+IrInstr ir_instr(IrOpcode op, IrOperand dest, IrOperand a, IrOperand b) {
+  return (IrInstr){ .op = op, .dest = dest, .args = { a, b }, .label = -1 };
+}
+
+IrInstr ir_label_instr(IrOpcode op, int label) {
+  IrInstr instr = ir_instr(op, IrNone(), IrNone(), IrNone());
+  instr.label = label;
+  return instr;
+}
+
+IrInstr ir_if_instr(IrOperand cond, int label) {
+  IrInstr instr = ir_instr(IR_IF, IrNone(), cond, IrNone());
+  instr.label = label;
+  return instr;
+}
+
+IrInstr ir_if_cmp_instr(IrOpcode relop, IrOperand a, IrOperand b, int label) {
+  IrInstr instr = ir_instr(IR_IF_CMP, IrNone(), a, b);
+  instr.relop = relop;
+  instr.label = label;
+  return instr;
+}
+
+// Lowers a parsed program into a new IR program
+IrProgram* ir_lower(StatementList* stmts) {
+  IrProgram* ir = alloc_ir_program();
+  ir_stmt_list(ir, stmts);
+  return ir;
+}
+
+/* ----------------------------- Opcodes ----------------------------- */
+
+bool ir_is_binary(IrOpcode op) {
+  switch (op) {
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+    case IR_EQ: case IR_GT: case IR_GTE: case IR_LT: case IR_LTE:
+    case IR_AND: case IR_OR:
+    case IR_FOR_TRIP:
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV:
+    case IR_FEQ: case IR_FGT: case IR_FGTE: case IR_FLT: case IR_FLTE:
+    case IR_BAND: case IR_BOR: case IR_BEQ:
+    case IR_CONCAT: case IR_STREQ:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Instructions that may transfer control to a label
+bool ir_is_branch(IrOpcode op) {
+  return op == IR_GOTO || ir_is_cond_branch(op);
+}
+
+bool ir_is_cond_branch(IrOpcode op) {
+  return op == IR_IF || op == IR_IF_CMP || op == IR_IF_NOT || op == IR_IF_NOT_CMP;
+}
+
+// Conditional branches comparing their two operands with `relop`
+bool ir_is_cmp_branch(IrOpcode op) {
+  return op == IR_IF_CMP || op == IR_IF_NOT_CMP;
+}
+
+// Conditional branches taken when their condition is false
+bool ir_is_negated_branch(IrOpcode op) {
+  return op == IR_IF_NOT || op == IR_IF_NOT_CMP;
+}
+
+// The branch taken exactly when `op` is not. Comparisons are not inverted
+// into their opposite relation, as comparisons with NaN are false both ways.
+IrOpcode ir_invert_branch(IrOpcode op) {
+  switch (op) {
+    case IR_IF: return IR_IF_NOT;
+    case IR_IF_NOT: return IR_IF;
+    case IR_IF_CMP: return IR_IF_NOT_CMP;
+    case IR_IF_NOT_CMP: return IR_IF_CMP;
+    default:
+      unreachable("ir_invert_branch");
+      return op;
+  }
+}
+
+bool ir_is_unary(IrOpcode op) {
+  return op == IR_NEG || op == IR_NOT || op == IR_TRUNC || op == IR_IS_NUMBER || op == IR_FNEG || op == IR_BNOT;
+}
+
+// Instructions that only operate on values of one type
+bool ir_is_typed(IrOpcode op) {
+  return op >= IR_FADD && op <= IR_STREQ;
+}
+
+bool ir_is_check(IrOpcode op) {
+  return op == IR_CHECK_NUMBER || op == IR_CHECK_BOOLEAN || op == IR_CHECK_STRING;
+}
+
+// The untyped instruction computing what the typed `op` does
+IrOpcode ir_untyped_op(IrOpcode op) {
+  switch (op) {
+    case IR_FADD: case IR_CONCAT: return IR_ADD;
+    case IR_FSUB: return IR_SUB;
+    case IR_FMUL: return IR_MUL;
+    case IR_FDIV: return IR_DIV;
+    case IR_FNEG: return IR_NEG;
+    case IR_FEQ: case IR_BEQ: case IR_STREQ: return IR_EQ;
+    case IR_FGT: return IR_GT;
+    case IR_FGTE: return IR_GTE;
+    case IR_FLT: return IR_LT;
+    case IR_FLTE: return IR_LTE;
+    case IR_BAND: return IR_AND;
+    case IR_BOR: return IR_OR;
+    case IR_BNOT: return IR_NOT;
+    default: return op;
+  }
+}
+
+// Type of the operands of a typed instruction or a check
+IrType ir_operand_type(IrOpcode op) {
+  switch (op) {
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: case IR_FNEG:
+    case IR_FEQ: case IR_FGT: case IR_FGTE: case IR_FLT: case IR_FLTE:
+    case IR_CHECK_NUMBER:
+      return IR_TYPE_NUMBER;
+    case IR_BAND: case IR_BOR: case IR_BNOT: case IR_BEQ: case IR_CHECK_BOOLEAN:
+      return IR_TYPE_BOOLEAN;
+    case IR_CONCAT: case IR_STREQ: case IR_CHECK_STRING:
+      return IR_TYPE_STRING;
+    default:
+      return IR_TYPE_ANY;
+  }
+}
+
+IrType ir_result_type(ExprResult value) {
+  match (value) {
+    of(BooleanResult, _) return IR_TYPE_BOOLEAN;
+    of(NumberResult, _) return IR_TYPE_NUMBER;
+    of(StringResult, _) return IR_TYPE_STRING;
+  }
+  return IR_TYPE_ANY;
+}
+
+const char* ir_type_name(IrType type) {
+  switch (type) {
+    case IR_TYPE_NONE: return "none";
+    case IR_TYPE_BOOLEAN: return "boolean";
+    case IR_TYPE_NUMBER: return "number";
+    case IR_TYPE_STRING: return "string";
+    default: return "any";
+  }
+}
+
+const char* ir_op_symbol(IrOpcode op) {
+  switch (op) {
+    case IR_ADD: return "+";
+    case IR_SUB: return "-";
+    case IR_MUL: return "*";
+    case IR_DIV: return "/";
+    case IR_NEG: return "-";
+    case IR_EQ:  return "==";
+    case IR_GT:  return ">";
+    case IR_GTE: return ">=";
+    case IR_LT:  return "<";
+    case IR_LTE: return "<=";
+    case IR_AND: return "&&";
+    case IR_OR:  return "||";
+    case IR_NOT: return "!";
+    case IR_FOR_TRIP: return "trip";
+    case IR_TRUNC: return "int";
+    case IR_IS_NUMBER: return "isnum";
+    case IR_FADD: return "fadd";
+    case IR_FSUB: return "fsub";
+    case IR_FMUL: return "fmul";
+    case IR_FDIV: return "fdiv";
+    case IR_FNEG: return "fneg";
+    case IR_FEQ: return "feq";
+    case IR_FGT: return "fgt";
+    case IR_FGTE: return "fge";
+    case IR_FLT: return "flt";
+    case IR_FLTE: return "fle";
+    case IR_BAND: return "and";
+    case IR_BOR: return "or";
+    case IR_BNOT: return "not";
+    case IR_BEQ: return "beq";
+    case IR_CONCAT: return "concat";
+    case IR_STREQ: return "streq";
+    default: return "?";
+  }
+}
+
+static IdentBinaryOp ir_binary_op(IrOpcode op) {
+  switch (op) {
+    case IR_ADD: return IdentBOp_Plus;
+    case IR_SUB: return IdentBOp_Minus;
+    case IR_MUL: return IdentBOp_Star;
+    case IR_DIV: return IdentBOp_Slash;
+    case IR_EQ:  return IdentBOp_EqEq;
+    case IR_GT:  return IdentBOp_Gt;
+    case IR_GTE: return IdentBOp_Gte;
+    case IR_LT:  return IdentBOp_Lt;
+    case IR_LTE: return IdentBOp_Lte;
+    case IR_AND: return IdentBOp_And;
+    case IR_OR:  return IdentBOp_Or;
+    default:
+      unreachable("ir_binary_op");
+      return IdentBOp_Plus;
+  }
+}
+
+/* ----------------------------- Folding ----------------------------- */
+
+// Computes `a op b` (or `op a` for unary operators, `a` for copies) at
+// compile time with the same semantics as eval_binary_values. Returns false
+// when evaluating it would be a runtime error, in which case the instruction
+// has to be kept so the error still happens. Strings in the result are newly
+// allocated.
+bool ir_fold(IrOpcode op, ExprResult a, ExprResult b, ExprResult* out) {
+  // Typed instructions compute what the untyped ones do on their types
+  if (ir_is_typed(op)) {
+    IrType type = ir_operand_type(op);
+    if (ir_result_type(a) != type || (ir_is_binary(op) && ir_result_type(b) != type)) return false;
+    op = ir_untyped_op(op);
+  }
+
+  switch (op) {
+    case IR_COPY:
+      *out = ir_copy_result(a);
+      return true;
+    case IR_NEG:
+      ifLet(a, NumberResult, num) {
+        *out = NumberResult(- *num);
+        return true;
+      }
+      return false;
+    case IR_NOT:
+      ifLet(a, BooleanResult, boolean) {
+        *out = BooleanResult(!*boolean);
+        return true;
+      }
+      return false;
+    case IR_FOR_TRIP:
+      if (!MATCHES(a, NumberResult) || !MATCHES(b, NumberResult)) return false;
+      *out = NumberResult(for_loop_trip_count(a, b));
+      return true;
+    case IR_TRUNC:
+      ifLet(a, NumberResult, num) {
+        *out = NumberResult(for_loop_start(*num));
+        return true;
+      }
+      return false;
+    case IR_IS_NUMBER:
+      *out = BooleanResult(MATCHES(a, NumberResult));
+      return true;
+    default:
+      break;
+  }
+
+  if (a.tag != b.tag) {
+    // Values of different types only ever compare unequal
+    if (op != IR_EQ) return false;
+    *out = BooleanResult(false);
+    return true;
+  }
+
+  match (a) {
+    of(BooleanResult, lhs) {
+      bool rhs = b.data.BooleanResult._0;
+      switch (op) {
+        case IR_EQ: *out = BooleanResult(*lhs == rhs); return true;
+        case IR_AND: *out = BooleanResult(*lhs && rhs); return true;
+        case IR_OR: *out = BooleanResult(*lhs || rhs); return true;
+        default: return false;
+      }
+    }
+    of(StringResult, lhs) {
+      char* rhs = b.data.StringResult._0;
+      switch (op) {
+        case IR_ADD: *out = StringResult(concat_str(*lhs, rhs)); return true;
+        case IR_EQ: *out = BooleanResult(strcmp(*lhs, rhs) == 0); return true;
+        default: return false;
+      }
+    }
+    of(NumberResult, lhs) {
+      double rhs = b.data.NumberResult._0;
+      switch (op) {
+        case IR_ADD: *out = NumberResult(*lhs + rhs); return true;
+        case IR_SUB: *out = NumberResult(*lhs - rhs); return true;
+        case IR_MUL: *out = NumberResult(*lhs * rhs); return true;
+        case IR_DIV: *out = NumberResult(*lhs / rhs); return true;
+        case IR_EQ:  *out = BooleanResult(*lhs == rhs); return true;
+        case IR_GT:  *out = BooleanResult(*lhs > rhs); return true;
+        case IR_GTE: *out = BooleanResult(*lhs >= rhs); return true;
+        case IR_LT:  *out = BooleanResult(*lhs < rhs); return true;
+        case IR_LTE: *out = BooleanResult(*lhs <= rhs); return true;
+        default: return false;
+      }
+    }
+  }
+
+  return false;
+}
+
+ExprResult ir_copy_result(ExprResult value) {
+  ifLet(value, StringResult, str) return StringResult(strdup(*str));
+  return value;
+}
+
+bool ir_results_equal(ExprResult a, ExprResult b) {
+  if (a.tag != b.tag) return false;
+
+  match (a) {
+    of(BooleanResult, boolean) return *boolean == b.data.BooleanResult._0;
+    // Compared bitwise so that 0 and -0, which display differently, are not
+    // treated as the same constant
+    of(NumberResult, number) return memcmp(number, &b.data.NumberResult._0, sizeof(double)) == 0;
+    of(StringResult, str) return strcmp(*str, b.data.StringResult._0) == 0;
+  }
+
+  return false;
+}
+
+void ir_free_result(ExprResult value) {
+  ifLet(value, StringResult, str) free(*str);
+}
+
+// Frees the constants an instruction reads, before it is removed or replaced
+void ir_free_operands(IrInstr* instr) {
+  for (int k = 0; k < 2; k++) {
+    ifLet(instr->args[k], IrConst, constant) ir_free_result(*constant);
+  }
+}
+
+/* ----------------------------- Printing ----------------------------- */
+
+// Whether a variable called `name` would read back as a temporary or a
+// number, and so is printed as $name
+static bool ir_name_needs_sigil(const char* name) {
+  char* end;
+  if (strchr("trs", name[0]) && name[1] != '\0' && strspn(name + 1, "0123456789") == strlen(name + 1)) return true;
+  strtod(name, &end);
+  return end != name && *end == '\0';
+}
+
+// Prints numbers with %g when that reads back as the same value, and with
+// as few more digits as it takes otherwise
+static void fprint_ir_number(FILE* out, double number) {
+  char digits[32];
+  snprintf(digits, sizeof(digits), "%g", number);
+  for (int precision = 15; precision <= 17 && !isnan(number) && strtod(digits, NULL) != number; precision++) {
+    snprintf(digits, sizeof(digits), "%.*g", precision, number);
+  }
+  fputs(digits, out);
+}
+
+static void fprint_ir_string(FILE* out, const char* str) {
+  fputc('"', out);
+  for (; *str; str++) {
+    switch (*str) {
+      case '"': fputs("\\\"", out); break;
+      case '\\': fputs("\\\\", out); break;
+      case '\n': fputs("\\n", out); break;
+      case '\t': fputs("\\t", out); break;
+      default: fputc(*str, out);
+    }
+  }
+  fputc('"', out);
+}
+
+void fprint_ir_operand(FILE* out, IrProgram* ir, IrOperand operand) {
+  match (operand) {
+    of(IrNone) {}
+    of(IrTemp, temp) {
+      if (ir->reg_count == 0) fprintf(out, "t%d", *temp);
+      else if (*temp < ir->reg_count) fprintf(out, "r%d", *temp);
+      else fprintf(out, "s%d", *temp - ir->reg_count);
+    }
+    of(IrVar, var) {
+      if (ir_name_needs_sigil(ir->vars[*var])) fputc('$', out);
+      fprintf(out, "%s", ir->vars[*var]);
+    }
+    of(IrConst, value) {
+      match (*value) {
+        of(BooleanResult, boolean) fprintf(out, "%s", *boolean ? "true" : "false");
+        of(NumberResult, number) fprint_ir_number(out, *number);
+        of(StringResult, string) fprint_ir_string(out, *string);
+      }
+    }
+  }
+}
+
+static void print_plain_operand(FILE* out, IrProgram* ir, IrOperand* operand, void* ctx) {
+  (void)ctx;
+  fprint_ir_operand(out, ir, *operand);
+}
+
+// Prints the value `op` computes from `args`
+static void fprint_ir_expr(FILE* out, IrProgram* ir, IrOpcode op, IrOperand* args, IrOperandPrinter print_operand, void* ctx) {
+  if (ir_is_unary(op)) {
+    fprintf(out, "%s ", ir_op_symbol(op));
+    print_operand(out, ir, &args[0], ctx);
+  } else if (op == IR_FOR_TRIP) {
+    fprintf(out, "trip ");
+    print_operand(out, ir, &args[0], ctx);
+    fprintf(out, ", ");
+    print_operand(out, ir, &args[1], ctx);
+  } else if (ir_is_binary(op)) {
+    print_operand(out, ir, &args[0], ctx);
+    fprintf(out, " %s ", ir_op_symbol(op));
+    print_operand(out, ir, &args[1], ctx);
+  } else {
+    print_operand(out, ir, &args[0], ctx);
+  }
+}
+
+// Prints an instruction without the trailing newline, printing its operands
+// with `print_operand`
+void fprint_ir_instr_with(FILE* out, IrProgram* ir, IrInstr* instr, IrOperandPrinter print_operand, void* ctx) {
+  switch (instr->op) {
+    case IR_LABEL: fprintf(out, "L%d:", instr->label); return;
+    case IR_GOTO: fprintf(out, "goto L%d", instr->label); return;
+    case IR_IF:
+      fprintf(out, "if ");
+      print_operand(out, ir, &instr->args[0], ctx);
+      fprintf(out, " == true goto L%d", instr->label);
+      return;
+    case IR_IF_NOT:
+      fprintf(out, "if ");
+      print_operand(out, ir, &instr->args[0], ctx);
+      fprintf(out, " == false goto L%d", instr->label);
+      return;
+    case IR_IF_CMP: {
+      // Comparing for equality with a boolean constant is parenthesized so
+      // it does not read back as an IR_IF or IR_IF_NOT
+      bool parens = instr->relop == IR_EQ && MATCHES(instr->args[1], IrConst)
+        && MATCHES(instr->args[1].data.IrConst._0, BooleanResult);
+      fprintf(out, parens ? "if (" : "if ");
+      print_operand(out, ir, &instr->args[0], ctx);
+      fprintf(out, " %s ", ir_op_symbol(instr->relop));
+      print_operand(out, ir, &instr->args[1], ctx);
+      fprintf(out, parens ? ") goto L%d" : " goto L%d", instr->label);
+      return;
+    }
+    case IR_IF_NOT_CMP:
+      fprintf(out, "if !(");
+      print_operand(out, ir, &instr->args[0], ctx);
+      fprintf(out, " %s ", ir_op_symbol(instr->relop));
+      print_operand(out, ir, &instr->args[1], ctx);
+      fprintf(out, ") goto L%d", instr->label);
+      return;
+    case IR_DISPLAY:
+      fprintf(out, "display ");
+      print_operand(out, ir, &instr->args[0], ctx);
+      return;
+    case IR_CHECK_NUMBER: case IR_CHECK_BOOLEAN: case IR_CHECK_STRING:
+      fprintf(out, "check %s ", ir_type_name(ir_operand_type(instr->op)));
+      if (instr->relop == IR_IF) fprintf(out, "if ");
+      fprint_ir_expr(out, ir, instr->relop, instr->args, print_operand, ctx);
+      return;
+    default: break;
+  }
+
+  print_operand(out, ir, &instr->dest, ctx);
+  fprintf(out, " = ");
+  fprint_ir_expr(out, ir, instr->op, instr->args, print_operand, ctx);
+}
+
+// Prints an instruction without the trailing newline
+void fprint_ir_instr(FILE* out, IrProgram* ir, IrInstr* instr) {
+  fprint_ir_instr_with(out, ir, instr, print_plain_operand, NULL);
+}
+
+void print_ir(IrProgram* ir) {
+  for (int i = 0; i < ir->len; i++) {
+    fprint_ir_instr(stdout, ir, &ir->instrs[i]);
+    printf("\n");
+  }
+}
+
+/* ----------------------------- Execution ----------------------------- */
+
+typedef struct {
+  IrProgram* ir;
+  ExprResult* temps;
+  Symbol** vars;  // Symbol table entry of each variable, NULL until assigned
+} IrFrame;
+
+static ExprResult read_operand(IrFrame* frame, IrOperand operand) {
+  match (operand) {
+    of(IrTemp, temp) return frame->temps[*temp];
+    of(IrVar, var) {
+      if (!frame->vars[*var]) undefined_variable_error(frame->ir->vars[*var]);
+      return frame->vars[*var]->value;
+    }
+    of(IrConst, value) return *value;
+    of(IrNone) {}
+  }
+
+  unreachable("read_operand");
+  return BooleanResult(false);
+}
+
+static void write_operand(IrFrame* frame, IrOperand operand, ExprResult value) {
+  match (operand) {
+    of(IrTemp, temp) frame->temps[*temp] = value;
+    of(IrVar, var) {
+      if (frame->vars[*var]) {
+        frame->vars[*var]->value = value;
+      } else {
+        add_symbol(&symtab, frame->ir->vars[*var], value);
+        frame->vars[*var] = symbol_lookup(symtab, frame->ir->vars[*var]);
+      }
+    }
+    otherwise unreachable("write_operand");
+  }
+}
+
+static ExprResult exec_unary(IrOpcode op, ExprResult value) {
+  if (op == IR_NEG) {
+    ifLet(value, NumberResult, num) return NumberResult(- *num);
+    runtime_error("unsupported variable type for number negation");
+  } else {
+    ifLet(value, BooleanResult, boolean) return BooleanResult(!*boolean);
+    runtime_error("unsupported variable type for boolean negation");
+  }
+
+  return value;
+}
+
+static bool exec_condition(ExprResult value) {
+  ifLet(value, BooleanResult, boolean) return *boolean;
+  runtime_error("if condition must evaluate to a boolean");
+  return false;
+}
+
+// Operands of typed instructions, which only ever get values of their type
+static double number_value(ExprResult value) {
+  if (!MATCHES(value, NumberResult)) unreachable("number_value");
+  return value.data.NumberResult._0;
+}
+
+static bool boolean_value(ExprResult value) {
+  if (!MATCHES(value, BooleanResult)) unreachable("boolean_value");
+  return value.data.BooleanResult._0;
+}
+
+static char* string_value(ExprResult value) {
+  if (!MATCHES(value, StringResult)) unreachable("string_value");
+  return value.data.StringResult._0;
+}
+
+static ExprResult exec_typed(IrOpcode op, ExprResult a, ExprResult b) {
+  switch (op) {
+    case IR_FADD: return NumberResult(number_value(a) + number_value(b));
+    case IR_FSUB: return NumberResult(number_value(a) - number_value(b));
+    case IR_FMUL: return NumberResult(number_value(a) * number_value(b));
+    case IR_FDIV: return NumberResult(number_value(a) / number_value(b));
+    case IR_FNEG: return NumberResult(- number_value(a));
+    case IR_FEQ: return BooleanResult(number_value(a) == number_value(b));
+    case IR_FGT: return BooleanResult(number_value(a) > number_value(b));
+    case IR_FGTE: return BooleanResult(number_value(a) >= number_value(b));
+    case IR_FLT: return BooleanResult(number_value(a) < number_value(b));
+    case IR_FLTE: return BooleanResult(number_value(a) <= number_value(b));
+    case IR_BAND: return BooleanResult(boolean_value(a) && boolean_value(b));
+    case IR_BOR: return BooleanResult(boolean_value(a) || boolean_value(b));
+    case IR_BNOT: return BooleanResult(!boolean_value(a));
+    case IR_BEQ: return BooleanResult(boolean_value(a) == boolean_value(b));
+    case IR_CONCAT: return StringResult(concat_str(string_value(a), string_value(b)));
+    case IR_STREQ: return BooleanResult(strcmp(string_value(a), string_value(b)) == 0);
+    default:
+      unreachable("exec_typed");
+      return a;
+  }
+}
+
+// Raises the error the instruction or branch checked by `check` raises when
+// its operands are not all of the checked type
+static void exec_check(IrInstr* check, ExprResult a, ExprResult b) {
+  IrType type = ir_operand_type(check->op);
+  if (ir_result_type(a) == type && (!ir_is_binary(check->relop) || ir_result_type(b) == type)) return;
+
+  switch (check->relop) {
+    case IR_IF: exec_condition(a); break;
+    case IR_NEG: case IR_NOT: exec_unary(check->relop, a); break;
+    case IR_TRUNC: runtime_error("start variable should be a number in for loop"); break;
+    case IR_FOR_TRIP: for_loop_trip_count(a, b); break;
+    default: eval_binary_values(a, ir_binary_op(check->relop), b); break;
+  }
+  unreachable("exec_check");
+}
+
+void exec_ir(IrProgram* ir) {
+  IrFrame frame = {
+    .ir = ir,
+    .temps = calloc(ir->temp_count + 1, sizeof(ExprResult)),
+    .vars = calloc(ir->var_count + 1, sizeof(Symbol*)),
+  };
+  ensure_non_null(frame.temps, "out of space");
+  ensure_non_null(frame.vars, "out of space");
+
+  // Loaded programs come with their label table
+  int32_t* computed_pcs = NULL;
+  const int32_t* label_pc = ir->label_pcs;
+  if (!label_pc) {
+    computed_pcs = malloc((ir->label_count + 1) * sizeof(int32_t));
+    ensure_non_null(computed_pcs, "out of space");
+    for (int i = 0; i < ir->len; i++) {
+      if (ir->instrs[i].op == IR_LABEL) computed_pcs[ir->instrs[i].label] = i;
+    }
+    label_pc = computed_pcs;
+  }
+
+  int pc = 0;
+  while (pc < ir->len) {
+    IrInstr* instr = &ir->instrs[pc++];
+
+    switch (instr->op) {
+      case IR_COPY:
+        write_operand(&frame, instr->dest, read_operand(&frame, instr->args[0]));
+        break;
+      case IR_NEG: case IR_NOT: {
+        ExprResult value = read_operand(&frame, instr->args[0]);
+        write_operand(&frame, instr->dest, exec_unary(instr->op, value));
+        break;
+      }
+      case IR_FOR_TRIP: {
+        ExprResult from = read_operand(&frame, instr->args[0]);
+        ExprResult to = read_operand(&frame, instr->args[1]);
+        write_operand(&frame, instr->dest, NumberResult(for_loop_trip_count(from, to)));
+        break;
+      }
+      case IR_TRUNC: {
+        ExprResult from = read_operand(&frame, instr->args[0]);
+        if (!MATCHES(from, NumberResult)) {
+          runtime_error("start variable should be a number in for loop");
+        }
+        write_operand(&frame, instr->dest, NumberResult(for_loop_start(from.data.NumberResult._0)));
+        break;
+      }
+      case IR_IS_NUMBER: {
+        ExprResult value = read_operand(&frame, instr->args[0]);
+        write_operand(&frame, instr->dest, BooleanResult(MATCHES(value, NumberResult)));
+        break;
+      }
+      case IR_DISPLAY:
+        print_result(read_operand(&frame, instr->args[0]));
+        break;
+      case IR_LABEL:
+        break;
+      case IR_GOTO:
+        pc = label_pc[instr->label];
+        break;
+      case IR_IF:
+      case IR_IF_NOT:
+        if (exec_condition(read_operand(&frame, instr->args[0])) != (instr->op == IR_IF_NOT)) {
+          pc = label_pc[instr->label];
+        }
+        break;
+      case IR_IF_CMP:
+      case IR_IF_NOT_CMP: {
+        ExprResult lhs = read_operand(&frame, instr->args[0]);
+        ExprResult rhs = read_operand(&frame, instr->args[1]);
+        bool cond = ir_is_typed(instr->relop)
+          ? boolean_value(exec_typed(instr->relop, lhs, rhs))
+          : exec_condition(eval_binary_values(lhs, ir_binary_op(instr->relop), rhs));
+        if (cond != (instr->op == IR_IF_NOT_CMP)) {
+          pc = label_pc[instr->label];
+        }
+        break;
+      }
+      case IR_CHECK_NUMBER: case IR_CHECK_BOOLEAN: case IR_CHECK_STRING: {
+        ExprResult a = read_operand(&frame, instr->args[0]);
+        ExprResult b = ir_is_binary(instr->relop) ? read_operand(&frame, instr->args[1]) : a;
+        exec_check(instr, a, b);
+        break;
+      }
+      case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: case IR_FNEG:
+      case IR_FEQ: case IR_FGT: case IR_FGTE: case IR_FLT: case IR_FLTE:
+      case IR_BAND: case IR_BOR: case IR_BNOT: case IR_BEQ:
+      case IR_CONCAT: case IR_STREQ: {
+        ExprResult lhs = read_operand(&frame, instr->args[0]);
+        ExprResult rhs = ir_is_binary(instr->op) ? read_operand(&frame, instr->args[1]) : lhs;
+        write_operand(&frame, instr->dest, exec_typed(instr->op, lhs, rhs));
+        break;
+      }
+      default: {
+        ExprResult lhs = read_operand(&frame, instr->args[0]);
+        ExprResult rhs = read_operand(&frame, instr->args[1]);
+        write_operand(&frame, instr->dest, eval_binary_values(lhs, ir_binary_op(instr->op), rhs));
+        break;
+      }
+    }
+  }
+
+  free(computed_pcs);
+  free(frame.vars);
+  free(frame.temps);
+}
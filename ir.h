@@ -0,0 +1,196 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "ast.h"
+#include "datatype99.h"
+
+/*
+ * Three address intermediate representation.
+ *
+ * A program is a growable array of quads. Each quad has an opcode, an optional
+ * destination and up to two operands. Labels are markers in the same array,
+ * and jumps refer to them by number.
+ */
+
+typedef enum {
+  IR_COPY,    // dest = a
+
+  IR_ADD,     // dest = a + b
+  IR_SUB,     // dest = a - b
+  IR_MUL,     // dest = a * b
+  IR_DIV,     // dest = a / b
+  IR_NEG,     // dest = - a
+
+  IR_EQ,      // dest = a == b
+  IR_GT,      // dest = a > b
+  IR_GTE,     // dest = a >= b
+  IR_LT,      // dest = a < b
+  IR_LTE,     // dest = a <= b
+
+  IR_AND,     // dest = a && b
+  IR_OR,      // dest = a || b
+  IR_NOT,     // dest = ! a
+
+  IR_FOR_TRIP, // dest = trip a, b: iterations of `for i = a to b`
+  IR_TRUNC,    // dest = int a: first value of the loop variable counting from a
+  IR_IS_NUMBER, // dest = isnum a: whether a is a number, never fails
+
+  IR_DISPLAY, // display a
+
+  IR_LABEL,   // Lk:
+  IR_GOTO,    // goto Lk
+  IR_IF,      // if a == true goto Lk
+  IR_IF_CMP,  // if a relop b goto Lk
+  IR_IF_NOT,      // if a == false goto Lk
+  IR_IF_NOT_CMP,  // if !(a relop b) goto Lk
+
+  // Typed instructions, which type_ir uses when the types of the operands are
+  // known. They never fail, and the relops among them can be the relop of a
+  // comparing branch.
+  IR_FADD,    // dest = a fadd b: numbers
+  IR_FSUB,    // dest = a fsub b
+  IR_FMUL,    // dest = a fmul b
+  IR_FDIV,    // dest = a fdiv b
+  IR_FNEG,    // dest = fneg a
+  IR_FEQ,     // dest = a feq b
+  IR_FGT,     // dest = a fgt b
+  IR_FGTE,    // dest = a fge b
+  IR_FLT,     // dest = a flt b
+  IR_FLTE,    // dest = a fle b
+  IR_BAND,    // dest = a and b: booleans
+  IR_BOR,     // dest = a or b
+  IR_BNOT,    // dest = not a
+  IR_BEQ,     // dest = a beq b
+  IR_CONCAT,  // dest = a concat b: strings
+  IR_STREQ,   // dest = a streq b
+
+  // check number a op b: fails the way the untyped instruction or branch
+  // `relop` on a and b would, unless they are all numbers
+  IR_CHECK_NUMBER,
+  IR_CHECK_BOOLEAN,
+  IR_CHECK_STRING,
+
+  IR_OPCODE_COUNT,
+} IrOpcode;
+
+// Static types of values. IR_TYPE_NONE is the type of a temporary or
+// variable no value has been stored in yet, and IR_TYPE_ANY the type of one
+// that can hold values of several types.
+typedef enum {
+  IR_TYPE_NONE,
+  IR_TYPE_BOOLEAN,
+  IR_TYPE_NUMBER,
+  IR_TYPE_STRING,
+  IR_TYPE_ANY,
+} IrType;
+
+datatype(
+  IrOperand,
+  (IrNone),
+  (IrTemp, int),
+  (IrVar, int),
+  (IrConst, ExprResult)
+);
+
+typedef struct {
+  IrOpcode op;
+  IrOperand dest;
+  IrOperand args[2];
+
+  int label;       // Label defined by IR_LABEL, or jumped to by a branch
+  IrOpcode relop;  // Comparison done by IR_IF_CMP/IR_IF_NOT_CMP, instruction checked by IR_CHECK_*
+} IrInstr;
+
+struct IrProgram {
+  IrInstr* instrs;
+  int len;
+  int cap;
+
+  // Variables are interned, and referred to by their index in this array
+  char** vars;
+  int var_count;
+  int var_cap;
+
+  int temp_count;
+  int label_count;
+
+  // Lowering options: for loops with a constant trip count are unrolled by
+  // unroll_factor (0 disables unrolling), as long as the unrolled body stays
+  // within unroll_budget instructions
+  int unroll_factor;
+  int unroll_budget;
+
+  // Set by register allocation: temporaries below reg_count are registers,
+  // printed as rN, and the ones above are spill slots, printed as sN
+  int reg_count;
+
+  // Set by type_ir: the type of every value each temporary holds
+  IrType* temp_types;
+
+  // Set for programs loaded from a binary file: the instruction index of
+  // every label, and the file mapping that holds it and the program's names
+  // and strings
+  const int32_t* label_pcs;
+  void* image;
+  size_t image_size;
+};
+
+// Growable list of integers used by the analyses over the IR
+typedef struct {
+  int* items;
+  int len;
+  int cap;
+} IntList;
+
+void int_list_push(IntList* list, int item);
+void free_int_list(IntList* list);
+
+IrProgram* alloc_ir_program();
+IrProgram* ir_lower(StatementList* stmts);
+void free_ir_program(IrProgram* ir);
+
+IrInstr* ir_emit(IrProgram* ir, IrInstr instr);
+IrInstr* ir_insert(IrProgram* ir, int index, IrInstr instr);
+int ir_remove_marked(IrProgram* ir, bool* remove);
+int ir_discard_marked(IrProgram* ir, bool* remove);
+int ir_new_temp(IrProgram* ir);
+int ir_new_label(IrProgram* ir);
+int ir_intern_var(IrProgram* ir, char* name);
+
+IrInstr ir_instr(IrOpcode op, IrOperand dest, IrOperand a, IrOperand b);
+IrInstr ir_label_instr(IrOpcode op, int label);
+IrInstr ir_if_instr(IrOperand cond, int label);
+IrInstr ir_if_cmp_instr(IrOpcode relop, IrOperand a, IrOperand b, int label);
+
+bool ir_is_binary(IrOpcode op);
+bool ir_is_branch(IrOpcode op);
+bool ir_is_cond_branch(IrOpcode op);
+bool ir_is_cmp_branch(IrOpcode op);
+bool ir_is_negated_branch(IrOpcode op);
+IrOpcode ir_invert_branch(IrOpcode op);
+bool ir_is_unary(IrOpcode op);
+bool ir_is_typed(IrOpcode op);
+bool ir_is_check(IrOpcode op);
+IrOpcode ir_untyped_op(IrOpcode op);
+IrType ir_operand_type(IrOpcode op);
+IrType ir_result_type(ExprResult value);
+const char* ir_type_name(IrType type);
+const char* ir_op_symbol(IrOpcode op);
+
+bool ir_fold(IrOpcode op, ExprResult a, ExprResult b, ExprResult* out);
+ExprResult ir_copy_result(ExprResult value);
+bool ir_results_equal(ExprResult a, ExprResult b);
+void ir_free_result(ExprResult value);
+void ir_free_operands(IrInstr* instr);
+
+void fprint_ir_operand(FILE* out, IrProgram* ir, IrOperand operand);
+void fprint_ir_instr(FILE* out, IrProgram* ir, IrInstr* instr);
+
+typedef void (*IrOperandPrinter)(FILE* out, IrProgram* ir, IrOperand* operand, void* ctx);
+void fprint_ir_instr_with(FILE* out, IrProgram* ir, IrInstr* instr, IrOperandPrinter print_operand, void* ctx);
+void print_ir(IrProgram* ir);
+IrProgram* parse_ir(FILE* in);
+
+void exec_ir(IrProgram* ir);
@@ -0,0 +1,409 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ast.h"
+#include "ir.h"
+#include "irbin.h"
+#include "datatype99.h"
+
+/* ----------------------------- Writing ----------------------------- */
+
+typedef struct {
+  char* data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+// Appends `size` bytes to `buffer`, returning the offset they start at
+static uint32_t buffer_append(Buffer* buffer, const void* data, size_t size) {
+  if (size == 0) return buffer->len;
+  if (buffer->len + size > buffer->cap) {
+    while (buffer->len + size > buffer->cap) buffer->cap = buffer->cap ? buffer->cap * 2 : 256;
+    buffer->data = realloc(buffer->data, buffer->cap);
+    ensure_non_null(buffer->data, "out of space");
+  }
+
+  uint32_t offset = buffer->len;
+  memcpy(buffer->data + buffer->len, data, size);
+  buffer->len += size;
+  return offset;
+}
+
+typedef struct {
+  Buffer consts;
+  Buffer strings;
+  ExprResult* values;  // Constants written so far, in pool order
+  int* next;           // Next constant in the same bucket, -1 for the last
+  int count;
+  int cap;
+
+  int* buckets;        // First constant of every bucket, -1 for empty ones
+  int bucket_count;    // A power of two
+} ConstPool;
+
+static void init_const_pool(ConstPool* pool, int operand_count) {
+  pool->bucket_count = 16;
+  while (pool->bucket_count < operand_count) pool->bucket_count *= 2;
+  pool->buckets = malloc(pool->bucket_count * sizeof(int));
+  ensure_non_null(pool->buckets, "out of space");
+  for (int b = 0; b < pool->bucket_count; b++) pool->buckets[b] = -1;
+}
+
+static unsigned hash_const(ExprResult value) {
+  unsigned hash = value.tag * 31u;
+  match (value) {
+    of(BooleanResult, boolean) hash += *boolean ? 7u : 3u;
+    of(NumberResult, number) {
+      unsigned bits[sizeof(double) / sizeof(unsigned)];
+      memcpy(bits, number, sizeof(double));
+      for (size_t w = 0; w < sizeof(bits) / sizeof(unsigned); w++) hash = hash * 31u + bits[w];
+    }
+    of(StringResult, string) {
+      for (char* c = *string; *c; c++) hash = hash * 31u + (unsigned char)*c;
+    }
+  }
+  return hash;
+}
+
+static uint32_t add_string(ConstPool* pool, const char* str) {
+  return buffer_append(&pool->strings, str, strlen(str) + 1);
+}
+
+static int32_t add_const(ConstPool* pool, ExprResult value) {
+  int bucket = hash_const(value) & (pool->bucket_count - 1);
+  for (int i = pool->buckets[bucket]; i >= 0; i = pool->next[i]) {
+    if (ir_results_equal(pool->values[i], value)) return i;
+  }
+
+  IrBinConst constant = { 0 };
+  match (value) {
+    of(BooleanResult, boolean) {
+      constant.kind = IRBIN_BOOLEAN;
+      constant.number = *boolean;
+    }
+    of(NumberResult, number) {
+      constant.kind = IRBIN_NUMBER;
+      constant.number = *number;
+    }
+    of(StringResult, str) {
+      constant.kind = IRBIN_STRING;
+      constant.string = add_string(pool, *str);
+    }
+  }
+  buffer_append(&pool->consts, &constant, sizeof(constant));
+
+  if (pool->count == pool->cap) {
+    pool->cap = pool->cap ? pool->cap * 2 : 16;
+    pool->values = realloc(pool->values, pool->cap * sizeof(ExprResult));
+    pool->next = realloc(pool->next, pool->cap * sizeof(int));
+    ensure_non_null(pool->values, "out of space");
+    ensure_non_null(pool->next, "out of space");
+  }
+  pool->values[pool->count] = value;
+  pool->next[pool->count] = pool->buckets[bucket];
+  pool->buckets[bucket] = pool->count;
+  return pool->count++;
+}
+
+static void encode_operand(ConstPool* pool, IrOperand operand, uint8_t* kind, int32_t* number) {
+  match (operand) {
+    of(IrNone) {
+      *kind = IRBIN_NONE;
+      *number = 0;
+    }
+    of(IrTemp, temp) {
+      *kind = IRBIN_TEMP;
+      *number = *temp;
+    }
+    of(IrVar, var) {
+      *kind = IRBIN_VAR;
+      *number = *var;
+    }
+    of(IrConst, value) {
+      *kind = IRBIN_CONST;
+      *number = add_const(pool, *value);
+    }
+  }
+}
+
+static uint32_t align_offset(uint32_t offset) {
+  return (offset + 7) & ~7u;
+}
+
+static void write_section(FILE* out, uint32_t* at, uint32_t offset, Buffer* section) {
+  static const char zeros[8] = { 0 };
+  fwrite(zeros, 1, offset - *at, out);
+  if (section->len > 0) fwrite(section->data, 1, section->len, out);
+  *at = offset + section->len;
+}
+
+// Writes `ir` to `path` in the binary format
+void write_ir_bin(IrProgram* ir, const char* path) {
+  ConstPool pool = { 0 };
+  Buffer instrs = { 0 };
+  Buffer vars = { 0 };
+  Buffer labels = { 0 };
+  init_const_pool(&pool, 2 * ir->len);
+
+  for (int i = 0; i < ir->var_count; i++) {
+    uint32_t name = add_string(&pool, ir->vars[i]);
+    buffer_append(&vars, &name, sizeof(name));
+  }
+
+  int32_t* label_pcs = malloc((ir->label_count + 1) * sizeof(int32_t));
+  ensure_non_null(label_pcs, "out of space");
+  for (int l = 0; l < ir->label_count; l++) label_pcs[l] = -1;
+
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    IrBinInstr encoded = { .op = instr->op, .relop = instr->relop, .label = instr->label };
+    encode_operand(&pool, instr->dest, &encoded.kinds[0], &encoded.operands[0]);
+    encode_operand(&pool, instr->args[0], &encoded.kinds[1], &encoded.operands[1]);
+    encode_operand(&pool, instr->args[1], &encoded.kinds[2], &encoded.operands[2]);
+    buffer_append(&instrs, &encoded, sizeof(encoded));
+
+    if (instr->op == IR_LABEL) label_pcs[instr->label] = i;
+  }
+  buffer_append(&labels, label_pcs, ir->label_count * sizeof(int32_t));
+
+  IrBinHeader header = {
+    .magic = IRBIN_MAGIC,
+    .version = IRBIN_VERSION,
+    .instr_count = ir->len,
+    .const_count = pool.count,
+    .var_count = ir->var_count,
+    .label_count = ir->label_count,
+    .temp_count = ir->temp_count,
+    .reg_count = ir->reg_count,
+    .strings_size = pool.strings.len,
+  };
+  header.instrs_offset = align_offset(sizeof(header));
+  header.consts_offset = align_offset(header.instrs_offset + instrs.len);
+  header.vars_offset = align_offset(header.consts_offset + pool.consts.len);
+  header.labels_offset = align_offset(header.vars_offset + vars.len);
+  header.strings_offset = align_offset(header.labels_offset + labels.len);
+
+  FILE* out = fopen(path, "wb");
+  if (!out) {
+    perror("could not open output file");
+    exit(1);
+  }
+
+  fwrite(&header, sizeof(header), 1, out);
+  uint32_t at = sizeof(header);
+  write_section(out, &at, header.instrs_offset, &instrs);
+  write_section(out, &at, header.consts_offset, &pool.consts);
+  write_section(out, &at, header.vars_offset, &vars);
+  write_section(out, &at, header.labels_offset, &labels);
+  write_section(out, &at, header.strings_offset, &pool.strings);
+
+  if (ferror(out) | fclose(out)) {
+    perror("could not write output file");
+    exit(1);
+  }
+
+  free(label_pcs);
+  free(pool.values);
+  free(pool.next);
+  free(pool.buckets);
+  free(pool.consts.data);
+  free(pool.strings.data);
+  free(instrs.data);
+  free(vars.data);
+  free(labels.data);
+}
+
+/* ----------------------------- Loading ----------------------------- */
+
+static void invalid_file(const char* path, const char* reason) {
+  fprintf(stderr, "%s: invalid intermediate code file: %s\n", path, reason);
+  exit(1);
+}
+
+// Whether `count` items of `size` bytes starting at `offset` fit in the file
+static bool section_fits(size_t file_size, uint32_t offset, uint32_t count, size_t size) {
+  return offset % 8 == 0 && offset <= file_size && count <= (file_size - offset) / size;
+}
+
+static char* pool_string(const char* path, IrBinHeader* header, char* strings, uint32_t offset) {
+  if (offset >= header->strings_size) invalid_file(path, "string out of range");
+  return strings + offset;
+}
+
+static IrOperand decode_operand(const char* path, IrBinHeader* header, ExprResult* consts, uint8_t kind, int32_t number) {
+  switch (kind) {
+    case IRBIN_NONE: return IrNone();
+    case IRBIN_TEMP:
+      if (number < 0 || (uint32_t)number >= header->temp_count) invalid_file(path, "temporary out of range");
+      return IrTemp(number);
+    case IRBIN_VAR:
+      if (number < 0 || (uint32_t)number >= header->var_count) invalid_file(path, "variable out of range");
+      return IrVar(number);
+    case IRBIN_CONST:
+      if (number < 0 || (uint32_t)number >= header->const_count) invalid_file(path, "constant out of range");
+      return IrConst(consts[number]);
+    default:
+      invalid_file(path, "unknown operand kind");
+  }
+  return IrNone();
+}
+
+static bool is_comparison(IrOpcode op) {
+  switch (op) {
+    case IR_EQ: case IR_GT: case IR_GTE: case IR_LT: case IR_LTE:
+    case IR_FEQ: case IR_FGT: case IR_FGTE: case IR_FLT: case IR_FLTE:
+    case IR_BEQ: case IR_STREQ:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Instructions an IR_CHECK_* may raise the error of
+static bool is_checkable(IrOpcode op) {
+  switch (op) {
+    case IR_IF: case IR_NEG: case IR_NOT: case IR_TRUNC: case IR_FOR_TRIP:
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+    case IR_EQ: case IR_GT: case IR_GTE: case IR_LT: case IR_LTE:
+    case IR_AND: case IR_OR:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether `instr` writes to a temporary or variable exactly when its opcode
+// produces a value, and has every operand its opcode reads
+static bool well_formed(IrInstr* instr) {
+  IrOpcode op = instr->op;
+  bool writes = op != IR_LABEL && !ir_is_branch(op) && op != IR_DISPLAY && !ir_is_check(op);
+  bool has_dest = MATCHES(instr->dest, IrTemp) || MATCHES(instr->dest, IrVar);
+  if (writes ? !has_dest : !MATCHES(instr->dest, IrNone)) return false;
+
+  int reads;
+  if (op == IR_LABEL || op == IR_GOTO) {
+    reads = 0;
+  } else if (ir_is_cmp_branch(op)) {
+    if (!is_comparison(instr->relop)) return false;
+    reads = 2;
+  } else if (ir_is_check(op)) {
+    if (!is_checkable(instr->relop)) return false;
+    reads = ir_is_binary(instr->relop) ? 2 : 1;
+  } else {
+    reads = ir_is_binary(op) ? 2 : 1;
+  }
+
+  for (int k = 0; k < reads; k++) {
+    if (MATCHES(instr->args[k], IrNone)) return false;
+  }
+  return true;
+}
+
+// Maps the binary intermediate code file at `path` into memory. The names
+// and strings of the program, and its label table, are used where they are
+// in the mapping, which the program keeps until it is freed.
+IrProgram* load_ir_bin(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("could not open file");
+    exit(1);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror("could not open file");
+    exit(1);
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(IrBinHeader)) invalid_file(path, "truncated header");
+
+  char* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    perror("could not map file");
+    exit(1);
+  }
+
+  IrBinHeader* header = (IrBinHeader*)image;
+  if (header->magic != IRBIN_MAGIC) invalid_file(path, "bad magic number");
+  if (header->version != IRBIN_VERSION) invalid_file(path, "unsupported version");
+  if (!section_fits(size, header->instrs_offset, header->instr_count, sizeof(IrBinInstr))
+      || !section_fits(size, header->consts_offset, header->const_count, sizeof(IrBinConst))
+      || !section_fits(size, header->vars_offset, header->var_count, sizeof(uint32_t))
+      || !section_fits(size, header->labels_offset, header->label_count, sizeof(int32_t))
+      || !section_fits(size, header->strings_offset, header->strings_size, 1)) {
+    invalid_file(path, "section out of range");
+  }
+  if (header->instr_count > INT32_MAX || header->temp_count > INT32_MAX || header->reg_count > header->temp_count) {
+    invalid_file(path, "bad counts");
+  }
+
+  char* strings = image + header->strings_offset;
+  if (header->strings_size > 0 && strings[header->strings_size - 1] != '\0') {
+    invalid_file(path, "unterminated string pool");
+  }
+
+  IrProgram* ir = alloc_ir_program();
+  ir->image = image;
+  ir->image_size = size;
+  ir->temp_count = header->temp_count;
+  ir->reg_count = header->reg_count;
+  ir->label_count = header->label_count;
+  ir->label_pcs = (const int32_t*)(image + header->labels_offset);
+
+  ir->var_count = ir->var_cap = header->var_count;
+  ir->vars = malloc((header->var_count + 1) * sizeof(char*));
+  ensure_non_null(ir->vars, "out of space");
+  const uint32_t* names = (const uint32_t*)(image + header->vars_offset);
+  for (uint32_t v = 0; v < header->var_count; v++) {
+    ir->vars[v] = pool_string(path, header, strings, names[v]);
+  }
+
+  ExprResult* consts = malloc((header->const_count + 1) * sizeof(ExprResult));
+  ensure_non_null(consts, "out of space");
+  const IrBinConst* encoded_consts = (const IrBinConst*)(image + header->consts_offset);
+  for (uint32_t c = 0; c < header->const_count; c++) {
+    const IrBinConst* constant = &encoded_consts[c];
+    switch (constant->kind) {
+      case IRBIN_BOOLEAN: consts[c] = BooleanResult(constant->number != 0); break;
+      case IRBIN_NUMBER: consts[c] = NumberResult(constant->number); break;
+      case IRBIN_STRING: consts[c] = StringResult(pool_string(path, header, strings, constant->string)); break;
+      default: invalid_file(path, "unknown constant kind");
+    }
+  }
+
+  ir->len = ir->cap = header->instr_count;
+  ir->instrs = malloc((header->instr_count + 1) * sizeof(IrInstr));
+  ensure_non_null(ir->instrs, "out of space");
+  const IrBinInstr* encoded = (const IrBinInstr*)(image + header->instrs_offset);
+  for (uint32_t i = 0; i < header->instr_count; i++) {
+    const IrBinInstr* instr = &encoded[i];
+    if (instr->op >= IR_OPCODE_COUNT || instr->relop >= IR_OPCODE_COUNT) invalid_file(path, "unknown opcode");
+
+    bool uses_label = instr->op == IR_LABEL || ir_is_branch(instr->op);
+    if (uses_label) {
+      if (instr->label < 0 || (uint32_t)instr->label >= header->label_count) invalid_file(path, "label out of range");
+      int32_t pc = ir->label_pcs[instr->label];
+      if (pc < 0 || (uint32_t)pc >= header->instr_count) invalid_file(path, "undefined label");
+    }
+
+    ir->instrs[i] = (IrInstr){
+      .op = instr->op,
+      .relop = instr->relop,
+      .label = instr->label,
+      .dest = decode_operand(path, header, consts, instr->kinds[0], instr->operands[0]),
+      .args = {
+        decode_operand(path, header, consts, instr->kinds[1], instr->operands[1]),
+        decode_operand(path, header, consts, instr->kinds[2], instr->operands[2]),
+      },
+    };
+    if (!well_formed(&ir->instrs[i])) invalid_file(path, "malformed instruction");
+  }
+
+  free(consts);
+  return ir;
+}
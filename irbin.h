@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include "ir.h"
+
+/*
+ * Binary intermediate code files.
+ *
+ * A file is a header followed by fixed size sections, each found through its
+ * offset from the start of the file, so the file can be mapped anywhere in
+ * memory and run without lexing, parsing or lowering:
+ *
+ *   instructions  IrBinInstr per instruction
+ *   constants     IrBinConst per distinct constant
+ *   variables     string pool offset of the name of every variable
+ *   labels        index of the instruction defining every label
+ *   strings       NUL terminated strings
+ *
+ * Operands refer to temporaries, variables and constants by number. Numbers
+ * are stored in the byte order of the machine that wrote the file, which the
+ * magic number detects.
+ */
+
+#define IRBIN_MAGIC 0x52495350u  // "PSIR" when written little endian
+#define IRBIN_VERSION 1
+
+typedef enum {
+  IRBIN_NONE,
+  IRBIN_TEMP,
+  IRBIN_VAR,
+  IRBIN_CONST,
+} IrBinOperandKind;
+
+typedef enum {
+  IRBIN_BOOLEAN,
+  IRBIN_NUMBER,
+  IRBIN_STRING,
+} IrBinConstKind;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+
+  uint32_t instr_count;
+  uint32_t const_count;
+  uint32_t var_count;
+  uint32_t label_count;
+  uint32_t temp_count;
+  uint32_t reg_count;
+
+  uint32_t instrs_offset;
+  uint32_t consts_offset;
+  uint32_t vars_offset;
+  uint32_t labels_offset;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+} IrBinHeader;
+
+typedef struct {
+  uint8_t op;
+  uint8_t relop;
+  uint8_t kinds[3];     // IrBinOperandKind of the destination and the operands
+  uint8_t padding[3];
+  int32_t operands[3];  // Temporary, variable or constant number
+  int32_t label;
+} IrBinInstr;
+
+typedef struct {
+  uint8_t kind;  // IrBinConstKind
+  uint8_t padding[3];
+  uint32_t string;  // String pool offset of a string
+  double number;    // Value of a number, or 0 and 1 for booleans
+} IrBinConst;
+
+void write_ir_bin(IrProgram* ir, const char* path);
+IrProgram* load_ir_bin(const char* path);
@@ -0,0 +1,362 @@
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "ir.h"
+#include "datatype99.h"
+
+/*
+ * Parser for the textual intermediate code that print_ir writes.
+ *
+ * Every line holds one instruction, and # starts a comment:
+ *
+ *   Lk:                          label
+ *   goto Lk
+ *   if a == true goto Lk         IR_IF
+ *   if a == false goto Lk        IR_IF_NOT
+ *   if a relop b goto Lk         IR_IF_CMP, also written if (a relop b) goto Lk
+ *   if !(a relop b) goto Lk      IR_IF_NOT_CMP
+ *   display a
+ *   d = a
+ *   d = op a                     op is -, !, int or isnum
+ *   d = a op b                   op is a binary operator or a relop
+ *   d = trip a, b
+ *   check type if a              type is number, boolean or string, and
+ *   check type expr              expr is an untyped unary or binary
+ *                                operation or trip
+ *
+ * Operands are temporaries tN, registers rN and spill slots sN, the
+ * constants true, false, numbers and "strings" with \" \\ \n and \t escapes,
+ * and variables, written $name when the name would read back as one of the
+ * others. A program uses either temporaries or registers and spill slots.
+ */
+
+#define MAX_TOKENS 16
+
+typedef struct {
+  char* text;   // Word or punctuation, or the contents of a string
+  bool string;
+} Token;
+
+typedef struct {
+  IrProgram* ir;
+  int line;
+
+  int max_temp;   // Highest tN or rN
+  int max_spill;  // Highest sN
+  bool plain_temps;
+  bool reg_temps;
+} IrParser;
+
+static void parse_error(IrParser* p, const char* s, ...) {
+  va_list ap;
+  va_start(ap, s);
+
+  fprintf(stderr, "%d: error: ", p->line);
+  vfprintf(stderr, s, ap);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+static bool is_punctuation(char c) {
+  return c == '(' || c == ')' || c == ',' || c == ':';
+}
+
+// Splits `line` into tokens, copying their text into `buffer`, which has room
+// for twice the length of the line
+static int tokenize(IrParser* p, const char* line, char* buffer, Token* tokens) {
+  int count = 0;
+  const char* c = line;
+
+  while (*c) {
+    if (isspace((unsigned char)*c)) {
+      c++;
+      continue;
+    }
+    if (*c == '#') break;
+    if (count == MAX_TOKENS) parse_error(p, "too many tokens");
+
+    tokens[count] = (Token){ .text = buffer, .string = *c == '"' };
+    if (*c == '"') {
+      for (c++; *c != '"'; c++) {
+        if (*c == '\0' || *c == '\n') parse_error(p, "unterminated string");
+        if (*c != '\\') {
+          *buffer++ = *c;
+          continue;
+        }
+        switch (*++c) {
+          case 'n': *buffer++ = '\n'; break;
+          case 't': *buffer++ = '\t'; break;
+          case '"': case '\\': *buffer++ = *c; break;
+          default: parse_error(p, "unknown escape in string");
+        }
+      }
+      c++;
+    } else if (is_punctuation(*c)) {
+      *buffer++ = *c++;
+    } else {
+      while (*c && !isspace((unsigned char)*c) && !is_punctuation(*c) && *c != '"') *buffer++ = *c++;
+    }
+    *buffer++ = '\0';
+    count++;
+  }
+
+  return count;
+}
+
+static bool is_word(Token* token, const char* text) {
+  return !token->string && strcmp(token->text, text) == 0;
+}
+
+static bool is_identifier(const char* text) {
+  if (!isalpha((unsigned char)*text) && *text != '_') return false;
+  for (; *text; text++) {
+    if (!isalnum((unsigned char)*text) && *text != '_') return false;
+  }
+  return true;
+}
+
+// Value of the digits following the first character of `text`, or -1 when
+// they are not all digits
+static int numbered(const char* text) {
+  if (text[1] == '\0' || strspn(text + 1, "0123456789") != strlen(text + 1)) return -1;
+  long value = strtol(text + 1, NULL, 10);
+  return value < INT_MAX / 2 ? value : -1;
+}
+
+static int parse_label(IrParser* p, Token* token) {
+  int label = token->string || token->text[0] != 'L' ? -1 : numbered(token->text);
+  if (label < 0) parse_error(p, "expected a label instead of '%s'", token->text);
+  if (label >= p->ir->label_count) p->ir->label_count = label + 1;
+  return label;
+}
+
+// Spill slots are numbered after the registers, which are only all known at
+// the end, so sN is kept as the negative temporary -N - 1 until then
+static IrOperand parse_temp(IrParser* p, const char* text, int number) {
+  if (text[0] == 't') p->plain_temps = true;
+  else p->reg_temps = true;
+
+  if (text[0] == 's') {
+    if (number > p->max_spill) p->max_spill = number;
+    return IrTemp(-number - 1);
+  }
+  if (number > p->max_temp) p->max_temp = number;
+  return IrTemp(number);
+}
+
+static IrOperand parse_operand(IrParser* p, Token* token) {
+  char* text = token->text;
+  if (token->string) return IrConst(StringResult(strdup(text)));
+  if (strcmp(text, "true") == 0) return IrConst(BooleanResult(true));
+  if (strcmp(text, "false") == 0) return IrConst(BooleanResult(false));
+
+  if (text[0] == '$') {
+    if (!is_identifier(text + 1)) parse_error(p, "bad variable name '%s'", text);
+    return IrVar(ir_intern_var(p->ir, text + 1));
+  }
+
+  int number = strchr("trs", text[0]) ? numbered(text) : -1;
+  if (number >= 0) return parse_temp(p, text, number);
+
+  char* end;
+  double value = strtod(text, &end);
+  if (end != text && *end == '\0') return IrConst(NumberResult(value));
+
+  if (!is_identifier(text)) parse_error(p, "unexpected '%s'", text);
+  return IrVar(ir_intern_var(p->ir, text));
+}
+
+static IrOperand parse_dest(IrParser* p, Token* token) {
+  IrOperand dest = parse_operand(p, token);
+  if (MATCHES(dest, IrConst)) parse_error(p, "cannot assign to a constant");
+  return dest;
+}
+
+// Opcode written as `symbol` among the ones `accepts`
+static IrOpcode parse_op(IrParser* p, Token* token, bool (*accepts)(IrOpcode)) {
+  for (IrOpcode op = IR_COPY; op < IR_OPCODE_COUNT; op++) {
+    if (accepts(op) && is_word(token, ir_op_symbol(op))) return op;
+  }
+  parse_error(p, "unknown operator '%s'", token->text);
+  return IR_COPY;
+}
+
+static bool is_relop(IrOpcode op) {
+  switch (ir_untyped_op(op)) {
+    case IR_EQ: case IR_GT: case IR_GTE: case IR_LT: case IR_LTE: return true;
+    default: return false;
+  }
+}
+
+static bool is_operator(IrOpcode op) {
+  return ir_is_binary(op) && op != IR_FOR_TRIP;
+}
+
+static IrInstr parse_if(IrParser* p, Token* tokens, int count) {
+  if (count < 4 || !is_word(&tokens[count - 2], "goto")) parse_error(p, "expected 'goto' at the end of the if");
+  int label = parse_label(p, &tokens[count - 1]);
+  Token* cond = &tokens[1];
+  int len = count - 3;
+
+  // if a == true goto Lk, if a == false goto Lk
+  if (len == 3 && is_word(&cond[1], "==") && (is_word(&cond[2], "true") || is_word(&cond[2], "false"))) {
+    IrInstr instr = ir_if_instr(parse_operand(p, &cond[0]), label);
+    if (is_word(&cond[2], "false")) instr.op = IR_IF_NOT;
+    return instr;
+  }
+
+  bool negated = false;
+  if (len == 6 && is_word(&cond[0], "!")) {
+    negated = true;
+    cond++;
+    len--;
+  }
+  if (len == 5 && is_word(&cond[0], "(") && is_word(&cond[4], ")")) {
+    cond++;
+    len -= 2;
+  } else if (negated) {
+    parse_error(p, "expected a parenthesized comparison after '!'");
+  }
+  if (len != 3) parse_error(p, "expected a comparison in the if");
+
+  IrOpcode relop = parse_op(p, &cond[1], is_relop);
+  IrInstr instr = ir_if_cmp_instr(relop, parse_operand(p, &cond[0]), parse_operand(p, &cond[2]), label);
+  if (negated) instr.op = IR_IF_NOT_CMP;
+  return instr;
+}
+
+// Parses the value an assignment computes, or a check checks
+static IrInstr parse_expr(IrParser* p, Token* rhs, int len) {
+  if (len == 1) return ir_instr(IR_COPY, IrNone(), parse_operand(p, &rhs[0]), IrNone());
+  if (len == 2) {
+    IrOpcode op = parse_op(p, &rhs[0], ir_is_unary);
+    return ir_instr(op, IrNone(), parse_operand(p, &rhs[1]), IrNone());
+  }
+  if (len == 4 && is_word(&rhs[0], "trip") && is_word(&rhs[2], ",")) {
+    return ir_instr(IR_FOR_TRIP, IrNone(), parse_operand(p, &rhs[1]), parse_operand(p, &rhs[3]));
+  }
+  if (len == 3) {
+    IrOpcode op = parse_op(p, &rhs[1], is_operator);
+    return ir_instr(op, IrNone(), parse_operand(p, &rhs[0]), parse_operand(p, &rhs[2]));
+  }
+
+  parse_error(p, "unrecognized expression");
+  return ir_instr(IR_COPY, IrNone(), IrNone(), IrNone());
+}
+
+static IrInstr parse_assignment(IrParser* p, Token* tokens, int count) {
+  IrOperand dest = parse_dest(p, &tokens[0]);
+  IrInstr instr = parse_expr(p, &tokens[2], count - 2);
+  instr.dest = dest;
+  return instr;
+}
+
+static IrInstr parse_check(IrParser* p, Token* tokens, int count) {
+  IrOpcode op = IR_CHECK_NUMBER;
+  if (is_word(&tokens[1], "boolean")) op = IR_CHECK_BOOLEAN;
+  else if (is_word(&tokens[1], "string")) op = IR_CHECK_STRING;
+  else if (!is_word(&tokens[1], "number")) parse_error(p, "unknown type '%s'", tokens[1].text);
+
+  IrInstr checked;
+  if (count == 4 && is_word(&tokens[2], "if")) {
+    checked = ir_instr(IR_IF, IrNone(), parse_operand(p, &tokens[3]), IrNone());
+  } else {
+    checked = parse_expr(p, &tokens[2], count - 2);
+  }
+
+  // Only instructions that fail on some types can be checked
+  IrOpcode relop = checked.op;
+  if (relop == IR_COPY || relop == IR_EQ || relop == IR_IS_NUMBER || ir_is_typed(relop)) {
+    parse_error(p, "'%s' can not be checked", ir_op_symbol(relop));
+  }
+
+  IrInstr instr = ir_instr(op, IrNone(), checked.args[0], checked.args[1]);
+  instr.relop = relop;
+  return instr;
+}
+
+static void parse_line(IrParser* p, const char* line, char* buffer) {
+  Token tokens[MAX_TOKENS];
+  int count = tokenize(p, line, buffer, tokens);
+  if (count == 0) return;
+
+  IrInstr instr;
+  if (count == 2 && is_word(&tokens[1], ":")) {
+    instr = ir_label_instr(IR_LABEL, parse_label(p, &tokens[0]));
+  } else if (count == 2 && is_word(&tokens[0], "goto")) {
+    instr = ir_label_instr(IR_GOTO, parse_label(p, &tokens[1]));
+  } else if (count == 2 && is_word(&tokens[0], "display")) {
+    instr = ir_instr(IR_DISPLAY, IrNone(), parse_operand(p, &tokens[1]), IrNone());
+  } else if (is_word(&tokens[0], "if")) {
+    instr = parse_if(p, tokens, count);
+  } else if (count >= 3 && is_word(&tokens[0], "check") && !is_word(&tokens[1], "=")) {
+    instr = parse_check(p, tokens, count);
+  } else if (count >= 3 && is_word(&tokens[1], "=")) {
+    instr = parse_assignment(p, tokens, count);
+  } else {
+    parse_error(p, "unrecognized instruction");
+  }
+
+  ir_emit(p->ir, instr);
+}
+
+static void resolve_temp(IrParser* p, IrOperand* operand) {
+  ifLet(*operand, IrTemp, temp) {
+    if (*temp < 0) *temp = p->ir->reg_count - *temp - 1;
+  }
+}
+
+// Numbers the spill slots and checks that every label jumped to is defined
+// exactly once
+static void finish_program(IrParser* p) {
+  IrProgram* ir = p->ir;
+  if (p->plain_temps && p->reg_temps) parse_error(p, "temporaries are mixed with registers or spill slots");
+
+  ir->reg_count = p->reg_temps ? p->max_temp + 1 : 0;
+  ir->temp_count = p->max_temp + 1;
+  if (p->max_spill >= 0) ir->temp_count = ir->reg_count + p->max_spill + 1;
+
+  bool* defined = calloc(ir->label_count + 1, sizeof(bool));
+  ensure_non_null(defined, "out of space");
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    resolve_temp(p, &instr->dest);
+    resolve_temp(p, &instr->args[0]);
+    resolve_temp(p, &instr->args[1]);
+
+    if (instr->op != IR_LABEL) continue;
+    if (defined[instr->label]) parse_error(p, "label L%d is defined twice", instr->label);
+    defined[instr->label] = true;
+  }
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    if (ir_is_branch(instr->op) && !defined[instr->label]) {
+      parse_error(p, "label L%d is never defined", instr->label);
+    }
+  }
+  free(defined);
+}
+
+// Reads a program in the textual intermediate code from `in`
+IrProgram* parse_ir(FILE* in) {
+  IrParser p = { .ir = alloc_ir_program(), .max_temp = -1, .max_spill = -1 };
+  char* line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+
+  while ((len = getline(&line, &cap, in)) != -1) {
+    p.line++;
+    char* buffer = malloc(2 * len + 2);
+    ensure_non_null(buffer, "out of space");
+    parse_line(&p, line, buffer);
+    free(buffer);
+  }
+
+  free(line);
+  finish_program(&p);
+  return p.ir;
+}
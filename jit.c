@@ -0,0 +1,765 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "ir.h"
+#include "jit.h"
+#include "opt.h"
+#include "datatype99.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+extern SymbolTable* symtab;
+
+int jit_enabled = true;
+int jit_threshold = JIT_DEFAULT_THRESHOLD;
+
+// A loop that leaves its compiled code this many times, or whose code is
+// compiled anew this many times, is only interpreted from then on
+#define JIT_MAX_DEOPTS 16
+#define JIT_MAX_RECOMPILES 4
+
+typedef enum {
+  JIT_NONE,  // Not compiled, or would raise an error
+  JIT_NUMBER,
+  JIT_BOOLEAN,
+} JitType;
+
+typedef enum {
+  FRAME_REST,     // Run statements to the end of their list
+  FRAME_ELSE_IF,  // Test the rest of an else if chain
+  FRAME_WHILE,    // Run the rest of a while loop
+  FRAME_FOR,      // Run the iterations of a for loop after the current one
+} JitFrameKind;
+
+// Part of what is left to run when compiled code leaves at a statement
+typedef struct {
+  JitFrameKind kind;
+  StatementList* rest;
+  ElseIfStatement* else_if;
+  StatementList* else_stmts;
+  Stmt* loop;
+  int counter;
+} JitFrame;
+
+// Where compiled code leaves, innermost frame first. The last frame is the
+// compiled loop.
+typedef struct {
+  JitFrame* frames;
+  int count;
+} JitExit;
+
+// Counter of a compiled for loop, in memory so the evaluator can pick up the
+// loop where compiled code left it
+typedef struct {
+  int64_t i;
+  int64_t last;
+} JitCounter;
+
+// Variable whose type the code assumes
+typedef struct {
+  Symbol* sym;
+  ExprResultTag tag;
+} JitGuard;
+
+struct JitLoop {
+  Stmt* stmt;
+  JitLoop* next;  // In its bucket of the loop table
+
+  int64_t runs;  // Body executions
+  int deopts;
+  int recompiles;
+  int active;    // Nesting of calls running the compiled code
+  bool disabled;
+
+  // Compiled code, returning 0 once the loop is done, or the index of the
+  // exit it left through plus one
+  void* code;
+  size_t code_size;
+  JitGuard* guards;
+  int guard_count;
+  JitExit* exits;
+  int exit_count;
+  JitCounter* counters;
+  int counter_count;
+};
+
+#define JIT_BUCKETS 256
+static JitLoop* loop_table[JIT_BUCKETS];
+
+/* ---------------------------- Machine code ---------------------------- */
+
+typedef struct {
+  uint8_t* bytes;
+  size_t len;
+  size_t cap;
+
+  JitLoop* loop;
+
+  // Statements enclosing the one being compiled, outermost first
+  JitFrame* context;
+  int depth;
+  int context_cap;
+
+  IntList epilogue_jumps;
+} JitCompiler;
+
+typedef enum {
+  JUMP,
+  JUMP_IF_ZERO,  // Also if equal
+} JitJump;
+
+static void emit_bytes(JitCompiler* c, const void* bytes, size_t count) {
+  if (c->len + count > c->cap) {
+    c->cap = (c->cap + count) * 2;
+    c->bytes = realloc(c->bytes, c->cap);
+    ensure_non_null(c->bytes, "out of space");
+  }
+  memcpy(c->bytes + c->len, bytes, count);
+  c->len += count;
+}
+
+#define EMIT(c, ...) emit_bytes(c, (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+static void emit32(JitCompiler* c, int32_t value) {
+  emit_bytes(c, &value, sizeof(value));
+}
+
+// mov rax, imm64
+static void emit_mov_rax(JitCompiler* c, uint64_t value) {
+  EMIT(c, 0x48, 0xb8);
+  emit_bytes(c, &value, sizeof(value));
+}
+
+// Returns the position of the displacement, for patch_jump
+static int emit_jump(JitCompiler* c, JitJump kind) {
+  if (kind == JUMP) EMIT(c, 0xe9);
+  else EMIT(c, 0x0f, 0x84);
+  emit32(c, 0);
+  return (int)c->len - 4;
+}
+
+static void patch_jump(JitCompiler* c, int at, size_t target) {
+  int32_t rel = (int32_t)(target - (at + 4));
+  memcpy(c->bytes + at, &rel, sizeof(rel));
+}
+
+static void emit_jump_to(JitCompiler* c, JitJump kind, size_t target) {
+  patch_jump(c, emit_jump(c, kind), target);
+}
+
+static void emit_call(JitCompiler* c, uint64_t function) {
+  emit_mov_rax(c, function);
+  EMIT(c, 0xff, 0xd0);  // call rax
+}
+
+// Operand [rbx + disp32] of the counter fields, after the opcode
+static void emit_counter_operand(JitCompiler* c, uint8_t reg, int counter, size_t field) {
+  EMIT(c, 0x83 | reg << 3);
+  emit32(c, (int32_t)(counter * sizeof(JitCounter) + field));
+}
+
+static void emit_number(JitCompiler* c, double number, int xmm) {
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  emit_mov_rax(c, bits);
+  EMIT(c, 0x66, 0x48, 0x0f, 0x6e, 0xc0 | xmm << 3);  // movq xmmN, rax
+}
+
+static void emit_boolean(JitCompiler* c, bool boolean) {
+  EMIT(c, 0xb8);  // mov eax, imm32
+  emit32(c, boolean);
+}
+
+// Numbers are computed in xmm0, and booleans in eax
+static void emit_load(JitCompiler* c, Symbol* sym, JitType type) {
+  if (type == JIT_NUMBER) {
+    emit_mov_rax(c, (uintptr_t)&sym->value.data.NumberResult._0);
+    EMIT(c, 0xf2, 0x0f, 0x10, 0x00);  // movsd xmm0, [rax]
+  } else {
+    emit_mov_rax(c, (uintptr_t)&sym->value.data.BooleanResult._0);
+    EMIT(c, 0x0f, 0xb6, 0x00);  // movzx eax, byte [rax]
+  }
+}
+
+static void emit_store(JitCompiler* c, Symbol* sym, JitType type) {
+  if (type == JIT_NUMBER) {
+    emit_mov_rax(c, (uintptr_t)&sym->value.data.NumberResult._0);
+    EMIT(c, 0xf2, 0x0f, 0x11, 0x00);  // movsd [rax], xmm0
+  } else {
+    EMIT(c, 0x48, 0xb9);  // mov rcx, imm64
+    uint64_t address = (uintptr_t)&sym->value.data.BooleanResult._0;
+    emit_bytes(c, &address, sizeof(address));
+    EMIT(c, 0x88, 0x01);  // mov [rcx], al
+  }
+}
+
+// Compares xmm0 with xmm1, or xmm1 with xmm0 when `swapped`, and sets eax
+// with `setcc`. Comparisons with NaN are unordered, which clears it.
+static void emit_compare(JitCompiler* c, uint8_t setcc, bool swapped) {
+  EMIT(c, 0x66, 0x0f, 0x2e, swapped ? 0xc8 : 0xc1);  // ucomisd
+  EMIT(c, 0x0f, setcc, 0xc0);                         // setcc al
+  EMIT(c, 0x0f, 0xb6, 0xc0);                          // movzx eax, al
+}
+
+/* ------------------------------- Types ------------------------------- */
+
+static void add_guard(JitLoop* loop, Symbol* sym) {
+  for (int g = 0; g < loop->guard_count; g++) {
+    if (loop->guards[g].sym == sym) return;
+  }
+
+  loop->guards = realloc(loop->guards, (loop->guard_count + 1) * sizeof(JitGuard));
+  ensure_non_null(loop->guards, "out of space");
+  loop->guards[loop->guard_count++] = (JitGuard){ .sym = sym, .tag = sym->value.tag };
+}
+
+// Type the code assumes a variable has: the one of its value now
+static JitType var_type(JitCompiler* c, char* name) {
+  Symbol* sym = symbol_lookup(symtab, name);
+  if (!sym) return JIT_NONE;
+
+  JitType type = MATCHES(sym->value, NumberResult) ? JIT_NUMBER
+    : MATCHES(sym->value, BooleanResult) ? JIT_BOOLEAN : JIT_NONE;
+  if (type != JIT_NONE) add_guard(c->loop, sym);
+  return type;
+}
+
+static JitType literal_type(LiteralExpr* expr) {
+  match (*expr) {
+    of(BooleanExpr, _) return JIT_BOOLEAN;
+    of(ArithmeticExpr, _) return JIT_NUMBER;
+    otherwise return JIT_NONE;
+  }
+  return JIT_NONE;
+}
+
+static JitType expr_type(JitCompiler* c, Expr* expr) {
+  ifLet(*expr, LiteralExpression, lexpr) return literal_type(*lexpr);
+
+  IdentExpr* iexpr = expr->data.IdentExpression._0;
+  match (*iexpr) {
+    of(IdentBinaryExpr, ident, op, rhs) {
+      JitType lhs = var_type(c, *ident);
+      JitType type = literal_type(*rhs);
+      if (lhs == JIT_NONE) return JIT_NONE;
+
+      switch (*op) {
+        case IdentBOp_Plus: case IdentBOp_Minus: case IdentBOp_Star: case IdentBOp_Slash:
+          return lhs == JIT_NUMBER && type == JIT_NUMBER ? JIT_NUMBER : JIT_NONE;
+        case IdentBOp_Gt: case IdentBOp_Gte: case IdentBOp_Lt: case IdentBOp_Lte:
+          return lhs == JIT_NUMBER && type == JIT_NUMBER ? JIT_BOOLEAN : JIT_NONE;
+        case IdentBOp_EqEq:
+          // Values of different types are never equal
+          return JIT_BOOLEAN;
+        case IdentBOp_And: case IdentBOp_Or:
+          return lhs == JIT_BOOLEAN && type == JIT_BOOLEAN ? JIT_BOOLEAN : JIT_NONE;
+      }
+      return JIT_NONE;
+    }
+    of(IdentUnaryExpr, op, ident) {
+      JitType type = var_type(c, *ident);
+      if (*op == IdentUOp_Minus) return type == JIT_NUMBER ? JIT_NUMBER : JIT_NONE;
+      return type == JIT_BOOLEAN ? JIT_BOOLEAN : JIT_NONE;
+    }
+    of(Identifier, ident) return var_type(c, *ident);
+  }
+  return JIT_NONE;
+}
+
+/* ----------------------------- Expressions ----------------------------- */
+
+static void emit_binary(JitCompiler* c, char* ident, IdentBinaryOp op, LiteralExpr* rhs) {
+  Symbol* sym = symbol_lookup(symtab, ident);
+  JitType lhs = var_type(c, ident);
+  if (op == IdentBOp_EqEq && lhs != literal_type(rhs)) {
+    emit_boolean(c, false);
+    return;
+  }
+
+  // Constant operands are evaluated once, here
+  if (lhs == JIT_BOOLEAN) {
+    bool value = eval_bexpr(rhs->data.BooleanExpr._0);
+    emit_load(c, sym, JIT_BOOLEAN);
+    if (op == IdentBOp_And && !value) emit_boolean(c, false);
+    if (op == IdentBOp_Or && value) emit_boolean(c, true);
+    if (op == IdentBOp_EqEq && !value) EMIT(c, 0x83, 0xf0, 0x01);  // xor eax, 1
+    return;
+  }
+
+  emit_load(c, sym, JIT_NUMBER);
+  emit_number(c, eval_aexpr(rhs->data.ArithmeticExpr._0), 1);
+  switch (op) {
+    case IdentBOp_Plus: EMIT(c, 0xf2, 0x0f, 0x58, 0xc1); break;   // addsd xmm0, xmm1
+    case IdentBOp_Minus: EMIT(c, 0xf2, 0x0f, 0x5c, 0xc1); break;  // subsd xmm0, xmm1
+    case IdentBOp_Star: EMIT(c, 0xf2, 0x0f, 0x59, 0xc1); break;   // mulsd xmm0, xmm1
+    case IdentBOp_Slash: EMIT(c, 0xf2, 0x0f, 0x5e, 0xc1); break;  // divsd xmm0, xmm1
+    case IdentBOp_Gt: emit_compare(c, 0x97, false); break;        // seta
+    case IdentBOp_Gte: emit_compare(c, 0x93, false); break;       // setae
+    case IdentBOp_Lt: emit_compare(c, 0x97, true); break;
+    case IdentBOp_Lte: emit_compare(c, 0x93, true); break;
+    case IdentBOp_EqEq:
+      EMIT(c, 0x66, 0x0f, 0x2e, 0xc1);  // ucomisd xmm0, xmm1
+      EMIT(c, 0x0f, 0x94, 0xc0);        // sete al
+      EMIT(c, 0x0f, 0x9b, 0xc1);        // setnp cl
+      EMIT(c, 0x20, 0xc8);              // and al, cl
+      EMIT(c, 0x0f, 0xb6, 0xc0);        // movzx eax, al
+      break;
+    default: unreachable("emit_binary");
+  }
+}
+
+// Emits an expression expr_type found a type for
+static void emit_expr(JitCompiler* c, Expr* expr) {
+  ifLet(*expr, LiteralExpression, lexpr) {
+    match (**lexpr) {
+      of(BooleanExpr, bexpr) emit_boolean(c, eval_bexpr(*bexpr));
+      of(ArithmeticExpr, aexpr) emit_number(c, eval_aexpr(*aexpr), 0);
+      otherwise unreachable("emit_expr");
+    }
+    return;
+  }
+
+  IdentExpr* iexpr = expr->data.IdentExpression._0;
+  match (*iexpr) {
+    of(IdentBinaryExpr, ident, op, rhs) emit_binary(c, *ident, *op, *rhs);
+    of(IdentUnaryExpr, op, ident) {
+      Symbol* sym = symbol_lookup(symtab, *ident);
+      if (*op == IdentUOp_Minus) {
+        emit_load(c, sym, JIT_NUMBER);
+        emit_number(c, -0.0, 1);
+        EMIT(c, 0x66, 0x0f, 0x57, 0xc1);  // xorpd xmm0, xmm1
+      } else {
+        emit_load(c, sym, JIT_BOOLEAN);
+        EMIT(c, 0x83, 0xf0, 0x01);  // xor eax, 1
+      }
+    }
+    of(Identifier, ident) emit_load(c, symbol_lookup(symtab, *ident), var_type(c, *ident));
+  }
+}
+
+/* ----------------------------- Statements ----------------------------- */
+
+static void display_number(double number) {
+  print_result(NumberResult(number));
+}
+
+static void display_boolean(int boolean) {
+  print_result(BooleanResult(boolean));
+}
+
+// Starts a nested for loop, returning whether it runs at all
+static int enter_for(double from, double to, JitCounter* counter) {
+  int64_t trip = for_loop_trip_count(NumberResult(from), NumberResult(to));
+  counter->i = for_loop_start(from);
+  counter->last = counter->i + (trip - 1);
+  return trip > 0;
+}
+
+static JitFrame rest_frame(StatementList* rest) {
+  return (JitFrame){ .kind = FRAME_REST, .rest = rest };
+}
+
+static void push_context(JitCompiler* c, JitFrame frame) {
+  if (c->depth == c->context_cap) {
+    c->context_cap = c->context_cap ? c->context_cap * 2 : 8;
+    c->context = realloc(c->context, c->context_cap * sizeof(JitFrame));
+    ensure_non_null(c->context, "out of space");
+  }
+  c->context[c->depth++] = frame;
+}
+
+// Leaves the compiled code, for the evaluator to run `first` and then the
+// rest of every statement enclosing it
+static void emit_exit(JitCompiler* c, JitFrame first) {
+  JitLoop* loop = c->loop;
+  JitExit exit = { .count = c->depth + 1 };
+  exit.frames = malloc(exit.count * sizeof(JitFrame));
+  ensure_non_null(exit.frames, "out of space");
+  exit.frames[0] = first;
+  for (int k = 0; k < c->depth; k++) exit.frames[k + 1] = c->context[c->depth - 1 - k];
+
+  loop->exits = realloc(loop->exits, (loop->exit_count + 1) * sizeof(JitExit));
+  ensure_non_null(loop->exits, "out of space");
+  loop->exits[loop->exit_count++] = exit;
+
+  EMIT(c, 0xb8);  // mov eax, imm32
+  emit32(c, loop->exit_count);
+  int_list_push(&c->epilogue_jumps, emit_jump(c, JUMP));
+}
+
+static void compile_stmt_list(JitCompiler* c, StatementList* stmts);
+
+// Emits the condition of a branch, returning the jump to patch to where it
+// goes when the condition is false
+static int emit_condition(JitCompiler* c, Expr* condition) {
+  emit_expr(c, condition);
+  EMIT(c, 0x85, 0xc0);  // test eax, eax
+  return emit_jump(c, JUMP_IF_ZERO);
+}
+
+// Runs the iterations of a for loop from the value of its counter to its
+// last, adding the jump out of the loop to `done`
+static void emit_for_iterations(JitCompiler* c, Symbol* var, int counter, StatementList* body, IntList* done) {
+  size_t head = c->len;
+  EMIT(c, 0x48, 0x8b);  // mov rax, i
+  emit_counter_operand(c, 0, counter, offsetof(JitCounter, i));
+  EMIT(c, 0xf2, 0x48, 0x0f, 0x2a, 0xc0);  // cvtsi2sd xmm0, rax
+  emit_store(c, var, JIT_NUMBER);
+
+  compile_stmt_list(c, body);
+
+  EMIT(c, 0x48, 0x8b);  // mov rax, i
+  emit_counter_operand(c, 0, counter, offsetof(JitCounter, i));
+  EMIT(c, 0x48, 0x3b);  // cmp rax, last
+  emit_counter_operand(c, 0, counter, offsetof(JitCounter, last));
+  int_list_push(done, emit_jump(c, JUMP_IF_ZERO));
+  EMIT(c, 0x48, 0xff);  // inc i
+  emit_counter_operand(c, 0, counter, offsetof(JitCounter, i));
+  emit_jump_to(c, JUMP, head);
+}
+
+static void compile_if(JitCompiler* c, StatementList* node) {
+  Condition* condition = node->value->data.IfStmt._0;
+  StatementList* true_stmts = node->value->data.IfStmt._1;
+  ElseIfStatement* else_if = node->value->data.IfStmt._2;
+  StatementList* else_stmts = node->value->data.IfStmt._3;
+  if (expr_type(c, condition) != JIT_BOOLEAN) {
+    emit_exit(c, rest_frame(node));
+    return;
+  }
+
+  // Else ifs are tested in turn, even those with a switch table
+  IntList ends = { 0 };
+  push_context(c, rest_frame(node->next));
+  int skip = emit_condition(c, condition);
+  compile_stmt_list(c, true_stmts);
+  int_list_push(&ends, emit_jump(c, JUMP));
+  patch_jump(c, skip, c->len);
+
+  bool left = false;
+  for (ElseIfStatement* e = else_if; e; e = e->next) {
+    if (expr_type(c, e->condition) != JIT_BOOLEAN) {
+      emit_exit(c, (JitFrame){ .kind = FRAME_ELSE_IF, .else_if = e, .else_stmts = else_stmts });
+      left = true;
+      break;
+    }
+    skip = emit_condition(c, e->condition);
+    compile_stmt_list(c, e->true_stmts);
+    int_list_push(&ends, emit_jump(c, JUMP));
+    patch_jump(c, skip, c->len);
+  }
+  if (!left) compile_stmt_list(c, else_stmts);
+
+  for (int k = 0; k < ends.len; k++) patch_jump(c, ends.items[k], c->len);
+  free_int_list(&ends);
+  c->depth--;
+}
+
+static void compile_while(JitCompiler* c, StatementList* node) {
+  Condition* condition = node->value->data.WhileStmt._0;
+  StatementList* body = node->value->data.WhileStmt._1;
+  if (expr_type(c, condition) != JIT_BOOLEAN) {
+    emit_exit(c, rest_frame(node));
+    return;
+  }
+
+  push_context(c, rest_frame(node->next));
+  push_context(c, (JitFrame){ .kind = FRAME_WHILE, .loop = node->value });
+  size_t head = c->len;
+  int done = emit_condition(c, condition);
+  compile_stmt_list(c, body);
+  emit_jump_to(c, JUMP, head);
+  patch_jump(c, done, c->len);
+  c->depth -= 2;
+}
+
+static void compile_for(JitCompiler* c, StatementList* node) {
+  char* ident = node->value->data.ForStmt._0;
+  Expr* from = node->value->data.ForStmt._1;
+  Expr* to = node->value->data.ForStmt._2;
+  StatementList* body = node->value->data.ForStmt._3;
+  if (var_type(c, ident) != JIT_NUMBER || expr_type(c, from) != JIT_NUMBER || expr_type(c, to) != JIT_NUMBER) {
+    emit_exit(c, rest_frame(node));
+    return;
+  }
+
+  int counter = c->loop->counter_count++;
+  emit_expr(c, from);
+  EMIT(c, 0xf2, 0x0f, 0x11, 0x04, 0x24);  // movsd [rsp], xmm0
+  emit_expr(c, to);
+  EMIT(c, 0x66, 0x0f, 0x28, 0xc8);        // movapd xmm1, xmm0
+  EMIT(c, 0xf2, 0x0f, 0x10, 0x04, 0x24);  // movsd xmm0, [rsp]
+  EMIT(c, 0x48, 0x8d);                    // lea rdi, counter
+  emit_counter_operand(c, 7, counter, 0);
+  emit_call(c, (uintptr_t)enter_for);
+  EMIT(c, 0x85, 0xc0);  // test eax, eax
+  IntList done = { 0 };
+  int_list_push(&done, emit_jump(c, JUMP_IF_ZERO));
+
+  push_context(c, rest_frame(node->next));
+  push_context(c, (JitFrame){ .kind = FRAME_FOR, .loop = node->value, .counter = counter });
+  emit_for_iterations(c, symbol_lookup(symtab, ident), counter, body, &done);
+  for (int k = 0; k < done.len; k++) patch_jump(c, done.items[k], c->len);
+  free_int_list(&done);
+  c->depth -= 2;
+}
+
+static void compile_stmt(JitCompiler* c, StatementList* node) {
+  match (*node->value) {
+    of(DisplayStmt, expr) {
+      JitType type = expr_type(c, *expr);
+      if (type == JIT_NONE) {
+        emit_exit(c, rest_frame(node));
+      } else {
+        emit_expr(c, *expr);
+        if (type == JIT_BOOLEAN) EMIT(c, 0x89, 0xc7);  // mov edi, eax
+        emit_call(c, type == JIT_NUMBER ? (uintptr_t)display_number : (uintptr_t)display_boolean);
+      }
+    }
+    of(ExprStmt, expr) {
+      // Evaluating the expression has no effect unless it fails
+      if (expr_type(c, *expr) == JIT_NONE) emit_exit(c, rest_frame(node));
+    }
+    of(AssignStmt, ident, value) {
+      JitType type = var_type(c, *ident);
+      if (type == JIT_NONE || expr_type(c, *value) != type) {
+        emit_exit(c, rest_frame(node));
+      } else {
+        emit_expr(c, *value);
+        emit_store(c, symbol_lookup(symtab, *ident), type);
+      }
+    }
+    of(IfStmt, _, _, _, _) compile_if(c, node);
+    of(WhileStmt, _, _) compile_while(c, node);
+    of(ForStmt, _, _, _, _) compile_for(c, node);
+  }
+}
+
+static void compile_stmt_list(JitCompiler* c, StatementList* stmts) {
+  for (StatementList* curr = stmts; curr; curr = curr->next) compile_stmt(c, curr);
+}
+
+/* -------------------------------- Loops -------------------------------- */
+
+static void* make_executable(const uint8_t* bytes, size_t len) {
+#if JIT_SUPPORTED
+  void* code = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) return NULL;
+  memcpy(code, bytes, len);
+  if (mprotect(code, len, PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, len);
+    return NULL;
+  }
+  return code;
+#else
+  (void)bytes;
+  (void)len;
+  return NULL;
+#endif
+}
+
+static void discard_code(JitLoop* loop) {
+#if JIT_SUPPORTED
+  if (loop->code) munmap(loop->code, loop->code_size);
+#endif
+  for (int e = 0; e < loop->exit_count; e++) free(loop->exits[e].frames);
+  free(loop->exits);
+  free(loop->guards);
+  free(loop->counters);
+  loop->code = NULL;
+  loop->exits = NULL;
+  loop->exit_count = 0;
+  loop->guards = NULL;
+  loop->guard_count = 0;
+  loop->counters = NULL;
+  loop->counter_count = 0;
+}
+
+// The code takes the counters in rdi, and keeps them in rbx. Below the saved
+// rbx, 16 bytes of stack keep the stack aligned for calls and hold the start
+// of nested for loops.
+static bool compile(JitLoop* loop) {
+  JitCompiler c = { .loop = loop };
+  EMIT(&c, 0x53);                    // push rbx
+  EMIT(&c, 0x48, 0x89, 0xfb);        // mov rbx, rdi
+  EMIT(&c, 0x48, 0x83, 0xec, 0x10);  // sub rsp, 16
+
+  IntList done = { 0 };
+  bool compiled = true;
+  match (*loop->stmt) {
+    of(WhileStmt, condition, body) {
+      if (expr_type(&c, *condition) != JIT_BOOLEAN) {
+        compiled = false;
+      } else {
+        push_context(&c, (JitFrame){ .kind = FRAME_WHILE, .loop = loop->stmt });
+        size_t head = c.len;
+        int_list_push(&done, emit_condition(&c, *condition));
+        compile_stmt_list(&c, *body);
+        emit_jump_to(&c, JUMP, head);
+      }
+    }
+    of(ForStmt, ident, _, _, body) {
+      // The evaluator sets the counter of the compiled loop itself
+      if (var_type(&c, *ident) != JIT_NUMBER) {
+        compiled = false;
+      } else {
+        int counter = loop->counter_count++;
+        push_context(&c, (JitFrame){ .kind = FRAME_FOR, .loop = loop->stmt, .counter = counter });
+        emit_for_iterations(&c, symbol_lookup(symtab, *ident), counter, *body, &done);
+      }
+    }
+    otherwise compiled = false;
+  }
+
+  for (int k = 0; k < done.len; k++) patch_jump(&c, done.items[k], c.len);
+  EMIT(&c, 0x31, 0xc0);  // xor eax, eax
+  for (int k = 0; k < c.epilogue_jumps.len; k++) patch_jump(&c, c.epilogue_jumps.items[k], c.len);
+  EMIT(&c, 0x48, 0x83, 0xc4, 0x10);  // add rsp, 16
+  EMIT(&c, 0x5b);                    // pop rbx
+  EMIT(&c, 0xc3);                    // ret
+
+  if (compiled) {
+    loop->counters = calloc(loop->counter_count + 1, sizeof(JitCounter));
+    ensure_non_null(loop->counters, "out of space");
+    loop->code = make_executable(c.bytes, c.len);
+    loop->code_size = c.len;
+  }
+  if (!loop->code) {
+    discard_code(loop);
+  } else if (opt_verbose) {
+    fprintf(stderr, "jit: compiled %s loop to %zu bytes with %d exits\n",
+      MATCHES(*loop->stmt, WhileStmt) ? "while" : "for", c.len, loop->exit_count);
+  }
+
+  free_int_list(&done);
+  free_int_list(&c.epilogue_jumps);
+  free(c.context);
+  free(c.bytes);
+  return loop->code != NULL;
+}
+
+static bool guards_hold(JitLoop* loop) {
+  for (int g = 0; g < loop->guard_count; g++) {
+    if (loop->guards[g].sym->value.tag != loop->guards[g].tag) return false;
+  }
+  return true;
+}
+
+// Counts an execution of the body, and returns whether the loop has code to
+// run the rest of it
+static bool ready(JitLoop* loop) {
+  if (loop->disabled || ++loop->runs < jit_threshold) return false;
+
+  // Code running further up the stack is kept until it returns
+  if (loop->code && !guards_hold(loop)) {
+    if (loop->active) return false;
+    if (opt_verbose) fprintf(stderr, "jit: variable types changed, compiling loop again\n");
+    discard_code(loop);
+    if (++loop->recompiles > JIT_MAX_RECOMPILES) loop->disabled = true;
+  }
+  if (!loop->disabled && !loop->code && !compile(loop)) loop->disabled = true;
+  return !loop->disabled;
+}
+
+// Runs what is left of the loop after compiled code left it through `exit`
+static void resume(JitLoop* loop, JitExit* exit) {
+  for (int f = 0; f < exit->count; f++) {
+    JitFrame* frame = &exit->frames[f];
+    bool compiled_loop = f == exit->count - 1;
+    switch (frame->kind) {
+      case FRAME_REST:
+        eval_stmt_list(frame->rest);
+        break;
+      case FRAME_ELSE_IF:
+        if (!eval_else_if(frame->else_if)) eval_stmt_list(frame->else_stmts);
+        break;
+      case FRAME_WHILE: {
+        // The compiled loop is entered again at its next back edge
+        if (compiled_loop) {
+          eval_stmt(frame->loop);
+          break;
+        }
+        Condition* condition = frame->loop->data.WhileStmt._0;
+        StatementList* body = frame->loop->data.WhileStmt._1;
+        while (eval_to_condition(condition)) eval_stmt_list(body);
+        break;
+      }
+      case FRAME_FOR: {
+        char* ident = frame->loop->data.ForStmt._0;
+        StatementList* body = frame->loop->data.ForStmt._3;
+        JitCounter counter = loop->counters[frame->counter];
+        while (counter.i != counter.last) {
+          counter.i++;
+          add_symbol(&symtab, ident, NumberResult(counter.i));
+          eval_stmt_list(body);
+          if (compiled_loop && counter.i != counter.last && jit_for_back_edge(loop, counter.i + 1, counter.last)) break;
+        }
+        break;
+      }
+    }
+  }
+}
+
+static bool run(JitLoop* loop) {
+  loop->active++;
+  int exit = ((int (*)(JitCounter*))loop->code)(loop->counters);
+  if (exit > 0) {
+    if (opt_verbose) fprintf(stderr, "jit: left compiled loop through exit %d\n", exit);
+    if (++loop->deopts >= JIT_MAX_DEOPTS) loop->disabled = true;
+    resume(loop, &loop->exits[exit - 1]);
+  }
+  loop->active--;
+  return true;
+}
+
+// Loop state of a while or for statement, or NULL when loops are not compiled
+JitLoop* jit_loop(Stmt* stmt) {
+  if (!JIT_SUPPORTED || !jit_enabled) return NULL;
+
+  size_t bucket = ((uintptr_t)stmt >> 4) % JIT_BUCKETS;
+  for (JitLoop* loop = loop_table[bucket]; loop; loop = loop->next) {
+    if (loop->stmt == stmt) return loop;
+  }
+
+  JitLoop* loop = calloc(1, sizeof(JitLoop));
+  ensure_non_null(loop, "out of space");
+  loop->stmt = stmt;
+  loop->next = loop_table[bucket];
+  loop_table[bucket] = loop;
+  return loop;
+}
+
+// Called after every execution of the body of a while loop. Returns true
+// when compiled code ran the rest of the loop.
+bool jit_while_back_edge(JitLoop* loop) {
+  return ready(loop) && run(loop);
+}
+
+// Called after every execution of the body of a for loop but its last, with
+// the value of the loop variable in the next iteration
+bool jit_for_back_edge(JitLoop* loop, int64_t next, int64_t last) {
+  if (!ready(loop)) return false;
+  loop->counters[0] = (JitCounter){ .i = next, .last = last };
+  return run(loop);
+}
+
+void free_jit(void) {
+  for (int b = 0; b < JIT_BUCKETS; b++) {
+    JitLoop* loop = loop_table[b];
+    while (loop) {
+      JitLoop* next = loop->next;
+      discard_code(loop);
+      free(loop);
+      loop = next;
+    }
+    loop_table[b] = NULL;
+  }
+}
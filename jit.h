@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ast.h"
+
+/*
+ * Baseline JIT of the tree walking evaluator.
+ *
+ * The evaluator counts how many times the body of every while and for loop
+ * runs. Once a loop is hot, and the variables it uses hold numbers and
+ * booleans, it is compiled to x86-64 machine code that works on the values
+ * in the symbol table directly, and the evaluator jumps into it at the end
+ * of the iteration it was running.
+ *
+ * The code assumes every variable keeps the type it had when the loop was
+ * compiled. Statements that would break that assumption or that the JIT does
+ * not compile, like assigning a string or anything raising a runtime error,
+ * leave the compiled code: the evaluator picks up the loop from that
+ * statement. Code whose assumptions no longer hold when it is entered again
+ * is compiled anew.
+ *
+ * Only Linux on x86-64 runs compiled code. Elsewhere, or with --no-jit,
+ * jit_loop returns NULL and loops are only interpreted.
+ */
+
+// Body executions after which a loop is compiled, by default
+#define JIT_DEFAULT_THRESHOLD 1000
+
+extern int jit_enabled;
+extern int jit_threshold;
+
+typedef struct JitLoop JitLoop;
+
+JitLoop* jit_loop(Stmt* loop);
+bool jit_while_back_edge(JitLoop* loop);
+bool jit_for_back_edge(JitLoop* loop, int64_t next, int64_t last);
+void free_jit(void);
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "loop.h"
+#include "opt.h"
+#include "datatype99.h"
+
+/*
+ * Loop invariant code motion.
+ *
+ * An instruction in a loop is invariant when it defines a temporary that has
+ * no other definition, and each of its operands is a constant, a name that
+ * is never assigned in the loop, or the result of another invariant
+ * instruction. Invariant instructions are moved to the loop's preheader, so
+ * they run once per entry to the loop instead of once per iteration.
+ *
+ * Moving an instruction that can fail would raise its runtime error when the
+ * loop body would never have run it, or before output the loop prints
+ * first. So an instruction that can fail is only moved when it is certain
+ * to be the first thing that fails or prints once the loop is entered: it is
+ * in the loop header, and everything before it in the header is moved as
+ * well or can neither fail nor print. Everything else is only moved when it
+ * cannot fail at all.
+ */
+
+// What is known of the value of a temporary
+typedef enum {
+  TYPE_UNKNOWN,
+  TYPE_BOOLEAN,
+  TYPE_NUMBER,
+  TYPE_STRING,
+} ValueType;
+
+static ValueType operand_type(ValueType* types, IrOperand operand) {
+  match (operand) {
+    of(IrTemp, temp) return types[*temp];
+    of(IrConst, value) {
+      match (*value) {
+        of(BooleanResult, _) return TYPE_BOOLEAN;
+        of(NumberResult, _) return TYPE_NUMBER;
+        of(StringResult, _) return TYPE_STRING;
+      }
+    }
+    otherwise return TYPE_UNKNOWN;
+  }
+
+  return TYPE_UNKNOWN;
+}
+
+// Whether `instr` could raise a runtime error. Reading a variable fails when
+// it was never assigned, so only instructions on temporaries and constants of
+// known types are safe.
+static bool may_fail(ValueType* types, IrInstr* instr) {
+  bool reads_var = MATCHES(instr->args[0], IrVar) || MATCHES(instr->args[1], IrVar);
+  ValueType a = operand_type(types, instr->args[0]);
+  ValueType b = operand_type(types, instr->args[1]);
+
+  switch (instr->op) {
+    case IR_COPY: case IR_EQ: case IR_IS_NUMBER: return reads_var;
+    case IR_NEG: case IR_TRUNC: return a != TYPE_NUMBER;
+    case IR_NOT: return a != TYPE_BOOLEAN;
+    case IR_AND: case IR_OR: return a != TYPE_BOOLEAN || b != TYPE_BOOLEAN;
+    case IR_ADD: return a != b || (a != TYPE_NUMBER && a != TYPE_STRING);
+    default: return a != TYPE_NUMBER || b != TYPE_NUMBER;
+  }
+}
+
+// Type of the value `instr` computes when it does not fail
+static ValueType result_type(ValueType* types, IrInstr* instr) {
+  switch (instr->op) {
+    case IR_COPY: return operand_type(types, instr->args[0]);
+    case IR_ADD: {
+      ValueType a = operand_type(types, instr->args[0]);
+      return a == operand_type(types, instr->args[1]) ? a : TYPE_UNKNOWN;
+    }
+    case IR_EQ: case IR_GT: case IR_GTE: case IR_LT: case IR_LTE:
+    case IR_AND: case IR_OR: case IR_NOT: case IR_IS_NUMBER:
+      return TYPE_BOOLEAN;
+    default:
+      return TYPE_NUMBER;
+  }
+}
+
+static bool is_computation(IrOpcode op) {
+  return op != IR_DISPLAY && op != IR_LABEL && !ir_is_branch(op);
+}
+
+// Moves the invariant instructions of `loop` to its preheader. Returns the
+// number of instructions moved.
+static int hoist_loop(IrProgram* ir, Cfg* cfg, Loop* loop, int* temp_defs, ValueType* types) {
+  bool* var_assigned = calloc(ir->var_count + 1, sizeof(bool));
+  bool* temp_assigned = calloc(ir->temp_count + 1, sizeof(bool));
+  bool* hoisted = calloc(ir->len + 1, sizeof(bool));
+  bool* hoisted_temp = calloc(ir->temp_count + 1, sizeof(bool));
+  IntList order = { 0 };
+  ensure_non_null(var_assigned, "out of space");
+  ensure_non_null(temp_assigned, "out of space");
+  ensure_non_null(hoisted, "out of space");
+  ensure_non_null(hoisted_temp, "out of space");
+
+  for (int i = 0; i < ir->len; i++) {
+    if (!loop_contains_instr(cfg, loop, i)) continue;
+    match (ir->instrs[i].dest) {
+      of(IrTemp, temp) temp_assigned[*temp] = true;
+      of(IrVar, var) var_assigned[*var] = true;
+      otherwise {}
+    }
+  }
+
+  BasicBlock* header = &cfg->blocks[loop->header];
+  for (bool progress = true; progress;) {
+    progress = false;
+
+    // Whether everything so far in the header is moved or harmless
+    bool clean_prefix = true;
+    for (int i = 0; i < ir->len; i++) {
+      IrInstr* instr = &ir->instrs[i];
+      if (!loop_contains_instr(cfg, loop, i)) continue;
+
+      bool in_header = i >= header->start && i < header->end;
+      bool fails = is_computation(instr->op) ? may_fail(types, instr) : instr->op != IR_LABEL;
+
+      bool invariant = !hoisted[i] && is_computation(instr->op) && MATCHES(instr->dest, IrTemp)
+        && temp_defs[instr->dest.data.IrTemp._0] == 1;
+      for (int k = 0; k < 2 && invariant; k++) {
+        match (instr->args[k]) {
+          of(IrTemp, temp) invariant = !temp_assigned[*temp] || hoisted_temp[*temp];
+          of(IrVar, var) invariant = !var_assigned[*var];
+          otherwise {}
+        }
+      }
+
+      if (invariant && (!fails || (in_header && clean_prefix))) {
+        hoisted[i] = true;
+        hoisted_temp[instr->dest.data.IrTemp._0] = true;
+        int_list_push(&order, i);
+        progress = true;
+      }
+
+      if (in_header && !hoisted[i] && (fails || instr->op == IR_DISPLAY)) clean_prefix = false;
+    }
+  }
+
+  int moved = order.len;
+  if (moved > 0) {
+    IrInstr* instrs = malloc(moved * sizeof(IrInstr));
+    ensure_non_null(instrs, "out of space");
+    for (int n = 0; n < moved; n++) {
+      instrs[n] = ir->instrs[order.items[n]];
+      if (opt_verbose) {
+        fprintf(stderr, "licm: ");
+        fprint_ir_instr(stderr, ir, &instrs[n]);
+        fprintf(stderr, "\n");
+      }
+    }
+
+    // The preheader shifts instructions around, but each moved one is the
+    // only definition of its temporary
+    int at = insert_preheader(ir, cfg, loop);
+    bool* remove = calloc(ir->len + 1, sizeof(bool));
+    ensure_non_null(remove, "out of space");
+    for (int i = 0; i < ir->len; i++) {
+      ifLet(ir->instrs[i].dest, IrTemp, temp) {
+        if (hoisted_temp[*temp]) {
+          remove[i] = true;
+          if (i < at) at--;
+        }
+      }
+    }
+
+    ir_remove_marked(ir, remove);
+    for (int n = 0; n < moved; n++) ir_insert(ir, at + n, instrs[n]);
+    free(remove);
+    free(instrs);
+  }
+
+  free_int_list(&order);
+  free(var_assigned);
+  free(temp_assigned);
+  free(hoisted);
+  free(hoisted_temp);
+  return moved;
+}
+
+int hoist_loop_invariants(IrProgram* ir) {
+  int changed = 0;
+
+  for (bool progress = true; progress;) {
+    progress = false;
+    remove_unreachable_blocks(ir);
+    Cfg* cfg = build_cfg(ir);
+    LoopList loops = find_loops(cfg);
+
+    // Temporaries with a single definition, and their types where known
+    int* temp_defs = calloc(ir->temp_count + 1, sizeof(int));
+    ValueType* types = calloc(ir->temp_count + 1, sizeof(ValueType));
+    ensure_non_null(temp_defs, "out of space");
+    ensure_non_null(types, "out of space");
+    for (int i = 0; i < ir->len; i++) {
+      ifLet(ir->instrs[i].dest, IrTemp, temp) temp_defs[*temp]++;
+    }
+    for (int i = 0; i < ir->len; i++) {
+      ifLet(ir->instrs[i].dest, IrTemp, temp) {
+        if (temp_defs[*temp] == 1) types[*temp] = result_type(types, &ir->instrs[i]);
+      }
+    }
+
+    for (int l = 0; l < loops.count && !progress; l++) {
+      int moved = hoist_loop(ir, cfg, &loops.loops[l], temp_defs, types);
+      changed += moved;
+      progress = moved > 0;
+    }
+
+    free(temp_defs);
+    free(types);
+    free_loops(&loops);
+    free_cfg(cfg);
+  }
+
+  return changed;
+}
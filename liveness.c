@@ -0,0 +1,103 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "liveness.h"
+#include "datatype99.h"
+
+#define WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+static unsigned long* block_set(Liveness* liveness, unsigned long* sets, int block) {
+  return sets + (size_t)block * liveness->words;
+}
+
+static bool set_has(unsigned long* set, int bit) {
+  return (set[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+}
+
+static void set_add(unsigned long* set, int bit) {
+  set[bit / WORD_BITS] |= 1UL << (bit % WORD_BITS);
+}
+
+bool is_live_in(Liveness* liveness, int block, int temp) {
+  return set_has(block_set(liveness, liveness->live_in, block), temp);
+}
+
+bool is_live_out(Liveness* liveness, int block, int temp) {
+  return set_has(block_set(liveness, liveness->live_out, block), temp);
+}
+
+// Backwards dataflow over the blocks:
+//   live_out(b) = union of live_in(s) over the successors s of b
+//   live_in(b) = uses(b) | (live_out(b) - defs(b))
+// where uses(b) are the temporaries read in b before being written.
+Liveness* compute_liveness(IrProgram* ir, Cfg* cfg) {
+  Liveness* liveness = malloc(sizeof(Liveness));
+  ensure_non_null(liveness, "out of space");
+  liveness->cfg = cfg;
+  liveness->words = ir->temp_count / WORD_BITS + 1;
+
+  size_t set_count = (size_t)cfg->block_count * liveness->words + 1;
+  liveness->live_in = calloc(set_count, sizeof(unsigned long));
+  liveness->live_out = calloc(set_count, sizeof(unsigned long));
+  unsigned long* uses = calloc(set_count, sizeof(unsigned long));
+  unsigned long* defs = calloc(set_count, sizeof(unsigned long));
+  ensure_non_null(liveness->live_in, "out of space");
+  ensure_non_null(liveness->live_out, "out of space");
+  ensure_non_null(uses, "out of space");
+  ensure_non_null(defs, "out of space");
+
+  for (int b = 0; b < cfg->block_count; b++) {
+    unsigned long* block_uses = block_set(liveness, uses, b);
+    unsigned long* block_defs = block_set(liveness, defs, b);
+    for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+      IrInstr* instr = &ir->instrs[i];
+      for (int k = 0; k < 2; k++) {
+        ifLet(instr->args[k], IrTemp, temp) {
+          if (!set_has(block_defs, *temp)) set_add(block_uses, *temp);
+        }
+      }
+      ifLet(instr->dest, IrTemp, temp) set_add(block_defs, *temp);
+    }
+  }
+
+  // Visiting the blocks in post-order converges in few iterations
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int r = cfg->rpo_count - 1; r >= 0; r--) {
+      int b = cfg->rpo[r];
+      BasicBlock* block = &cfg->blocks[b];
+      unsigned long* out = block_set(liveness, liveness->live_out, b);
+      unsigned long* in = block_set(liveness, liveness->live_in, b);
+
+      for (int s = 0; s < block->succ_count; s++) {
+        unsigned long* succ_in = block_set(liveness, liveness->live_in, block->succs[s]);
+        for (int w = 0; w < liveness->words; w++) out[w] |= succ_in[w];
+      }
+
+      unsigned long* block_uses = block_set(liveness, uses, b);
+      unsigned long* block_defs = block_set(liveness, defs, b);
+      for (int w = 0; w < liveness->words; w++) {
+        unsigned long word = block_uses[w] | (out[w] & ~block_defs[w]);
+        if (word != in[w]) {
+          in[w] = word;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  free(uses);
+  free(defs);
+  return liveness;
+}
+
+void free_liveness(Liveness* liveness) {
+  free(liveness->live_in);
+  free(liveness->live_out);
+  free(liveness);
+}
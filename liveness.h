@@ -0,0 +1,23 @@
+#pragma once
+
+#include "cfg.h"
+#include "ir.h"
+
+/*
+ * Liveness of the temporaries of an IR program at the boundaries of every
+ * basic block, as bit sets indexed by temporary number.
+ */
+
+typedef struct {
+  Cfg* cfg;
+  int words;  // Words per bit set
+
+  unsigned long* live_in;
+  unsigned long* live_out;
+} Liveness;
+
+Liveness* compute_liveness(IrProgram* ir, Cfg* cfg);
+void free_liveness(Liveness* liveness);
+
+bool is_live_in(Liveness* liveness, int block, int temp);
+bool is_live_out(Liveness* liveness, int block, int temp);
@@ -0,0 +1,799 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "llvm.h"
+#include "runtime.h"
+#include "datatype99.h"
+
+/*
+ * LLVM backend.
+ *
+ * Translates intermediate code to a textual LLVM IR module defining the
+ * pseudo_main that the runtime library in runtime.c calls, for clang or llc
+ * to optimize and compile. No LLVM library is used.
+ *
+ * Every variable and temporary gets a stack slot typed after the values it
+ * can hold: a double for numbers, an i1 for booleans, an i8* for strings,
+ * and a PseudoValue for the ones that can hold several types, or that are
+ * read where they may not have been assigned yet. LLVM promotes the typed
+ * slots to SSA registers. Typed instructions become LLVM instructions on the
+ * payloads, branches become branches between basic blocks named after the
+ * IR labels, and untyped instructions, displaying, concatenating and every
+ * error go through the runtime library, as in the assembly backend.
+ */
+
+typedef struct {
+  FILE* out;
+  IrProgram* ir;
+  IrType* types;   // Of every variable, then every temporary
+  bool* assigned;  // Variables assigned on every path to the current instruction
+  Cfg* cfg;
+  int next_value;  // Number of the next %x value
+  int next_local;  // Number of the next %ok/%fail block
+
+  ExprResult* consts;  // Constant pool, in @.const order
+  int const_count;
+} Llvm;
+
+static void emit(Llvm* l, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  fputs("  ", l->out);
+  vfprintf(l->out, fmt, ap);
+  fputc('\n', l->out);
+  va_end(ap);
+}
+
+// Names of LLVM values and constants. The text lives until the 32nd call
+// after this one, longer than any instruction needs it.
+static char* name_buffer(void) {
+  static char buffers[32][96];
+  static int next = 0;
+  return buffers[next++ % 32];
+}
+
+static const char* new_value(Llvm* l) {
+  char* buffer = name_buffer();
+  sprintf(buffer, "%%x%d", l->next_value++);
+  return buffer;
+}
+
+static int new_local(Llvm* l) {
+  return l->next_local++;
+}
+
+static int add_const(Llvm* l, ExprResult value) {
+  for (int i = 0; i < l->const_count; i++) {
+    if (ir_results_equal(l->consts[i], value)) return i;
+  }
+
+  l->consts = realloc(l->consts, (l->const_count + 1) * sizeof(ExprResult));
+  ensure_non_null(l->consts, "out of space");
+  l->consts[l->const_count] = value;
+  return l->const_count++;
+}
+
+static const char* llvm_type(IrType type) {
+  switch (type) {
+    case IR_TYPE_BOOLEAN: return "i1";
+    case IR_TYPE_NUMBER: return "double";
+    case IR_TYPE_STRING: return "i8*";
+    default: return "%PseudoValue";
+  }
+}
+
+static int64_t runtime_op(IrOpcode op) {
+  switch (ir_untyped_op(op)) {
+    case IR_ADD: return PSEUDO_ADD;
+    case IR_SUB: return PSEUDO_SUB;
+    case IR_MUL: return PSEUDO_MUL;
+    case IR_DIV: return PSEUDO_DIV;
+    case IR_EQ: return PSEUDO_EQ;
+    case IR_GT: return PSEUDO_GT;
+    case IR_GTE: return PSEUDO_GTE;
+    case IR_LT: return PSEUDO_LT;
+    case IR_LTE: return PSEUDO_LTE;
+    case IR_AND: return PSEUDO_AND;
+    case IR_OR: return PSEUDO_OR;
+    case IR_NEG: return PSEUDO_NEG;
+    case IR_NOT: return PSEUDO_NOT;
+    case IR_IF: return PSEUDO_IF;
+    case IR_TRUNC: return PSEUDO_TRUNC;
+    case IR_FOR_TRIP: return PSEUDO_FOR_TRIP;
+    default:
+      unreachable("runtime_op");
+      return 0;
+  }
+}
+
+static int64_t runtime_tag(IrType type) {
+  switch (type) {
+    case IR_TYPE_BOOLEAN: return PSEUDO_BOOLEAN;
+    case IR_TYPE_NUMBER: return PSEUDO_NUMBER;
+    case IR_TYPE_STRING: return PSEUDO_STRING;
+    default:
+      unreachable("runtime_tag");
+      return 0;
+  }
+}
+
+/* ------------------------------ Slot types ------------------------------ */
+
+static int slot(Llvm* l, IrOperand operand) {
+  match (operand) {
+    of(IrVar, var) return *var;
+    of(IrTemp, temp) return l->ir->var_count + *temp;
+    otherwise return -1;
+  }
+  return -1;
+}
+
+static IrType join(IrType a, IrType b) {
+  if (a == IR_TYPE_NONE) return b;
+  if (b == IR_TYPE_NONE || a == b) return a;
+  return IR_TYPE_ANY;
+}
+
+static bool is_known(IrType type) {
+  return type != IR_TYPE_NONE && type != IR_TYPE_ANY;
+}
+
+static IrType operand_type(Llvm* l, IrOperand operand) {
+  match (operand) {
+    of(IrConst, value) return ir_result_type(*value);
+    of(IrNone) return IR_TYPE_NONE;
+    otherwise return l->types[slot(l, operand)];
+  }
+  return IR_TYPE_ANY;
+}
+
+// Type of the values `instr` stores in its destination when it does not
+// fail. Untyped additions can give numbers and strings; every other
+// instruction gives one type.
+static IrType result_type(Llvm* l, IrInstr* instr) {
+  switch (instr->op) {
+    case IR_COPY:
+      return operand_type(l, instr->args[0]);
+    case IR_ADD: {
+      IrType a = operand_type(l, instr->args[0]);
+      IrType b = operand_type(l, instr->args[1]);
+      if (a == IR_TYPE_NONE || b == IR_TYPE_NONE) return IR_TYPE_NONE;
+      return a == b && is_known(a) ? a : IR_TYPE_ANY;
+    }
+    case IR_SUB: case IR_MUL: case IR_DIV: case IR_NEG:
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: case IR_FNEG:
+    case IR_FOR_TRIP: case IR_TRUNC:
+      return IR_TYPE_NUMBER;
+    case IR_CONCAT:
+      return IR_TYPE_STRING;
+    default:
+      return IR_TYPE_BOOLEAN;
+  }
+}
+
+// Finds the type of every slot, over the whole program: the join of the
+// types of the values stored in it. Variables read where they may not have
+// been assigned need the undefined tag, and so a PseudoValue.
+static void infer_slot_types(Llvm* l) {
+  IrProgram* ir = l->ir;
+  int slots = ir->var_count + ir->temp_count;
+  l->types = calloc(slots + 1, sizeof(IrType));
+  ensure_non_null(l->types, "out of space");
+
+  bool* assigned = assigned_on_entry(ir, l->cfg);
+  for (int b = 0; b < l->cfg->block_count; b++) {
+    bool* block_assigned = &assigned[b * (size_t)ir->var_count];
+    for (int i = l->cfg->blocks[b].start; i < l->cfg->blocks[b].end; i++) {
+      IrInstr* instr = &ir->instrs[i];
+      for (int a = 0; a < 2; a++) {
+        ifLet(instr->args[a], IrVar, var) {
+          if (!block_assigned[*var]) l->types[*var] = IR_TYPE_ANY;
+        }
+      }
+      ifLet(instr->dest, IrVar, var) block_assigned[*var] = true;
+    }
+  }
+  free(assigned);
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < ir->len; i++) {
+      int dest = slot(l, ir->instrs[i].dest);
+      if (dest < 0) continue;
+      IrType type = join(l->types[dest], result_type(l, &ir->instrs[i]));
+      changed |= type != l->types[dest];
+      l->types[dest] = type;
+    }
+  }
+
+  // Slots nothing is stored in are never read either
+  for (int s = 0; s < slots; s++) {
+    if (l->types[s] == IR_TYPE_NONE) l->types[s] = IR_TYPE_ANY;
+  }
+}
+
+/* ------------------------------ Operands ------------------------------ */
+
+static const char* slot_name(IrOperand operand) {
+  char* buffer = name_buffer();
+  match (operand) {
+    of(IrVar, var) sprintf(buffer, "%%v%d", *var);
+    of(IrTemp, temp) sprintf(buffer, "%%t%d", *temp);
+    otherwise unreachable("slot_name");
+  }
+  return buffer;
+}
+
+static const char* string_pointer(int length, const char* global) {
+  char* buffer = name_buffer();
+  sprintf(buffer, "getelementptr inbounds ([%d x i8], [%d x i8]* %s, i64 0, i64 0)", length, length, global);
+  return buffer;
+}
+
+static const char* const_string(Llvm* l, int c) {
+  char global[32];
+  sprintf(global, "@.str.%d", c);
+  ExprResult value = l->consts[c];
+  return string_pointer((int)strlen(value.data.StringResult._0) + 1, global);
+}
+
+// Payload of a PseudoValue slot, as a value of type `type`
+static const char* load_payload(Llvm* l, const char* pointer, IrType type) {
+  const char* field = new_value(l);
+  emit(l, "%s = getelementptr inbounds %%PseudoValue, %%PseudoValue* %s, i32 0, i32 1", field, pointer);
+  const char* bits = new_value(l);
+  emit(l, "%s = load i64, i64* %s", bits, field);
+  const char* value = new_value(l);
+  switch (type) {
+    case IR_TYPE_NUMBER: emit(l, "%s = bitcast i64 %s to double", value, bits); break;
+    case IR_TYPE_BOOLEAN: emit(l, "%s = icmp ne i64 %s, 0", value, bits); break;
+    case IR_TYPE_STRING: emit(l, "%s = inttoptr i64 %s to i8*", value, bits); break;
+    default: unreachable("load_payload");
+  }
+  return value;
+}
+
+static const char* load_tag(Llvm* l, const char* pointer) {
+  const char* field = new_value(l);
+  emit(l, "%s = getelementptr inbounds %%PseudoValue, %%PseudoValue* %s, i32 0, i32 0", field, pointer);
+  const char* tag = new_value(l);
+  emit(l, "%s = load i64, i64* %s", tag, field);
+  return tag;
+}
+
+// The value of `operand` as type `type`: a constant, or a value loaded from
+// its slot. Operands known to hold another type are only read in code that
+// fails before, so their value is undefined.
+static const char* load(Llvm* l, IrOperand operand, IrType type) {
+  IrType have = operand_type(l, operand);
+  if (have == IR_TYPE_ANY) return load_payload(l, slot_name(operand), type);
+  if (have != type) return "undef";
+
+  char* buffer = name_buffer();
+  match (operand) {
+    of(IrConst, value) {
+      match (*value) {
+        of(BooleanResult, boolean) return *boolean ? "true" : "false";
+        of(NumberResult, number) {
+          uint64_t bits;
+          memcpy(&bits, number, sizeof(bits));
+          sprintf(buffer, "0x%016llX", (unsigned long long)bits);
+          return buffer;
+        }
+        of(StringResult, _) return const_string(l, add_const(l, *value));
+      }
+    }
+    otherwise {
+      const char* value = new_value(l);
+      emit(l, "%s = load %s, %s* %s", value, llvm_type(type), llvm_type(type), slot_name(operand));
+      return value;
+    }
+  }
+  return buffer;
+}
+
+// `value` of type `type` as the 64 bit payload of a PseudoValue
+static const char* payload_bits(Llvm* l, const char* value, IrType type) {
+  if (strcmp(value, "undef") == 0) return "undef";
+  const char* bits = new_value(l);
+  switch (type) {
+    case IR_TYPE_NUMBER: emit(l, "%s = bitcast double %s to i64", bits, value); break;
+    case IR_TYPE_BOOLEAN: emit(l, "%s = zext i1 %s to i64", bits, value); break;
+    case IR_TYPE_STRING: emit(l, "%s = ptrtoint i8* %s to i64", bits, value); break;
+    default: unreachable("payload_bits");
+  }
+  return bits;
+}
+
+static void store_pseudo_value(Llvm* l, const char* pointer, IrType type, const char* value) {
+  const char* bits = payload_bits(l, value, type);
+  const char* tag = new_value(l);
+  emit(l, "%s = getelementptr inbounds %%PseudoValue, %%PseudoValue* %s, i32 0, i32 0", tag, pointer);
+  emit(l, "store i64 %ld, i64* %s", (long)runtime_tag(type), tag);
+  const char* field = new_value(l);
+  emit(l, "%s = getelementptr inbounds %%PseudoValue, %%PseudoValue* %s, i32 0, i32 1", field, pointer);
+  emit(l, "store i64 %s, i64* %s", bits, field);
+}
+
+// Stores `value` of type `type` in `dest`
+static void store(Llvm* l, IrOperand dest, IrType type, const char* value) {
+  IrType have = operand_type(l, dest);
+  if (have == IR_TYPE_ANY) {
+    store_pseudo_value(l, slot_name(dest), type, value);
+  } else {
+    emit(l, "store %s %s, %s* %s", llvm_type(type), value, llvm_type(type), slot_name(dest));
+  }
+}
+
+// Pointer to a PseudoValue holding `operand`, for the runtime library.
+// Values in typed slots are copied to the scratch PseudoValue `scratch`.
+static const char* value_pointer(Llvm* l, IrOperand operand, const char* scratch) {
+  IrType type = operand_type(l, operand);
+  char* buffer = name_buffer();
+  ifLet(operand, IrConst, value) {
+    sprintf(buffer, "@.const.%d", add_const(l, *value));
+    return buffer;
+  }
+  if (type == IR_TYPE_ANY) return slot_name(operand);
+
+  store_pseudo_value(l, scratch, type, load(l, operand, type));
+  strcpy(buffer, scratch);
+  return buffer;
+}
+
+// Stores the result the runtime library left in `pointer` in `dest`
+static void store_result(Llvm* l, IrOperand dest, const char* pointer) {
+  IrType type = operand_type(l, dest);
+  if (type == IR_TYPE_ANY) return;
+  store(l, dest, type, load_payload(l, pointer, type));
+}
+
+// Pointer for the runtime library to leave the result for `dest` in
+static const char* result_pointer(Llvm* l, IrOperand dest) {
+  return operand_type(l, dest) == IR_TYPE_ANY ? slot_name(dest) : "%result";
+}
+
+/* ---------------------------- Instructions ---------------------------- */
+
+static void start_block(Llvm* l, const char* kind, int local) {
+  fprintf(l->out, "%s%d:\n", kind, local);
+}
+
+// Reading a variable nothing was assigned to is an error
+static void emit_defined_check(Llvm* l, IrOperand operand) {
+  ifLet(operand, IrVar, var) {
+    if (l->assigned[*var]) return;
+    int ok = new_local(l);
+    int fail = new_local(l);
+    const char* tag = load_tag(l, slot_name(operand));
+    const char* undefined = new_value(l);
+    emit(l, "%s = icmp eq i64 %s, %d", undefined, tag, PSEUDO_UNDEFINED);
+    emit(l, "br i1 %s, label %%fail%d, label %%ok%d", undefined, fail, ok);
+    start_block(l, "fail", fail);
+    int length = (int)strlen(l->ir->vars[*var]) + 1;
+    char global[32];
+    sprintf(global, "@.name.%d", *var);
+    emit(l, "call void @pseudo_undefined(i8* %s)", string_pointer(length, global));
+    emit(l, "unreachable");
+    start_block(l, "ok", ok);
+  }
+}
+
+// i1 value of the typed comparison `relop` of x and y. Comparisons with NaN
+// are false, as ordered comparisons are.
+static const char* emit_typed_compare(Llvm* l, IrOpcode relop, IrOperand x, IrOperand y) {
+  const char* result = NULL;
+  switch (relop) {
+    case IR_FEQ: case IR_FGT: case IR_FGTE: case IR_FLT: case IR_FLTE: {
+      const char* cond = relop == IR_FEQ ? "oeq" : relop == IR_FGT ? "ogt" : relop == IR_FGTE ? "oge"
+        : relop == IR_FLT ? "olt" : "ole";
+      const char* a = load(l, x, IR_TYPE_NUMBER);
+      const char* b = load(l, y, IR_TYPE_NUMBER);
+      result = new_value(l);
+      emit(l, "%s = fcmp %s double %s, %s", result, cond, a, b);
+      break;
+    }
+    case IR_BEQ: {
+      const char* a = load(l, x, IR_TYPE_BOOLEAN);
+      const char* b = load(l, y, IR_TYPE_BOOLEAN);
+      result = new_value(l);
+      emit(l, "%s = icmp eq i1 %s, %s", result, a, b);
+      break;
+    }
+    case IR_STREQ: {
+      const char* a = load(l, x, IR_TYPE_STRING);
+      const char* b = load(l, y, IR_TYPE_STRING);
+      const char* equal = new_value(l);
+      emit(l, "%s = call i64 @pseudo_streq(i8* %s, i8* %s)", equal, a, b);
+      result = new_value(l);
+      emit(l, "%s = icmp ne i64 %s, 0", result, equal);
+      break;
+    }
+    default:
+      unreachable("emit_typed_compare");
+  }
+  return result;
+}
+
+static const char* block_name(Llvm* l, int block) {
+  char* buffer = name_buffer();
+  if (block >= l->cfg->block_count) return "exit";
+
+  IrInstr* first = &l->ir->instrs[l->cfg->blocks[block].start];
+  if (first->op == IR_LABEL) sprintf(buffer, "L%d", first->label);
+  else sprintf(buffer, "B%d", block);
+  return buffer;
+}
+
+static void emit_branch(Llvm* l, IrInstr* instr, int next) {
+  bool negated = instr->op == IR_IF_NOT || instr->op == IR_IF_NOT_CMP;
+  IrOperand x = instr->args[0];
+  IrOperand y = instr->args[1];
+  const char* cond = NULL;
+
+  if (instr->op == IR_IF || instr->op == IR_IF_NOT) {
+    IrType type = operand_type(l, x);
+    if (type == IR_TYPE_BOOLEAN) {
+      cond = load(l, x, IR_TYPE_BOOLEAN);
+    } else if (type == IR_TYPE_ANY) {
+      int ok = new_local(l);
+      int fail = new_local(l);
+      const char* tag = load_tag(l, slot_name(x));
+      const char* boolean = new_value(l);
+      emit(l, "%s = icmp eq i64 %s, %d", boolean, tag, PSEUDO_BOOLEAN);
+      emit(l, "br i1 %s, label %%ok%d, label %%fail%d", boolean, ok, fail);
+      start_block(l, "fail", fail);
+      emit(l, "call i64 @pseudo_condition(%%PseudoValue* %s)", slot_name(x));
+      emit(l, "unreachable");
+      start_block(l, "ok", ok);
+      cond = load(l, x, IR_TYPE_BOOLEAN);
+    } else {
+      // Always fails
+      emit(l, "call i64 @pseudo_condition(%%PseudoValue* %s)", value_pointer(l, x, "%arg0"));
+      emit(l, "unreachable");
+      return;
+    }
+  } else if (ir_is_typed(instr->relop)) {
+    cond = emit_typed_compare(l, instr->relop, x, y);
+  } else {
+    // Untyped comparisons always give a boolean, or fail
+    const char* a = value_pointer(l, x, "%arg0");
+    const char* b = value_pointer(l, y, "%arg1");
+    emit(l, "call void @pseudo_binary(%%PseudoValue* %%result, i64 %ld, %%PseudoValue* %s, %%PseudoValue* %s)",
+         (long)runtime_op(instr->relop), a, b);
+    cond = load_payload(l, "%result", IR_TYPE_BOOLEAN);
+  }
+
+  const char* target = block_name(l, l->cfg->label_block[instr->label]);
+  const char* fallthrough = block_name(l, next);
+  emit(l, "br i1 %s, label %%%s, label %%%s", cond, negated ? fallthrough : target, negated ? target : fallthrough);
+}
+
+static void emit_check(Llvm* l, IrInstr* instr) {
+  IrType type = ir_operand_type(instr->op);
+  bool binary = ir_is_binary(instr->relop);
+  IrOperand x = instr->args[0];
+  IrOperand y = binary ? instr->args[1] : x;
+
+  // Operands whose type is known need no checking, and operands known to
+  // have another type always fail
+  const char* conds[2] = { NULL, NULL };
+  bool fails = false;
+  for (int a = 0; a < (binary ? 2 : 1); a++) {
+    IrOperand operand = a == 0 ? x : y;
+    IrType have = operand_type(l, operand);
+    if (have == type) continue;
+    if (have != IR_TYPE_ANY) {
+      fails = true;
+      continue;
+    }
+    const char* tag = load_tag(l, slot_name(operand));
+    const char* cond = new_value(l);
+    emit(l, "%s = icmp eq i64 %s, %ld", cond, tag, (long)runtime_tag(type));
+    conds[a] = cond;
+  }
+  if (!fails && !conds[0] && !conds[1]) return;
+
+  int ok = new_local(l);
+  int fail = new_local(l);
+  if (fails) {
+    emit(l, "br label %%fail%d", fail);
+  } else if (conds[0] && conds[1]) {
+    const char* both = new_value(l);
+    emit(l, "%s = and i1 %s, %s", both, conds[0], conds[1]);
+    emit(l, "br i1 %s, label %%ok%d, label %%fail%d", both, ok, fail);
+  } else {
+    emit(l, "br i1 %s, label %%ok%d, label %%fail%d", conds[0] ? conds[0] : conds[1], ok, fail);
+  }
+  start_block(l, "fail", fail);
+  const char* a = value_pointer(l, x, "%arg0");
+  const char* b = value_pointer(l, y, "%arg1");
+  emit(l, "call void @pseudo_check_failed(i64 %ld, %%PseudoValue* %s, %%PseudoValue* %s)",
+       (long)runtime_op(instr->relop), a, b);
+  emit(l, "unreachable");
+  start_block(l, "ok", ok);
+}
+
+static void emit_display(Llvm* l, IrOperand x) {
+  IrType type = operand_type(l, x);
+  const char* value;
+  switch (type) {
+    case IR_TYPE_NUMBER:
+      emit(l, "call void @pseudo_display_number(double %s)", load(l, x, type));
+      break;
+    case IR_TYPE_BOOLEAN:
+      value = payload_bits(l, load(l, x, type), type);
+      emit(l, "call void @pseudo_display_boolean(i64 %s)", value);
+      break;
+    case IR_TYPE_STRING:
+      emit(l, "call void @pseudo_display_string(i8* %s)", load(l, x, type));
+      break;
+    default:
+      emit(l, "call void @pseudo_display(%%PseudoValue* %s)", value_pointer(l, x, "%arg0"));
+      break;
+  }
+}
+
+// Emits `instr`, the last instruction of its block when `next` is not -1.
+// Blocks that do not end in a branch fall through to block `next`.
+static void emit_instr(Llvm* l, IrInstr* instr, int next) {
+  IrOperand dest = instr->dest;
+  IrOperand x = instr->args[0];
+  IrOperand y = instr->args[1];
+
+  if (instr->op != IR_LABEL) {
+    fprintf(l->out, "  ; ");
+    fprint_ir_instr(l->out, l->ir, instr);
+    fprintf(l->out, "\n");
+  }
+  emit_defined_check(l, x);
+  emit_defined_check(l, y);
+
+  switch (instr->op) {
+    case IR_COPY: {
+      IrType type = operand_type(l, x);
+      if (type != IR_TYPE_ANY) {
+        store(l, dest, type, load(l, x, type));
+      } else {
+        const char* value = new_value(l);
+        emit(l, "%s = load %%PseudoValue, %%PseudoValue* %s", value, slot_name(x));
+        emit(l, "store %%PseudoValue %s, %%PseudoValue* %s", value, slot_name(dest));
+      }
+      break;
+    }
+    case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+    case IR_EQ: case IR_GT: case IR_GTE: case IR_LT: case IR_LTE:
+    case IR_AND: case IR_OR: {
+      const char* a = value_pointer(l, x, "%arg0");
+      const char* b = value_pointer(l, y, "%arg1");
+      const char* result = result_pointer(l, dest);
+      emit(l, "call void @pseudo_binary(%%PseudoValue* %s, i64 %ld, %%PseudoValue* %s, %%PseudoValue* %s)",
+           result, (long)runtime_op(instr->op), a, b);
+      store_result(l, dest, result);
+      break;
+    }
+    case IR_NEG: case IR_NOT: {
+      const char* a = value_pointer(l, x, "%arg0");
+      const char* result = result_pointer(l, dest);
+      emit(l, "call void @pseudo_unary(%%PseudoValue* %s, i64 %ld, %%PseudoValue* %s)",
+           result, (long)runtime_op(instr->op), a);
+      store_result(l, dest, result);
+      break;
+    }
+    case IR_FOR_TRIP: {
+      const char* a = value_pointer(l, x, "%arg0");
+      const char* b = value_pointer(l, y, "%arg1");
+      const char* trip = new_value(l);
+      emit(l, "%s = call double @pseudo_for_trip(%%PseudoValue* %s, %%PseudoValue* %s)", trip, a, b);
+      store(l, dest, IR_TYPE_NUMBER, trip);
+      break;
+    }
+    case IR_TRUNC: {
+      const char* a = value_pointer(l, x, "%arg0");
+      const char* start = new_value(l);
+      emit(l, "%s = call double @pseudo_for_start(%%PseudoValue* %s)", start, a);
+      store(l, dest, IR_TYPE_NUMBER, start);
+      break;
+    }
+    case IR_IS_NUMBER: {
+      IrType type = operand_type(l, x);
+      const char* is_number = type == IR_TYPE_NUMBER ? "true" : "false";
+      if (type == IR_TYPE_ANY) {
+        const char* tag = load_tag(l, slot_name(x));
+        is_number = new_value(l);
+        emit(l, "%s = icmp eq i64 %s, %d", is_number, tag, PSEUDO_NUMBER);
+      }
+      store(l, dest, IR_TYPE_BOOLEAN, is_number);
+      break;
+    }
+    case IR_DISPLAY:
+      emit_display(l, x);
+      break;
+    case IR_LABEL:
+      break;
+    case IR_GOTO:
+      emit(l, "br label %%%s", block_name(l, l->cfg->label_block[instr->label]));
+      return;
+    case IR_IF: case IR_IF_NOT: case IR_IF_CMP: case IR_IF_NOT_CMP:
+      emit_branch(l, instr, next);
+      return;
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: {
+      const char* name = instr->op == IR_FADD ? "fadd" : instr->op == IR_FSUB ? "fsub"
+        : instr->op == IR_FMUL ? "fmul" : "fdiv";
+      const char* a = load(l, x, IR_TYPE_NUMBER);
+      const char* b = load(l, y, IR_TYPE_NUMBER);
+      const char* value = new_value(l);
+      emit(l, "%s = %s double %s, %s", value, name, a, b);
+      store(l, dest, IR_TYPE_NUMBER, value);
+      break;
+    }
+    case IR_FNEG: {
+      const char* a = load(l, x, IR_TYPE_NUMBER);
+      const char* value = new_value(l);
+      emit(l, "%s = fneg double %s", value, a);
+      store(l, dest, IR_TYPE_NUMBER, value);
+      break;
+    }
+    case IR_FEQ: case IR_FGT: case IR_FGTE: case IR_FLT: case IR_FLTE:
+    case IR_BEQ: case IR_STREQ:
+      store(l, dest, IR_TYPE_BOOLEAN, emit_typed_compare(l, instr->op, x, y));
+      break;
+    case IR_BAND: case IR_BOR: {
+      const char* a = load(l, x, IR_TYPE_BOOLEAN);
+      const char* b = load(l, y, IR_TYPE_BOOLEAN);
+      const char* value = new_value(l);
+      emit(l, "%s = %s i1 %s, %s", value, instr->op == IR_BAND ? "and" : "or", a, b);
+      store(l, dest, IR_TYPE_BOOLEAN, value);
+      break;
+    }
+    case IR_BNOT: {
+      const char* a = load(l, x, IR_TYPE_BOOLEAN);
+      const char* value = new_value(l);
+      emit(l, "%s = xor i1 %s, true", value, a);
+      store(l, dest, IR_TYPE_BOOLEAN, value);
+      break;
+    }
+    case IR_CONCAT: {
+      const char* a = load(l, x, IR_TYPE_STRING);
+      const char* b = load(l, y, IR_TYPE_STRING);
+      const char* value = new_value(l);
+      emit(l, "%s = call i8* @pseudo_concat(i8* %s, i8* %s)", value, a, b);
+      store(l, dest, IR_TYPE_STRING, value);
+      break;
+    }
+    case IR_CHECK_NUMBER: case IR_CHECK_BOOLEAN: case IR_CHECK_STRING:
+      emit_check(l, instr);
+      break;
+    default:
+      unreachable("emit_instr");
+  }
+
+  if (next != -1) emit(l, "br label %%%s", block_name(l, next));
+}
+
+/* ------------------------------- Module ------------------------------- */
+
+static void emit_string(Llvm* l, const char* global, const char* str) {
+  fprintf(l->out, "%s = private unnamed_addr constant [%d x i8] c\"", global, (int)strlen(str) + 1);
+  for (const unsigned char* c = (const unsigned char*)str; *c; c++) {
+    if (*c == '"' || *c == '\\' || *c < ' ' || *c >= 0x7f) fprintf(l->out, "\\%02X", *c);
+    else fputc(*c, l->out);
+  }
+  fprintf(l->out, "\\00\"\n");
+}
+
+static void emit_globals(Llvm* l) {
+  fprintf(l->out, "\n");
+  for (int i = 0; i < l->const_count; i++) {
+    char global[32];
+    match (l->consts[i]) {
+      of(BooleanResult, boolean) {
+        fprintf(l->out, "@.const.%d = private unnamed_addr constant %%PseudoValue { i64 %d, i64 %d }\n",
+                i, PSEUDO_BOOLEAN, *boolean ? 1 : 0);
+      }
+      of(NumberResult, number) {
+        int64_t bits;
+        memcpy(&bits, number, sizeof(bits));
+        fprintf(l->out, "@.const.%d = private unnamed_addr constant %%PseudoValue { i64 %d, i64 %lld }  ; %g\n",
+                i, PSEUDO_NUMBER, (long long)bits, *number);
+      }
+      of(StringResult, str) {
+        sprintf(global, "@.str.%d", i);
+        emit_string(l, global, *str);
+        fprintf(l->out, "@.const.%d = private unnamed_addr constant %%PseudoValue { i64 %d, i64 ptrtoint (i8* %s to i64) }\n",
+                i, PSEUDO_STRING, const_string(l, i));
+      }
+    }
+  }
+  for (int v = 0; v < l->ir->var_count; v++) {
+    char global[32];
+    sprintf(global, "@.name.%d", v);
+    emit_string(l, global, l->ir->vars[v]);
+  }
+}
+
+static void emit_declarations(Llvm* l) {
+  fprintf(l->out,
+    "\n"
+    "declare void @pseudo_display(%%PseudoValue*)\n"
+    "declare void @pseudo_display_boolean(i64)\n"
+    "declare void @pseudo_display_number(double)\n"
+    "declare void @pseudo_display_string(i8*)\n"
+    "declare void @pseudo_binary(%%PseudoValue*, i64, %%PseudoValue*, %%PseudoValue*)\n"
+    "declare void @pseudo_unary(%%PseudoValue*, i64, %%PseudoValue*)\n"
+    "declare i64 @pseudo_condition(%%PseudoValue*)\n"
+    "declare double @pseudo_for_start(%%PseudoValue*)\n"
+    "declare double @pseudo_for_trip(%%PseudoValue*, %%PseudoValue*)\n"
+    "declare i8* @pseudo_concat(i8*, i8*)\n"
+    "declare i64 @pseudo_streq(i8*, i8*)\n"
+    "declare void @pseudo_check_failed(i64, %%PseudoValue*, %%PseudoValue*) noreturn\n"
+    "declare void @pseudo_undefined(i8*) noreturn\n");
+}
+
+// Writes `ir`, compiled from the file `source`, to `path` as an LLVM module
+// defining pseudo_main
+void write_llvm(IrProgram* ir, const char* source, const char* path) {
+  FILE* out = fopen(path, "w");
+  if (!out) {
+    perror("could not open output file");
+    exit(1);
+  }
+
+  Llvm l = { .out = out, .ir = ir, .cfg = build_cfg(ir) };
+  infer_slot_types(&l);
+
+  fprintf(out, "; ModuleID = '%s'\n", source);
+  fprintf(out, "source_filename = \"%s\"\n\n", source);
+  fprintf(out, "%%PseudoValue = type { i64, i64 }\n\n");
+  fprintf(out, "define void @pseudo_main() {\n");
+  fprintf(out, "entry:\n");
+  for (int v = 0; v < ir->var_count; v++) {
+    emit(&l, "%%v%d = alloca %s  ; %s", v, llvm_type(l.types[v]), ir->vars[v]);
+  }
+  for (int t = 0; t < ir->temp_count; t++) {
+    emit(&l, "%%t%d = alloca %s", t, llvm_type(l.types[ir->var_count + t]));
+  }
+  emit(&l, "%%arg0 = alloca %%PseudoValue");
+  emit(&l, "%%arg1 = alloca %%PseudoValue");
+  emit(&l, "%%result = alloca %%PseudoValue");
+
+  // Variables that can be read before they are assigned start out undefined
+  for (int v = 0; v < ir->var_count; v++) {
+    if (l.types[v] != IR_TYPE_ANY) continue;
+    emit(&l, "%%v%d.tag = getelementptr inbounds %%PseudoValue, %%PseudoValue* %%v%d, i32 0, i32 0", v, v);
+    emit(&l, "store i64 %d, i64* %%v%d.tag", PSEUDO_UNDEFINED, v);
+  }
+  emit(&l, "br label %%%s", block_name(&l, 0));
+
+  bool* assigned = assigned_on_entry(ir, l.cfg);
+  for (int b = 0; b < l.cfg->block_count; b++) {
+    BasicBlock* block = &l.cfg->blocks[b];
+    l.assigned = &assigned[b * (size_t)ir->var_count];
+    fprintf(out, "%s:\n", block_name(&l, b));
+    for (int i = block->start; i < block->end; i++) {
+      emit_instr(&l, &ir->instrs[i], i == block->end - 1 ? b + 1 : -1);
+      ifLet(ir->instrs[i].dest, IrVar, var) l.assigned[*var] = true;
+    }
+    if (block->start == block->end) emit(&l, "br label %%%s", block_name(&l, b + 1));
+  }
+  free(assigned);
+
+  fprintf(out, "exit:\n");
+  emit(&l, "ret void");
+  fprintf(out, "}\n");
+  emit_globals(&l);
+  emit_declarations(&l);
+
+  if (ferror(out) | fclose(out)) {
+    perror("could not write output file");
+    exit(1);
+  }
+  free(l.consts);
+  free(l.types);
+  free_cfg(l.cfg);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "ir.h"
+
+void write_llvm(IrProgram* ir, const char* source, const char* path);
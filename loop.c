@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "loop.h"
+#include "datatype99.h"
+
+static int compare_size(const void* a, const void* b) {
+  const Loop* x = a;
+  const Loop* y = b;
+  if (x->block_count != y->block_count) return x->block_count - y->block_count;
+  return x->header - y->header;
+}
+
+LoopList find_loops(Cfg* cfg) {
+  compute_dominators(cfg);
+  LoopList list = { NULL, 0 };
+  int* loop_of_header = malloc((cfg->block_count + 1) * sizeof(int));
+  int* worklist = malloc((cfg->block_count + 1) * sizeof(int));
+  ensure_non_null(loop_of_header, "out of space");
+  ensure_non_null(worklist, "out of space");
+  for (int b = 0; b < cfg->block_count; b++) loop_of_header[b] = -1;
+
+  for (int r = 0; r < cfg->rpo_count; r++) {
+    int latch = cfg->rpo[r];
+    BasicBlock* block = &cfg->blocks[latch];
+
+    for (int s = 0; s < block->succ_count; s++) {
+      int header = block->succs[s];
+      if (!dominates(cfg, header, latch)) continue;
+
+      // Loops sharing a header are merged
+      if (loop_of_header[header] < 0) {
+        list.loops = realloc(list.loops, (list.count + 1) * sizeof(Loop));
+        ensure_non_null(list.loops, "out of space");
+        Loop* loop = &list.loops[list.count];
+        loop->header = header;
+        loop->blocks = calloc(cfg->block_count + 1, sizeof(bool));
+        ensure_non_null(loop->blocks, "out of space");
+        loop->blocks[header] = true;
+        loop->block_count = 1;
+        loop_of_header[header] = list.count++;
+      }
+
+      Loop* loop = &list.loops[loop_of_header[header]];
+      int len = 0;
+      if (!loop->blocks[latch]) {
+        loop->blocks[latch] = true;
+        loop->block_count++;
+        worklist[len++] = latch;
+      }
+      while (len > 0) {
+        BasicBlock* curr = &cfg->blocks[worklist[--len]];
+        for (int p = 0; p < curr->pred_count; p++) {
+          int pred = curr->preds[p];
+          if (loop->blocks[pred] || cfg->idom[pred] == -1) continue;
+          loop->blocks[pred] = true;
+          loop->block_count++;
+          worklist[len++] = pred;
+        }
+      }
+    }
+  }
+
+  if (list.count > 0) qsort(list.loops, list.count, sizeof(Loop), compare_size);
+  free(loop_of_header);
+  free(worklist);
+  return list;
+}
+
+void free_loops(LoopList* list) {
+  for (int l = 0; l < list->count; l++) free(list->loops[l].blocks);
+  free(list->loops);
+  list->loops = NULL;
+  list->count = 0;
+}
+
+bool loop_contains_instr(Cfg* cfg, Loop* loop, int instr) {
+  return loop->blocks[cfg->instr_block[instr]];
+}
+
+// Makes sure the loop has a preheader: a place that runs exactly once each
+// time the loop is entered from outside, and never from inside the loop.
+// Returns the index of the instruction that code for the preheader should be
+// inserted before. The CFG is out of date afterwards.
+int insert_preheader(IrProgram* ir, Cfg* cfg, Loop* loop) {
+  BasicBlock* header = &cfg->blocks[loop->header];
+
+  int outside = -1, outside_count = 0;
+  for (int p = 0; p < header->pred_count; p++) {
+    if (!loop->blocks[header->preds[p]]) {
+      outside = header->preds[p];
+      outside_count++;
+    }
+  }
+
+  // A single predecessor that always continues into the header already is one
+  if (outside_count == 1 && cfg->blocks[outside].succ_count == 1) {
+    BasicBlock* pred = &cfg->blocks[outside];
+    IrOpcode last = ir->instrs[pred->end - 1].op;
+    if (last == IR_GOTO) return pred->end - 1;
+    if (!ir_is_cond_branch(last)) return pred->end;
+  }
+
+  // Otherwise a new block is placed right before the header, and the branches
+  // from outside the loop are redirected to it
+  int at = header->start;
+  bool has_label = ir->instrs[at].op == IR_LABEL;
+  int header_label = has_label ? ir->instrs[at].label : ir_new_label(ir);
+  int preheader_label = ir_new_label(ir);
+
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    if (ir_is_branch(instr->op) && instr->label == header_label && !loop_contains_instr(cfg, loop, i)) {
+      instr->label = preheader_label;
+    }
+  }
+
+  // Code falling through from the loop into the header skips the preheader
+  bool falls_in = false;
+  if (loop->header > 0 && loop->blocks[loop->header - 1]) {
+    falls_in = ir->instrs[cfg->blocks[loop->header - 1].end - 1].op != IR_GOTO;
+  }
+
+  if (!has_label) ir_insert(ir, at, ir_label_instr(IR_LABEL, header_label));
+  ir_insert(ir, at, ir_label_instr(IR_LABEL, preheader_label));
+  if (falls_in) {
+    ir_insert(ir, at, ir_label_instr(IR_GOTO, header_label));
+    at++;
+  }
+  return at + 1;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "cfg.h"
+#include "ir.h"
+
+/*
+ * Natural loops of a control flow graph.
+ *
+ * A back edge is an edge whose target dominates its source. The loop of a
+ * header is the header plus every block that reaches one of its back edges
+ * without going through the header.
+ */
+
+typedef struct {
+  int header;
+  bool* blocks;    // Whether each block of the CFG is in the loop
+  int block_count;
+} Loop;
+
+typedef struct {
+  Loop* loops;     // Innermost loops first
+  int count;
+} LoopList;
+
+LoopList find_loops(Cfg* cfg);
+void free_loops(LoopList* loops);
+
+bool loop_contains_instr(Cfg* cfg, Loop* loop, int instr);
+int insert_preheader(IrProgram* ir, Cfg* cfg, Loop* loop);
@@ -0,0 +1,691 @@
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+#include "ast.h"
+#include "ir.h"
+#include "obj.h"
+
+/*
+ * ELF object backend.
+ *
+ * Assembles the output of the assembly backend in memory and writes it as
+ * an x86-64 ELF64 relocatable object, to link with runtime.o, without
+ * running an assembler. Only the instructions and directives asm.c writes
+ * are understood: jumps are resolved here, and references to constants and
+ * calls into the runtime library are left to the linker as relocations.
+ */
+
+typedef enum {
+  SEC_TEXT,
+  SEC_DATA,    // .data.rel.ro.local, constants that hold pointers
+  SEC_RODATA,
+  SEC_NOTE,    // .note.GNU-stack, empty
+  SEC_COUNT,
+} ObjSection;
+
+static const char* section_names[SEC_COUNT] = { ".text", ".data.rel.ro.local", ".rodata", ".note.GNU-stack" };
+
+typedef struct {
+  uint8_t* bytes;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+typedef struct {
+  char* name;
+  ObjSection section;
+  size_t offset;
+} ObjLabel;
+
+// A field to fill in once every label is known. Jumps within .text are
+// resolved here, everything else becomes a relocation.
+typedef struct {
+  ObjSection section;
+  size_t offset;
+  char* target;
+  int64_t addend;
+  int type;  // R_X86_64_*, R_X86_64_NONE for jumps
+  int size;  // Of the displacement of a jump, 1 or 4 bytes
+} ObjFixup;
+
+typedef struct Obj Obj;
+struct Obj {
+  Buffer sections[SEC_COUNT];
+  ObjSection current;
+
+  ObjLabel* labels;
+  int label_count;
+  ObjFixup* fixups;
+  int fixup_count;
+
+  // Jumps are assembled with 32 bit displacements first. Every next pass
+  // uses 8 bit ones for the jumps whose target was close enough in the
+  // one before, which only brings the targets of the others closer, until
+  // the code stops shrinking.
+  size_t* jumps;  // Offsets of the jumps in .text, in order
+  int jump_count;
+  const Obj* previous;  // Pass
+
+  size_t main_size;
+  const char* line;  // Being assembled, for errors
+};
+
+typedef enum {
+  OPERAND_IMM,
+  OPERAND_REG,
+  OPERAND_MEM,
+  OPERAND_SYMBOL,
+} OperandKind;
+
+#define REG_RIP -1
+
+typedef struct {
+  OperandKind kind;
+  int64_t value;  // Immediate, or displacement
+  int reg;        // Register, or base register
+  bool xmm;
+  char* symbol;   // Label or function, or what a RIP relative displacement is from
+} Operand;
+
+static _Noreturn void cannot_assemble(Obj* o) {
+  fprintf(stderr, "cannot assemble: %s\n", o->line);
+  exit(1);
+}
+
+static void buffer_append(Buffer* buffer, const void* bytes, size_t count) {
+  if (buffer->len + count > buffer->cap) {
+    buffer->cap = (buffer->cap + count) * 2;
+    buffer->bytes = realloc(buffer->bytes, buffer->cap);
+    ensure_non_null(buffer->bytes, "out of space");
+  }
+  memcpy(buffer->bytes + buffer->len, bytes, count);
+  buffer->len += count;
+}
+
+static void buffer_pad(Buffer* buffer, size_t align) {
+  static const uint8_t zeros[16] = { 0 };
+  while (buffer->len % align) buffer_append(buffer, zeros, 1);
+}
+
+static Buffer* text(Obj* o) {
+  return &o->sections[SEC_TEXT];
+}
+
+static void byte(Obj* o, uint8_t value) {
+  buffer_append(text(o), &value, 1);
+}
+
+static void bytes32(Obj* o, int32_t value) {
+  buffer_append(text(o), &value, sizeof(value));
+}
+
+static void add_fixup(Obj* o, ObjSection section, char* target, int64_t addend, int type, int size) {
+  o->fixups = realloc(o->fixups, (o->fixup_count + 1) * sizeof(ObjFixup));
+  ensure_non_null(o->fixups, "out of space");
+  o->fixups[o->fixup_count++] = (ObjFixup){
+    .section = section,
+    .offset = o->sections[section].len,
+    .target = strdup(target),
+    .addend = addend,
+    .type = type,
+    .size = size,
+  };
+}
+
+static ObjLabel* find_label(Obj* o, const char* name) {
+  for (int l = 0; l < o->label_count; l++) {
+    if (strcmp(o->labels[l].name, name) == 0) return &o->labels[l];
+  }
+  return NULL;
+}
+
+/* ------------------------------ Operands ------------------------------ */
+
+static const struct {
+  const char* name;
+  int reg;
+} registers[] = {
+  { "rax", 0 }, { "rcx", 1 }, { "rdx", 2 }, { "rbx", 3 }, { "rsp", 4 }, { "rbp", 5 }, { "rsi", 6 }, { "rdi", 7 },
+  { "eax", 0 }, { "ecx", 1 }, { "edx", 2 }, { "ebx", 3 }, { "esi", 6 }, { "edi", 7 },
+  { "al", 0 }, { "cl", 1 }, { "dl", 2 }, { "bl", 3 },
+  { "rip", REG_RIP },
+};
+
+static int parse_register(Obj* o, const char* name, bool* xmm) {
+  if (*name++ != '%') cannot_assemble(o);
+  *xmm = strncmp(name, "xmm", 3) == 0;
+  if (*xmm) {
+    int reg = atoi(name + 3);
+    if (reg > 7) cannot_assemble(o);
+    return reg;
+  }
+  for (size_t r = 0; r < sizeof(registers) / sizeof(registers[0]); r++) {
+    if (strcmp(registers[r].name, name) == 0) return registers[r].reg;
+  }
+  cannot_assemble(o);
+}
+
+// Parses `$imm`, `%reg`, `disp(%rbp)`, `sym+off(%rip)` or `sym`
+static Operand parse_operand(Obj* o, char* text) {
+  Operand operand = { 0 };
+  if (*text == '$') {
+    operand.kind = OPERAND_IMM;
+    operand.value = strtoll(text + 1, NULL, 0);
+  } else if (*text == '%') {
+    operand.kind = OPERAND_REG;
+    operand.reg = parse_register(o, text, &operand.xmm);
+  } else if (strchr(text, '(')) {
+    char* paren = strchr(text, '(');
+    char* close = strchr(paren, ')');
+    if (!close) cannot_assemble(o);
+    *paren = *close = '\0';
+    operand.kind = OPERAND_MEM;
+    operand.reg = parse_register(o, paren + 1, &operand.xmm);
+    if (operand.reg == REG_RIP) {
+      char* plus = strchr(text, '+');
+      if (plus) {
+        *plus = '\0';
+        operand.value = strtoll(plus + 1, NULL, 0);
+      }
+      operand.symbol = text;
+    } else {
+      operand.value = strtoll(text, NULL, 0);
+    }
+  } else {
+    operand.kind = OPERAND_SYMBOL;
+    operand.symbol = text;
+  }
+  return operand;
+}
+
+/* ---------------------------- Instructions ---------------------------- */
+
+static bool fits8(int64_t value) {
+  return value >= -128 && value <= 127;
+}
+
+// Emits the ModRM byte and displacement of `rm`, with `reg` in its reg
+// field. A RIP relative displacement is relative to the end of the
+// instruction, after an immediate of `imm_size` bytes.
+static void emit_modrm(Obj* o, int reg, Operand* rm, int imm_size) {
+  if (rm->kind == OPERAND_REG) {
+    byte(o, 0xc0 | reg << 3 | rm->reg);
+  } else if (rm->kind != OPERAND_MEM || rm->reg == 4) {
+    cannot_assemble(o);
+  } else if (rm->reg == REG_RIP) {
+    byte(o, 0x05 | reg << 3);
+    add_fixup(o, SEC_TEXT, rm->symbol, rm->value - 4 - imm_size, R_X86_64_PC32, 4);
+    bytes32(o, 0);
+  } else if (fits8(rm->value)) {
+    byte(o, 0x40 | reg << 3 | rm->reg);
+    byte(o, (uint8_t)rm->value);
+  } else {
+    byte(o, 0x80 | reg << 3 | rm->reg);
+    bytes32(o, (int32_t)rm->value);
+  }
+}
+
+// Emits an instruction with a ModRM operand: an optional mandatory prefix,
+// REX.W for 64 bit operands, and a one or two byte opcode
+static void emit_op(Obj* o, uint8_t prefix, bool wide, uint16_t opcode, int reg, Operand* rm, int imm_size) {
+  if (prefix) byte(o, prefix);
+  if (wide) byte(o, 0x48);
+  if (opcode > 0xff) byte(o, opcode >> 8);
+  byte(o, opcode & 0xff);
+  emit_modrm(o, reg, rm, imm_size);
+}
+
+static int condition_code(Obj* o, const char* cc) {
+  static const char* codes[] = { "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g" };
+  for (int c = 0; c < 16; c++) {
+    if (strcmp(codes[c], cc) == 0) return c;
+  }
+  cannot_assemble(o);
+}
+
+static void emit_jump(Obj* o, int cc, char* label) {
+  o->jumps = realloc(o->jumps, (o->jump_count + 1) * sizeof(size_t));
+  ensure_non_null(o->jumps, "out of space");
+  o->jumps[o->jump_count] = text(o)->len;
+
+  const Obj* previous = o->previous;
+  ObjLabel* target = previous ? find_label((Obj*)previous, label) : NULL;
+  int64_t distance = target ? (int64_t)target->offset - (int64_t)(previous->jumps[o->jump_count] + 2) : INT64_MAX;
+  o->jump_count++;
+  if (fits8(distance)) {
+    byte(o, cc < 0 ? 0xeb : 0x70 + cc);
+    add_fixup(o, SEC_TEXT, label, -1, R_X86_64_NONE, 1);
+    byte(o, 0);
+    return;
+  }
+
+  if (cc < 0) {
+    byte(o, 0xe9);
+  } else {
+    byte(o, 0x0f);
+    byte(o, 0x80 + cc);
+  }
+  add_fixup(o, SEC_TEXT, label, -4, R_X86_64_NONE, 4);
+  bytes32(o, 0);
+}
+
+// SSE2 instructions on doubles and their opcodes
+static const struct {
+  const char* name;
+  uint8_t prefix;
+  uint16_t opcode;
+} sse_ops[] = {
+  { "addsd", 0xf2, 0x0f58 }, { "subsd", 0xf2, 0x0f5c }, { "mulsd", 0xf2, 0x0f59 }, { "divsd", 0xf2, 0x0f5e },
+  { "ucomisd", 0x66, 0x0f2e },
+};
+
+// Operands are in AT&T order, source first
+static void assemble_instr(Obj* o, char* name, Operand* ops, int count) {
+  Operand* src = &ops[0];
+  Operand* dst = &ops[count > 1 ? 1 : 0];
+
+  for (size_t s = 0; s < sizeof(sse_ops) / sizeof(sse_ops[0]); s++) {
+    if (strcmp(name, sse_ops[s].name) == 0 && count == 2 && dst->xmm) {
+      emit_op(o, sse_ops[s].prefix, false, sse_ops[s].opcode, dst->reg, src, 0);
+      return;
+    }
+  }
+
+  if (strcmp(name, "ret") == 0) {
+    byte(o, 0xc3);
+  } else if (strcmp(name, "leave") == 0) {
+    byte(o, 0xc9);
+  } else if (strcmp(name, "rep") == 0 && count == 1 && strcmp(src->symbol, "stosq") == 0) {
+    byte(o, 0xf3);
+    byte(o, 0x48);
+    byte(o, 0xab);
+  } else if (strcmp(name, "pushq") == 0 && src->kind == OPERAND_REG) {
+    byte(o, 0x50 + src->reg);
+  } else if (strcmp(name, "call") == 0 && src->kind == OPERAND_SYMBOL) {
+    byte(o, 0xe8);
+    add_fixup(o, SEC_TEXT, src->symbol, -4, R_X86_64_PLT32, 4);
+    bytes32(o, 0);
+  } else if (strcmp(name, "jmp") == 0 && src->kind == OPERAND_SYMBOL) {
+    emit_jump(o, -1, src->symbol);
+  } else if (name[0] == 'j' && src->kind == OPERAND_SYMBOL) {
+    emit_jump(o, condition_code(o, name + 1), src->symbol);
+  } else if (strncmp(name, "set", 3) == 0 && src->kind == OPERAND_REG) {
+    emit_op(o, 0, false, 0x0f90 + condition_code(o, name + 3), 0, src, 0);
+  } else if (count != 2) {
+    cannot_assemble(o);
+  } else if (strcmp(name, "movq") == 0 && src->kind == OPERAND_IMM) {
+    emit_op(o, 0, true, 0xc7, 0, dst, 4);
+    bytes32(o, (int32_t)src->value);
+  } else if (strcmp(name, "movq") == 0 && src->kind == OPERAND_REG) {
+    emit_op(o, 0, true, 0x89, src->reg, dst, 0);
+  } else if (strcmp(name, "movq") == 0 && dst->kind == OPERAND_REG) {
+    emit_op(o, 0, true, 0x8b, dst->reg, src, 0);
+  } else if (strcmp(name, "movl") == 0 && src->kind == OPERAND_IMM && dst->kind == OPERAND_REG) {
+    byte(o, 0xb8 + dst->reg);
+    bytes32(o, (int32_t)src->value);
+  } else if (strcmp(name, "leaq") == 0 && dst->kind == OPERAND_REG) {
+    emit_op(o, 0, true, 0x8d, dst->reg, src, 0);
+  } else if ((strcmp(name, "subq") == 0 || strcmp(name, "xorq") == 0 || strcmp(name, "cmpq") == 0) && src->kind == OPERAND_IMM) {
+    int ext = name[0] == 's' ? 5 : name[0] == 'x' ? 6 : 7;
+    if (fits8(src->value)) {
+      emit_op(o, 0, true, 0x83, ext, dst, 1);
+      byte(o, (uint8_t)src->value);
+    } else {
+      emit_op(o, 0, true, 0x81, ext, dst, 4);
+      bytes32(o, (int32_t)src->value);
+    }
+  } else if (strcmp(name, "cmpq") == 0 && dst->kind == OPERAND_REG) {
+    emit_op(o, 0, true, 0x3b, dst->reg, src, 0);
+  } else if (strcmp(name, "andq") == 0 && dst->kind == OPERAND_REG) {
+    emit_op(o, 0, true, 0x23, dst->reg, src, 0);
+  } else if (strcmp(name, "orq") == 0 && dst->kind == OPERAND_REG) {
+    emit_op(o, 0, true, 0x0b, dst->reg, src, 0);
+  } else if (strcmp(name, "btcq") == 0 && src->kind == OPERAND_IMM) {
+    emit_op(o, 0, true, 0x0fba, 7, dst, 1);
+    byte(o, (uint8_t)src->value);
+  } else if (strcmp(name, "xorl") == 0 && src->kind == OPERAND_REG) {
+    emit_op(o, 0, false, 0x31, src->reg, dst, 0);
+  } else if (strcmp(name, "andb") == 0 && src->kind == OPERAND_REG) {
+    emit_op(o, 0, false, 0x20, src->reg, dst, 0);
+  } else if (strcmp(name, "testb") == 0 && src->kind == OPERAND_REG) {
+    emit_op(o, 0, false, 0x84, src->reg, dst, 0);
+  } else if (strcmp(name, "movzbl") == 0 && dst->kind == OPERAND_REG) {
+    emit_op(o, 0, false, 0x0fb6, dst->reg, src, 0);
+  } else if ((strcmp(name, "movsd") == 0 || strcmp(name, "movups") == 0) && (src->xmm || dst->xmm)) {
+    uint8_t prefix = name[4] == 'd' ? 0xf2 : 0;
+    if (dst->kind == OPERAND_REG) emit_op(o, prefix, false, 0x0f10, dst->reg, src, 0);
+    else emit_op(o, prefix, false, 0x0f11, src->reg, dst, 0);
+  } else {
+    cannot_assemble(o);
+  }
+}
+
+/* ----------------------------- Directives ----------------------------- */
+
+static void assemble_string(Obj* o, const char* quoted) {
+  Buffer* buffer = &o->sections[o->current];
+  if (*quoted++ != '"') cannot_assemble(o);
+
+  while (*quoted && *quoted != '"') {
+    uint8_t c = *quoted++;
+    if (c == '\\') {
+      if (*quoted >= '0' && *quoted <= '7') {
+        c = 0;
+        for (int digits = 0; digits < 3 && *quoted >= '0' && *quoted <= '7'; digits++) c = c * 8 + (*quoted++ - '0');
+      } else {
+        c = *quoted++;
+      }
+    }
+    buffer_append(buffer, &c, 1);
+  }
+  buffer_append(buffer, "", 1);
+}
+
+static void assemble_directive(Obj* o, char* name, char* args) {
+  Buffer* buffer = &o->sections[o->current];
+  if (strcmp(name, ".text") == 0) {
+    o->current = SEC_TEXT;
+  } else if (strcmp(name, ".section") == 0) {
+    char* comma = strchr(args, ',');
+    if (comma) *comma = '\0';
+    for (int s = 0; s < SEC_COUNT; s++) {
+      if (strcmp(args, section_names[s]) == 0) {
+        o->current = s;
+        return;
+      }
+    }
+    cannot_assemble(o);
+  } else if (strcmp(name, ".p2align") == 0) {
+    buffer_pad(buffer, (size_t)1 << atoi(args));
+  } else if (strcmp(name, ".quad") == 0) {
+    uint64_t value = 0;
+    if (*args == '-' || (*args >= '0' && *args <= '9')) {
+      value = *args == '-' ? (uint64_t)strtoll(args, NULL, 0) : strtoull(args, NULL, 0);
+    } else {
+      add_fixup(o, o->current, args, 0, R_X86_64_64, 8);
+    }
+    buffer_append(buffer, &value, sizeof(value));
+  } else if (strcmp(name, ".string") == 0) {
+    assemble_string(o, args);
+  } else if (strcmp(name, ".size") == 0) {
+    // Only the size of pseudo_main, which ends here
+    ObjLabel* main = find_label(o, "pseudo_main");
+    if (!main) cannot_assemble(o);
+    o->main_size = text(o)->len - main->offset;
+  } else if (strcmp(name, ".globl") != 0 && strcmp(name, ".type") != 0) {
+    cannot_assemble(o);
+  }
+}
+
+static char* trim(char* s) {
+  while (*s == ' ' || *s == '\t') s++;
+  char* end = s + strlen(s);
+  while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n')) *--end = '\0';
+  return s;
+}
+
+static void assemble_line(Obj* o, char* line) {
+  o->line = line;
+  line = trim(line);
+
+  // Comments, outside of strings
+  if (strncmp(line, ".string", 7) != 0) {
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    line = trim(line);
+  }
+  if (!*line) return;
+
+  size_t len = strlen(line);
+  if (line[len - 1] == ':') {
+    line[len - 1] = '\0';
+    if (find_label(o, line)) cannot_assemble(o);
+    o->labels = realloc(o->labels, (o->label_count + 1) * sizeof(ObjLabel));
+    ensure_non_null(o->labels, "out of space");
+    o->labels[o->label_count++] = (ObjLabel){
+      .name = strdup(line),
+      .section = o->current,
+      .offset = o->sections[o->current].len,
+    };
+    return;
+  }
+
+  char* args = line + strcspn(line, " \t");
+  if (*args) *args++ = '\0';
+  args = trim(args);
+  if (line[0] == '.') {
+    assemble_directive(o, line, args);
+    return;
+  }
+
+  Operand ops[2];
+  int count = 0;
+  for (char* arg = strtok(args, ","); arg; arg = strtok(NULL, ",")) {
+    if (count == 2) cannot_assemble(o);
+    ops[count++] = parse_operand(o, trim(arg));
+  }
+  if (count == 0 && strcmp(line, "ret") != 0 && strcmp(line, "leave") != 0) cannot_assemble(o);
+  assemble_instr(o, line, ops, count);
+}
+
+/* ------------------------------ Object file ------------------------------ */
+
+static size_t add_string(Buffer* table, const char* str) {
+  size_t offset = table->len;
+  buffer_append(table, str, strlen(str) + 1);
+  return offset;
+}
+
+// Symbol table: a section symbol for every section with contents, then
+// pseudo_main, then the runtime functions called
+#define SECTION_SYMBOL(section) (1 + (section))
+#define FIRST_GLOBAL (1 + SEC_NOTE)
+
+static int extern_symbol(char*** externs, int* count, const char* name) {
+  for (int e = 0; e < *count; e++) {
+    if (strcmp((*externs)[e], name) == 0) return FIRST_GLOBAL + 1 + e;
+  }
+  *externs = realloc(*externs, (*count + 1) * sizeof(char*));
+  ensure_non_null(*externs, "out of space");
+  (*externs)[(*count)++] = (char*)name;
+  return FIRST_GLOBAL + *count;
+}
+
+static void write_elf(Obj* o, FILE* out) {
+  ObjLabel* main = find_label(o, "pseudo_main");
+  if (!main || main->section != SEC_TEXT) {
+    fprintf(stderr, "cannot assemble: no pseudo_main\n");
+    exit(1);
+  }
+
+  // Resolve jumps, and turn the other fixups into relocations
+  Buffer rela[SEC_COUNT] = { 0 };
+  char** externs = NULL;
+  int extern_count = 0;
+  for (int f = 0; f < o->fixup_count; f++) {
+    ObjFixup* fixup = &o->fixups[f];
+    ObjLabel* label = find_label(o, fixup->target);
+    if (fixup->type == R_X86_64_NONE) {
+      if (!label || label->section != SEC_TEXT) {
+        fprintf(stderr, "cannot assemble: unknown label %s\n", fixup->target);
+        exit(1);
+      }
+      int32_t rel = (int32_t)(label->offset + fixup->addend - fixup->offset);
+      if (fixup->size == 1) text(o)->bytes[fixup->offset] = (uint8_t)rel;
+      else memcpy(text(o)->bytes + fixup->offset, &rel, sizeof(rel));
+      continue;
+    }
+
+    Elf64_Rela entry = { .r_offset = fixup->offset, .r_addend = fixup->addend };
+    if (label) {
+      entry.r_info = ELF64_R_INFO(SECTION_SYMBOL(label->section), fixup->type);
+      entry.r_addend += label->offset;
+    } else {
+      entry.r_info = ELF64_R_INFO(extern_symbol(&externs, &extern_count, fixup->target), fixup->type);
+    }
+    buffer_append(&rela[fixup->section], &entry, sizeof(entry));
+  }
+
+  Buffer strtab = { 0 };
+  Buffer symtab = { 0 };
+  add_string(&strtab, "");
+  Elf64_Sym null_sym = { 0 };
+  buffer_append(&symtab, &null_sym, sizeof(null_sym));
+  for (int s = 0; s < SEC_NOTE; s++) {
+    Elf64_Sym sym = { .st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION), .st_shndx = 1 + s };
+    buffer_append(&symtab, &sym, sizeof(sym));
+  }
+  Elf64_Sym main_sym = {
+    .st_name = add_string(&strtab, "pseudo_main"),
+    .st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC),
+    .st_shndx = 1 + SEC_TEXT,
+    .st_value = main->offset,
+    .st_size = o->main_size,
+  };
+  buffer_append(&symtab, &main_sym, sizeof(main_sym));
+  for (int e = 0; e < extern_count; e++) {
+    Elf64_Sym sym = { .st_name = add_string(&strtab, externs[e]), .st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE) };
+    buffer_append(&symtab, &sym, sizeof(sym));
+  }
+
+  // Sections: the contents, the relocations of .text and of the
+  // constants, then the tables
+  enum { SH_RELA_TEXT = 1 + SEC_COUNT, SH_RELA_DATA, SH_SYMTAB, SH_STRTAB, SH_SHSTRTAB, SH_COUNT };
+  Buffer shstrtab = { 0 };
+  Elf64_Shdr headers[SH_COUNT] = { 0 };
+  Buffer* contents[SH_COUNT] = { 0 };
+  add_string(&shstrtab, "");
+
+  for (int s = 0; s < SEC_COUNT; s++) {
+    Elf64_Shdr* header = &headers[1 + s];
+    header->sh_name = add_string(&shstrtab, section_names[s]);
+    header->sh_type = SHT_PROGBITS;
+    header->sh_addralign = s == SEC_RODATA || s == SEC_NOTE ? 1 : 16;
+    contents[1 + s] = &o->sections[s];
+  }
+  headers[1 + SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+  headers[1 + SEC_DATA].sh_flags = SHF_ALLOC | SHF_WRITE;
+  headers[1 + SEC_RODATA].sh_flags = SHF_ALLOC;
+
+  ObjSection relocated[] = { SEC_TEXT, SEC_DATA };
+  for (int r = 0; r < 2; r++) {
+    Elf64_Shdr* header = &headers[SH_RELA_TEXT + r];
+    char name[64];
+    snprintf(name, sizeof(name), ".rela%s", section_names[relocated[r]]);
+    header->sh_name = add_string(&shstrtab, name);
+    header->sh_type = SHT_RELA;
+    header->sh_flags = SHF_INFO_LINK;
+    header->sh_link = SH_SYMTAB;
+    header->sh_info = 1 + relocated[r];
+    header->sh_addralign = 8;
+    header->sh_entsize = sizeof(Elf64_Rela);
+    contents[SH_RELA_TEXT + r] = &rela[relocated[r]];
+  }
+
+  headers[SH_SYMTAB] = (Elf64_Shdr){
+    .sh_name = add_string(&shstrtab, ".symtab"),
+    .sh_type = SHT_SYMTAB,
+    .sh_link = SH_STRTAB,
+    .sh_info = FIRST_GLOBAL,
+    .sh_addralign = 8,
+    .sh_entsize = sizeof(Elf64_Sym),
+  };
+  contents[SH_SYMTAB] = &symtab;
+  headers[SH_STRTAB] = (Elf64_Shdr){ .sh_name = add_string(&shstrtab, ".strtab"), .sh_type = SHT_STRTAB, .sh_addralign = 1 };
+  contents[SH_STRTAB] = &strtab;
+  headers[SH_SHSTRTAB] = (Elf64_Shdr){ .sh_name = add_string(&shstrtab, ".shstrtab"), .sh_type = SHT_STRTAB, .sh_addralign = 1 };
+  contents[SH_SHSTRTAB] = &shstrtab;
+
+  // Contents follow the file header, each aligned, and the section
+  // headers come last
+  Buffer file = { 0 };
+  Elf64_Ehdr ehdr = {
+    .e_ident = { ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV },
+    .e_type = ET_REL,
+    .e_machine = EM_X86_64,
+    .e_version = EV_CURRENT,
+    .e_ehsize = sizeof(Elf64_Ehdr),
+    .e_shentsize = sizeof(Elf64_Shdr),
+    .e_shnum = SH_COUNT,
+    .e_shstrndx = SH_SHSTRTAB,
+  };
+  buffer_append(&file, &ehdr, sizeof(ehdr));
+  for (int s = 1; s < SH_COUNT; s++) {
+    buffer_pad(&file, headers[s].sh_addralign);
+    headers[s].sh_offset = file.len;
+    headers[s].sh_size = contents[s]->len;
+    if (contents[s]->len) buffer_append(&file, contents[s]->bytes, contents[s]->len);
+  }
+  buffer_pad(&file, 8);
+  ((Elf64_Ehdr*)file.bytes)->e_shoff = file.len;
+  buffer_append(&file, headers, sizeof(headers));
+
+  fwrite(file.bytes, 1, file.len, out);
+
+  free(file.bytes);
+  free(shstrtab.bytes);
+  free(symtab.bytes);
+  free(strtab.bytes);
+  for (int s = 0; s < SEC_COUNT; s++) free(rela[s].bytes);
+  free(externs);
+}
+
+// Assembles `source` into `o`, leaving `source` untouched
+static void assemble(Obj* o, const char* source) {
+  char* copy = strdup(source);
+  ensure_non_null(copy, "out of space");
+  for (char* line = copy; line; ) {
+    char* newline = strchr(line, '\n');
+    if (newline) *newline++ = '\0';
+    assemble_line(o, line);
+    line = newline;
+  }
+  free(copy);
+}
+
+static void free_obj(Obj* o) {
+  for (int l = 0; l < o->label_count; l++) free(o->labels[l].name);
+  for (int f = 0; f < o->fixup_count; f++) free(o->fixups[f].target);
+  for (int s = 0; s < SEC_COUNT; s++) free(o->sections[s].bytes);
+  free(o->labels);
+  free(o->fixups);
+  free(o->jumps);
+}
+
+// Writes `ir` to `path` as an ELF relocatable object defining pseudo_main
+void write_obj(IrProgram* ir, const char* path) {
+  char* source = NULL;
+  size_t source_len = 0;
+  FILE* stream = open_memstream(&source, &source_len);
+  ensure_non_null(stream, "out of space");
+  emit_asm(ir, stream);
+  fclose(stream);
+
+  Obj previous = { .current = SEC_TEXT };
+  assemble(&previous, source);
+  Obj o;
+  while (true) {
+    o = (Obj){ .current = SEC_TEXT, .previous = &previous };
+    assemble(&o, source);
+    if (text(&o)->len == text(&previous)->len) break;
+    free_obj(&previous);
+    previous = o;
+  }
+
+  FILE* out = fopen(path, "wb");
+  if (!out) {
+    perror("could not open output file");
+    exit(1);
+  }
+  write_elf(&o, out);
+  if (ferror(out) | fclose(out)) {
+    perror("could not write output file");
+    exit(1);
+  }
+
+  free_obj(&previous);
+  free_obj(&o);
+  free(source);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "ir.h"
+
+void write_obj(IrProgram* ir, const char* path);
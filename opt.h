@@ -0,0 +1,90 @@
+#pragma once
+
+#include "ir.h"
+
+/*
+ * Optimization passes. Syntax tree passes run once before the program is
+ * lowered, and passes over the IR run after it, in pipeline order, for as
+ * long as one of them makes the others useful again. Every pass rewrites the
+ * program in place and returns the number of nodes or instructions it
+ * changed or removed.
+ */
+
+typedef enum {
+  PASS_FOLD,  // Syntax tree
+  PASS_SCCP,
+  PASS_GVN,
+  PASS_COPY_PROP,
+  PASS_LICM,
+  PASS_STRENGTH_REDUCE,
+  PASS_DCE,
+  PASS_PEEPHOLE,
+  PASS_CFG_CLEANUP,
+  PASS_COUNT,
+} PassId;
+
+typedef struct {
+  const char* name;
+  int (*run_ast)(StatementList* program);
+  int (*run_ir)(IrProgram* ir);
+} Pass;
+
+extern const Pass pass_table[PASS_COUNT];
+
+// -v: report on stderr what the optimizations, the JIT and tiering do
+extern int opt_verbose;
+
+// Longest pipeline --passes may give
+#define PIPELINE_MAX 64
+
+// What --time-passes reports for a pass
+typedef struct {
+  int runs;
+  int changed;
+  int instr_delta;  // Change in the number of IR instructions
+  double seconds;
+} PassStats;
+
+// Passes enabled on the command line
+typedef struct {
+  int enabled[PASS_COUNT];
+  int level;         // -O level
+  const char* list;  // --passes: comma separated pipeline replacing the others
+
+  // Pipeline built by pipeline_configure
+  PassId order[PIPELINE_MAX];
+  int order_len;
+
+  int registers;  // Allocate temporaries to this many registers when non zero
+  int typed;      // Lower to typed instructions after every other pass
+
+  int unroll;         // Unroll constant trip for loops by this factor when non zero
+  int unroll_given;   // Whether --unroll set the factor, otherwise the -O level picks it
+  int unroll_budget;  // Most instructions an unrolled loop body may lower to
+
+  int print; // Print the IR before and after every pass
+  int time;  // Report the time spent in every pass on stderr
+
+  PassStats stats[PASS_COUNT];
+  PassStats lowering;
+  PassStats regalloc;
+  PassStats typing;
+} PassPipeline;
+
+void pipeline_configure(PassPipeline* pipeline);
+void optimize_ast(StatementList* program, PassPipeline* pipeline);
+IrProgram* lower_and_optimize(StatementList* program, PassPipeline* pipeline);
+void optimize_ir(IrProgram* ir, PassPipeline* pipeline);
+void print_pass_times(PassPipeline* pipeline);
+
+int fold_constants(StatementList* program);
+
+int sccp(IrProgram* ir);
+int copy_propagate(IrProgram* ir);
+int global_value_numbering(IrProgram* ir);
+int hoist_loop_invariants(IrProgram* ir);
+int strength_reduce(IrProgram* ir);
+int eliminate_dead_temps(IrProgram* ir);
+int peephole(IrProgram* ir);
+int allocate_registers(IrProgram* ir, int registers);
+int type_ir(IrProgram* ir);
@@ -72,6 +72,8 @@
 
 #include <stdio.h>
 #include "ast.h"
+#include "switch.h"
+#include "tape.h"
 #include "datatype99.h"
 
 /* Global variable for storing the resulting AST after parsing a file */
@@ -83,7 +85,7 @@ SymbolTable* symtab = NULL;
 int yylex();
 
 
-#line 87 "parser.tab.c"
+#line 89 "parser.tab.c"
 
 # ifndef YY_CAST
 #  ifdef __cplusplus
@@ -534,13 +536,13 @@ static const yytype_int8 yytranslate[] =
 /* YYRLINE[YYN] -- Source line where rule number YYN was defined.  */
 static const yytype_uint8 yyrline[] =
 {
-       0,    74,    74,    75,    77,    78,    80,    85,    90,    91,
-      92,    93,    94,    95,    97,    99,   101,   105,   107,   108,
-     113,   114,   116,   120,   124,   126,   127,   128,   129,   130,
-     131,   132,   133,   134,   135,   136,   138,   139,   141,   142,
-     145,   146,   147,   149,   150,   151,   154,   155,   156,   157,
-     158,   159,   160,   164,   165,   166,   167,   168,   169,   170,
-     171,   172,   173,   174,   176,   177
+       0,    76,    76,    77,    79,    80,    82,    87,    92,    93,
+      94,    95,    96,    97,    99,   101,   103,   110,   112,   113,
+     118,   119,   121,   125,   129,   131,   132,   133,   134,   135,
+     136,   137,   138,   139,   140,   141,   143,   144,   146,   147,
+     150,   151,   152,   154,   155,   156,   159,   160,   161,   162,
+     163,   164,   165,   169,   170,   171,   172,   173,   174,   175,
+     176,   177,   178,   179,   181,   182
 };
 #endif
 
@@ -1685,359 +1687,362 @@ yyreduce:
     switch (yyn)
       {
   case 2: /* program: stmt-list  */
-#line 74 "parser.y"
+#line 76 "parser.y"
                    { parse_result = (yyvsp[0].statement_list); }
-#line 1691 "parser.tab.c"
+#line 1693 "parser.tab.c"
     break;
 
   case 3: /* program: eol stmt-list  */
-#line 75 "parser.y"
+#line 77 "parser.y"
                    { parse_result = (yyvsp[0].statement_list); }
-#line 1697 "parser.tab.c"
+#line 1699 "parser.tab.c"
     break;
 
   case 6: /* stmt-list: stmt  */
-#line 80 "parser.y"
+#line 82 "parser.y"
                 {
     StatementList* ptr = NULL;
     add_stmt_list(&ptr, (yyvsp[0].stmt));
     (yyval.statement_list) = ptr;
   }
-#line 1707 "parser.tab.c"
+#line 1709 "parser.tab.c"
     break;
 
   case 7: /* stmt-list: stmt-list stmt  */
-#line 85 "parser.y"
+#line 87 "parser.y"
                    {
     add_stmt_list(&(yyvsp[-1].statement_list), (yyvsp[0].stmt));
     (yyval.statement_list) = (yyvsp[-1].statement_list);
   }
-#line 1716 "parser.tab.c"
+#line 1718 "parser.tab.c"
     break;
 
   case 14: /* assign-stmt: IDENT '=' expr eol  */
-#line 97 "parser.y"
+#line 99 "parser.y"
                                 { (yyval.stmt) = alloc_stmt(AssignStmt((yyvsp[-3].ident), (yyvsp[-1].expr))); }
-#line 1722 "parser.tab.c"
+#line 1724 "parser.tab.c"
     break;
 
   case 15: /* display-stmt: DISPLAY expr eol  */
-#line 99 "parser.y"
+#line 101 "parser.y"
                                { (yyval.stmt) = alloc_stmt(DisplayStmt((yyvsp[-1].expr))); }
-#line 1728 "parser.tab.c"
+#line 1730 "parser.tab.c"
     break;
 
   case 16: /* if-stmt: IF expr then-clause else-if-chain else-clause ENDIF eol  */
-#line 101 "parser.y"
+#line 103 "parser.y"
                                                                  {
+    if ((yyvsp[-3].else_if)) {
+      (yyvsp[-3].else_if)->switch_table = build_switch_table((yyvsp[-5].expr), (yyvsp[-4].statement_list), (yyvsp[-3].else_if));
+    }
     (yyval.stmt) = alloc_stmt(IfStmt((yyvsp[-5].expr), (yyvsp[-4].statement_list), (yyvsp[-3].else_if), (yyvsp[-2].statement_list)));
   }
-#line 1736 "parser.tab.c"
+#line 1741 "parser.tab.c"
     break;
 
   case 17: /* then-clause: THEN eol stmt-list  */
-#line 105 "parser.y"
+#line 110 "parser.y"
                                 { (yyval.statement_list) = (yyvsp[0].statement_list); }
-#line 1742 "parser.tab.c"
+#line 1747 "parser.tab.c"
     break;
 
   case 18: /* else-if-chain: %empty  */
-#line 107 "parser.y"
+#line 112 "parser.y"
                       { (yyval.else_if) = NULL; }
-#line 1748 "parser.tab.c"
+#line 1753 "parser.tab.c"
     break;
 
   case 19: /* else-if-chain: else-if-chain ELSE IF expr then-clause  */
-#line 108 "parser.y"
+#line 113 "parser.y"
                                            {
     add_else_if(&(yyvsp[-4].else_if), (yyvsp[-1].expr), (yyvsp[0].statement_list));
     (yyval.else_if) = (yyvsp[-4].else_if);
   }
-#line 1757 "parser.tab.c"
+#line 1762 "parser.tab.c"
     break;
 
   case 20: /* else-clause: %empty  */
-#line 113 "parser.y"
+#line 118 "parser.y"
                     { (yyval.statement_list) = NULL; }
-#line 1763 "parser.tab.c"
+#line 1768 "parser.tab.c"
     break;
 
   case 21: /* else-clause: ELSE eol stmt-list  */
-#line 114 "parser.y"
+#line 119 "parser.y"
                        { (yyval.statement_list) = (yyvsp[0].statement_list); }
-#line 1769 "parser.tab.c"
+#line 1774 "parser.tab.c"
     break;
 
   case 22: /* while-stmt: WHILE expr DO eol stmt-list ENDWHILE eol  */
-#line 116 "parser.y"
+#line 121 "parser.y"
                                                      {
   (yyval.stmt) = alloc_stmt(WhileStmt((yyvsp[-5].expr), (yyvsp[-2].statement_list)));
 }
-#line 1777 "parser.tab.c"
+#line 1782 "parser.tab.c"
     break;
 
   case 23: /* for-stmt: FOR IDENT '=' expr TO expr DO eol stmt-list ENDFOR eol  */
-#line 120 "parser.y"
+#line 125 "parser.y"
                                                                              {
-  (yyval.stmt) = alloc_stmt(ForStmt((yyvsp[-9].ident), (yyvsp[-7].expr), (yyvsp[-5].expr), (yyvsp[-2].statement_list)));
+  (yyval.stmt) = alloc_stmt(ForStmt((yyvsp[-9].ident), (yyvsp[-7].expr), (yyvsp[-5].expr), (yyvsp[-2].statement_list), stmt_list_mentions((yyvsp[-2].statement_list), (yyvsp[-9].ident))));
 }
-#line 1785 "parser.tab.c"
+#line 1790 "parser.tab.c"
     break;
 
   case 24: /* expr-stmt: expr eol  */
-#line 124 "parser.y"
+#line 129 "parser.y"
                     { (yyval.stmt) = alloc_stmt(ExprStmt((yyvsp[-1].expr))); }
-#line 1791 "parser.tab.c"
+#line 1796 "parser.tab.c"
     break;
 
   case 25: /* ident-binary-op: '+'  */
-#line 126 "parser.y"
+#line 131 "parser.y"
                      { (yyval.ident_bop) = IdentBOp_Plus; }
-#line 1797 "parser.tab.c"
+#line 1802 "parser.tab.c"
     break;
 
   case 26: /* ident-binary-op: '-'  */
-#line 127 "parser.y"
+#line 132 "parser.y"
          { (yyval.ident_bop) = IdentBOp_Minus; }
-#line 1803 "parser.tab.c"
+#line 1808 "parser.tab.c"
     break;
 
   case 27: /* ident-binary-op: '*'  */
-#line 128 "parser.y"
+#line 133 "parser.y"
          { (yyval.ident_bop) = IdentBOp_Star;  }
-#line 1809 "parser.tab.c"
+#line 1814 "parser.tab.c"
     break;
 
   case 28: /* ident-binary-op: '/'  */
-#line 129 "parser.y"
+#line 134 "parser.y"
          { (yyval.ident_bop) = IdentBOp_Slash; }
-#line 1815 "parser.tab.c"
+#line 1820 "parser.tab.c"
     break;
 
   case 29: /* ident-binary-op: GT  */
-#line 130 "parser.y"
+#line 135 "parser.y"
          { (yyval.ident_bop) = IdentBOp_Gt;    }
-#line 1821 "parser.tab.c"
+#line 1826 "parser.tab.c"
     break;
 
   case 30: /* ident-binary-op: GTE  */
-#line 131 "parser.y"
+#line 136 "parser.y"
          { (yyval.ident_bop) = IdentBOp_Gte;   }
-#line 1827 "parser.tab.c"
+#line 1832 "parser.tab.c"
     break;
 
   case 31: /* ident-binary-op: LT  */
-#line 132 "parser.y"
+#line 137 "parser.y"
          { (yyval.ident_bop) = IdentBOp_Lt;    }
-#line 1833 "parser.tab.c"
+#line 1838 "parser.tab.c"
     break;
 
   case 32: /* ident-binary-op: LTE  */
-#line 133 "parser.y"
+#line 138 "parser.y"
          { (yyval.ident_bop) = IdentBOp_Lte;   }
-#line 1839 "parser.tab.c"
+#line 1844 "parser.tab.c"
     break;
 
   case 33: /* ident-binary-op: EQEQ  */
-#line 134 "parser.y"
+#line 139 "parser.y"
          { (yyval.ident_bop) = IdentBOp_EqEq;  }
-#line 1845 "parser.tab.c"
+#line 1850 "parser.tab.c"
     break;
 
   case 34: /* ident-binary-op: AND  */
-#line 135 "parser.y"
+#line 140 "parser.y"
          { (yyval.ident_bop) = IdentBOp_And;   }
-#line 1851 "parser.tab.c"
+#line 1856 "parser.tab.c"
     break;
 
   case 35: /* ident-binary-op: OR  */
-#line 136 "parser.y"
+#line 141 "parser.y"
          { (yyval.ident_bop) = IdentBOp_Or;    }
-#line 1857 "parser.tab.c"
+#line 1862 "parser.tab.c"
     break;
 
   case 36: /* ident-unary-op: '!'  */
-#line 138 "parser.y"
+#line 143 "parser.y"
                     { (yyval.ident_uop) = IdentUOp_Exclamation; }
-#line 1863 "parser.tab.c"
+#line 1868 "parser.tab.c"
     break;
 
   case 37: /* ident-unary-op: '-'  */
-#line 139 "parser.y"
+#line 144 "parser.y"
         { (yyval.ident_uop) = IdentUOp_Minus; }
-#line 1869 "parser.tab.c"
+#line 1874 "parser.tab.c"
     break;
 
   case 38: /* expr: literal-expr  */
-#line 141 "parser.y"
+#line 146 "parser.y"
                    { (yyval.expr) = alloc_expr(LiteralExpression((yyvsp[0].literal_expr))); }
-#line 1875 "parser.tab.c"
+#line 1880 "parser.tab.c"
     break;
 
   case 39: /* expr: ident-expr  */
-#line 142 "parser.y"
+#line 147 "parser.y"
                { (yyval.expr) = alloc_expr(IdentExpression((yyvsp[0].ident_expr))); }
-#line 1881 "parser.tab.c"
+#line 1886 "parser.tab.c"
     break;
 
   case 40: /* ident-expr: IDENT ident-binary-op literal-expr  */
-#line 145 "parser.y"
+#line 150 "parser.y"
                                      { (yyval.ident_expr) = alloc_ident_expr(IdentBinaryExpr((yyvsp[-2].ident), (yyvsp[-1].ident_bop), (yyvsp[0].literal_expr))); }
-#line 1887 "parser.tab.c"
+#line 1892 "parser.tab.c"
     break;
 
   case 41: /* ident-expr: ident-unary-op IDENT  */
-#line 146 "parser.y"
+#line 151 "parser.y"
                          { (yyval.ident_expr) = alloc_ident_expr(IdentUnaryExpr((yyvsp[-1].ident_uop), (yyvsp[0].ident))); }
-#line 1893 "parser.tab.c"
+#line 1898 "parser.tab.c"
     break;
 
   case 42: /* ident-expr: IDENT  */
-#line 147 "parser.y"
+#line 152 "parser.y"
           { (yyval.ident_expr) = alloc_ident_expr(Identifier((yyvsp[0].ident))); }
-#line 1899 "parser.tab.c"
+#line 1904 "parser.tab.c"
     break;
 
   case 43: /* literal-expr: aexpr  */
-#line 149 "parser.y"
-                    { (yyval.literal_expr) = alloc_literal_expr(ArithmeticExpr((yyvsp[0].arith_expr))); }
-#line 1905 "parser.tab.c"
+#line 154 "parser.y"
+                    { (yyval.literal_expr) = alloc_literal_expr(ArithmeticExpr((yyvsp[0].arith_expr), build_aexpr_tape((yyvsp[0].arith_expr)))); }
+#line 1910 "parser.tab.c"
     break;
 
   case 44: /* literal-expr: bexpr  */
-#line 150 "parser.y"
-          { (yyval.literal_expr) = alloc_literal_expr(BooleanExpr((yyvsp[0].bool_expr))); }
-#line 1911 "parser.tab.c"
+#line 155 "parser.y"
+          { (yyval.literal_expr) = alloc_literal_expr(BooleanExpr((yyvsp[0].bool_expr), build_bexpr_tape((yyvsp[0].bool_expr)))); }
+#line 1916 "parser.tab.c"
     break;
 
   case 45: /* literal-expr: sexpr  */
-#line 151 "parser.y"
+#line 156 "parser.y"
           { (yyval.literal_expr) = alloc_literal_expr(StringExpr((yyvsp[0].str_expr))); }
-#line 1917 "parser.tab.c"
+#line 1922 "parser.tab.c"
     break;
 
   case 46: /* aexpr: aexpr '+' aexpr  */
-#line 154 "parser.y"
+#line 159 "parser.y"
                        { (yyval.arith_expr) = alloc_aexpr(BinaryAExpr((yyvsp[-2].arith_expr), BinaryOp_Add, (yyvsp[0].arith_expr))); }
-#line 1923 "parser.tab.c"
+#line 1928 "parser.tab.c"
     break;
 
   case 47: /* aexpr: aexpr '-' aexpr  */
-#line 155 "parser.y"
+#line 160 "parser.y"
                        { (yyval.arith_expr) = alloc_aexpr(BinaryAExpr((yyvsp[-2].arith_expr), BinaryOp_Sub, (yyvsp[0].arith_expr))); }
-#line 1929 "parser.tab.c"
+#line 1934 "parser.tab.c"
     break;
 
   case 48: /* aexpr: aexpr '*' aexpr  */
-#line 156 "parser.y"
+#line 161 "parser.y"
                        { (yyval.arith_expr) = alloc_aexpr(BinaryAExpr((yyvsp[-2].arith_expr), BinaryOp_Mul, (yyvsp[0].arith_expr))); }
-#line 1935 "parser.tab.c"
+#line 1940 "parser.tab.c"
     break;
 
   case 49: /* aexpr: aexpr '/' aexpr  */
-#line 157 "parser.y"
+#line 162 "parser.y"
                        { (yyval.arith_expr) = alloc_aexpr(BinaryAExpr((yyvsp[-2].arith_expr), BinaryOp_Div, (yyvsp[0].arith_expr))); }
-#line 1941 "parser.tab.c"
+#line 1946 "parser.tab.c"
     break;
 
   case 50: /* aexpr: '-' aexpr  */
-#line 158 "parser.y"
+#line 163 "parser.y"
                            { (yyval.arith_expr) = alloc_aexpr(UnaryAExpr(UnaryOp_Minus, (yyvsp[0].arith_expr))); }
-#line 1947 "parser.tab.c"
+#line 1952 "parser.tab.c"
     break;
 
   case 51: /* aexpr: '(' aexpr ')'  */
-#line 159 "parser.y"
+#line 164 "parser.y"
                        { (yyval.arith_expr) = (yyvsp[-1].arith_expr);                       }
-#line 1953 "parser.tab.c"
+#line 1958 "parser.tab.c"
     break;
 
   case 52: /* aexpr: NUMBER  */
-#line 160 "parser.y"
+#line 165 "parser.y"
                        { (yyval.arith_expr) = alloc_aexpr(Number((yyvsp[0].number)));  }
-#line 1959 "parser.tab.c"
+#line 1964 "parser.tab.c"
     break;
 
   case 53: /* bexpr: aexpr EQEQ aexpr  */
-#line 164 "parser.y"
+#line 169 "parser.y"
                      { (yyval.bool_expr) = alloc_bexpr(RelationalArithExpr((yyvsp[-2].arith_expr), RelationalEqual, (yyvsp[0].arith_expr))); }
-#line 1965 "parser.tab.c"
+#line 1970 "parser.tab.c"
     break;
 
   case 54: /* bexpr: aexpr GT aexpr  */
-#line 165 "parser.y"
+#line 170 "parser.y"
                      { (yyval.bool_expr) = alloc_bexpr(RelationalArithExpr((yyvsp[-2].arith_expr), Greater, (yyvsp[0].arith_expr)));         }
-#line 1971 "parser.tab.c"
+#line 1976 "parser.tab.c"
     break;
 
   case 55: /* bexpr: aexpr GTE aexpr  */
-#line 166 "parser.y"
+#line 171 "parser.y"
                      { (yyval.bool_expr) = alloc_bexpr(RelationalArithExpr((yyvsp[-2].arith_expr), GreaterOrEqual, (yyvsp[0].arith_expr)));  }
-#line 1977 "parser.tab.c"
+#line 1982 "parser.tab.c"
     break;
 
   case 56: /* bexpr: aexpr LT aexpr  */
-#line 167 "parser.y"
+#line 172 "parser.y"
                      { (yyval.bool_expr) = alloc_bexpr(RelationalArithExpr((yyvsp[-2].arith_expr), Less, (yyvsp[0].arith_expr)));            }
-#line 1983 "parser.tab.c"
+#line 1988 "parser.tab.c"
     break;
 
   case 57: /* bexpr: aexpr LTE aexpr  */
-#line 168 "parser.y"
+#line 173 "parser.y"
                      { (yyval.bool_expr) = alloc_bexpr(RelationalArithExpr((yyvsp[-2].arith_expr), LessOrEqual, (yyvsp[0].arith_expr)));     }
-#line 1989 "parser.tab.c"
+#line 1994 "parser.tab.c"
     break;
 
   case 58: /* bexpr: bexpr AND bexpr  */
-#line 169 "parser.y"
+#line 174 "parser.y"
                      { (yyval.bool_expr) = alloc_bexpr(LogicalBoolExpr((yyvsp[-2].bool_expr), And, (yyvsp[0].bool_expr)));                 }
-#line 1995 "parser.tab.c"
+#line 2000 "parser.tab.c"
     break;
 
   case 59: /* bexpr: bexpr OR bexpr  */
-#line 170 "parser.y"
+#line 175 "parser.y"
                      { (yyval.bool_expr) = alloc_bexpr(LogicalBoolExpr((yyvsp[-2].bool_expr), Or, (yyvsp[0].bool_expr)));                  }
-#line 2001 "parser.tab.c"
+#line 2006 "parser.tab.c"
     break;
 
   case 60: /* bexpr: bexpr EQEQ bexpr  */
-#line 171 "parser.y"
+#line 176 "parser.y"
                      { (yyval.bool_expr) = alloc_bexpr(LogicalBoolExpr((yyvsp[-2].bool_expr), LogicalEqual, (yyvsp[0].bool_expr)));        }
-#line 2007 "parser.tab.c"
+#line 2012 "parser.tab.c"
     break;
 
   case 61: /* bexpr: '!' bexpr  */
-#line 172 "parser.y"
+#line 177 "parser.y"
               { (yyval.bool_expr) = alloc_bexpr(NegatedBoolExpr((yyvsp[0].bool_expr))); }
-#line 2013 "parser.tab.c"
+#line 2018 "parser.tab.c"
     break;
 
   case 62: /* bexpr: TRUE  */
-#line 173 "parser.y"
+#line 178 "parser.y"
               { (yyval.bool_expr) = alloc_bexpr(Boolean(true));       }
-#line 2019 "parser.tab.c"
+#line 2024 "parser.tab.c"
     break;
 
   case 63: /* bexpr: FALSE  */
-#line 174 "parser.y"
+#line 179 "parser.y"
               { (yyval.bool_expr) = alloc_bexpr(Boolean(false));      }
-#line 2025 "parser.tab.c"
+#line 2030 "parser.tab.c"
     break;
 
   case 64: /* sexpr: STRING  */
-#line 176 "parser.y"
+#line 181 "parser.y"
               { (yyval.str_expr) = alloc_sexpr(String((yyvsp[0].string))); }
-#line 2031 "parser.tab.c"
+#line 2036 "parser.tab.c"
     break;
 
   case 65: /* sexpr: sexpr '+' sexpr  */
-#line 177 "parser.y"
-                    { (yyval.str_expr) = alloc_sexpr(StringConcat((yyvsp[-2].str_expr), (yyvsp[0].str_expr))); }
-#line 2037 "parser.tab.c"
+#line 182 "parser.y"
+                    { (yyval.str_expr) = alloc_concat_sexpr((yyvsp[-2].str_expr), (yyvsp[0].str_expr)); }
+#line 2042 "parser.tab.c"
     break;
 
 
-#line 2041 "parser.tab.c"
+#line 2046 "parser.tab.c"
 
         default: break;
       }
@@ -6,6 +6,8 @@
 
 #include <stdio.h>
 #include "ast.h"
+#include "switch.h"
+#include "tape.h"
 #include "datatype99.h"
 
 /* Global variable for storing the resulting AST after parsing a file */
@@ -99,6 +101,9 @@ assign-stmt: IDENT '=' expr eol { $$ = alloc_stmt(AssignStmt($1, $expr)); }
 display-stmt: DISPLAY expr eol { $$ = alloc_stmt(DisplayStmt($expr)); }
 
 if-stmt: IF expr then-clause else-if-chain else-clause ENDIF eol {
+    if ($[else-if-chain]) {
+      $[else-if-chain]->switch_table = build_switch_table($expr, $[then-clause], $[else-if-chain]);
+    }
     $$ = alloc_stmt(IfStmt($expr, $[then-clause], $[else-if-chain], $[else-clause]));
   }
 
@@ -118,7 +123,7 @@ while-stmt: WHILE expr DO eol stmt-list ENDWHILE eol {
 }
 
 for-stmt: FOR IDENT '=' expr[start] TO expr[end] DO eol stmt-list ENDFOR eol {
-  $$ = alloc_stmt(ForStmt($2, $start, $end, $[stmt-list]));
+  $$ = alloc_stmt(ForStmt($2, $start, $end, $[stmt-list], stmt_list_mentions($[stmt-list], $2)));
 }
 
 expr-stmt: expr eol { $$ = alloc_stmt(ExprStmt($expr)); }
@@ -146,8 +151,8 @@ ident-expr:
   | ident-unary-op IDENT { $$ = alloc_ident_expr(IdentUnaryExpr($1, $2)); }
   | IDENT { $$ = alloc_ident_expr(Identifier($1)); }
 
-literal-expr: aexpr { $$ = alloc_literal_expr(ArithmeticExpr($1)); }
-  | bexpr { $$ = alloc_literal_expr(BooleanExpr($1)); }
+literal-expr: aexpr { $$ = alloc_literal_expr(ArithmeticExpr($1, build_aexpr_tape($1))); }
+  | bexpr { $$ = alloc_literal_expr(BooleanExpr($1, build_bexpr_tape($1))); }
   | sexpr { $$ = alloc_literal_expr(StringExpr($1)); }
 
 /* Arithmetic expression */
@@ -174,4 +179,4 @@ bexpr:
   | FALSE     { $$ = alloc_bexpr(Boolean(false));      }
 
 sexpr: STRING { $$ = alloc_sexpr(String($1)); }
-  | sexpr '+' sexpr { $$ = alloc_sexpr(StringConcat($1, $3)); }
+  | sexpr '+' sexpr { $$ = alloc_concat_sexpr($1, $3); }
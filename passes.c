@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "opt.h"
+
+/*
+ * Pass manager.
+ *
+ * The pipeline is either the passes in pass_table order that a -O level or
+ * their own flags enable, or exactly the list given with --passes. Syntax
+ * tree passes in it run once, before lowering, and the IR passes run in
+ * order for up to MAX_ROUNDS rounds, stopping at the first round that
+ * changes nothing.
+ */
+
+#define MAX_ROUNDS 4
+
+const Pass pass_table[PASS_COUNT] = {
+  [PASS_FOLD] = { "fold", fold_constants, NULL },
+  [PASS_SCCP] = { "sccp", NULL, sccp },
+  [PASS_GVN] = { "gvn", NULL, global_value_numbering },
+  [PASS_COPY_PROP] = { "copy-prop", NULL, copy_propagate },
+  [PASS_LICM] = { "licm", NULL, hoist_loop_invariants },
+  [PASS_STRENGTH_REDUCE] = { "strength-reduce", NULL, strength_reduce },
+  [PASS_DCE] = { "dce", NULL, eliminate_dead_temps },
+  [PASS_PEEPHOLE] = { "peephole", NULL, peephole },
+  [PASS_CFG_CLEANUP] = { "cfg-cleanup", NULL, remove_unreachable_blocks },
+};
+
+// Passes each -O level enables, on top of the ones enabled by their flags
+static const PassId level_passes[][PASS_COUNT + 1] = {
+  { PASS_COUNT },
+  { PASS_FOLD, PASS_SCCP, PASS_COPY_PROP, PASS_DCE, PASS_CFG_CLEANUP, PASS_COUNT },
+  {
+    PASS_FOLD, PASS_SCCP, PASS_GVN, PASS_COPY_PROP, PASS_LICM, PASS_STRENGTH_REDUCE,
+    PASS_DCE, PASS_PEEPHOLE, PASS_CFG_CLEANUP, PASS_COUNT
+  },
+};
+
+#define LEVEL_COUNT (int)(sizeof(level_passes) / sizeof(level_passes[0]))
+
+// Loops -O2 unrolls by, unless --unroll says otherwise
+#define LEVEL2_UNROLL 4
+
+static int find_pass(const char* name, size_t len) {
+  for (int p = 0; p < PASS_COUNT; p++) {
+    if (strlen(pass_table[p].name) == len && strncmp(pass_table[p].name, name, len) == 0) return p;
+  }
+  return -1;
+}
+
+static void list_passes() {
+  fprintf(stderr, "available passes:");
+  for (int p = 0; p < PASS_COUNT; p++) fprintf(stderr, " %s", pass_table[p].name);
+  fprintf(stderr, "\n");
+}
+
+// Builds the pipeline from the -O level, --passes and the flags of each pass.
+// Exits on an unknown level or pass name.
+void pipeline_configure(PassPipeline* pipeline) {
+  if (pipeline->level < 0 || pipeline->level >= LEVEL_COUNT) {
+    fprintf(stderr, "optimization level must be between 0 and %d\n", LEVEL_COUNT - 1);
+    exit(1);
+  }
+
+  if (!pipeline->unroll_given) pipeline->unroll = pipeline->level >= 2 && !pipeline->list ? LEVEL2_UNROLL : 0;
+
+  pipeline->order_len = 0;
+  if (pipeline->list) {
+    for (const char* name = pipeline->list; *name;) {
+      size_t len = strcspn(name, ",");
+      if (len > 0) {
+        int pass = find_pass(name, len);
+        if (pass < 0) {
+          fprintf(stderr, "unknown pass '%.*s'\n", (int)len, name);
+          list_passes();
+          exit(1);
+        }
+        if (pipeline->order_len == PIPELINE_MAX) {
+          fprintf(stderr, "at most %d passes can be given\n", PIPELINE_MAX);
+          exit(1);
+        }
+        pipeline->order[pipeline->order_len++] = pass;
+      }
+      name += len;
+      if (*name == ',') name++;
+    }
+    return;
+  }
+
+  for (const PassId* p = level_passes[pipeline->level]; *p != PASS_COUNT; p++) {
+    pipeline->enabled[*p] = true;
+  }
+  if (pipeline->level >= 2) pipeline->typed = 1;
+
+  for (int p = 0; p < PASS_COUNT; p++) {
+    if (pipeline->enabled[p]) pipeline->order[pipeline->order_len++] = p;
+  }
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_stats(PassStats* stats, double start, int changed, int instr_delta) {
+  stats->runs++;
+  stats->changed += changed;
+  stats->instr_delta += instr_delta;
+  stats->seconds += now() - start;
+}
+
+// Runs the syntax tree passes of the pipeline
+void optimize_ast(StatementList* program, PassPipeline* pipeline) {
+  for (int n = 0; n < pipeline->order_len; n++) {
+    PassId id = pipeline->order[n];
+    if (!pass_table[id].run_ast) continue;
+
+    double start = now();
+    int changed = pass_table[id].run_ast(program);
+    add_stats(&pipeline->stats[id], start, changed, 0);
+  }
+}
+
+static int run_pass(IrProgram* ir, PassPipeline* pipeline, PassId id) {
+  int before = ir->len;
+  double start = now();
+  int changed = pass_table[id].run_ir(ir);
+  add_stats(&pipeline->stats[id], start, changed, ir->len - before);
+
+  if (pipeline->print) {
+    printf("# after %s: %d changed, %d instructions\n", pass_table[id].name, changed, ir->len);
+    print_ir(ir);
+  }
+  return changed;
+}
+
+// Lowers a program to intermediate code and runs the pipeline over it
+IrProgram* lower_and_optimize(StatementList* program, PassPipeline* pipeline) {
+  optimize_ast(program, pipeline);
+
+  double start = now();
+  IrProgram* ir = alloc_ir_program();
+  ir->unroll_factor = pipeline->unroll;
+  ir->unroll_budget = pipeline->unroll_budget;
+  ir_stmt_list(ir, program);
+  add_stats(&pipeline->lowering, start, 0, ir->len);
+
+  optimize_ir(ir, pipeline);
+  return ir;
+}
+
+// Runs the IR passes of the pipeline over `ir`, repeating them for as long
+// as one of them makes the others useful again, then allocates registers and
+// lowers to typed instructions
+void optimize_ir(IrProgram* ir, PassPipeline* pipeline) {
+  if (pipeline->print) {
+    printf("# before optimization: %d instructions\n", ir->len);
+    print_ir(ir);
+  }
+
+  int changed = 1;
+  for (int round = 0; changed > 0 && round < MAX_ROUNDS; round++) {
+    changed = 0;
+    for (int n = 0; n < pipeline->order_len; n++) {
+      if (pass_table[pipeline->order[n]].run_ir) changed += run_pass(ir, pipeline, pipeline->order[n]);
+    }
+  }
+
+  // Register allocation renumbers the temporaries, so it comes last
+  if (pipeline->registers > 0) {
+    int before = ir->len;
+    double start = now();
+    allocate_registers(ir, pipeline->registers);
+    add_stats(&pipeline->regalloc, start, 0, ir->len - before);
+    if (pipeline->print) {
+      printf("# after regalloc: %d registers, %d spill slots\n", ir->reg_count, ir->temp_count - ir->reg_count);
+      print_ir(ir);
+    }
+  }
+
+  // Typing comes after register allocation, so the types it records are the
+  // ones of the registers and spill slots
+  if (pipeline->typed) {
+    int before = ir->len;
+    double start = now();
+    int changed = type_ir(ir);
+    add_stats(&pipeline->typing, start, changed, ir->len - before);
+    if (pipeline->print) {
+      printf("# after typing: %d typed instructions\n", changed);
+      print_ir(ir);
+    }
+  }
+}
+
+static void print_stats(const char* name, PassStats* stats) {
+  fprintf(stderr, "%-16s %6d %8d %+8d %10.3f\n", name, stats->runs, stats->changed, stats->instr_delta, stats->seconds * 1e3);
+}
+
+// Reports the runs, changes, instruction count deltas and wall time of every
+// pass that ran, on stderr so it does not mix with the program's output
+void print_pass_times(PassPipeline* pipeline) {
+  PassStats total = { 0 };
+  fprintf(stderr, "%-16s %6s %8s %8s %10s\n", "pass", "runs", "changed", "instrs", "time (ms)");
+
+  if (pipeline->lowering.runs > 0) print_stats("lowering", &pipeline->lowering);
+  for (int p = 0; p < PASS_COUNT; p++) {
+    PassStats* stats = &pipeline->stats[p];
+    if (stats->runs == 0) continue;
+    print_stats(pass_table[p].name, stats);
+    total.runs += stats->runs;
+    total.changed += stats->changed;
+    total.instr_delta += stats->instr_delta;
+    total.seconds += stats->seconds;
+  }
+  if (pipeline->regalloc.runs > 0) print_stats("regalloc", &pipeline->regalloc);
+  if (pipeline->typing.runs > 0) print_stats("typing", &pipeline->typing);
+
+  print_stats("total passes", &total);
+}
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "opt.h"
+#include "datatype99.h"
+
+/*
+ * Peephole optimizations of the branches emitted by the lowering of if,
+ * while and for statements:
+ *
+ *   t = a < b; if t == true goto L    =>  if a < b goto L
+ *   goto L1; ... L1: goto L2          =>  goto L2; ... L1: goto L2
+ *   if c goto L1; goto L2; L1:        =>  if !c goto L2; L1:
+ *   goto L1; L1:                      =>  L1:
+ *
+ * jump threading, which retargets a conditional branch to a test of the same
+ * condition to where that test goes, since its outcome is already known:
+ *
+ *   if c goto L1; ... L1: if c goto L2          =>  if c goto L2
+ *   if c goto L1; ... L1: if !c goto L2; L3:    =>  if c goto L3
+ *   if c goto L1; if c goto L2                  =>  if c goto L1
+ *   if c goto L1; if !c goto L2                 =>  if c goto L1; goto L2
+ *
+ * and loop rotation, which replaces the `goto` at the end of a loop body by
+ * a copy of the inverted exit test of the loop header, so every iteration
+ * ends in a single conditional branch back to the top of the body.
+ * Labels that are not jumped to are dropped.
+ */
+
+static bool is_relop(IrOpcode op) {
+  return op == IR_EQ || op == IR_GT || op == IR_GTE || op == IR_LT || op == IR_LTE;
+}
+
+static IrInstr copy_instr(IrInstr instr) {
+  for (int k = 0; k < 2; k++) {
+    ifLet(instr.args[k], IrConst, constant) instr.args[k] = IrConst(ir_copy_result(*constant));
+  }
+  return instr;
+}
+
+static void count_temps(IrProgram* ir, int* defs, int* uses) {
+  memset(defs, 0, ir->temp_count * sizeof(int));
+  memset(uses, 0, ir->temp_count * sizeof(int));
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    ifLet(instr->dest, IrTemp, temp) defs[*temp]++;
+    for (int k = 0; k < 2; k++) {
+      ifLet(instr->args[k], IrTemp, temp) uses[*temp]++;
+    }
+  }
+}
+
+// Merges a comparison into the branch that is its only use. Negations are
+// left alone: `!a` and a branch on `a` report different errors for a
+// non boolean `a`.
+static int fuse_conditions(IrProgram* ir) {
+  int* defs = malloc((ir->temp_count + 1) * sizeof(int));
+  int* uses = malloc((ir->temp_count + 1) * sizeof(int));
+  bool* remove = calloc(ir->len + 1, sizeof(bool));
+  ensure_non_null(defs, "out of space");
+  ensure_non_null(uses, "out of space");
+  ensure_non_null(remove, "out of space");
+  count_temps(ir, defs, uses);
+
+  int changed = 0;
+  for (int i = 0; i + 1 < ir->len; i++) {
+    IrInstr* def = &ir->instrs[i];
+    IrInstr* branch = &ir->instrs[i + 1];
+    if (branch->op != IR_IF && branch->op != IR_IF_NOT) continue;
+    if (!is_relop(def->op)) continue;
+
+    ifLet(def->dest, IrTemp, temp) {
+      bool only_use = defs[*temp] == 1 && uses[*temp] == 1;
+      ifLet(branch->args[0], IrTemp, cond) {
+        if (*cond != *temp || !only_use) continue;
+
+        branch->op = branch->op == IR_IF ? IR_IF_CMP : IR_IF_NOT_CMP;
+        branch->relop = def->op;
+        branch->args[0] = def->args[0];
+        branch->args[1] = def->args[1];
+        remove[i] = true;
+        changed++;
+        i++;
+      }
+    }
+  }
+
+  ir_remove_marked(ir, remove);
+  free(defs);
+  free(uses);
+  free(remove);
+  return changed;
+}
+
+// Position of every label in the program
+static int* label_positions(IrProgram* ir) {
+  int* position = malloc((ir->label_count + 1) * sizeof(int));
+  ensure_non_null(position, "out of space");
+  for (int l = 0; l < ir->label_count; l++) position[l] = -1;
+  for (int i = 0; i < ir->len; i++) {
+    if (ir->instrs[i].op == IR_LABEL) position[ir->instrs[i].label] = i;
+  }
+  return position;
+}
+
+// First instruction at or after `i` that is not a label
+static int skip_labels(IrProgram* ir, int i) {
+  while (i < ir->len && ir->instrs[i].op == IR_LABEL) i++;
+  return i;
+}
+
+// Whether label `label` is in the run of labels starting at `i`
+static bool label_in_run(IrProgram* ir, int i, int label) {
+  for (; i < ir->len && ir->instrs[i].op == IR_LABEL; i++) {
+    if (ir->instrs[i].label == label) return true;
+  }
+  return false;
+}
+
+// Retargets branches to labels that are followed by a goto
+static int collapse_jump_chains(IrProgram* ir) {
+  int* position = label_positions(ir);
+  int changed = 0;
+
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    if (!ir_is_branch(instr->op)) continue;
+
+    // Bounded by the number of labels so a cycle of gotos ends
+    int target = instr->label;
+    for (int hops = 0; hops < ir->label_count; hops++) {
+      int next = skip_labels(ir, position[target]);
+      if (next >= ir->len || ir->instrs[next].op != IR_GOTO) break;
+      if (ir->instrs[next].label == target) break;
+      target = ir->instrs[next].label;
+    }
+
+    if (target != instr->label) {
+      instr->label = target;
+      changed++;
+    }
+  }
+
+  free(position);
+  return changed;
+}
+
+static bool same_operand(IrOperand a, IrOperand b) {
+  if (a.tag != b.tag) return false;
+  match (a) {
+    of(IrTemp, temp) return *temp == b.data.IrTemp._0;
+    of(IrVar, var) return *var == b.data.IrVar._0;
+    of(IrConst, value) return ir_results_equal(*value, b.data.IrConst._0);
+    of(IrNone) return true;
+  }
+  return false;
+}
+
+// Whether two conditional branches test the same condition, each either
+// taken when it holds or when it does not
+static bool same_test(IrInstr* a, IrInstr* b) {
+  if (ir_is_cmp_branch(a->op) != ir_is_cmp_branch(b->op)) return false;
+  if (ir_is_cmp_branch(a->op) && a->relop != b->relop) return false;
+  return same_operand(a->args[0], b->args[0]) && same_operand(a->args[1], b->args[1]);
+}
+
+// Retargets conditional branches to tests of the same condition. Evaluating
+// the condition again gives the same result, or the same runtime error,
+// since nothing runs in between.
+static int thread_jumps(IrProgram* ir) {
+  int* position = label_positions(ir);
+  int changed = 0;
+
+  for (int i = 0; i < ir->len; i++) {
+    if (!ir_is_cond_branch(ir->instrs[i].op)) continue;
+
+    // Bounded by the number of labels so a cycle of tests ends
+    int target = ir->instrs[i].label;
+    for (int hops = 0; hops < ir->label_count; hops++) {
+      int test = skip_labels(ir, position[target]);
+      if (test >= ir->len || test == i) break;
+      if (!ir_is_cond_branch(ir->instrs[test].op) || !same_test(&ir->instrs[i], &ir->instrs[test])) break;
+
+      if (ir->instrs[test].op == ir->instrs[i].op) {
+        if (ir->instrs[test].label == target) break;
+        target = ir->instrs[test].label;
+        continue;
+      }
+
+      // The test is not taken, so continue after it
+      if (test + 1 >= ir->len || ir->instrs[test + 1].op != IR_LABEL) {
+        ir_insert(ir, test + 1, ir_label_instr(IR_LABEL, ir_new_label(ir)));
+        if (test + 1 <= i) i++;
+        free(position);
+        position = label_positions(ir);
+      }
+      target = ir->instrs[test + 1].label;
+    }
+
+    if (target != ir->instrs[i].label) {
+      ir->instrs[i].label = target;
+      changed++;
+    }
+  }
+
+  // A test right after a branch on the same condition is only reached when
+  // that branch was not taken
+  bool* remove = calloc(ir->len + 1, sizeof(bool));
+  ensure_non_null(remove, "out of space");
+  for (int i = 0; i + 1 < ir->len; i++) {
+    IrInstr* branch = &ir->instrs[i];
+    IrInstr* test = &ir->instrs[i + 1];
+    if (!ir_is_cond_branch(branch->op) || !ir_is_cond_branch(test->op) || !same_test(branch, test)) continue;
+
+    if (test->op == branch->op) {
+      remove[i + 1] = true;
+    } else {
+      ir_free_operands(test);
+      *test = ir_label_instr(IR_GOTO, test->label);
+    }
+    changed++;
+    i++;
+  }
+
+  ir_discard_marked(ir, remove);
+  free(remove);
+  free(position);
+  return changed;
+}
+
+// Turns a conditional branch over a goto into the inverted branch
+static int invert_branches(IrProgram* ir) {
+  bool* remove = calloc(ir->len + 1, sizeof(bool));
+  ensure_non_null(remove, "out of space");
+  int changed = 0;
+
+  for (int i = 0; i + 2 < ir->len; i++) {
+    IrInstr* branch = &ir->instrs[i];
+    IrInstr* jump = &ir->instrs[i + 1];
+    if (!ir_is_cond_branch(branch->op) || jump->op != IR_GOTO) continue;
+    if (!label_in_run(ir, i + 2, branch->label)) continue;
+
+    branch->op = ir_invert_branch(branch->op);
+    branch->label = jump->label;
+    remove[i + 1] = true;
+    changed++;
+    i++;
+  }
+
+  ir_remove_marked(ir, remove);
+  free(remove);
+  return changed;
+}
+
+// Removes gotos to the label right after them
+static int remove_jumps_to_next(IrProgram* ir) {
+  bool* remove = calloc(ir->len + 1, sizeof(bool));
+  ensure_non_null(remove, "out of space");
+  int changed = 0;
+
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    if (instr->op == IR_GOTO && label_in_run(ir, i + 1, instr->label)) {
+      remove[i] = true;
+      changed++;
+    }
+  }
+
+  ir_remove_marked(ir, remove);
+  free(remove);
+  return changed;
+}
+
+// Replaces a backwards `goto H`, where H is a loop header consisting only of
+// an exit test `if c goto Lexit`, by `if !c goto Lbody; goto Lexit`, with
+// Lbody the label after the test. The goto to the exit usually falls through
+// and is removed by remove_jumps_to_next.
+static int rotate_loops(IrProgram* ir) {
+  int changed = 0;
+
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* jump = &ir->instrs[i];
+    if (jump->op != IR_GOTO) continue;
+
+    int* position = label_positions(ir);
+    int header = position[jump->label];
+    free(position);
+    if (header > i) continue;
+
+    int test = skip_labels(ir, header);
+    if (test >= i || !ir_is_cond_branch(ir->instrs[test].op)) continue;
+
+    if (ir->instrs[test + 1].op != IR_LABEL) {
+      ir_insert(ir, test + 1, ir_label_instr(IR_LABEL, ir_new_label(ir)));
+      i++;
+    }
+    IrInstr* exit_test = &ir->instrs[test];
+    int body = ir->instrs[test + 1].label;
+
+    IrInstr back_edge = copy_instr(*exit_test);
+    back_edge.op = ir_invert_branch(exit_test->op);
+    back_edge.label = body;
+    int exit = exit_test->label;
+
+    ir->instrs[i] = back_edge;
+    ir_insert(ir, i + 1, ir_label_instr(IR_GOTO, exit));
+    changed++;
+  }
+
+  return changed;
+}
+
+static int drop_unreferenced_labels(IrProgram* ir) {
+  bool* referenced = calloc(ir->label_count + 1, sizeof(bool));
+  bool* remove = calloc(ir->len + 1, sizeof(bool));
+  ensure_non_null(referenced, "out of space");
+  ensure_non_null(remove, "out of space");
+
+  for (int i = 0; i < ir->len; i++) {
+    if (ir_is_branch(ir->instrs[i].op)) referenced[ir->instrs[i].label] = true;
+  }
+  for (int i = 0; i < ir->len; i++) {
+    if (ir->instrs[i].op == IR_LABEL && !referenced[ir->instrs[i].label]) remove[i] = true;
+  }
+
+  int removed = ir_remove_marked(ir, remove);
+  free(referenced);
+  free(remove);
+  return removed;
+}
+
+int peephole(IrProgram* ir) {
+  int total = 0;
+  int changed = 1;
+  while (changed > 0) {
+    changed = fuse_conditions(ir);
+    changed += collapse_jump_chains(ir);
+    changed += thread_jumps(ir);
+    changed += invert_branches(ir);
+    changed += remove_jumps_to_next(ir);
+    changed += remove_unreachable_blocks(ir);
+    total += changed;
+  }
+
+  // Rotating loops before the labels are dropped keeps the label of the
+  // loop body around for the new back edge
+  changed = rotate_loops(ir);
+  if (changed > 0) {
+    changed += remove_jumps_to_next(ir);
+    changed += remove_unreachable_blocks(ir);
+    total += changed;
+  }
+
+  total += drop_unreferenced_labels(ir);
+  if (opt_verbose && total > 0) fprintf(stderr, "peephole: %d instructions changed\n", total);
+  return total;
+}
@@ -0,0 +1,179 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "liveness.h"
+#include "opt.h"
+#include "datatype99.h"
+
+/*
+ * Linear scan register allocation (Poletto and Sarkar).
+ *
+ * Every temporary gets a live interval over the linear order of the IR, from
+ * its first to its last occurrence, stretched over the blocks it is live into
+ * or out of. Intervals are scanned by start point, and a temporary gets a
+ * free register or, when all of them are taken, the interval ending last is
+ * spilled to a frame slot. Spilled intervals are packed into as few slots as
+ * possible the same way.
+ *
+ * Registers become temporaries 0 .. registers - 1 and slots the temporaries
+ * after them, so the frame of the program is as small as its register
+ * pressure.
+ */
+
+typedef struct {
+  int temp;
+  int start;
+  int end;
+} Interval;
+
+static int compare_start(const void* a, const void* b) {
+  const Interval* x = a;
+  const Interval* y = b;
+  if (x->start != y->start) return x->start - y->start;
+  return x->temp - y->temp;
+}
+
+static void extend(Interval* interval, int point) {
+  if (point < interval->start) interval->start = point;
+  if (point > interval->end) interval->end = point;
+}
+
+static Interval* live_intervals(IrProgram* ir, int* count) {
+  Cfg* cfg = build_cfg(ir);
+  Liveness* liveness = compute_liveness(ir, cfg);
+
+  Interval* intervals = malloc((ir->temp_count + 1) * sizeof(Interval));
+  ensure_non_null(intervals, "out of space");
+  for (int t = 0; t < ir->temp_count; t++) intervals[t] = (Interval){ t, INT_MAX, -1 };
+
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    IrOperand* operands[3] = { &instr->args[0], &instr->args[1], &instr->dest };
+    for (int k = 0; k < 3; k++) {
+      ifLet(*operands[k], IrTemp, temp) extend(&intervals[*temp], i);
+    }
+  }
+
+  for (int b = 0; b < cfg->block_count; b++) {
+    BasicBlock* block = &cfg->blocks[b];
+    for (int t = 0; t < ir->temp_count; t++) {
+      if (is_live_in(liveness, b, t)) extend(&intervals[t], block->start);
+      if (is_live_out(liveness, b, t)) extend(&intervals[t], block->end - 1);
+    }
+  }
+
+  free_liveness(liveness);
+  free_cfg(cfg);
+
+  // Drop the temporaries that no longer occur in the program
+  *count = 0;
+  for (int t = 0; t < ir->temp_count; t++) {
+    if (intervals[t].end >= 0) intervals[(*count)++] = intervals[t];
+  }
+  qsort(intervals, *count, sizeof(Interval), compare_start);
+  return intervals;
+}
+
+// Assigns one of `limit` locations to every interval. Intervals that do not
+// fit get location -1. Returns the number of locations used.
+static int linear_scan(Interval* intervals, int count, int limit, int* location) {
+  int* active = malloc((count + 1) * sizeof(int));  // Sorted by end point
+  int* free_locations = malloc((count + 1) * sizeof(int));
+  ensure_non_null(active, "out of space");
+  ensure_non_null(free_locations, "out of space");
+  int active_count = 0, free_count = 0, used = 0;
+
+  for (int n = 0; n < count; n++) {
+    Interval* current = &intervals[n];
+
+    // Expire the intervals that ended strictly before this one starts, so an
+    // instruction never writes the location of one of its operands
+    int kept = 0;
+    for (int a = 0; a < active_count; a++) {
+      Interval* other = &intervals[active[a]];
+      if (other->end < current->start) free_locations[free_count++] = location[other->temp];
+      else active[kept++] = active[a];
+    }
+    active_count = kept;
+
+    if (free_count == 0 && used < limit) free_locations[free_count++] = used++;
+
+    int chosen = n;
+    if (free_count > 0) {
+      location[current->temp] = free_locations[--free_count];
+    } else {
+      // Spill whichever of the current and the active intervals ends last
+      Interval* last = &intervals[active[active_count - 1]];
+      if (last->end > current->end) {
+        location[current->temp] = location[last->temp];
+        location[last->temp] = -1;
+        active_count--;
+      } else {
+        location[current->temp] = -1;
+        chosen = -1;
+      }
+    }
+    if (chosen < 0) continue;
+
+    int a = active_count++;
+    while (a > 0 && intervals[active[a - 1]].end > current->end) {
+      active[a] = active[a - 1];
+      a--;
+    }
+    active[a] = n;
+  }
+
+  free(active);
+  free(free_locations);
+  return used;
+}
+
+int allocate_registers(IrProgram* ir, int registers) {
+  remove_unreachable_blocks(ir);
+
+  int count = 0;
+  Interval* intervals = live_intervals(ir, &count);
+  int* location = malloc((ir->temp_count + 1) * sizeof(int));
+  ensure_non_null(location, "out of space");
+
+  linear_scan(intervals, count, registers, location);
+
+  int spilled = 0;
+  for (int n = 0; n < count; n++) {
+    if (location[intervals[n].temp] < 0) intervals[spilled++] = intervals[n];
+  }
+  int* slot = malloc((ir->temp_count + 1) * sizeof(int));
+  ensure_non_null(slot, "out of space");
+  int slots = linear_scan(intervals, spilled, INT_MAX, slot);
+
+  for (int n = 0; n < spilled; n++) {
+    int temp = intervals[n].temp;
+    location[temp] = registers + slot[temp];
+  }
+
+  if (opt_verbose) {
+    fprintf(stderr, "regalloc: %d temporaries in %d registers and %d spill slots\n",
+      count, registers, slots);
+  }
+
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    IrOperand* operands[3] = { &instr->args[0], &instr->args[1], &instr->dest };
+    for (int k = 0; k < 3; k++) {
+      ifLet(*operands[k], IrTemp, temp) *temp = location[*temp];
+    }
+  }
+
+  int changed = ir->temp_count - (registers + slots);
+  ir->temp_count = registers + slots;
+  ir->reg_count = registers;
+
+  free(intervals);
+  free(location);
+  free(slot);
+  return changed > 0 ? changed : 0;
+}
@@ -0,0 +1,182 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "runtime.h"
+
+/*
+ * Runtime library of compiled programs. It is built on its own, and linked
+ * with the native code the backends generate, never into pseudoc. Values,
+ * results and error messages follow the tree walking evaluator in ast.c.
+ */
+
+static _Noreturn void runtime_error(const char* s, ...) {
+  va_list ap;
+  va_start(ap, s);
+
+  fprintf(stderr, "runtime error: ");
+  vfprintf(stderr, s, ap);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+static PseudoValue boolean_value(int64_t boolean) {
+  return (PseudoValue){ .tag = PSEUDO_BOOLEAN, .boolean = boolean != 0 };
+}
+
+static PseudoValue number_value(double number) {
+  return (PseudoValue){ .tag = PSEUDO_NUMBER, .number = number };
+}
+
+void pseudo_display_boolean(int64_t boolean) {
+  printf("%s\n", boolean ? "true" : "false");
+}
+
+void pseudo_display_number(double number) {
+  printf("%g\n", number);
+}
+
+void pseudo_display_string(const char* string) {
+  printf("%s\n", string);
+}
+
+void pseudo_display(const PseudoValue* value) {
+  switch (value->tag) {
+    case PSEUDO_BOOLEAN: pseudo_display_boolean(value->boolean); break;
+    case PSEUDO_NUMBER: pseudo_display_number(value->number); break;
+    case PSEUDO_STRING: pseudo_display_string(value->string); break;
+  }
+}
+
+const char* pseudo_concat(const char* a, const char* b) {
+  size_t len = strlen(a);
+  char* new = malloc(len + strlen(b) + 1);
+  if (!new) {
+    fprintf(stderr, "out of space");
+    exit(1);
+  }
+  strcpy(new, a);
+  strcpy(new + len, b);
+  return new;
+}
+
+int64_t pseudo_streq(const char* a, const char* b) {
+  return strcmp(a, b) == 0;
+}
+
+static PseudoValue eval_binary(int64_t op, PseudoValue a, PseudoValue b) {
+  if (a.tag != b.tag) {
+    if (op == PSEUDO_EQ) return boolean_value(0);
+  } else if (a.tag == PSEUDO_BOOLEAN) {
+    switch (op) {
+      case PSEUDO_EQ: return boolean_value(a.boolean == b.boolean);
+      case PSEUDO_AND: return boolean_value(a.boolean && b.boolean);
+      case PSEUDO_OR: return boolean_value(a.boolean || b.boolean);
+    }
+  } else if (a.tag == PSEUDO_STRING) {
+    switch (op) {
+      case PSEUDO_ADD: return (PseudoValue){ .tag = PSEUDO_STRING, .string = pseudo_concat(a.string, b.string) };
+      case PSEUDO_EQ: return boolean_value(strcmp(a.string, b.string) == 0);
+    }
+  } else {
+    switch (op) {
+      case PSEUDO_ADD: return number_value(a.number + b.number);
+      case PSEUDO_SUB: return number_value(a.number - b.number);
+      case PSEUDO_MUL: return number_value(a.number * b.number);
+      case PSEUDO_DIV: return number_value(a.number / b.number);
+      case PSEUDO_GT: return boolean_value(a.number > b.number);
+      case PSEUDO_GTE: return boolean_value(a.number >= b.number);
+      case PSEUDO_LT: return boolean_value(a.number < b.number);
+      case PSEUDO_LTE: return boolean_value(a.number <= b.number);
+      case PSEUDO_EQ: return boolean_value(a.number == b.number);
+    }
+  }
+
+  switch (a.tag) {
+    case PSEUDO_BOOLEAN: runtime_error("unsupported boolean operation");
+    case PSEUDO_STRING: runtime_error("unsupported string operation");
+    default: runtime_error("unsupported number operation");
+  }
+}
+
+// `dest` can be one of the operands
+void pseudo_binary(PseudoValue* dest, int64_t op, const PseudoValue* a, const PseudoValue* b) {
+  *dest = eval_binary(op, *a, *b);
+}
+
+void pseudo_unary(PseudoValue* dest, int64_t op, const PseudoValue* a) {
+  if (op == PSEUDO_NEG) {
+    if (a->tag != PSEUDO_NUMBER) runtime_error("unsupported variable type for number negation");
+    *dest = number_value(- a->number);
+  } else {
+    if (a->tag != PSEUDO_BOOLEAN) runtime_error("unsupported variable type for boolean negation");
+    *dest = boolean_value(!a->boolean);
+  }
+}
+
+int64_t pseudo_condition(const PseudoValue* value) {
+  if (value->tag != PSEUDO_BOOLEAN) runtime_error("if condition must evaluate to a boolean");
+  return value->boolean;
+}
+
+static int64_t for_loop_start(double from) {
+  if (isnan(from)) return 0;
+  if (from <= (double)INT64_MIN) return INT64_MIN;
+  if (from >= (double)INT64_MAX) return INT64_MAX;
+  return (int64_t)from;
+}
+
+// First value of the variable of `for i = from to ...`
+int64_t pseudo_for_first(const PseudoValue* from) {
+  if (from->tag != PSEUDO_NUMBER) runtime_error("start variable should be a number in for loop");
+  return for_loop_start(from->number);
+}
+
+// Iterations of `for i = from to to`, as for_loop_trip_count in ast.c counts them
+int64_t pseudo_for_count(const PseudoValue* from, const PseudoValue* to) {
+  if (from->tag != PSEUDO_NUMBER) runtime_error("start variable should be a number in for loop");
+  if (to->tag != PSEUDO_NUMBER) runtime_error("for loop end should be a number");
+
+  int64_t start = for_loop_start(from->number);
+  double end = floor(to->number);
+  if (isnan(end) || end < (double)start) return 0;
+
+  double count = end - (double)start + 1;
+  return count >= (double)INT64_MAX ? INT64_MAX : (int64_t)count;
+}
+
+// The same as numbers, for the IR's trunc and trip instructions
+double pseudo_for_start(const PseudoValue* from) {
+  return (double)pseudo_for_first(from);
+}
+
+double pseudo_for_trip(const PseudoValue* from, const PseudoValue* to) {
+  return (double)pseudo_for_count(from, to);
+}
+
+// Raises the error of `op` on operands that failed the check of a typed
+// instruction
+void pseudo_check_failed(int64_t op, const PseudoValue* a, const PseudoValue* b) {
+  PseudoValue scratch;
+  switch (op) {
+    case PSEUDO_IF: pseudo_condition(a); break;
+    case PSEUDO_NEG: case PSEUDO_NOT: pseudo_unary(&scratch, op, a); break;
+    case PSEUDO_TRUNC: pseudo_for_start(a); break;
+    case PSEUDO_FOR_TRIP: pseudo_for_trip(a, b); break;
+    default: pseudo_binary(&scratch, op, a, b); break;
+  }
+
+  fprintf(stderr, "unreachable: pseudo_check_failed\n");
+  exit(1);
+}
+
+void pseudo_undefined(const char* name) {
+  fprintf(stderr, "Runtime error: undefined variable '%s'\n", name);
+  exit(1);
+}
+
+int main(void) {
+  pseudo_main();
+  return 0;
+}
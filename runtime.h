@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Runtime library of compiled programs.
+ *
+ * Native code generated by the backends keeps every variable and temporary
+ * in a PseudoValue, and calls into this library for what it does not do
+ * inline: displaying values, concatenating strings, the untyped operations
+ * and raising runtime errors with the interpreter's messages. The library
+ * does not depend on the rest of the compiler, and provides the `main` that
+ * runs the compiled program's pseudo_main.
+ *
+ * The layout of PseudoValue and the values of PseudoTag and PseudoOp are
+ * part of the interface with generated code.
+ */
+
+typedef enum {
+  PSEUDO_UNDEFINED,  // Variable nothing has been assigned to yet
+  PSEUDO_BOOLEAN,
+  PSEUDO_NUMBER,
+  PSEUDO_STRING,
+} PseudoTag;
+
+typedef struct {
+  int64_t tag;  // PseudoTag
+  union {
+    int64_t boolean;  // 0 or 1
+    double number;
+    const char* string;
+  };
+} PseudoValue;
+
+// Operations of pseudo_binary, pseudo_unary and pseudo_check_failed
+typedef enum {
+  PSEUDO_ADD,
+  PSEUDO_SUB,
+  PSEUDO_MUL,
+  PSEUDO_DIV,
+  PSEUDO_EQ,
+  PSEUDO_GT,
+  PSEUDO_GTE,
+  PSEUDO_LT,
+  PSEUDO_LTE,
+  PSEUDO_AND,
+  PSEUDO_OR,
+
+  PSEUDO_NEG,
+  PSEUDO_NOT,
+
+  PSEUDO_IF,        // Condition of a branch
+  PSEUDO_TRUNC,     // Start of a for loop
+  PSEUDO_FOR_TRIP,  // Trip count of a for loop
+} PseudoOp;
+
+void pseudo_main(void);
+
+void pseudo_display(const PseudoValue* value);
+void pseudo_display_boolean(int64_t boolean);
+void pseudo_display_number(double number);
+void pseudo_display_string(const char* string);
+void pseudo_binary(PseudoValue* dest, int64_t op, const PseudoValue* a, const PseudoValue* b);
+void pseudo_unary(PseudoValue* dest, int64_t op, const PseudoValue* a);
+int64_t pseudo_condition(const PseudoValue* value);
+int64_t pseudo_for_first(const PseudoValue* from);
+int64_t pseudo_for_count(const PseudoValue* from, const PseudoValue* to);
+double pseudo_for_start(const PseudoValue* from);
+double pseudo_for_trip(const PseudoValue* from, const PseudoValue* to);
+const char* pseudo_concat(const char* a, const char* b);
+int64_t pseudo_streq(const char* a, const char* b);
+
+_Noreturn void pseudo_check_failed(int64_t op, const PseudoValue* a, const PseudoValue* b);
+_Noreturn void pseudo_undefined(const char* name);
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "opt.h"
+#include "ssa.h"
+#include "datatype99.h"
+
+/*
+ * Sparse conditional constant propagation (Wegman and Zadeck).
+ *
+ * Every SSA value starts out unknown (top) and is lowered to a constant or to
+ * overdefined (bottom) as the blocks that define it are found to be
+ * executable. Branches on constants only make one of their edges executable,
+ * so definitions in dead arms never pollute the values at join points.
+ *
+ * Values that are undefined on entry are overdefined, and operations that
+ * would be a runtime error are never folded, so programs that fail at run
+ * time still fail the same way.
+ */
+
+typedef enum {
+  Lattice_Top,
+  Lattice_Const,
+  Lattice_Bottom,
+} Lattice;
+
+typedef struct {
+  IrProgram* ir;
+  SsaForm* ssa;
+  Cfg* cfg;
+
+  Lattice* state;
+  ExprResult* value;
+
+  // Instructions and phis reading each value
+  IntList* instr_uses;
+  IntList* phi_uses;
+
+  // Edge `s` out of block `b` is at index 2 * b + s
+  bool* edge_executable;
+  bool* block_executable;
+
+  IntList edge_worklist;
+  IntList value_worklist;
+} Sccp;
+
+static void lower_to(Sccp* s, int v, Lattice state, ExprResult value) {
+  if (s->state[v] == Lattice_Bottom) return;
+
+  if (state == Lattice_Const && s->state[v] == Lattice_Const) {
+    if (ir_results_equal(s->value[v], value)) return;
+    state = Lattice_Bottom;
+  }
+  if (state == s->state[v]) return;
+
+  if (s->state[v] == Lattice_Const) ir_free_result(s->value[v]);
+  s->state[v] = state;
+  if (state == Lattice_Const) s->value[v] = ir_copy_result(value);
+  int_list_push(&s->value_worklist, v);
+}
+
+// Lattice value of an operand of instruction `i`
+static Lattice operand_state(Sccp* s, int i, int k, ExprResult* value) {
+  IrOperand operand = s->ir->instrs[i].args[k];
+  ifLet(operand, IrConst, constant) {
+    *value = *constant;
+    return Lattice_Const;
+  }
+
+  int v = s->ssa->use_value[2 * i + k];
+  if (v < 0) return Lattice_Bottom;
+  *value = s->value[v];
+  return s->state[v];
+}
+
+// Evaluates `op` over the operands of instruction `i`
+static Lattice evaluate(Sccp* s, int i, IrOpcode op, int arg_count, ExprResult* out) {
+  ExprResult args[2] = { BooleanResult(false), BooleanResult(false) };
+  Lattice result = Lattice_Const;
+
+  for (int k = 0; k < arg_count; k++) {
+    Lattice state = operand_state(s, i, k, &args[k]);
+    if (state == Lattice_Bottom) return Lattice_Bottom;
+    if (state == Lattice_Top) result = Lattice_Top;
+  }
+  if (result == Lattice_Top) return Lattice_Top;
+
+  return ir_fold(op, args[0], args[1], out) ? Lattice_Const : Lattice_Bottom;
+}
+
+// Evaluates the condition of a conditional branch, before any negation
+static Lattice evaluate_condition(Sccp* s, int i, ExprResult* cond) {
+  IrInstr* instr = &s->ir->instrs[i];
+  if (ir_is_cmp_branch(instr->op)) return evaluate(s, i, instr->relop, 2, cond);
+  return evaluate(s, i, IR_COPY, 1, cond);
+}
+
+static int arg_count(IrOpcode op) {
+  if (ir_is_binary(op) || ir_is_cmp_branch(op)) return 2;
+  return 1;
+}
+
+static void mark_edge(Sccp* s, int b, int target) {
+  BasicBlock* block = &s->cfg->blocks[b];
+  for (int e = 0; e < block->succ_count; e++) {
+    if (block->succs[e] == target) int_list_push(&s->edge_worklist, 2 * b + e);
+  }
+}
+
+static void visit_instr(Sccp* s, int i) {
+  IrInstr* instr = &s->ir->instrs[i];
+  int b = s->cfg->instr_block[i];
+  if (!s->block_executable[b]) return;
+
+  int def = s->ssa->def_value[i];
+  if (def >= 0) {
+    ExprResult result = BooleanResult(false);
+    Lattice state = evaluate(s, i, instr->op, arg_count(instr->op), &result);
+    lower_to(s, def, state, result);
+    if (state == Lattice_Const) ir_free_result(result);
+  }
+
+  BasicBlock* block = &s->cfg->blocks[b];
+  if (i != block->end - 1) return;
+
+  if (ir_is_cond_branch(instr->op)) {
+    ExprResult cond = BooleanResult(false);
+    Lattice state = evaluate_condition(s, i, &cond);
+
+    if (state == Lattice_Top) return;
+    if (state == Lattice_Const && MATCHES(cond, BooleanResult)) {
+      bool taken = cond.data.BooleanResult._0 != ir_is_negated_branch(instr->op);
+      if (taken) mark_edge(s, b, s->cfg->label_block[instr->label]);
+      else if (b + 1 < s->cfg->block_count) mark_edge(s, b, b + 1);
+      return;
+    }
+    if (state == Lattice_Const) ir_free_result(cond);
+  }
+
+  for (int e = 0; e < block->succ_count; e++) int_list_push(&s->edge_worklist, 2 * b + e);
+}
+
+static void visit_phi(Sccp* s, int p) {
+  Phi* phi = &s->ssa->phis[p];
+  BasicBlock* block = &s->cfg->blocks[phi->block];
+
+  for (int a = 0; a < block->pred_count; a++) {
+    int pred = block->preds[a];
+    BasicBlock* pred_block = &s->cfg->blocks[pred];
+
+    bool executable = false;
+    for (int e = 0; e < pred_block->succ_count; e++) {
+      if (pred_block->succs[e] == phi->block && s->edge_executable[2 * pred + e]) executable = true;
+    }
+    if (!executable) continue;
+
+    int v = phi->args[a];
+    lower_to(s, phi->dest, s->state[v], s->value[v]);
+  }
+}
+
+static void propagate(Sccp* s) {
+  s->block_executable[0] = true;
+  for (int i = s->cfg->blocks[0].start; i < s->cfg->blocks[0].end; i++) visit_instr(s, i);
+
+  while (s->edge_worklist.len > 0 || s->value_worklist.len > 0) {
+    while (s->edge_worklist.len > 0) {
+      int e = s->edge_worklist.items[--s->edge_worklist.len];
+      if (s->edge_executable[e]) continue;
+      s->edge_executable[e] = true;
+
+      int target = s->cfg->blocks[e / 2].succs[e % 2];
+      for (int p = s->ssa->block_phis[target]; p < s->ssa->block_phis[target + 1]; p++) {
+        visit_phi(s, p);
+      }
+
+      if (!s->block_executable[target]) {
+        s->block_executable[target] = true;
+        BasicBlock* block = &s->cfg->blocks[target];
+        for (int i = block->start; i < block->end; i++) visit_instr(s, i);
+      }
+    }
+
+    while (s->value_worklist.len > 0) {
+      int v = s->value_worklist.items[--s->value_worklist.len];
+      for (int u = 0; u < s->instr_uses[v].len; u++) visit_instr(s, s->instr_uses[v].items[u]);
+      for (int u = 0; u < s->phi_uses[v].len; u++) {
+        int p = s->phi_uses[v].items[u];
+        if (s->block_executable[s->ssa->phis[p].block]) visit_phi(s, p);
+      }
+    }
+  }
+}
+
+static void replace_operand(IrOperand* operand, ExprResult value) {
+  ifLet(*operand, IrConst, old) ir_free_result(*old);
+  *operand = IrConst(ir_copy_result(value));
+}
+
+// Rewrites the IR with the constants found, and folds constant branches
+static int rewrite(Sccp* s) {
+  IrProgram* ir = s->ir;
+  bool* remove = calloc(ir->len + 1, sizeof(bool));
+  ensure_non_null(remove, "out of space");
+  int changed = 0;
+
+  for (int i = 0; i < ir->len; i++) {
+    if (!s->block_executable[s->cfg->instr_block[i]]) continue;
+    IrInstr* instr = &ir->instrs[i];
+
+    for (int k = 0; k < 2; k++) {
+      int v = s->ssa->use_value[2 * i + k];
+      if (v >= 0 && s->state[v] == Lattice_Const) {
+        replace_operand(&instr->args[k], s->value[v]);
+        changed++;
+      }
+    }
+
+    int def = s->ssa->def_value[i];
+    bool is_const_copy = instr->op == IR_COPY && MATCHES(instr->args[0], IrConst);
+    if (def >= 0 && s->state[def] == Lattice_Const && !is_const_copy) {
+      replace_operand(&instr->args[0], s->value[def]);
+      ifLet(instr->args[1], IrConst, old) ir_free_result(*old);
+      instr->op = IR_COPY;
+      instr->args[1] = IrNone();
+      changed++;
+    }
+
+    if (ir_is_cond_branch(instr->op)) {
+      ExprResult cond = BooleanResult(false);
+      Lattice state = evaluate_condition(s, i, &cond);
+      if (state != Lattice_Const) continue;
+
+      ifLet(cond, BooleanResult, value) {
+        bool taken = *value != ir_is_negated_branch(instr->op);
+        ir_free_operands(instr);
+        if (taken) *instr = ir_label_instr(IR_GOTO, instr->label);
+        else remove[i] = true;
+        changed++;
+      }
+      ir_free_result(cond);
+    }
+  }
+
+  ir_remove_marked(ir, remove);
+  free(remove);
+  return changed;
+}
+
+int sccp(IrProgram* ir) {
+  SsaForm* ssa = build_ssa(ir);
+  Sccp s = {
+    .ir = ir,
+    .ssa = ssa,
+    .cfg = ssa->cfg,
+    .state = calloc(ssa->value_count + 1, sizeof(Lattice)),
+    .value = calloc(ssa->value_count + 1, sizeof(ExprResult)),
+    .instr_uses = calloc(ssa->value_count + 1, sizeof(IntList)),
+    .phi_uses = calloc(ssa->value_count + 1, sizeof(IntList)),
+    .edge_executable = calloc(2 * ssa->cfg->block_count + 1, sizeof(bool)),
+    .block_executable = calloc(ssa->cfg->block_count + 1, sizeof(bool)),
+  };
+  ensure_non_null(s.state, "out of space");
+  ensure_non_null(s.value, "out of space");
+  ensure_non_null(s.instr_uses, "out of space");
+  ensure_non_null(s.phi_uses, "out of space");
+  ensure_non_null(s.edge_executable, "out of space");
+  ensure_non_null(s.block_executable, "out of space");
+
+  for (int v = 0; v < ssa->name_count; v++) s.state[v] = Lattice_Bottom;
+  for (int i = 0; i < ir->len; i++) {
+    for (int k = 0; k < 2; k++) {
+      int v = ssa->use_value[2 * i + k];
+      if (v >= 0) int_list_push(&s.instr_uses[v], i);
+    }
+  }
+  for (int p = 0; p < ssa->phi_count; p++) {
+    for (int a = 0; a < ssa->cfg->blocks[ssa->phis[p].block].pred_count; a++) {
+      int_list_push(&s.phi_uses[ssa->phis[p].args[a]], p);
+    }
+  }
+
+  int changed = 0;
+  if (ssa->cfg->block_count > 0) {
+    propagate(&s);
+    changed = rewrite(&s);
+  }
+
+  for (int v = 0; v < ssa->value_count; v++) {
+    if (s.state[v] == Lattice_Const) ir_free_result(s.value[v]);
+    free_int_list(&s.instr_uses[v]);
+    free_int_list(&s.phi_uses[v]);
+  }
+  free_int_list(&s.edge_worklist);
+  free_int_list(&s.value_worklist);
+  free(s.state);
+  free(s.value);
+  free(s.instr_uses);
+  free(s.phi_uses);
+  free(s.edge_executable);
+  free(s.block_executable);
+  free_ssa(ssa);
+
+  return changed + remove_unreachable_blocks(ir);
+}
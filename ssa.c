@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "ssa.h"
+#include "datatype99.h"
+
+int ssa_name(IrProgram* ir, IrOperand operand) {
+  match (operand) {
+    of(IrTemp, temp) return *temp;
+    of(IrVar, var) return ir->temp_count + *var;
+    otherwise return -1;
+  }
+
+  return -1;
+}
+
+IrOperand ssa_name_operand(IrProgram* ir, int name) {
+  if (name < ir->temp_count) return IrTemp(name);
+  return IrVar(name - ir->temp_count);
+}
+
+bool ssa_value_is_undef(SsaForm* ssa, int value) {
+  return value < ssa->name_count;
+}
+
+static void* ssa_alloc(size_t count, size_t size) {
+  void* alloc = calloc(count + 1, size);
+  ensure_non_null(alloc, "out of space");
+  return alloc;
+}
+
+SsaScope alloc_ssa_scope(int name_count) {
+  SsaScope scope = {
+    .stacks = ssa_alloc(name_count, sizeof(IntList)),
+    .name_count = name_count,
+  };
+  return scope;
+}
+
+void free_ssa_scope(SsaScope* scope) {
+  for (int name = 0; name < scope->name_count; name++) free_int_list(&scope->stacks[name]);
+  free_int_list(&scope->pushed);
+  free(scope->stacks);
+}
+
+void ssa_scope_push(SsaScope* scope, int name, int value) {
+  int_list_push(&scope->stacks[name], value);
+  int_list_push(&scope->pushed, name);
+}
+
+// The undefined entry value of a name is the value with the same number
+int ssa_scope_current(SsaScope* scope, int name) {
+  IntList* stack = &scope->stacks[name];
+  return stack->len > 0 ? stack->items[stack->len - 1] : name;
+}
+
+void ssa_scope_pop_to(SsaScope* scope, int mark) {
+  while (scope->pushed.len > mark) {
+    int name = scope->pushed.items[--scope->pushed.len];
+    scope->stacks[name].len--;
+  }
+}
+
+/* ----------------------------- Dominator tree ----------------------------- */
+
+static void build_dom_tree(SsaForm* ssa) {
+  Cfg* cfg = ssa->cfg;
+  int n = cfg->block_count;
+
+  ssa->dom_child_start = ssa_alloc(n + 1, sizeof(int));
+  ssa->dom_children = ssa_alloc(n, sizeof(int));
+
+  for (int b = 1; b < n; b++) {
+    if (cfg->idom[b] >= 0) ssa->dom_child_start[cfg->idom[b] + 1]++;
+  }
+  for (int b = 0; b < n; b++) ssa->dom_child_start[b + 1] += ssa->dom_child_start[b];
+
+  int* fill = ssa_alloc(n, sizeof(int));
+  for (int b = 1; b < n; b++) {
+    int parent = cfg->idom[b];
+    if (parent < 0) continue;
+    ssa->dom_children[ssa->dom_child_start[parent] + fill[parent]++] = b;
+  }
+  free(fill);
+}
+
+// Dominance frontier of every block, computed by walking up the dominator
+// tree from the predecessors of each join point.
+static IntList* dominance_frontiers(Cfg* cfg) {
+  IntList* frontiers = ssa_alloc(cfg->block_count, sizeof(IntList));
+
+  for (int b = 0; b < cfg->block_count; b++) {
+    BasicBlock* block = &cfg->blocks[b];
+    if (block->pred_count < 2) continue;
+
+    for (int p = 0; p < block->pred_count; p++) {
+      int runner = block->preds[p];
+      while (runner != cfg->idom[b]) {
+        IntList* frontier = &frontiers[runner];
+        if (frontier->len == 0 || frontier->items[frontier->len - 1] != b) {
+          int_list_push(frontier, b);
+        }
+        runner = cfg->idom[runner];
+      }
+    }
+  }
+
+  return frontiers;
+}
+
+/* ----------------------------- Phi insertion ----------------------------- */
+
+static int new_value(SsaForm* ssa, int name, int* version_counter) {
+  int value = ssa->value_count++;
+  ssa->value_name[value] = name;
+  ssa->value_version[value] = ++version_counter[name];
+  ssa->value_instr[value] = -1;
+  ssa->value_phi[value] = -1;
+  return value;
+}
+
+// Inserts phis for the names that are live across blocks (semi-pruned SSA)
+// at the iterated dominance frontier of the blocks defining them.
+static void insert_phis(SsaForm* ssa) {
+  IrProgram* ir = ssa->ir;
+  Cfg* cfg = ssa->cfg;
+  int names = ssa->name_count;
+
+  bool* global = ssa_alloc(names, sizeof(bool));
+  IntList* def_blocks = ssa_alloc(names, sizeof(IntList));
+  int* defined_in = ssa_alloc(names, sizeof(int));
+  for (int n = 0; n < names; n++) defined_in[n] = -1;
+
+  for (int b = 0; b < cfg->block_count; b++) {
+    BasicBlock* block = &cfg->blocks[b];
+    for (int i = block->start; i < block->end; i++) {
+      IrInstr* instr = &ir->instrs[i];
+      for (int k = 0; k < 2; k++) {
+        int name = ssa_name(ir, instr->args[k]);
+        if (name >= 0 && defined_in[name] != b) global[name] = true;
+      }
+
+      int def = ssa_name(ir, instr->dest);
+      if (def >= 0 && defined_in[def] != b) {
+        defined_in[def] = b;
+        int_list_push(&def_blocks[def], b);
+      }
+    }
+  }
+
+  IntList* frontiers = dominance_frontiers(cfg);
+  int* has_phi = ssa_alloc(cfg->block_count, sizeof(int));
+  int* queued = ssa_alloc(cfg->block_count, sizeof(int));
+  for (int b = 0; b < cfg->block_count; b++) has_phi[b] = queued[b] = -1;
+
+  IntList phis = {0};
+  IntList worklist = {0};
+  for (int name = 0; name < names; name++) {
+    if (!global[name]) continue;
+
+    // Every name is implicitly defined (as undefined) in the entry block
+    worklist.len = 0;
+    int_list_push(&worklist, 0);
+    queued[0] = name;
+    for (int i = 0; i < def_blocks[name].len; i++) {
+      int b = def_blocks[name].items[i];
+      if (queued[b] != name) {
+        queued[b] = name;
+        int_list_push(&worklist, b);
+      }
+    }
+
+    while (worklist.len > 0) {
+      int x = worklist.items[--worklist.len];
+      for (int i = 0; i < frontiers[x].len; i++) {
+        int y = frontiers[x].items[i];
+        if (has_phi[y] == name) continue;
+
+        has_phi[y] = name;
+        int_list_push(&phis, name);
+        int_list_push(&phis, y);
+        if (queued[y] != name) {
+          queued[y] = name;
+          int_list_push(&worklist, y);
+        }
+      }
+    }
+  }
+
+  // Group the phis by block
+  ssa->phi_count = phis.len / 2;
+  ssa->phis = ssa_alloc(ssa->phi_count, sizeof(Phi));
+  ssa->block_phis = ssa_alloc(cfg->block_count + 1, sizeof(int));
+  for (int i = 0; i < ssa->phi_count; i++) ssa->block_phis[phis.items[2 * i + 1] + 1]++;
+  for (int b = 0; b < cfg->block_count; b++) ssa->block_phis[b + 1] += ssa->block_phis[b];
+
+  int* fill = ssa_alloc(cfg->block_count, sizeof(int));
+  for (int i = 0; i < ssa->phi_count; i++) {
+    int name = phis.items[2 * i];
+    int block = phis.items[2 * i + 1];
+    Phi* phi = &ssa->phis[ssa->block_phis[block] + fill[block]++];
+    phi->name = name;
+    phi->block = block;
+    phi->dest = -1;
+    phi->args = ssa_alloc(cfg->blocks[block].pred_count, sizeof(int));
+  }
+  free(fill);
+
+  for (int b = 0; b < cfg->block_count; b++) free_int_list(&frontiers[b]);
+  for (int n = 0; n < names; n++) free_int_list(&def_blocks[n]);
+  free_int_list(&phis);
+  free_int_list(&worklist);
+  free(frontiers);
+  free(def_blocks);
+  free(defined_in);
+  free(global);
+  free(has_phi);
+  free(queued);
+}
+
+/* ----------------------------- Renaming ----------------------------- */
+
+typedef struct {
+  SsaScope scope;
+  int* versions;
+} Renamer;
+
+static void rename_block(SsaForm* ssa, Renamer* r, int b) {
+  IrProgram* ir = ssa->ir;
+  BasicBlock* block = &ssa->cfg->blocks[b];
+  int mark = r->scope.pushed.len;
+
+  for (int p = ssa->block_phis[b]; p < ssa->block_phis[b + 1]; p++) {
+    Phi* phi = &ssa->phis[p];
+    phi->dest = new_value(ssa, phi->name, r->versions);
+    ssa->value_phi[phi->dest] = p;
+    ssa_scope_push(&r->scope, phi->name, phi->dest);
+  }
+
+  for (int i = block->start; i < block->end; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    for (int k = 0; k < 2; k++) {
+      int name = ssa_name(ir, instr->args[k]);
+      ssa->use_value[2 * i + k] = name >= 0 ? ssa_scope_current(&r->scope, name) : -1;
+    }
+
+    int def = ssa_name(ir, instr->dest);
+    if (def >= 0) {
+      int value = new_value(ssa, def, r->versions);
+      ssa->value_instr[value] = i;
+      ssa->def_value[i] = value;
+      ssa_scope_push(&r->scope, def, value);
+    }
+  }
+
+  for (int s = 0; s < block->succ_count; s++) {
+    BasicBlock* succ = &ssa->cfg->blocks[block->succs[s]];
+    int pred_index = 0;
+    while (succ->preds[pred_index] != b) pred_index++;
+
+    for (int p = ssa->block_phis[succ->id]; p < ssa->block_phis[succ->id + 1]; p++) {
+      ssa->phis[p].args[pred_index] = ssa_scope_current(&r->scope, ssa->phis[p].name);
+    }
+  }
+
+  for (int c = ssa->dom_child_start[b]; c < ssa->dom_child_start[b + 1]; c++) {
+    rename_block(ssa, r, ssa->dom_children[c]);
+  }
+
+  ssa_scope_pop_to(&r->scope, mark);
+}
+
+/* ----------------------------- Construction ----------------------------- */
+
+SsaForm* build_ssa(IrProgram* ir) {
+  remove_unreachable_blocks(ir);
+
+  SsaForm* ssa = ssa_alloc(1, sizeof(SsaForm));
+  ssa->ir = ir;
+  ssa->cfg = build_cfg(ir);
+  compute_dominators(ssa->cfg);
+  build_dom_tree(ssa);
+
+  ssa->name_count = ir->temp_count + ir->var_count;
+  insert_phis(ssa);
+
+  int max_values = ssa->name_count + ir->len + ssa->phi_count;
+  ssa->value_name = ssa_alloc(max_values, sizeof(int));
+  ssa->value_version = ssa_alloc(max_values, sizeof(int));
+  ssa->value_instr = ssa_alloc(max_values, sizeof(int));
+  ssa->value_phi = ssa_alloc(max_values, sizeof(int));
+  ssa->def_value = ssa_alloc(ir->len, sizeof(int));
+  ssa->use_value = ssa_alloc(2 * ir->len, sizeof(int));
+  for (int i = 0; i < ir->len; i++) ssa->def_value[i] = -1;
+
+  Renamer r = {
+    .scope = alloc_ssa_scope(ssa->name_count),
+    .versions = ssa_alloc(ssa->name_count, sizeof(int)),
+  };
+  for (int name = 0; name < ssa->name_count; name++) {
+    ssa->value_name[name] = name;
+    ssa->value_instr[name] = -1;
+    ssa->value_phi[name] = -1;
+  }
+  ssa->value_count = ssa->name_count;
+
+  if (ssa->cfg->block_count > 0) rename_block(ssa, &r, 0);
+
+  free_ssa_scope(&r.scope);
+  free(r.versions);
+  return ssa;
+}
+
+void free_ssa(SsaForm* ssa) {
+  for (int p = 0; p < ssa->phi_count; p++) free(ssa->phis[p].args);
+  free(ssa->phis);
+  free(ssa->block_phis);
+  free(ssa->def_value);
+  free(ssa->use_value);
+  free(ssa->value_name);
+  free(ssa->value_version);
+  free(ssa->value_instr);
+  free(ssa->value_phi);
+  free(ssa->dom_children);
+  free(ssa->dom_child_start);
+  free_cfg(ssa->cfg);
+  free(ssa);
+}
+
+/* ----------------------------- Printing ----------------------------- */
+
+static void print_value(FILE* out, SsaForm* ssa, int value) {
+  int name = ssa->value_name[value];
+  if (name < ssa->ir->temp_count) {
+    fprintf(out, "t%d", name);
+  } else {
+    fprintf(out, "%s", ssa->ir->vars[name - ssa->ir->temp_count]);
+  }
+  fprintf(out, ".%d", ssa->value_version[value]);
+}
+
+typedef struct {
+  SsaForm* ssa;
+  int instr;
+} SsaPrintCtx;
+
+static void print_ssa_operand(FILE* out, IrProgram* ir, IrOperand* operand, void* data) {
+  SsaPrintCtx* ctx = data;
+  IrInstr* instr = &ir->instrs[ctx->instr];
+
+  int value = -1;
+  if (operand == &instr->dest) value = ctx->ssa->def_value[ctx->instr];
+  else value = ctx->ssa->use_value[2 * ctx->instr + (operand - instr->args)];
+
+  if (value < 0) {
+    fprint_ir_operand(out, ir, *operand);
+  } else {
+    print_value(out, ctx->ssa, value);
+  }
+}
+
+// Prints the IR with every operand renamed to the SSA value it reads or
+// defines (`name.version`, version 0 being undefined) and the phis placed at
+// the start of their block.
+void print_ssa(SsaForm* ssa) {
+  IrProgram* ir = ssa->ir;
+  Cfg* cfg = ssa->cfg;
+
+  for (int b = 0; b < cfg->block_count; b++) {
+    BasicBlock* block = &cfg->blocks[b];
+    printf("# B%d\n", b);
+
+    // Phis go after the block's label
+    int i = block->start;
+    if (ir->instrs[i].op == IR_LABEL) {
+      fprint_ir_instr(stdout, ir, &ir->instrs[i++]);
+      printf("\n");
+    }
+
+    for (int p = ssa->block_phis[b]; p < ssa->block_phis[b + 1]; p++) {
+      Phi* phi = &ssa->phis[p];
+      print_value(stdout, ssa, phi->dest);
+      printf(" = phi(");
+      for (int a = 0; a < block->pred_count; a++) {
+        if (a > 0) printf(", ");
+        print_value(stdout, ssa, phi->args[a]);
+      }
+      printf(")\n");
+    }
+
+    for (; i < block->end; i++) {
+      SsaPrintCtx ctx = { ssa, i };
+      fprint_ir_instr_with(stdout, ir, &ir->instrs[i], print_ssa_operand, &ctx);
+      printf("\n");
+    }
+  }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "cfg.h"
+#include "ir.h"
+
+/*
+ * Static single assignment form of an IR program.
+ *
+ * The SSA form is kept alongside the IR instead of rewriting it: every
+ * definition of a temporary or variable gets a distinct SSA value, every
+ * operand that reads one records which value reaches it, and phis record the
+ * merges at join points. Analyses work on the values and write their results
+ * back into the plain IR.
+ *
+ * Temporaries and variables share one name space: name `t` is temporary `t`,
+ * and name `temp_count + v` is variable `v`. Values `0 .. name_count - 1` are
+ * the undefined values every name holds on entry to the program.
+ */
+
+typedef struct {
+  int name;
+  int block;
+  int dest;
+  int* args; // Value flowing in from each predecessor, in the block's pred order
+} Phi;
+
+typedef struct {
+  IrProgram* ir;
+  Cfg* cfg;
+
+  int name_count;
+  int value_count;
+
+  // Value defined by each instruction, -1 if it does not define one
+  int* def_value;
+  // Value read by operand k of instruction i at index 2 * i + k, -1 if the
+  // operand is not a temporary or a variable
+  int* use_value;
+
+  // Phis grouped by block, the phis of block b are
+  // phis[block_phis[b] .. block_phis[b + 1] - 1]
+  Phi* phis;
+  int phi_count;
+  int* block_phis;
+
+  // Definition of each value: an instruction, a phi, or neither for the
+  // undefined entry values
+  int* value_name;
+  int* value_version;
+  int* value_instr;
+  int* value_phi;
+
+  // Children of each block in the dominator tree, the children of block b
+  // are dom_children[dom_child_start[b] .. dom_child_start[b + 1] - 1]
+  int* dom_children;
+  int* dom_child_start;
+} SsaForm;
+
+SsaForm* build_ssa(IrProgram* ir);
+void free_ssa(SsaForm* ssa);
+void print_ssa(SsaForm* ssa);
+
+// Value held by every name while walking down the dominator tree. Values
+// pushed inside a block are popped again with ssa_scope_pop_to when the walk
+// leaves it.
+typedef struct {
+  IntList* stacks;
+  IntList pushed;
+  int name_count;
+} SsaScope;
+
+SsaScope alloc_ssa_scope(int name_count);
+void free_ssa_scope(SsaScope* scope);
+void ssa_scope_push(SsaScope* scope, int name, int value);
+int ssa_scope_current(SsaScope* scope, int name);
+void ssa_scope_pop_to(SsaScope* scope, int mark);
+
+int ssa_name(IrProgram* ir, IrOperand operand);
+IrOperand ssa_name_operand(IrProgram* ir, int name);
+bool ssa_value_is_undef(SsaForm* ssa, int value);
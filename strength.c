@@ -0,0 +1,224 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "loop.h"
+#include "opt.h"
+#include "datatype99.h"
+
+/*
+ * Strength reduction of induction variables.
+ *
+ * A basic induction variable is a temporary c whose only definition inside a
+ * loop is `c = c + k` (or `c - k`), like the counter of a for loop. A
+ * multiplication `x = c * m` in the loop is replaced by `x = d`, where d is a
+ * new temporary set to `c * m` in the loop's preheader and incremented by
+ * `k * m` right after every update of c.
+ *
+ * Repeated addition only gives the same result as multiplication when no
+ * rounding happens, so c has to start out as a constant integer, k and m
+ * have to be integers, and the loop has to exit on comparing c against a
+ * constant, so that every multiple of m that d steps through, and k * m,
+ * stays within the integers doubles represent exactly.
+ */
+
+#define MAX_EXACT_INTEGER 9007199254740992.0
+
+static bool integral_const(IrOperand operand, double* value) {
+  ifLet(operand, IrConst, constant) {
+    ifLet(*constant, NumberResult, num) {
+      if (*num != floor(*num) || fabs(*num) > MAX_EXACT_INTEGER) return false;
+      *value = *num;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool is_temp(IrOperand operand, int temp) {
+  ifLet(operand, IrTemp, t) return *t == temp;
+  return false;
+}
+
+// Step of the induction variable `c = c + k` or `c = c - k` at `instr`
+static bool induction_step(IrInstr* instr, int c, double* step) {
+  if (!is_temp(instr->dest, c)) return false;
+  if (instr->op == IR_ADD) {
+    if (is_temp(instr->args[0], c) && integral_const(instr->args[1], step)) return true;
+    if (is_temp(instr->args[1], c) && integral_const(instr->args[0], step)) return true;
+  }
+  if (instr->op == IR_SUB && is_temp(instr->args[0], c) && integral_const(instr->args[1], step)) {
+    *step = - *step;
+    return true;
+  }
+  return false;
+}
+
+// Whether the definition at `instr` gives c a constant integer value
+static bool integral_init(IrInstr* instr, double* value) {
+  return instr->op == IR_COPY && integral_const(instr->args[0], value);
+}
+
+// Factor m of `x = c * m` at `instr`, if it multiplies c by an integer
+static bool derived_factor(IrInstr* instr, int c, double* factor) {
+  if (instr->op != IR_MUL) return false;
+  if (is_temp(instr->args[0], c) && integral_const(instr->args[1], factor)) return true;
+  return is_temp(instr->args[1], c) && integral_const(instr->args[0], factor);
+}
+
+static IrOpcode swapped_relop(IrOpcode relop) {
+  switch (relop) {
+    case IR_LT: return IR_GT;
+    case IR_LTE: return IR_GTE;
+    case IR_GT: return IR_LT;
+    case IR_GTE: return IR_LTE;
+    default: return relop;
+  }
+}
+
+static IrOpcode negated_relop(IrOpcode relop) {
+  switch (relop) {
+    case IR_LT: return IR_GTE;
+    case IR_LTE: return IR_GT;
+    case IR_GT: return IR_LTE;
+    case IR_GTE: return IR_LT;
+    default: return IR_EQ;
+  }
+}
+
+// Largest magnitude of the constant c is compared against by the branch that
+// ends the header of `loop`, when the loop only keeps running while c has not
+// gone past it in the direction of `step`
+static bool exit_bound(IrProgram* ir, Cfg* cfg, Loop* loop, int c, double step, double* bound) {
+  BasicBlock* header = &cfg->blocks[loop->header];
+  IrInstr* branch = &ir->instrs[header->end - 1];
+  if (branch->op != IR_IF_CMP && branch->op != IR_IF_NOT_CMP) return false;
+
+  IrOpcode relop = branch->relop;
+  if (is_temp(branch->args[1], c) && integral_const(branch->args[0], bound)) {
+    relop = swapped_relop(relop);
+  } else if (!is_temp(branch->args[0], c) || !integral_const(branch->args[1], bound)) {
+    return false;
+  }
+
+  // The comparison that keeps the loop running
+  int target = cfg->label_block[branch->label];
+  int next = header->end < ir->len ? cfg->instr_block[header->end] : -1;
+  bool target_inside = target >= 0 && loop->blocks[target];
+  bool next_inside = next >= 0 && loop->blocks[next];
+  if (target_inside == next_inside) return false;
+  if ((branch->op == IR_IF_NOT_CMP) == target_inside) relop = negated_relop(relop);
+
+  *bound = fabs(*bound);
+  if (step > 0) return relop == IR_LT || relop == IR_LTE;
+  return relop == IR_GT || relop == IR_GTE;
+}
+
+// Strength reduces one multiplication of an induction variable of `loop`
+// (and every other multiplication by the same factor). Returns whether the
+// program changed.
+static bool reduce_loop(IrProgram* ir, Cfg* cfg, Loop* loop) {
+  int* inside_defs = calloc(ir->temp_count + 1, sizeof(int));
+  int* inside_def = calloc(ir->temp_count + 1, sizeof(int));
+  double* init_bound = calloc(ir->temp_count + 1, sizeof(double));
+  bool* bad_init = calloc(ir->temp_count + 1, sizeof(bool));
+  bool* dominating_init = calloc(ir->temp_count + 1, sizeof(bool));
+  ensure_non_null(inside_defs, "out of space");
+  ensure_non_null(inside_def, "out of space");
+  ensure_non_null(init_bound, "out of space");
+  ensure_non_null(bad_init, "out of space");
+  ensure_non_null(dominating_init, "out of space");
+
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    double value;
+    ifLet(instr->dest, IrTemp, temp) {
+      if (loop_contains_instr(cfg, loop, i)) {
+        inside_defs[*temp]++;
+        inside_def[*temp] = i;
+      } else if (!integral_init(instr, &value)) {
+        bad_init[*temp] = true;
+      } else {
+        init_bound[*temp] = fmax(init_bound[*temp], fabs(value));
+        if (dominates(cfg, cfg->instr_block[i], loop->header)) dominating_init[*temp] = true;
+      }
+    }
+  }
+
+  int c = -1, update;
+  double step = 0, factor = 0;
+  for (int i = 0; i < ir->len && c < 0; i++) {
+    if (!loop_contains_instr(cfg, loop, i)) continue;
+
+    for (int k = 0; k < 2 && c < 0; k++) {
+      ifLet(ir->instrs[i].args[k], IrTemp, temp) {
+        int t = *temp;
+        if (inside_defs[t] != 1 || bad_init[t] || !dominating_init[t]) continue;
+        if (!induction_step(&ir->instrs[inside_def[t]], t, &step)) continue;
+        if (!derived_factor(&ir->instrs[i], t, &factor)) continue;
+
+        // Products rounded up to 2^53 may have been above it, so it is excluded
+        double bound;
+        if (!exit_bound(ir, cfg, loop, t, step, &bound)) continue;
+        double largest = fmax(init_bound[t], bound + fabs(step));
+        if (largest * fabs(factor) >= MAX_EXACT_INTEGER || fabs(step * factor) >= MAX_EXACT_INTEGER) continue;
+        c = t;
+      }
+    }
+  }
+
+  free(inside_defs);
+  free(inside_def);
+  free(init_bound);
+  free(bad_init);
+  free(dominating_init);
+  if (c < 0) return false;
+
+  // Replace every `x = c * factor` in the loop by `x = d`
+  int d = ir_new_temp(ir);
+  for (int i = 0; i < ir->len; i++) {
+    double m;
+    IrInstr* instr = &ir->instrs[i];
+    if (!loop_contains_instr(cfg, loop, i) || !derived_factor(instr, c, &m) || m != factor) continue;
+
+    if (opt_verbose) {
+      fprintf(stderr, "strength-reduce: ");
+      fprint_ir_instr(stderr, ir, instr);
+      fprintf(stderr, "\n");
+    }
+    *instr = ir_instr(IR_COPY, instr->dest, IrTemp(d), IrNone());
+  }
+
+  int at = insert_preheader(ir, cfg, loop);
+  ir_insert(ir, at, ir_instr(IR_MUL, IrTemp(d), IrTemp(c), IrConst(NumberResult(factor))));
+
+  // Instructions moved, but the update is still the only `c = c + k`
+  for (update = 0; !induction_step(&ir->instrs[update], c, &step); update++);
+  IrInstr increment = ir_instr(IR_ADD, IrTemp(d), IrTemp(d), IrConst(NumberResult(step * factor)));
+  ir_insert(ir, update + 1, increment);
+  return true;
+}
+
+int strength_reduce(IrProgram* ir) {
+  int changed = 0;
+
+  for (bool progress = true; progress;) {
+    progress = false;
+    remove_unreachable_blocks(ir);
+    Cfg* cfg = build_cfg(ir);
+    LoopList loops = find_loops(cfg);
+
+    for (int l = 0; l < loops.count && !progress; l++) {
+      progress = reduce_loop(ir, cfg, &loops.loops[l]);
+    }
+
+    free_loops(&loops);
+    free_cfg(cfg);
+    if (progress) changed++;
+  }
+
+  return changed;
+}
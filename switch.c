@@ -0,0 +1,127 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "switch.h"
+#include "datatype99.h"
+
+// Constant compared against a variable by `condition`, when it has the form
+// `ident == constant`
+static bool case_condition(Condition* condition, char** ident, ExprResult* key) {
+  ifLet(*condition, IdentExpression, iexpr) {
+    ifLet(**iexpr, IdentBinaryExpr, name, op, lexpr) {
+      if (*op != IdentBOp_EqEq) return false;
+      *ident = *name;
+
+      match (**lexpr) {
+        of(ArithmeticExpr, aexpr) *key = NumberResult(eval_aexpr(*aexpr));
+        of(BooleanExpr, bexpr) *key = BooleanResult(eval_bexpr(*bexpr));
+        of(StringExpr, sexpr) {
+          // Only plain strings, which the syntax tree owns
+          ifLet(**sexpr, String, str) {
+            *key = StringResult(*str);
+            return true;
+          }
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+static int compare_keys(ExprResult a, ExprResult b) {
+  if (a.tag != b.tag) return a.tag < b.tag ? -1 : 1;
+
+  match (a) {
+    of(BooleanResult, boolean) return (int)*boolean - (int)b.data.BooleanResult._0;
+    of(NumberResult, num) {
+      double other = b.data.NumberResult._0;
+      return *num < other ? -1 : *num > other ? 1 : 0;
+    }
+    of(StringResult, str) return strcmp(*str, b.data.StringResult._0);
+  }
+  return 0;
+}
+
+static int compare_cases(const void* a, const void* b) {
+  const SwitchCase* x = a;
+  const SwitchCase* y = b;
+  int order = compare_keys(x->key, y->key);
+  return order != 0 ? order : x->arm - y->arm;
+}
+
+// Builds the dispatch table of an if statement, or returns NULL when its
+// conditions do not all compare the same variable against a constant
+SwitchTable* build_switch_table(Condition* condition, TrueStatements* true_stmts, ElseIfStatement* else_if) {
+  int arm_count = 1;
+  for (ElseIfStatement* e = else_if; e; e = e->next) arm_count++;
+  if (arm_count < SWITCH_MIN_CASES) return NULL;
+
+  SwitchTable* table = calloc(1, sizeof(SwitchTable));
+  ensure_non_null(table, "out of space");
+  table->cases = malloc(arm_count * sizeof(SwitchCase));
+  table->arms = malloc(arm_count * sizeof(StatementList*));
+  ensure_non_null(table->cases, "out of space");
+  ensure_non_null(table->arms, "out of space");
+  table->arm_count = arm_count;
+
+  ElseIfStatement* e = else_if;
+  for (int arm = 0; arm < arm_count; arm++) {
+    Condition* cond = arm == 0 ? condition : e->condition;
+    table->arms[arm] = arm == 0 ? true_stmts : e->true_stmts;
+    if (arm > 0) e = e->next;
+
+    char* ident;
+    ExprResult key;
+    if (!case_condition(cond, &ident, &key) || (table->ident && strcmp(ident, table->ident) != 0)) {
+      free_switch_table(table);
+      return NULL;
+    }
+    table->ident = ident;
+
+    // NaN is never equal to anything, so its arm can never run
+    if (MATCHES(key, NumberResult) && isnan(key.data.NumberResult._0)) continue;
+    table->cases[table->count++] = (SwitchCase){ .key = key, .arm = arm };
+  }
+
+  if (table->count > 0) qsort(table->cases, table->count, sizeof(SwitchCase), compare_cases);
+  int count = 0;
+  for (int i = 0; i < table->count; i++) {
+    if (count > 0 && compare_keys(table->cases[count - 1].key, table->cases[i].key) == 0) continue;
+    table->cases[count++] = table->cases[i];
+  }
+  table->count = count;
+  return table;
+}
+
+// Arm whose condition is the first one `value` satisfies, -1 for none
+int switch_table_lookup(SwitchTable* table, ExprResult value) {
+  if (MATCHES(value, NumberResult) && isnan(value.data.NumberResult._0)) return -1;
+
+  int lo = 0, hi = table->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int order = compare_keys(value, table->cases[mid].key);
+    if (order == 0) return table->cases[mid].arm;
+    if (order < 0) hi = mid;
+    else lo = mid + 1;
+  }
+  return -1;
+}
+
+// Whether every constant in the table is a number
+bool switch_table_numeric(SwitchTable* table) {
+  for (int i = 0; i < table->count; i++) {
+    if (!MATCHES(table->cases[i].key, NumberResult)) return false;
+  }
+  return true;
+}
+
+void free_switch_table(SwitchTable* table) {
+  if (!table) return;
+  free(table->cases);
+  free(table->arms);
+  free(table);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ast.h"
+
+/*
+ * Dispatch tables for if statements that compare one variable against
+ * constants, like
+ *
+ *   if mode == 1 then ... else if mode == 2 then ... else if mode == 3 then
+ *
+ * The constants are sorted, so the arm to run is found with a binary search
+ * instead of by testing every condition in turn. Comparing for equality never
+ * fails and values of different types are never equal, so the search picks
+ * the same arm as the chain of tests would.
+ */
+
+// Chains with fewer conditions than this are left as they are
+#define SWITCH_MIN_CASES 4
+
+typedef struct {
+  ExprResult key;
+  int arm;  // 0 for the then clause, k for the k-th else if
+} SwitchCase;
+
+struct SwitchTable {
+  char* ident;
+
+  // One case per distinct constant, sorted by type and then by value. A
+  // constant tested twice runs the first arm testing it.
+  SwitchCase* cases;
+  int count;
+
+  // Statements of every arm
+  StatementList** arms;
+  int arm_count;
+};
+
+SwitchTable* build_switch_table(Condition* condition, TrueStatements* true_stmts, ElseIfStatement* else_if);
+int switch_table_lookup(SwitchTable* table, ExprResult value);
+bool switch_table_numeric(SwitchTable* table);
+void free_switch_table(SwitchTable* table);
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include "ast.h"
+#include "tape.h"
+#include "datatype99.h"
+
+typedef struct {
+  ExprTape* tape;
+  int depth;
+  int max_depth;
+} TapeBuilder;
+
+// Every node of the tree becomes one instruction
+static int aexpr_size(ArithExpr* ast) {
+  match (*ast) {
+    of(BinaryAExpr, left, _, right) return 1 + aexpr_size(*left) + aexpr_size(*right);
+    of(UnaryAExpr, _, right) return 1 + aexpr_size(*right);
+    of(Number, _) return 1;
+  }
+  return 0;
+}
+
+static int bexpr_size(BoolExpr* ast) {
+  match (*ast) {
+    of(RelationalArithExpr, left, _, right) return 1 + aexpr_size(*left) + aexpr_size(*right);
+    of(LogicalBoolExpr, left, _, right) return 1 + bexpr_size(*left) + bexpr_size(*right);
+    of(NegatedBoolExpr, bexpr) return 1 + bexpr_size(*bexpr);
+    of(Boolean, _) return 1;
+  }
+  return 0;
+}
+
+// Appends an instruction changing the depth of the stack by `effect`, and
+// returns its index
+static int emit(TapeBuilder* b, TapeInstr instr, int effect) {
+  b->depth += effect;
+  if (b->depth > b->max_depth) b->max_depth = b->depth;
+  b->tape->code[b->tape->length] = instr;
+  return b->tape->length++;
+}
+
+static void emit_aexpr(TapeBuilder* b, ArithExpr* ast) {
+  match (*ast) {
+    of(BinaryAExpr, left, op, right) {
+      emit_aexpr(b, *left);
+      emit_aexpr(b, *right);
+      switch (*op) {
+        case BinaryOp_Add: emit(b, (TapeInstr){ .op = TAPE_ADD }, -1); break;
+        case BinaryOp_Sub: emit(b, (TapeInstr){ .op = TAPE_SUB }, -1); break;
+        case BinaryOp_Mul: emit(b, (TapeInstr){ .op = TAPE_MUL }, -1); break;
+        case BinaryOp_Div: emit(b, (TapeInstr){ .op = TAPE_DIV }, -1); break;
+      }
+    }
+    of(UnaryAExpr, op, right) {
+      emit_aexpr(b, *right);
+      switch (*op) {
+        case UnaryOp_Minus: emit(b, (TapeInstr){ .op = TAPE_NEG }, 0); break;
+      }
+    }
+    of(Number, num) emit(b, (TapeInstr){ .op = TAPE_NUMBER, .number = *num }, 1);
+  }
+}
+
+static void emit_bexpr(TapeBuilder* b, BoolExpr* ast) {
+  match (*ast) {
+    of(RelationalArithExpr, left, relop, right) {
+      emit_aexpr(b, *left);
+      emit_aexpr(b, *right);
+      switch (*relop) {
+        case RelationalEqual: emit(b, (TapeInstr){ .op = TAPE_EQ }, -1); break;
+        case Greater:         emit(b, (TapeInstr){ .op = TAPE_GT }, -1); break;
+        case GreaterOrEqual:  emit(b, (TapeInstr){ .op = TAPE_GTE }, -1); break;
+        case Less:            emit(b, (TapeInstr){ .op = TAPE_LT }, -1); break;
+        case LessOrEqual:     emit(b, (TapeInstr){ .op = TAPE_LTE }, -1); break;
+      }
+    }
+    of(LogicalBoolExpr, left, logicalop, right) {
+      emit_bexpr(b, *left);
+      if (*logicalop == LogicalEqual) {
+        emit_bexpr(b, *right);
+        emit(b, (TapeInstr){ .op = TAPE_LOGICAL_EQ }, -1);
+        return;
+      }
+
+      // Falling through pops the left operand, which the right one replaces
+      TapeOp op = *logicalop == And ? TAPE_AND : TAPE_OR;
+      int jump = emit(b, (TapeInstr){ .op = op }, -1);
+      emit_bexpr(b, *right);
+      b->tape->code[jump].target = b->tape->length;
+    }
+    of(NegatedBoolExpr, bexpr) {
+      emit_bexpr(b, *bexpr);
+      emit(b, (TapeInstr){ .op = TAPE_NOT }, 0);
+    }
+    of(Boolean, boolean) emit(b, (TapeInstr){ .op = TAPE_BOOLEAN, .boolean = *boolean }, 1);
+  }
+}
+
+static ExprTape* alloc_tape(int size) {
+  ExprTape* tape = calloc(1, sizeof(ExprTape));
+  ensure_non_null(tape, "out of space");
+  tape->code = malloc(size * sizeof(TapeInstr));
+  ensure_non_null(tape->code, "out of space");
+  return tape;
+}
+
+static ExprTape* finish_tape(TapeBuilder* b) {
+  if (b->max_depth <= TAPE_STACK_SIZE) return b->tape;
+  free_expr_tape(b->tape);
+  return NULL;
+}
+
+// Flattens the tree of an expression, or returns NULL when evaluating it
+// needs more than TAPE_STACK_SIZE values on the stack
+ExprTape* build_aexpr_tape(ArithExpr* ast) {
+  TapeBuilder b = { .tape = alloc_tape(aexpr_size(ast)) };
+  emit_aexpr(&b, ast);
+  return finish_tape(&b);
+}
+
+ExprTape* build_bexpr_tape(BoolExpr* ast) {
+  TapeBuilder b = { .tape = alloc_tape(bexpr_size(ast)) };
+  emit_bexpr(&b, ast);
+  return finish_tape(&b);
+}
+
+typedef union {
+  double number;
+  bool boolean;
+} TapeValue;
+
+// Runs the tape, leaving the value of the expression at the bottom of `stack`.
+// `top` points past the value on top of the stack.
+static void run_tape(ExprTape* tape, TapeValue* stack) {
+  TapeValue* top = stack;
+  TapeInstr* code = tape->code;
+  int pc = 0;
+
+  while (pc < tape->length) {
+    TapeInstr* instr = &code[pc++];
+    switch (instr->op) {
+      case TAPE_NUMBER: (top++)->number = instr->number; break;
+      case TAPE_BOOLEAN: (top++)->boolean = instr->boolean; break;
+
+      case TAPE_ADD: top--; top[-1].number += top->number; break;
+      case TAPE_SUB: top--; top[-1].number -= top->number; break;
+      case TAPE_MUL: top--; top[-1].number *= top->number; break;
+      case TAPE_DIV: top--; top[-1].number /= top->number; break;
+      case TAPE_NEG: top[-1].number = - top[-1].number; break;
+
+      case TAPE_EQ:  top--; top[-1].boolean = top[-1].number == top->number; break;
+      case TAPE_GT:  top--; top[-1].boolean = top[-1].number >  top->number; break;
+      case TAPE_GTE: top--; top[-1].boolean = top[-1].number >= top->number; break;
+      case TAPE_LT:  top--; top[-1].boolean = top[-1].number <  top->number; break;
+      case TAPE_LTE: top--; top[-1].boolean = top[-1].number <= top->number; break;
+
+      case TAPE_LOGICAL_EQ: top--; top[-1].boolean = top[-1].boolean == top->boolean; break;
+      case TAPE_NOT: top[-1].boolean = !top[-1].boolean; break;
+
+      case TAPE_AND:
+        if (!top[-1].boolean) pc = instr->target;
+        else top--;
+        break;
+      case TAPE_OR:
+        if (top[-1].boolean) pc = instr->target;
+        else top--;
+        break;
+    }
+  }
+}
+
+double run_aexpr_tape(ExprTape* tape) {
+  TapeValue stack[TAPE_STACK_SIZE];
+  run_tape(tape, stack);
+  return stack[0].number;
+}
+
+bool run_bexpr_tape(ExprTape* tape) {
+  TapeValue stack[TAPE_STACK_SIZE];
+  run_tape(tape, stack);
+  return stack[0].boolean;
+}
+
+void free_expr_tape(ExprTape* tape) {
+  if (!tape) return;
+  free(tape->code);
+  free(tape);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "ast.h"
+
+/*
+ * Postfix tapes for arithmetic and boolean literal expressions.
+ *
+ * The tree of every such expression is flattened at parse time into a tape
+ * of instructions that push constants and apply operators to the values on
+ * top of a stack, so the tree walking evaluator runs one loop over an array
+ * instead of recursing through the tree. Like the tree, && and || skip their
+ * right operand when the left one decides the result.
+ */
+
+// Expressions needing a deeper stack than this keep no tape, and are
+// evaluated by recursing through their tree
+#define TAPE_STACK_SIZE 32
+
+typedef enum {
+  TAPE_NUMBER,
+  TAPE_BOOLEAN,
+
+  TAPE_ADD,
+  TAPE_SUB,
+  TAPE_MUL,
+  TAPE_DIV,
+  TAPE_NEG,
+
+  TAPE_EQ,
+  TAPE_GT,
+  TAPE_GTE,
+  TAPE_LT,
+  TAPE_LTE,
+
+  TAPE_LOGICAL_EQ,
+  TAPE_NOT,
+
+  // Jump to `target` leaving the boolean on top of the stack when it is false
+  // for &&, true for ||, and pop it otherwise
+  TAPE_AND,
+  TAPE_OR,
+} TapeOp;
+
+typedef struct {
+  TapeOp op;
+  union {
+    double number;
+    bool boolean;
+    int target;
+  };
+} TapeInstr;
+
+struct ExprTape {
+  TapeInstr* code;
+  int length;
+};
+
+ExprTape* build_aexpr_tape(ArithExpr* ast);
+ExprTape* build_bexpr_tape(BoolExpr* ast);
+double run_aexpr_tape(ExprTape* tape);
+bool run_bexpr_tape(ExprTape* tape);
+void free_expr_tape(ExprTape* tape);
@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ast.h"
+#include "closure.h"
+#include "jit.h"
+#include "opt.h"
+#include "switch.h"
+#include "tier.h"
+#include "datatype99.h"
+
+atomic_bool tier_ready;
+
+static StatementList* program;
+static Closure* compiled;
+static pthread_t compiler;
+static bool started;
+
+// Closures of the statements, by address of the statement, filled in on the
+// main thread at the first switch
+typedef struct {
+  Stmt* stmt;
+  Closure* closure;
+} TierEntry;
+
+static TierEntry* table;
+static size_t table_size;
+
+static void* compile_program(void* arg) {
+  (void)arg;
+  compiled = compile_stmt_list(program);
+  atomic_store_explicit(&tier_ready, true, memory_order_release);
+  return NULL;
+}
+
+// Starts compiling `program` in the background. Without threads the
+// program only runs in the tree walking evaluator.
+void tier_start(StatementList* stmts) {
+  program = stmts;
+  started = pthread_create(&compiler, NULL, compile_program, NULL) == 0;
+  if (!started && opt_verbose) fprintf(stderr, "tier: could not start the compiler thread\n");
+}
+
+static size_t slot_of(Stmt* stmt) {
+  return ((uintptr_t)stmt >> 4) % table_size;
+}
+
+static void insert(Closure* c) {
+  size_t s = slot_of(c->stmt);
+  while (table[s].stmt) s = (s + 1) % table_size;
+  table[s] = (TierEntry){ c->stmt, c };
+}
+
+static size_t count_stmts(Closure* c) {
+  size_t count = 0;
+  for (; c; c = c->next) {
+    count += c->stmt != NULL;
+    count += count_stmts(c->body) + count_stmts(c->orelse);
+    for (int arm = 0; c->arms && arm < c->table->arm_count; arm++) count += count_stmts(c->arms[arm]);
+  }
+  return count;
+}
+
+// Records the closure of every statement, and gives loops the JIT state the
+// tree walking evaluator has been counting their iterations in
+static void add_stmts(Closure* c) {
+  for (; c; c = c->next) {
+    if (c->stmt) {
+      insert(c);
+      if (MATCHES(*c->stmt, WhileStmt) || MATCHES(*c->stmt, ForStmt)) c->jit = jit_loop(c->stmt);
+    }
+    add_stmts(c->body);
+    add_stmts(c->orelse);
+    for (int arm = 0; c->arms && arm < c->table->arm_count; arm++) add_stmts(c->arms[arm]);
+  }
+}
+
+static Closure* closure_of(Stmt* stmt, const char* where) {
+  if (!table) {
+    if (opt_verbose) fprintf(stderr, "tier: switching to closures at a %s\n", where);
+    table_size = 2 * count_stmts(compiled) + 1;
+    table = calloc(table_size, sizeof(TierEntry));
+    ensure_non_null(table, "out of space");
+    add_stmts(compiled);
+  }
+
+  for (size_t s = slot_of(stmt); table[s].stmt; s = (s + 1) % table_size) {
+    if (table[s].stmt == stmt) return table[s].closure;
+  }
+  unreachable("closure_of");
+  return NULL;
+}
+
+// Runs `stmt` and the statements after it in its list
+void tier_run(Stmt* stmt) {
+  run_closure(closure_of(stmt, "statement boundary"));
+}
+
+// Runs the rest of a while loop from its back edge
+void tier_resume_while(Stmt* loop) {
+  Closure* c = closure_of(loop, "loop back edge");
+  c->fn.exec(c);
+}
+
+// Runs the rest of a for loop from its back edge, where the loop variable
+// is `next` in the next iteration
+void tier_resume_for(Stmt* loop, int64_t next, int64_t last) {
+  run_for_iterations(closure_of(loop, "loop back edge"), next, last);
+}
+
+// Stops the compiler thread, which only has to finish the statement it is
+// compiling when the program ended before the closures were ready, and frees
+// the closures
+void tier_finish(void) {
+  atomic_store(&compile_cancelled, true);
+  if (started) pthread_join(compiler, NULL);
+  free_closure(compiled);
+  free(table);
+  compiled = NULL;
+  table = NULL;
+  started = false;
+  atomic_store(&tier_ready, false);
+  atomic_store(&compile_cancelled, false);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "ast.h"
+
+/*
+ * Tiered execution.
+ *
+ * The program starts right away in the tree walking evaluator, while a
+ * background thread compiles it to closures. Once they are ready the
+ * evaluator switches over at the next statement boundary or loop back edge:
+ * it runs the closures of the rest of the statement list, or of the rest of
+ * the loop, and every statement list further up the stack does the same
+ * when control gets back to it. Both tiers read and write the same symbol
+ * table, so the values of the variables carry over as they are.
+ *
+ * Loops keep their JIT state across the switch, and hot loops are still
+ * compiled to machine code in the closure tier.
+ */
+
+// Set once the closures are ready
+extern atomic_bool tier_ready;
+
+void tier_start(StatementList* program);
+void tier_run(Stmt* stmt);
+void tier_resume_while(Stmt* loop);
+void tier_resume_for(Stmt* loop, int64_t next, int64_t last);
+void tier_finish(void);
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "cfg.h"
+#include "ir.h"
+#include "opt.h"
+#include "datatype99.h"
+
+/*
+ * Lowering to typed intermediate code.
+ *
+ * A forward data flow analysis finds the type of every variable and
+ * temporary at every instruction. Each instruction whose operands must all
+ * have one type for it to succeed is then replaced by the typed instruction
+ * for that type. When an operand's type is not known, an IR_CHECK_* before
+ * the typed instruction raises the error the untyped one would have raised
+ * for any other type, and after it the operand is known to have the type.
+ *
+ * Instructions that can not be given a single type stay untyped: additions
+ * where neither operand's type is known, equality tests between values not
+ * known to have the same type, and instructions whose operands are known to
+ * have types they always fail on.
+ */
+
+typedef struct {
+  IrProgram* ir;
+
+  // Slot of the type of each variable, followed by each temporary. Variables
+  // and temporaries that can carry a value from one block to another come
+  // first, in the `shared` slots kept for the entry of every block. A
+  // temporary only used in the block that defines it, after defining it, gets
+  // one of the other slots, which blocks reuse.
+  int* slot_of;
+  int shared;
+  int slots;
+} Typer;
+
+static IrType join(IrType a, IrType b) {
+  if (a == IR_TYPE_NONE) return b;
+  if (b == IR_TYPE_NONE || a == b) return a;
+  return IR_TYPE_ANY;
+}
+
+static bool is_known(IrType type) {
+  return type != IR_TYPE_NONE && type != IR_TYPE_ANY;
+}
+
+// Slot of the type of a variable or temporary, -1 for other operands
+static int slot(Typer* t, IrOperand operand) {
+  match (operand) {
+    of(IrVar, var) return t->slot_of[*var];
+    of(IrTemp, temp) return t->slot_of[t->ir->var_count + *temp];
+    otherwise return -1;
+  }
+  return -1;
+}
+
+static IrType operand_type(Typer* t, IrType* state, IrOperand operand) {
+  match (operand) {
+    of(IrConst, value) return ir_result_type(*value);
+    of(IrNone) return IR_TYPE_NONE;
+    otherwise return state[slot(t, operand)];
+  }
+  return IR_TYPE_ANY;
+}
+
+static IrOpcode typed_op(IrOpcode op, IrType type) {
+  switch (type) {
+    case IR_TYPE_NUMBER:
+      switch (op) {
+        case IR_ADD: return IR_FADD;
+        case IR_SUB: return IR_FSUB;
+        case IR_MUL: return IR_FMUL;
+        case IR_DIV: return IR_FDIV;
+        case IR_NEG: return IR_FNEG;
+        case IR_EQ: return IR_FEQ;
+        case IR_GT: return IR_FGT;
+        case IR_GTE: return IR_FGTE;
+        case IR_LT: return IR_FLT;
+        case IR_LTE: return IR_FLTE;
+        default: return op;
+      }
+    case IR_TYPE_BOOLEAN:
+      switch (op) {
+        case IR_AND: return IR_BAND;
+        case IR_OR: return IR_BOR;
+        case IR_NOT: return IR_BNOT;
+        case IR_EQ: return IR_BEQ;
+        default: return op;
+      }
+    case IR_TYPE_STRING:
+      switch (op) {
+        case IR_ADD: return IR_CONCAT;
+        case IR_EQ: return IR_STREQ;
+        default: return op;
+      }
+    default:
+      return op;
+  }
+}
+
+// Type every operand of the untyped `op` must have for it to succeed, given
+// the types of its operands, or IR_TYPE_NONE when it has no single one
+static IrType required_type(IrOpcode op, IrType a, IrType b) {
+  switch (op) {
+    case IR_ADD:
+      if (is_known(a) && a != IR_TYPE_BOOLEAN) return a;
+      if (is_known(b) && b != IR_TYPE_BOOLEAN) return b;
+      return IR_TYPE_NONE;
+    case IR_SUB: case IR_MUL: case IR_DIV: case IR_NEG:
+    case IR_GT: case IR_GTE: case IR_LT: case IR_LTE:
+    case IR_TRUNC: case IR_FOR_TRIP:
+      return IR_TYPE_NUMBER;
+    case IR_AND: case IR_OR: case IR_NOT: case IR_IF: case IR_IF_NOT:
+      return IR_TYPE_BOOLEAN;
+    case IR_EQ:
+      return is_known(a) && a == b ? a : IR_TYPE_NONE;
+    default:
+      return IR_TYPE_NONE;
+  }
+}
+
+// Type of the value the untyped or typed `op` computes
+static IrType result_type(IrOpcode op, IrType a, IrType b) {
+  switch (op) {
+    case IR_COPY: return a;
+    case IR_ADD: return is_known(a) && a == b ? a : IR_TYPE_ANY;
+    case IR_CONCAT: return IR_TYPE_STRING;
+    case IR_SUB: case IR_MUL: case IR_DIV: case IR_NEG: case IR_TRUNC: case IR_FOR_TRIP:
+    case IR_FADD: case IR_FSUB: case IR_FMUL: case IR_FDIV: case IR_FNEG:
+      return IR_TYPE_NUMBER;
+    default:
+      return IR_TYPE_BOOLEAN;
+  }
+}
+
+static void narrow(Typer* t, IrType* state, IrOperand operand, IrType type) {
+  int s = slot(t, operand);
+  if (s >= 0) state[s] = type;
+}
+
+// Applies `instr` to the types in `state`. When `out` is given, appends the
+// typed instruction to it, after the check it needs if any, and returns the
+// number of instructions typed.
+static int type_instr(Typer* t, IrType* state, IrInstr instr, IrProgram* out) {
+  bool branch = ir_is_cond_branch(instr.op);
+  IrOpcode op = ir_is_cmp_branch(instr.op) ? instr.relop : instr.op;
+  bool checks_if = instr.op == IR_IF || instr.op == IR_IF_NOT;
+  if (instr.op == IR_LABEL || instr.op == IR_GOTO || instr.op == IR_DISPLAY || ir_is_check(instr.op)) {
+    if (out) ir_emit(out, instr);
+    if (ir_is_check(instr.op)) {
+      narrow(t, state, instr.args[0], ir_operand_type(instr.op));
+      if (ir_is_binary(instr.relop)) narrow(t, state, instr.args[1], ir_operand_type(instr.op));
+    }
+    return 0;
+  }
+
+  bool binary = ir_is_binary(op) || ir_is_cmp_branch(instr.op);
+  IrType a = operand_type(t, state, instr.args[0]);
+  IrType b = binary ? operand_type(t, state, instr.args[1]) : a;
+  IrType type = ir_is_typed(op) ? IR_TYPE_NONE : required_type(op, a, b);
+
+  // Operands known to have another type make the instruction fail
+  bool fails = is_known(type) && ((is_known(a) && a != type) || (is_known(b) && b != type));
+  bool typed = is_known(type) && !fails;
+  int changed = 0;
+
+  if (typed) {
+    if (a != type || b != type) {
+      IrOpcode check = type == IR_TYPE_NUMBER ? IR_CHECK_NUMBER
+        : type == IR_TYPE_BOOLEAN ? IR_CHECK_BOOLEAN : IR_CHECK_STRING;
+      IrInstr checked = ir_instr(check, IrNone(), instr.args[0], binary ? instr.args[1] : IrNone());
+      checked.relop = checks_if ? IR_IF : op;
+      if (out) {
+        for (int k = 0; k < 2; k++) {
+          ifLet(checked.args[k], IrConst, constant) checked.args[k] = IrConst(ir_copy_result(*constant));
+        }
+        ir_emit(out, checked);
+        if (opt_verbose) {
+          fprintf(stderr, "typing: ");
+          fprint_ir_instr(stderr, t->ir, &checked);
+          fprintf(stderr, "\n");
+        }
+      }
+    }
+
+    narrow(t, state, instr.args[0], type);
+    if (binary) narrow(t, state, instr.args[1], type);
+    a = b = type;
+
+    IrOpcode specialized = typed_op(op, type);
+    if (specialized != op) {
+      if (branch) instr.relop = specialized;
+      else instr.op = specialized;
+      changed++;
+    }
+  }
+
+  if (!branch) {
+    int s = slot(t, instr.dest);
+    if (s >= 0) state[s] = result_type(ir_is_typed(instr.op) ? instr.op : op, a, b);
+  }
+  if (out) ir_emit(out, instr);
+  return changed;
+}
+
+static bool join_into(IrType* into, IrType* from, int slots) {
+  bool changed = false;
+  for (int s = 0; s < slots; s++) {
+    IrType joined = join(into[s], from[s]);
+    if (joined != into[s]) {
+      into[s] = joined;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Splits the variables and temporaries of `ir` into the shared and local
+// slots of `t`
+static void assign_slots(Typer* t, Cfg* cfg) {
+  IrProgram* ir = t->ir;
+  int count = ir->var_count + ir->temp_count;
+  int* block_of = malloc((count + 1) * sizeof(int));
+  bool* shared = calloc(count + 1, sizeof(bool));
+  t->slot_of = malloc((count + 1) * sizeof(int));
+  ensure_non_null(block_of, "out of space");
+  ensure_non_null(shared, "out of space");
+  ensure_non_null(t->slot_of, "out of space");
+
+  for (int v = 0; v < count; v++) block_of[v] = -1;
+  for (int v = 0; v < ir->var_count; v++) shared[v] = true;
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr* instr = &ir->instrs[i];
+    int b = cfg->instr_block[i];
+    for (int k = 0; k < 2; k++) {
+      ifLet(instr->args[k], IrTemp, temp) {
+        int v = ir->var_count + *temp;
+        if (block_of[v] != b) shared[v] = true;
+      }
+    }
+    ifLet(instr->dest, IrTemp, temp) {
+      int v = ir->var_count + *temp;
+      if (block_of[v] == -1) block_of[v] = b;
+      else if (block_of[v] != b) shared[v] = true;
+    }
+  }
+
+  t->shared = 0;
+  for (int v = 0; v < count; v++) {
+    if (shared[v]) t->slot_of[v] = t->shared++;
+  }
+  t->slots = t->shared;
+  for (int v = 0; v < count; v++) {
+    if (!shared[v]) t->slot_of[v] = t->slots++;
+  }
+
+  free(shared);
+  free(block_of);
+}
+
+// Lowers `ir` to typed instructions and records the types of its temporaries.
+// Returns the number of instructions typed.
+int type_ir(IrProgram* ir) {
+  remove_unreachable_blocks(ir);
+  Cfg* cfg = build_cfg(ir);
+  Typer t = { .ir = ir };
+  assign_slots(&t, cfg);
+
+  // Types on entry to every block, joined over its predecessors in reverse
+  // post-order until nothing changes. No variable has a value on entry to
+  // the program.
+  IrType* entry = calloc((size_t)cfg->block_count * t.shared + 1, sizeof(IrType));
+  IrType* state = calloc(t.slots + 1, sizeof(IrType));
+  bool* reached = calloc(cfg->block_count + 1, sizeof(bool));
+  int* order = calloc(cfg->block_count + 1, sizeof(int));
+  ensure_non_null(entry, "out of space");
+  ensure_non_null(state, "out of space");
+  ensure_non_null(reached, "out of space");
+  ensure_non_null(order, "out of space");
+  for (int r = 0; r < cfg->rpo_count; r++) order[cfg->rpo[r]] = r;
+
+  if (cfg->block_count > 0) reached[0] = true;
+  for (bool progress = true; progress;) {
+    progress = false;
+    for (int r = 0; r < cfg->rpo_count; r++) {
+      int b = cfg->rpo[r];
+      BasicBlock* block = &cfg->blocks[b];
+      if (!reached[b]) continue;
+
+      memcpy(state, &entry[(size_t)b * t.shared], t.shared * sizeof(IrType));
+      for (int i = block->start; i < block->end; i++) type_instr(&t, state, ir->instrs[i], NULL);
+
+      for (int e = 0; e < block->succ_count; e++) {
+        int succ = block->succs[e];
+        bool changed = join_into(&entry[(size_t)succ * t.shared], state, t.shared);
+        // Blocks later in the order are visited in this same pass
+        if (changed && order[succ] <= r) progress = true;
+        reached[succ] = true;
+      }
+    }
+  }
+
+  // Rewrite every block from the types on entry to it, joining the types of
+  // the values given to each temporary
+  IrProgram* typed = alloc_ir_program();
+  IrType* temp_types = calloc(ir->temp_count + 1, sizeof(IrType));
+  ensure_non_null(temp_types, "out of space");
+  int changed = 0;
+  for (int b = 0; b < cfg->block_count; b++) {
+    BasicBlock* block = &cfg->blocks[b];
+    memcpy(state, &entry[(size_t)b * t.shared], t.shared * sizeof(IrType));
+    for (int i = block->start; i < block->end; i++) {
+      changed += type_instr(&t, state, ir->instrs[i], typed);
+      ifLet(ir->instrs[i].dest, IrTemp, temp) {
+        temp_types[*temp] = join(temp_types[*temp], state[slot(&t, ir->instrs[i].dest)]);
+      }
+    }
+  }
+
+  free(ir->instrs);
+  ir->instrs = typed->instrs;
+  ir->len = typed->len;
+  ir->cap = typed->cap;
+  free(typed);
+  free(ir->temp_types);
+  ir->temp_types = temp_types;
+
+  free(t.slot_of);
+  free(order);
+  free(reached);
+  free(state);
+  free(entry);
+  free_cfg(cfg);
+  return changed;
+}